@@ -0,0 +1,385 @@
+/*
+  CAN Pub/Sub Benchmark
+
+  Runs one broker and BENCH_CLIENTS clients in a single program on a
+  VirtualCANBus, so protocol throughput and latency can be measured
+  without CAN hardware. Use it to compare builds before and after a change
+  to the broker's forwarding or multi-frame reassembly paths.
+
+  Scenarios:
+  - Publish storm: every client publishes to one of BENCH_TOPICS topics
+    per round, clients are spread evenly over the topics as subscribers
+  - Multi-frame storm: the same with BENCH_LARGE_PAYLOAD byte messages,
+    so reassembly slots on the broker are contended
+  - Reconnect storm: all clients drop and connect again at the same time
+  - Subscription restore: broker and clients restart, subscriptions come
+    back from the broker's storage
+
+  Reported per scenario:
+  - frames per second of wall-clock time (CPU bound, all nodes share one
+    core) and frames lost to full RX queues
+  - bus time the frames would need at the virtual bit rate, and the frame
+    rate that bit rate allows
+  - end-to-end latency percentiles from publish() to the subscriber callback
+  - broker loop() time per publish, including frames the virtual bus
+    delivers while the broker waits for a transmit slot
+
+  Latency figures are relative: every node runs in turn on one CPU, so
+  they measure processing cost and scheduling, not bus timing.
+
+  Circuit:
+  - None, any board with enough RAM for the broker and clients (ESP32,
+    RP2040, SAMD51...) or a host build with an Arduino core emulation
+
+  The broker's stored mappings and subscriptions are cleared on start.
+
+  Created 2026
+*/
+
+#include <SuperCANBus.h>
+#include <VirtualCAN.h>
+
+#define BENCH_CLIENTS         8
+#define BENCH_TOPICS          4
+#define BENCH_ROUNDS          50
+#define BENCH_SMALL_PAYLOAD   8
+#define BENCH_LARGE_PAYLOAD   60
+#define BENCH_RX_QUEUE        128   // frames, per client
+#define BENCH_BROKER_RX_QUEUE 128
+#define BENCH_LATENCY_SAMPLES 512
+#define BENCH_TIMEOUT         10000 // ms, per wait
+
+VirtualCANBus bus(500E3);
+VirtualCANClass brokerCAN(bus);
+CANPubSubBroker broker(brokerCAN);
+
+VirtualCANClass* clientCAN[BENCH_CLIENTS];
+CANPubSubClient* clients[BENCH_CLIENTS];
+
+const char* topicNames[BENCH_TOPICS] = { "bench/0", "bench/1", "bench/2", "bench/3" };
+uint16_t topicHashes[BENCH_TOPICS];
+
+// measurement state
+unsigned long latencies[BENCH_LATENCY_SAMPLES];
+unsigned int latencyCount = 0;
+unsigned long deliveries = 0;
+unsigned long brokerPublishes = 0;
+unsigned long brokerMicros = 0;
+
+void onBenchMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  if (length < 4) {
+    return;
+  }
+
+  unsigned long sent = (unsigned long)data[0] | ((unsigned long)data[1] << 8) |
+                       ((unsigned long)data[2] << 16) | ((unsigned long)data[3] << 24);
+
+  if (latencyCount < BENCH_LATENCY_SAMPLES) {
+    latencies[latencyCount++] = micros() - sent;
+  }
+  deliveries++;
+}
+
+void onBrokerPublish(uint16_t topicHash, const uint8_t* data, size_t length) {
+  brokerPublishes++;
+}
+
+// One scheduling round: carry pending frames, then let every node run
+void pump() {
+  bus.run();
+
+  unsigned long start = micros();
+  broker.loop();
+  brokerMicros += micros() - start;
+
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clients[i]->loop();
+  }
+}
+
+// Pump until no frame has moved for a few rounds
+void settle() {
+  int idle = 0;
+  unsigned long start = millis();
+
+  while (idle < 3 && millis() - start < BENCH_TIMEOUT) {
+    unsigned long frames = bus.frameCount();
+    pump();
+
+    if (bus.frameCount() == frames && bus.pending() == 0 && brokerCAN.rxQueueCount() == 0) {
+      idle++;
+    } else {
+      idle = 0;
+    }
+  }
+}
+
+bool allConnected() {
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    if (!clients[i]->isConnected()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool allRestored(uint8_t expected) {
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    if (!clients[i]->isConnected() || clients[i]->getSubscriptionCount() < expected) {
+      return false;
+    }
+  }
+  return true;
+}
+
+String serialFor(int i) {
+  return String("BENCH-") + String(i);
+}
+
+int compareLatency(const void* a, const void* b) {
+  unsigned long x = *(const unsigned long*)a;
+  unsigned long y = *(const unsigned long*)b;
+  return (x > y) - (x < y);
+}
+
+unsigned long percentile(int p) {
+  return latencies[(unsigned long)(latencyCount - 1) * p / 100];
+}
+
+void resetMeasurement() {
+  latencyCount = 0;
+  deliveries = 0;
+  brokerPublishes = 0;
+  brokerMicros = 0;
+  bus.resetCounters();
+
+  brokerCAN.resetRxQueueOverflows();
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clientCAN[i]->resetRxQueueOverflows();
+  }
+}
+
+void printTraffic(unsigned long wallMicros) {
+  unsigned long frames = bus.frameCount();
+  unsigned long busMicros = bus.busTimeMicros();
+
+  unsigned long overflows = brokerCAN.rxQueueOverflows();
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    overflows += clientCAN[i]->rxQueueOverflows();
+  }
+
+  Serial.print("  frames ");
+  Serial.print(frames);
+  Serial.print(" in ");
+  Serial.print(wallMicros / 1000);
+  Serial.print(" ms, ");
+  Serial.print(wallMicros ? (unsigned long)(frames * 1000000.0 / wallMicros) : 0);
+  Serial.print(" frames/s, RX queue overflows ");
+  Serial.println(overflows);
+
+  // what the same traffic needs on a real bus
+  Serial.print("  bus time ");
+  Serial.print(busMicros / 1000);
+  Serial.print(" ms at ");
+  Serial.print(bus.bitRate() / 1000);
+  Serial.print(" kbit/s, bus limit ");
+  Serial.print(busMicros ? (unsigned long)(frames * 1000000.0 / busMicros) : 0);
+  Serial.println(" frames/s");
+}
+
+void printLatency() {
+  if (latencyCount == 0) {
+    Serial.println("  latency: no samples");
+    return;
+  }
+
+  qsort(latencies, latencyCount, sizeof(latencies[0]), compareLatency);
+
+  Serial.print("  latency us: p50 ");
+  Serial.print(percentile(50));
+  Serial.print(", p90 ");
+  Serial.print(percentile(90));
+  Serial.print(", p99 ");
+  Serial.print(percentile(99));
+  Serial.print(", max ");
+  Serial.println(latencies[latencyCount - 1]);
+}
+
+void publishStorm(const char* name, size_t payloadSize) {
+  uint8_t payload[BENCH_LARGE_PAYLOAD];
+  for (size_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = i;
+  }
+
+  // each topic has BENCH_CLIENTS / BENCH_TOPICS subscribers
+  unsigned long expected = (unsigned long)BENCH_ROUNDS * BENCH_CLIENTS * (BENCH_CLIENTS / BENCH_TOPICS);
+
+  resetMeasurement();
+  unsigned long start = micros();
+
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    for (int i = 0; i < BENCH_CLIENTS; i++) {
+      unsigned long now = micros();
+      payload[0] = now;
+      payload[1] = now >> 8;
+      payload[2] = now >> 16;
+      payload[3] = now >> 24;
+
+      clients[i]->publish(topicHashes[(i + 1) % BENCH_TOPICS], payload, payloadSize);
+    }
+
+    settle();
+  }
+
+  unsigned long wall = micros() - start;
+
+  Serial.println(name);
+  Serial.print("  ");
+  Serial.print(BENCH_CLIENTS);
+  Serial.print(" clients x ");
+  Serial.print(BENCH_TOPICS);
+  Serial.print(" topics, ");
+  Serial.print(payloadSize);
+  Serial.print(" byte payload, ");
+  Serial.print(BENCH_ROUNDS);
+  Serial.println(" rounds");
+
+  Serial.print("  publishes ");
+  Serial.print(brokerPublishes);
+  Serial.print("/");
+  Serial.print((unsigned long)BENCH_ROUNDS * BENCH_CLIENTS);
+  Serial.print(", deliveries ");
+  Serial.print(deliveries);
+  Serial.print("/");
+  Serial.println(expected);
+
+  printTraffic(wall);
+  printLatency();
+
+  Serial.print("  broker ");
+  Serial.print(brokerPublishes ? (float)brokerMicros / brokerPublishes : 0, 1);
+  Serial.println(" us/publish");
+}
+
+void reconnectStorm() {
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clients[i]->end();
+  }
+
+  resetMeasurement();
+  unsigned long start = micros();
+
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clients[i]->connectAsync(serialFor(i), BENCH_TIMEOUT);
+  }
+
+  while (!allConnected() && micros() - start < BENCH_TIMEOUT * 1000UL) {
+    pump();
+  }
+
+  unsigned long wall = micros() - start;
+
+  uint8_t maxAttempts = 0;
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    if (clients[i]->getConnectAttempts() > maxAttempts) {
+      maxAttempts = clients[i]->getConnectAttempts();
+    }
+  }
+
+  Serial.println("Reconnect storm");
+  Serial.print("  ");
+  Serial.print(BENCH_CLIENTS);
+  Serial.print(" clients, connected: ");
+  Serial.print(broker.getClientCount());
+  Serial.print(", most ID requests by one client: ");
+  Serial.println(maxAttempts);
+  printTraffic(wall);
+}
+
+void subscriptionRestore() {
+  uint8_t expected = clients[0]->getSubscriptionCount();
+
+  // write subscriptions out, then restart everything
+  broker.flush();
+  broker.end();
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clients[i]->end();
+  }
+  broker.begin();
+
+  resetMeasurement();
+  unsigned long start = micros();
+
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clients[i]->connectAsync(serialFor(i), BENCH_TIMEOUT);
+  }
+
+  while (!allRestored(expected) && micros() - start < BENCH_TIMEOUT * 1000UL) {
+    pump();
+  }
+
+  unsigned long wall = micros() - start;
+
+  Serial.println("Subscription restore after reboot");
+  Serial.print("  ");
+  Serial.print(BENCH_CLIENTS);
+  Serial.print(" clients, restored: ");
+  Serial.println(allRestored(expected) ? "all" : "incomplete");
+  printTraffic(wall);
+}
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial);
+
+  Serial.println("=== CAN Pub/Sub Benchmark ===");
+
+  brokerCAN.begin(500E3);
+  brokerCAN.setRxQueueSize(BENCH_BROKER_RX_QUEUE);
+
+  broker.begin();
+  broker.clearStoredMappings();
+  broker.clearStoredSubscriptions();
+  broker.clearStoredTopicNames();
+  broker.onPublishBinary(onBrokerPublish);
+
+  for (int i = 0; i < BENCH_TOPICS; i++) {
+    topicHashes[i] = CANPubSubBase::hashTopic(topicNames[i]);
+  }
+
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clientCAN[i] = new VirtualCANClass(bus);
+    clientCAN[i]->begin(500E3);
+    clientCAN[i]->setRxQueueSize(BENCH_RX_QUEUE);
+
+    clients[i] = new CANPubSubClient(*clientCAN[i]);
+    clients[i]->onMessageBinary(onBenchMessage);
+    clients[i]->enableHardwareFilter(true);
+    clients[i]->connectAsync(serialFor(i), BENCH_TIMEOUT);
+  }
+
+  unsigned long start = millis();
+  while (!allConnected() && millis() - start < BENCH_TIMEOUT) {
+    pump();
+  }
+
+  if (!allConnected()) {
+    Serial.println("Clients failed to connect!");
+    while (1);
+  }
+
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    clients[i]->subscribe(topicNames[i % BENCH_TOPICS]);
+    settle();
+  }
+
+  publishStorm("Publish storm", BENCH_SMALL_PAYLOAD);
+  publishStorm("Multi-frame storm", BENCH_LARGE_PAYLOAD);
+  reconnectStorm();
+  subscriptionRestore();
+
+  Serial.println("Done.");
+}
+
+void loop() {
+}
@@ -0,0 +1,118 @@
+/*
+  CAN Pub/Sub Gateway (Linux)
+
+  Runs the broker on a Linux machine with a SocketCAN interface, e.g. a
+  Raspberry Pi with an MCP2515 HAT or a USB CAN adapter. Client IDs and
+  subscriptions are kept in a file (see EEPROM.h in extras/linux/shim),
+  so they survive restarts of the gateway.
+
+  Environment:
+  - CAN_INTERFACE       - interface to use (default can0)
+  - SUPERCANBUS_EEPROM  - storage file (default supercanbus.eeprom)
+
+  Commands (on stdin):
+  - list   - List registered clients
+  - stats  - Show broker and bus statistics
+
+  Build and interface setup are described in extras/linux/README.md.
+*/
+
+#include <poll.h>
+
+#include <Arduino.h>
+#include <CANPubSub.h>
+#include <SocketCAN.h>
+
+SocketCANClass CANBus;
+CANPubSubBroker broker(CANBus);
+
+void onClientConnect(uint8_t clientId) {
+  Serial.print("Client connected: ");
+  Serial.print(clientId, DEC);
+
+  String serial = broker.getSerialByClientId(clientId);
+  if (serial.length() > 0) {
+    Serial.print(" (");
+    Serial.print(serial);
+    Serial.print(")");
+  }
+  Serial.println();
+}
+
+void onClientDisconnect(uint8_t clientId) {
+  Serial.print("Client disconnected: ");
+  Serial.println(clientId, DEC);
+}
+
+void onPublish(uint16_t topicHash, const String& topic, const String& message) {
+  Serial.print("[");
+  Serial.print(topic);
+  Serial.print(" 0x");
+  Serial.print(topicHash, HEX);
+  Serial.print("] ");
+  Serial.println(message);
+}
+
+void setup() {
+  const char* interfaceName = getenv("CAN_INTERFACE");
+  if (interfaceName) {
+    CANBus.setInterface(interfaceName);
+  }
+
+  // configures nothing on the interface, the bit rate is only used for busLoad()
+  if (!CANBus.begin(500E3)) {
+    Serial.println("Opening the CAN interface failed (is it up?)");
+    exit(1);
+  }
+
+  if (!broker.begin()) {
+    Serial.println("Starting broker failed!");
+    exit(1);
+  }
+
+  broker.onClientConnect(onClientConnect);
+  broker.onClientDisconnect(onClientDisconnect);
+  broker.onPublish(onPublish);
+
+  broker.setPingInterval(5000);
+  broker.setMaxMissedPings(2);
+  broker.enableAutoPing(true);
+  broker.enableLoadAdaptation(true);
+
+  Serial.println("Gateway ready");
+}
+
+void loop() {
+  broker.loop();
+
+  if (Serial.available()) {
+    String input = Serial.readStringUntil('\n');
+    input.trim();
+
+    if (input == "list") {
+      broker.listRegisteredClients([](uint8_t id, const String& serial, bool /*registered*/) {
+        Serial.print(id, DEC);
+        Serial.print(broker.isClientOnline(id) ? "  online   " : "  offline  ");
+        Serial.println(serial);
+      });
+    } else if (input == "stats") {
+      Serial.print("Clients: ");
+      Serial.println(broker.getClientCount());
+      Serial.print("Bus state: ");
+      Serial.println(broker.getBusState());
+      Serial.print("Bus load: ");
+      Serial.print(broker.getBusLoad());
+      Serial.println("%");
+      Serial.print("Bus errors: ");
+      Serial.println(CANBus.busErrorCount());
+      Serial.print("RX overruns: ");
+      Serial.println(CANBus.rxOverrunCount());
+    }
+  }
+
+  // frames batched during this loop leave before sleeping, then nothing to do
+  // until a frame arrives or the next ping is due
+  CANBus.flush();
+  struct pollfd p = { CANBus.socketDescriptor(), POLLIN, 0 };
+  poll(&p, 1, 1);
+}
@@ -0,0 +1,170 @@
+// Arduino-compatible subset for building the library on Linux
+
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Both counters start at zero like on a board and wrap the same way
+static const uint64_t startMicros = monotonicMicros();
+
+unsigned long millis() {
+  return (unsigned long)((monotonicMicros() - startMicros) / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)(monotonicMicros() - startMicros);
+}
+
+void delay(unsigned long ms) {
+  struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+}
+
+void delayMicroseconds(unsigned int us) {
+  struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000L };
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+}
+
+void yield() {
+  sched_yield();
+}
+
+long random(long max) {
+  return max > 0 ? ::random() % max : 0;
+}
+
+long random(long min, long max) {
+  return min < max ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+  if (seed != 0) {
+    srandom(seed);
+  }
+}
+
+size_t Print::printf(const char* format, ...) {
+  char buf[256];
+  va_list args;
+
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+
+  if (len < 0) {
+    return 0;
+  }
+
+  if ((size_t)len < sizeof(buf)) {
+    return write((const uint8_t*)buf, len);
+  }
+
+  // longer than the stack buffer, format again into the heap
+  char* big = (char*)malloc(len + 1);
+  if (big == NULL) {
+    return 0;
+  }
+
+  va_start(args, format);
+  vsnprintf(big, len + 1, format, args);
+  va_end(args);
+
+  size_t n = write((const uint8_t*)big, len);
+  free(big);
+
+  return n;
+}
+
+LinuxSerial Serial;
+
+int Stream::timedRead() {
+  unsigned long start = millis();
+
+  do {
+    int c = read();
+    if (c >= 0) {
+      return c;
+    }
+    delay(1);
+  } while (millis() - start < _timeout);
+
+  return -1;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String result;
+  int c;
+
+  while ((c = timedRead()) >= 0 && c != terminator) {
+    result += (char)c;
+  }
+
+  return result;
+}
+
+String Stream::readString() {
+  String result;
+  int c;
+
+  while ((c = timedRead()) >= 0) {
+    result += (char)c;
+  }
+
+  return result;
+}
+
+size_t LinuxSerial::write(uint8_t byte) {
+  return fputc(byte, stdout) == EOF ? 0 : 1;
+}
+
+size_t LinuxSerial::write(const uint8_t* buffer, size_t size) {
+  return fwrite(buffer, 1, size, stdout);
+}
+
+int LinuxSerial::available() {
+  if (_peeked >= 0) {
+    return 1;
+  }
+
+  struct pollfd p = { STDIN_FILENO, POLLIN, 0 };
+  return (poll(&p, 1, 0) > 0 && (p.revents & POLLIN)) ? 1 : 0;
+}
+
+int LinuxSerial::read() {
+  if (_peeked >= 0) {
+    int c = _peeked;
+    _peeked = -1;
+    return c;
+  }
+
+  if (!available()) {
+    return -1;
+  }
+
+  uint8_t c;
+  return ::read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+}
+
+int LinuxSerial::peek() {
+  if (_peeked < 0) {
+    _peeked = read();
+  }
+
+  return _peeked;
+}
+
+void LinuxSerial::flush() {
+  fflush(stdout);
+}
@@ -0,0 +1,272 @@
+// Arduino-compatible subset for building the library on Linux
+// (SocketCAN gateways, host tools). Only what the library and simple
+// sketches need: timing, String, Print/Stream and a stdout Serial.
+
+#ifndef ARDUINO_LINUX_SHIM_H
+#define ARDUINO_LINUX_SHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <string>
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// Timing (CLOCK_MONOTONIC, counted from program start)
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// No interrupt context on Linux, the library only uses these around its own state
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// GPIO does not exist here, calls are accepted and ignored
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// Functions rather than the usual macros, so standard headers keep working
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type min(T a, U b) { return (b < a) ? b : a; }
+template <typename T, typename U>
+inline typename std::common_type<T, U>::type max(T a, U b) { return (a < b) ? b : a; }
+template <typename T, typename L, typename H>
+inline T constrain(T x, L low, H high) { return x < low ? low : (x > high ? high : x); }
+
+class String {
+public:
+  String() {}
+  String(const char* str) : _s(str ? str : "") {}
+  String(const std::string& str) : _s(str) {}
+  String(const String& str) : _s(str._s) {}
+  explicit String(char c) : _s(1, c) {}
+  explicit String(unsigned char value, unsigned char base = DEC) { fromUnsigned(value, base); }
+  explicit String(int value, unsigned char base = DEC) { fromSigned(value, base); }
+  explicit String(unsigned int value, unsigned char base = DEC) { fromUnsigned(value, base); }
+  explicit String(long value, unsigned char base = DEC) { fromSigned(value, base); }
+  explicit String(unsigned long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+  explicit String(float value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+  explicit String(double value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+
+  String& operator=(const String& rhs) { _s = rhs._s; return *this; }
+  String& operator=(const char* rhs) { _s = rhs ? rhs : ""; return *this; }
+
+  unsigned int length() const { return _s.size(); }
+  bool isEmpty() const { return _s.empty(); }
+  bool reserve(unsigned int size) { _s.reserve(size); return true; }
+  const char* c_str() const { return _s.c_str(); }
+
+  char charAt(unsigned int index) const { return index < _s.size() ? _s[index] : 0; }
+  void setCharAt(unsigned int index, char c) { if (index < _s.size()) _s[index] = c; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) { return _s[index]; }
+
+  bool concat(const String& str) { _s += str._s; return true; }
+  bool concat(const char* str) { if (str) _s += str; return true; }
+  bool concat(char c) { _s += c; return true; }
+  template <typename T> bool concat(T value) { return concat(String(value)); }
+
+  String& operator+=(const String& rhs) { concat(rhs); return *this; }
+  String& operator+=(const char* rhs) { concat(rhs); return *this; }
+  String& operator+=(char rhs) { concat(rhs); return *this; }
+  template <typename T> String& operator+=(T rhs) { concat(rhs); return *this; }
+
+  bool equals(const String& rhs) const { return _s == rhs._s; }
+  bool equals(const char* rhs) const { return _s == (rhs ? rhs : ""); }
+  bool operator==(const String& rhs) const { return equals(rhs); }
+  bool operator==(const char* rhs) const { return equals(rhs); }
+  bool operator!=(const String& rhs) const { return !equals(rhs); }
+  bool operator!=(const char* rhs) const { return !equals(rhs); }
+  bool operator<(const String& rhs) const { return _s < rhs._s; }
+  int compareTo(const String& rhs) const { return _s.compare(rhs._s); }
+
+  bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+  bool endsWith(const String& suffix) const {
+    return _s.size() >= suffix._s.size() &&
+           _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+  }
+
+  int indexOf(char c, unsigned int from = 0) const { return position(_s.find(c, from)); }
+  int indexOf(const String& str, unsigned int from = 0) const { return position(_s.find(str._s, from)); }
+  int lastIndexOf(char c) const { return position(_s.rfind(c)); }
+  int lastIndexOf(const String& str) const { return position(_s.rfind(str._s)); }
+
+  String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) { unsigned int t = from; from = to; to = t; }
+    return from < _s.size() ? String(_s.substr(from, to - from)) : String();
+  }
+
+  void replace(const String& find, const String& with) {
+    if (find._s.empty()) return;
+    for (size_t pos = 0; (pos = _s.find(find._s, pos)) != std::string::npos; pos += with._s.size()) {
+      _s.replace(pos, find._s.size(), with._s);
+    }
+  }
+  void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+  void toLowerCase() { for (char& c : _s) c = tolower((unsigned char)c); }
+  void toUpperCase() { for (char& c : _s) c = toupper((unsigned char)c); }
+  void trim() {
+    size_t first = _s.find_first_not_of(" \t\r\n");
+    size_t last = _s.find_last_not_of(" \t\r\n");
+    _s = (first == std::string::npos) ? std::string() : _s.substr(first, last - first + 1);
+  }
+
+  long toInt() const { return strtol(_s.c_str(), NULL, 10); }
+  float toFloat() const { return strtof(_s.c_str(), NULL); }
+  double toDouble() const { return strtod(_s.c_str(), NULL); }
+
+  void getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index = 0) const {
+    if (!bufsize || !buf) return;
+    size_t n = index < _s.size() ? min(_s.size() - index, (size_t)bufsize - 1) : 0;
+    memcpy(buf, _s.data() + index, n);
+    buf[n] = 0;
+  }
+  void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const {
+    getBytes((unsigned char*)buf, bufsize, index);
+  }
+
+private:
+  static int position(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+  void fromUnsigned(unsigned long value, unsigned char base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = 0;
+    if (base < 2) base = DEC;
+    do {
+      unsigned long digit = value % base;
+      *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+      value /= base;
+    } while (value);
+    _s = p;
+  }
+  void fromSigned(long value, unsigned char base) {
+    if (value < 0 && base == DEC) {
+      fromUnsigned(-(unsigned long)value, base);
+      _s.insert(0, 1, '-');
+    } else {
+      fromUnsigned((unsigned long)value, base);
+    }
+  }
+  void fromDouble(double value, unsigned char decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    _s = buf;
+  }
+
+  std::string _s;
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, const char* rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const char* lhs, const String& rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, char rhs) { String s(lhs); s += rhs; return s; }
+template <typename T> inline String operator+(const String& lhs, T rhs) { String s(lhs); s += rhs; return s; }
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t byte) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+  size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+  size_t print(const char* str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char value, int base = DEC) { return print(String(value, base)); }
+  size_t print(int value, int base = DEC) { return print(String(value, base)); }
+  size_t print(unsigned int value, int base = DEC) { return print(String(value, base)); }
+  size_t print(long value, int base = DEC) { return print(String(value, base)); }
+  size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+  size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+  template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() { return _timeout; }
+
+  // waits up to the timeout for the terminator
+  String readStringUntil(char terminator);
+  String readString();
+
+protected:
+  int timedRead();
+
+  unsigned long _timeout = 1000;
+};
+
+// Serial: stdout for output, stdin (non-blocking) for input
+class LinuxSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  void end() {}
+  operator bool() { return true; }
+
+  virtual size_t write(uint8_t byte);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  virtual int available();
+  virtual int read();
+  virtual int peek();
+  virtual void flush();
+
+private:
+  int _peeked = -1;
+};
+
+extern LinuxSerial Serial;
+
+// Sketch entry points, called by the shim's main()
+void setup();
+void loop();
+
+#endif
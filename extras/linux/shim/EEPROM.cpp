@@ -0,0 +1,123 @@
+// File-backed EEPROM for Linux builds
+
+#include "EEPROM.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass() :
+  _data(NULL),
+  _size(0),
+  _fd(-1)
+{
+  const char* path = getenv("SUPERCANBUS_EEPROM");
+  setPath(path ? path : EEPROM_DEFAULT_PATH);
+}
+
+EEPROMClass::~EEPROMClass()
+{
+  end();
+}
+
+void EEPROMClass::setPath(const char* path)
+{
+  strncpy(_path, path, sizeof(_path) - 1);
+  _path[sizeof(_path) - 1] = '\0';
+}
+
+bool EEPROMClass::begin(size_t size)
+{
+  if (_data && size == _size) {
+    return true;
+  }
+  end();
+
+  _data = (uint8_t*)malloc(size);
+  if (_data == NULL) {
+    return false;
+  }
+  _size = size;
+
+  // unwritten cells read as 0xff, like erased flash
+  memset(_data, 0xff, size);
+
+  _fd = open(_path, O_RDWR | O_CREAT, 0644);
+  if (_fd < 0) {
+    // keep working from RAM, nothing persists
+    return true;
+  }
+
+  ssize_t n = pread(_fd, _data, size, 0);
+  if (n < (ssize_t)size) {
+    // new or shorter file, pad it to the full size
+    pwrite(_fd, _data + (n > 0 ? n : 0), size - (n > 0 ? n : 0), n > 0 ? n : 0);
+  }
+
+  return true;
+}
+
+void EEPROMClass::end()
+{
+  if (_fd >= 0) {
+    close(_fd);
+    _fd = -1;
+  }
+
+  free(_data);
+  _data = NULL;
+  _size = 0;
+}
+
+bool EEPROMClass::commit()
+{
+  return _fd >= 0 && fdatasync(_fd) == 0;
+}
+
+uint16_t EEPROMClass::length()
+{
+  return _size > 0xffff ? 0xffff : _size;
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+  uint8_t value = 0xff;
+  readBytes(address, &value, 1);
+  return value;
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+  writeBytes(address, &value, 1);
+}
+
+void EEPROMClass::update(int address, uint8_t value)
+{
+  if (read(address) != value) {
+    write(address, value);
+  }
+}
+
+void EEPROMClass::readBytes(int address, void* data, size_t length)
+{
+  if (address < 0 || (size_t)address + length > _size) {
+    memset(data, 0xff, length);
+    return;
+  }
+
+  memcpy(data, _data + address, length);
+}
+
+void EEPROMClass::writeBytes(int address, const void* data, size_t length)
+{
+  if (address < 0 || (size_t)address + length > _size) {
+    return;
+  }
+
+  memcpy(_data + address, data, length);
+
+  if (_fd >= 0) {
+    pwrite(_fd, data, length, address);
+  }
+}
@@ -0,0 +1,50 @@
+// File-backed EEPROM for Linux builds. Writes go straight to the file,
+// so broker state survives restarts like it does in flash.
+
+#ifndef EEPROM_LINUX_SHIM_H
+#define EEPROM_LINUX_SHIM_H
+
+#include "Arduino.h"
+
+#define EEPROM_DEFAULT_PATH "supercanbus.eeprom"
+
+class EEPROMClass {
+public:
+  EEPROMClass();
+  ~EEPROMClass();
+
+  // Storage file, set before begin() (default EEPROM_DEFAULT_PATH, or $SUPERCANBUS_EEPROM)
+  void setPath(const char* path);
+
+  bool begin(size_t size);
+  void end();
+  bool commit();
+  uint16_t length();
+
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value);
+
+  template <typename T> T& get(int address, T& value) {
+    readBytes(address, &value, sizeof(T));
+    return value;
+  }
+
+  template <typename T> const T& put(int address, const T& value) {
+    writeBytes(address, &value, sizeof(T));
+    return value;
+  }
+
+private:
+  void readBytes(int address, void* data, size_t length);
+  void writeBytes(int address, const void* data, size_t length);
+
+  char _path[256];
+  uint8_t* _data;
+  size_t _size;
+  int _fd;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,15 @@
+// Runs an Arduino-style sketch (setup() once, then loop() forever)
+
+#include "Arduino.h"
+
+int main()
+{
+  setup();
+
+  for (;;) {
+    loop();
+    Serial.flush();
+  }
+
+  return 0;
+}
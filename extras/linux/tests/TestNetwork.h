@@ -0,0 +1,193 @@
+// Host test support: a broker and clients on one VirtualCANBus, pumped in
+// turn like examples/Benchmark, plus CHECK macros that count failures.
+// Each test_*.cpp is its own program and exits non-zero when a check fails.
+
+#ifndef TEST_NETWORK_H
+#define TEST_NETWORK_H
+
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "CANPubSub.h"
+#include "VirtualCAN.h"
+
+#define TEST_MAX_NODES  16
+#define TEST_RX_QUEUE   128    // frames, per node
+#define TEST_TIMEOUT    5000   // ms, per wait
+
+static int testChecks = 0;
+static int testFailures = 0;
+
+#define CHECK(cond) do { \
+    testChecks++; \
+    if (!(cond)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      testFailures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+    testChecks++; \
+    long _a = (long)(actual), _e = (long)(expected); \
+    if (_a != _e) { \
+      printf("%s:%d: CHECK_EQ(%s, %s) failed: %ld != %ld\n", __FILE__, __LINE__, #actual, #expected, _a, _e); \
+      testFailures++; \
+    } \
+  } while (0)
+
+inline int testSummary(const char* name) {
+  printf("%s: %d checks, %d failed\n", name, testChecks, testFailures);
+  return testFailures ? 1 : 0;
+}
+
+// Virtual controller that counts the frames it sends per message type and
+// can drop the next frames of one type before they reach the bus
+class TestCAN : public VirtualCANClass {
+public:
+  TestCAN(VirtualCANBus& bus) : VirtualCANClass(bus), _dropType(-1), _dropCount(0), _dropped(0), _fdFrames(0) {
+    memset(_sent, 0, sizeof(_sent));
+  }
+
+  // message type of an ID: low byte of a standard ID, bits 26-19 of an extended ID
+  static uint8_t messageType(long id, bool extended) {
+    return extended ? (id >> CAN_PS_EXT_TYPE_SHIFT) & 0xFF : id & 0xFF;
+  }
+
+  virtual int endPacket() {
+    uint8_t type = messageType(_txId, _txExtended);
+    bool fd = maxDataLength() > 8 && _txLength > 8;  // sent as a padded FD frame
+
+    if (_packetBegun && type == _dropType && _dropCount > 0) {
+      _dropCount--;
+      _dropped++;
+      return CANControllerClass::endPacket();  // lost on the bus, the sender does not know
+    }
+
+    int result = VirtualCANClass::endPacket();
+    if (result) {
+      _sent[type]++;
+      if (fd) _fdFrames++;
+    }
+    return result;
+  }
+
+  void dropNext(uint8_t type, unsigned int count) {
+    _dropType = type;
+    _dropCount = count;
+  }
+
+  unsigned long sent(uint8_t type) { return _sent[type]; }
+  unsigned long dropped() { return _dropped; }
+  unsigned long fdFrames() { return _fdFrames; }
+  void resetSent() { memset(_sent, 0, sizeof(_sent)); _dropped = 0; _fdFrames = 0; }
+
+private:
+  int _dropType;
+  unsigned int _dropCount;
+  unsigned long _dropped;
+  unsigned long _fdFrames;
+  unsigned long _sent[256];
+};
+
+class TestNetwork {
+public:
+  TestNetwork() : _nodeCount(0), _fdDataRate(0) {}
+
+  VirtualCANBus bus;
+
+  // Start the nodes added after this in CAN FD mode
+  void useFD(long dataBaudRate = 2E6) { _fdDataRate = dataBaudRate; }
+
+  // node controllers start with an RX queue, so fan-out does not overrun them
+  void add(TestCAN& can, CANPubSubBrokerCore& broker) { attach(can, &broker, NULL); }
+  void add(TestCAN& can, CANPubSubClientCore& client) { attach(can, NULL, &client); }
+
+  // One scheduling round: carry pending frames, then let every node run
+  void pump() {
+    bus.run();
+    for (int i = 0; i < _nodeCount; i++) {
+      if (_nodes[i].broker) _nodes[i].broker->loop();
+      if (_nodes[i].client) _nodes[i].client->loop();
+    }
+  }
+
+  // Pump until no frame has moved for a few rounds and every latency has passed
+  void settle(unsigned long quietMs = 30) {
+    unsigned long start = millis();
+    unsigned long lastTraffic = start;
+
+    while (millis() - start < TEST_TIMEOUT) {
+      unsigned long frames = bus.frameCount();
+      pump();
+      if (bus.frameCount() != frames || bus.pending() > 0 || rxPending()) {
+        lastTraffic = millis();
+      } else if (millis() - lastTraffic >= quietMs) {
+        return;
+      }
+    }
+  }
+
+  template <typename Condition>
+  bool waitFor(Condition condition, unsigned long timeoutMs = TEST_TIMEOUT) {
+    unsigned long start = millis();
+    while (!condition()) {
+      if (millis() - start > timeoutMs) return false;
+      pump();
+    }
+    return true;
+  }
+
+  bool connect(CANPubSubClientCore& client, const String& serial) {
+    client.setConnectBackoff(5, 50);
+    client.connectAsync(serial, TEST_TIMEOUT);
+    if (!waitFor([&]() { return client.isConnected() && !client.isRestoring(); })) return false;
+    settle();
+    return true;
+  }
+
+private:
+  struct Node {
+    TestCAN* can;
+    CANPubSubBrokerCore* broker;
+    CANPubSubClientCore* client;
+  };
+
+  void attach(TestCAN& can, CANPubSubBrokerCore* broker, CANPubSubClientCore* client) {
+    if (_nodeCount >= TEST_MAX_NODES) return;
+    if (_fdDataRate) {
+      can.beginFD(500E3, _fdDataRate);
+    } else {
+      can.begin(500E3);
+    }
+    can.setRxQueueSize(TEST_RX_QUEUE);
+    _nodes[_nodeCount].can = &can;
+    _nodes[_nodeCount].broker = broker;
+    _nodes[_nodeCount].client = client;
+    _nodeCount++;
+  }
+
+  bool rxPending() {
+    for (int i = 0; i < _nodeCount; i++) {
+      if (_nodes[i].can->rxQueueCount() > 0) return true;
+    }
+    return false;
+  }
+
+  Node _nodes[TEST_MAX_NODES];
+  int _nodeCount;
+  long _fdDataRate;
+};
+
+// Broker storage in a fresh file of its own, removed again at exit
+inline void useTestStorage(const char* name) {
+  static char path[256];
+  const char* dir = getenv("TMPDIR");
+  snprintf(path, sizeof(path), "%s/supercanbus-%s-%d.eeprom", dir ? dir : "/tmp", name, (int)getpid());
+  unlink(path);
+  EEPROM.end();
+  EEPROM.setPath(path);
+  atexit([]() { EEPROM.end(); unlink(path); });
+}
+
+#endif
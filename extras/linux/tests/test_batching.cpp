@@ -0,0 +1,145 @@
+// Client publish batching: queued records reach subscribers in order, in
+// batch messages only, when the latency passes, the batch fills or on flush()
+
+#include "TestNetwork.h"
+
+#define SMALL_BATCH 32  // bytes, client ID included: 7 records of 2 bytes
+
+TestNetwork net;
+TestCAN brokerCAN(net.bus), canA(net.bus), canB(net.bus), canSmall(net.bus);
+CANPubSubBroker broker(brokerCAN);
+CANPubSubClient subscriber(canA), publisher(canB);
+CANPubSubClientT<MAX_CLIENT_TOPICS, MAX_SUBSCRIPTIONS, SMALL_BATCH> small(canSmall);
+
+#define MAX_RECEIVED 64
+
+uint16_t topicA, topicB;
+uint16_t values[MAX_RECEIVED];
+uint16_t hashes[MAX_RECEIVED];
+size_t lengths[MAX_RECEIVED];
+int received = 0;
+
+void onMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  if (received >= MAX_RECEIVED) return;
+  hashes[received] = topicHash;
+  lengths[received] = length;
+  values[received] = length >= 2 ? data[0] | (data[1] << 8) : 0;
+  received++;
+}
+
+void publishValue(CANPubSubClientCore& client, uint16_t topicHash, uint16_t value) {
+  uint8_t data[2] = { (uint8_t)(value & 0xFF), (uint8_t)(value >> 8) };
+  client.publish(topicHash, data, 2);
+}
+
+void reset() {
+  received = 0;
+  canB.resetSent();
+  canSmall.resetSent();
+}
+
+int main() {
+  net.add(brokerCAN, broker);
+  net.add(canA, subscriber);
+  net.add(canB, publisher);
+  net.add(canSmall, small);
+
+  useTestStorage("batching");
+  broker.begin();
+  subscriber.onMessageBinary(onMessage);
+  CHECK(net.connect(subscriber, "BATCH-S"));
+  CHECK(net.connect(publisher, "BATCH-P"));
+  CHECK(net.connect(small, "BATCH-SMALL"));
+  subscriber.subscribe("t/a");
+  subscriber.subscribe("t/b");
+  net.settle();
+  topicA = CANPubSubBase::hashTopic("t/a");
+  topicB = CANPubSubBase::hashTopic("t/b");
+
+  // Queued until the latency has passed, then one batch in publish order
+  publisher.enablePublishBatching(true, 20);
+  CHECK(publisher.isPublishBatchingEnabled());
+  reset();
+  for (int i = 0; i < 10; i++) {
+    publishValue(publisher, i & 1 ? topicB : topicA, 100 + i);
+  }
+  CHECK_EQ(canB.sent(CAN_PS_PUBLISH_BATCH), 0);
+  net.settle();
+  CHECK(canB.sent(CAN_PS_PUBLISH_BATCH) >= 1);
+  CHECK_EQ(canB.sent(CAN_PS_PUBLISH), 0);
+  CHECK_EQ(received, 10);
+  for (int i = 0; i < received; i++) {
+    CHECK_EQ(values[i], 100 + i);
+    CHECK_EQ(hashes[i], i & 1 ? topicB : topicA);
+  }
+
+  // flush() sends at once, a lone record goes out as a plain publish
+  reset();
+  publishValue(publisher, topicA, 7);
+  publisher.flush();
+  net.settle();
+  CHECK_EQ(canB.sent(CAN_PS_PUBLISH), 1);
+  CHECK_EQ(canB.sent(CAN_PS_PUBLISH_BATCH), 0);
+  CHECK_EQ(received, 1);
+  CHECK_EQ(values[0], 7);
+
+  // Records of 1 and 0 bytes fit one standard frame
+  reset();
+  uint8_t one = 1;
+  publisher.publish(topicA, &one, 1);
+  publisher.publish(topicB, &one, 0);
+  publisher.flush();
+  net.settle();
+  CHECK_EQ(canB.sent(CAN_PS_PUBLISH_BATCH), 1);
+  CHECK_EQ(received, 2);
+  CHECK_EQ(lengths[0], 1);
+  CHECK_EQ(lengths[1], 0);
+
+  // A record too large for a batch sends the queue first, so order holds
+  reset();
+  uint8_t big[100];
+  memset(big, 0xAB, sizeof(big));
+  small.enablePublishBatching(true, 1000);
+  publishValue(small, topicA, 1);
+  publishValue(small, topicA, 2);
+  small.publish(topicB, big, sizeof(big));
+  publishValue(small, topicA, 3);
+  small.flush();
+  net.settle();
+  CHECK_EQ(received, 4);
+  CHECK_EQ(values[0], 1);
+  CHECK_EQ(values[1], 2);
+  CHECK_EQ(lengths[2], sizeof(big));
+  CHECK_EQ(hashes[2], topicB);
+  CHECK_EQ(values[3], 3);
+
+  // A full batch goes out without waiting for the latency (as one multi-frame message)
+  reset();
+  int perBatch = (SMALL_BATCH - 1) / 5;
+  for (int i = 0; i < perBatch + 1; i++) {
+    publishValue(small, topicA, 200 + i);
+  }
+  net.settle(5);
+  CHECK(canSmall.sent(CAN_PS_PUBLISH_BATCH) >= 1);
+  CHECK_EQ(canSmall.sent(CAN_PS_PUBLISH), 0);
+  CHECK_EQ(received, perBatch);
+  small.flush();
+  net.settle();
+  CHECK_EQ(received, perBatch + 1);
+  for (int i = 0; i < received; i++) {
+    CHECK_EQ(values[i], 200 + i);
+  }
+
+  // Disabling batching sends what is queued and publishes at once again
+  reset();
+  publishValue(publisher, topicA, 300);
+  publisher.enablePublishBatching(false);
+  publishValue(publisher, topicA, 301);
+  net.settle();
+  CHECK_EQ(received, 2);
+  CHECK_EQ(values[0], 300);
+  CHECK_EQ(values[1], 301);
+  CHECK_EQ(canB.sent(CAN_PS_PUBLISH_BATCH), 0);
+
+  return testSummary("batching");
+}
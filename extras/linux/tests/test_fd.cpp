@@ -0,0 +1,111 @@
+// CAN FD multi-frame messages: frames are padded to the next DLC step
+// (12, 16, 20, 24, 32, 48, 64), the length in frame 0 strips the padding.
+// Every payload length puts every DLC step in the first and the last frame.
+
+#include "TestNetwork.h"
+
+#if CAN_MAX_DATA_LENGTH != 64
+#error "test_fd needs 64-byte frames, build with -DCAN_MAX_DATA_LENGTH=64 (see the Makefile)"
+#endif
+
+#define MAX_PAYLOAD (MAX_EXTENDED_MSG_SIZE - 3)  // clientId and topic hash travel with it
+
+TestNetwork net;
+TestCAN brokerCAN(net.bus), canS(net.bus), canP(net.bus);
+CANPubSubBroker broker(brokerCAN);
+CANPubSubClient subscriber(canS), publisher(canP);
+
+uint16_t topic;
+size_t lastLength, brokerLength;
+int received = 0;
+int brokerReceived = 0;
+bool intact = true;
+
+uint8_t pattern(size_t length, size_t i) {
+  return (uint8_t)(length * 13 + i * 5 + 3);
+}
+
+void fill(uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) data[i] = pattern(length, i);
+}
+
+void check(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != pattern(length, i)) intact = false;
+  }
+}
+
+void onMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  received++;
+  lastLength = length;
+  check(data, length);
+}
+
+void onBrokerPublish(uint16_t topicHash, const uint8_t* data, size_t length) {
+  brokerReceived++;
+  brokerLength = length;
+  check(data, length);
+}
+
+void roundTrip(size_t length, bool reliable) {
+  uint8_t data[MAX_EXTENDED_MSG_SIZE];
+  fill(data, length);
+  received = 0;
+  brokerReceived = 0;
+  intact = true;
+  if (reliable) {
+    publisher.publishReliable(topic, data, length);
+  } else {
+    publisher.publish(topic, data, length);
+  }
+  net.settle(5);
+  CHECK_EQ(brokerReceived, 1);
+  CHECK_EQ(brokerLength, length);
+  CHECK_EQ(received, 1);
+  CHECK_EQ(lastLength, length);
+  CHECK(intact);
+  if (brokerLength != length || lastLength != length || !intact) printf("  length %u\n", (unsigned)length);
+}
+
+int main() {
+  net.useFD();
+  net.add(brokerCAN, broker);
+  net.add(canS, subscriber);
+  net.add(canP, publisher);
+  CHECK_EQ(brokerCAN.maxDataLength(), 64);
+
+  useTestStorage("fd");
+  broker.begin();
+  broker.onPublishBinary(onBrokerPublish);
+  subscriber.onMessageBinary(onMessage);
+
+  // Serial numbers and topic names longer than 8 bytes go multi-frame as well
+  CHECK(net.connect(subscriber, "FD-SUBSCRIBER-0001"));
+  CHECK(net.connect(publisher, "FD-PUBLISHER-0002"));
+  CHECK_EQ(broker.getClientIdBySerial("FD-SUBSCRIBER-0001"), subscriber.getClientId());
+  CHECK(broker.getSerialByClientId(publisher.getClientId()) == "FD-PUBLISHER-0002");
+  subscriber.subscribe("fd/a-long-topic-name");
+  net.settle();
+  topic = CANPubSubBase::hashTopic("fd/a-long-topic-name");
+  CHECK(broker.getTopicName(topic) != NULL && strcmp(broker.getTopicName(topic), "fd/a-long-topic-name") == 0);
+
+  // Multicast fan-out, then unicast copies, then reliable publishes
+  canP.resetSent();
+  for (size_t length = 0; length <= MAX_PAYLOAD; length++) {
+    roundTrip(length, false);
+  }
+  CHECK(canP.fdFrames() > 0);
+
+  broker.enableMulticast(false);
+  for (size_t length = 0; length <= MAX_PAYLOAD; length++) {
+    roundTrip(length, false);
+  }
+  broker.enableMulticast(true);
+
+  for (size_t length = 0; length <= CAN_PS_QOS_PAYLOAD_SIZE; length++) {
+    roundTrip(length, true);
+  }
+  CHECK(net.waitFor([]() { return publisher.getPendingPublishes() == 0; }));
+
+  return testSummary("fd");
+}
@@ -0,0 +1,157 @@
+// Reliable publish: lost ACKs make the client send again, the broker's dedup
+// window delivers each publish once, and one ACK range covers several publishes
+
+#include "TestNetwork.h"
+
+TestNetwork net;
+TestCAN brokerCAN(net.bus), canP(net.bus), canS(net.bus), canN(net.bus);
+CANPubSubBroker broker(brokerCAN);
+CANPubSubClient publisher(canP), subscriber(canS);
+CANPubSubClientT<MAX_CLIENT_TOPICS, MAX_SUBSCRIPTIONS, CAN_PS_BATCH_SIZE, CAN_PS_EXT_REASSEMBLY_SLOTS,
+                 CAN_PS_TOPIC_ARENA_SIZE, MAX_EXTENDED_MSG_SIZE, 2> narrow(canN);
+
+#define QOS_MESSAGES 6
+
+int delivered[256];
+int acknowledged = 0;
+int failed = 0;
+
+void onMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  if (length == 1) delivered[data[0]]++;
+}
+
+void onPublishDone(uint16_t topicHash, bool ack) {
+  if (ack) {
+    acknowledged++;
+  } else {
+    failed++;
+  }
+}
+
+void reset() {
+  memset(delivered, 0, sizeof(delivered));
+  acknowledged = 0;
+  failed = 0;
+  brokerCAN.resetSent();
+  canP.resetSent();
+}
+
+bool publishAll(uint8_t first, int count) {
+  bool ok = true;
+  for (int i = 0; i < count; i++) {
+    uint8_t value = first + i;
+    ok = publisher.publishReliable(CANPubSubBase::hashTopic("qos/data"), &value, 1) && ok;
+  }
+  return ok;
+}
+
+int main() {
+  net.add(brokerCAN, broker);
+  net.add(canP, publisher);
+  net.add(canS, subscriber);
+  net.add(canN, narrow);
+
+  useTestStorage("qos");
+  broker.begin();
+  subscriber.onMessageBinary(onMessage);
+  publisher.onPublishDone(onPublishDone);
+  publisher.setQosTimeout(20, 3);
+  CHECK(net.connect(publisher, "QOS-P"));
+  CHECK(net.connect(subscriber, "QOS-S"));
+  subscriber.subscribe("qos/data");
+  net.settle();
+
+  // Clean path: everything delivered once, fewer ACK frames than publishes
+  reset();
+  CHECK(publishAll(0, QOS_MESSAGES));
+  CHECK_EQ(publisher.getPendingPublishes(), QOS_MESSAGES);
+  net.waitFor([]() { return publisher.getPendingPublishes() == 0; });
+  net.settle();
+  for (int i = 0; i < QOS_MESSAGES; i++) {
+    CHECK_EQ(delivered[i], 1);
+  }
+  CHECK_EQ(acknowledged, QOS_MESSAGES);
+  CHECK_EQ(failed, 0);
+  CHECK(brokerCAN.sent(CAN_PS_PUBLISH_ACK) >= 1);
+  CHECK(brokerCAN.sent(CAN_PS_PUBLISH_ACK) < QOS_MESSAGES);
+  CHECK_EQ(canP.sent(CAN_PS_PUBLISH_QOS), QOS_MESSAGES);
+
+  // Lost ACKs: the client sends again, the broker drops the duplicates and ACKs them again
+  reset();
+  brokerCAN.dropNext(CAN_PS_PUBLISH_ACK, 2);
+  CHECK(publishAll(10, QOS_MESSAGES));
+  net.waitFor([]() { return publisher.getPendingPublishes() == 0; });
+  net.settle();
+  CHECK_EQ(brokerCAN.dropped(), 2);
+  CHECK(canP.sent(CAN_PS_PUBLISH_QOS) > QOS_MESSAGES);
+  for (int i = 10; i < 10 + QOS_MESSAGES; i++) {
+    CHECK_EQ(delivered[i], 1);
+  }
+  CHECK_EQ(acknowledged, QOS_MESSAGES);
+  CHECK_EQ(failed, 0);
+
+  // Lost publishes: the retransmission is the first copy the broker sees
+  reset();
+  canP.dropNext(CAN_PS_PUBLISH_QOS, 3);
+  CHECK(publishAll(20, QOS_MESSAGES));
+  net.waitFor([]() { return publisher.getPendingPublishes() == 0; });
+  net.settle();
+  for (int i = 20; i < 20 + QOS_MESSAGES; i++) {
+    CHECK_EQ(delivered[i], 1);
+  }
+  CHECK_EQ(acknowledged, QOS_MESSAGES);
+
+  // No ACK ever arrives: reported as failed after the retries, delivered once all the same
+  reset();
+  brokerCAN.dropNext(CAN_PS_PUBLISH_ACK, 1000);
+  CHECK(publishAll(30, 2));
+  net.waitFor([]() { return publisher.getPendingPublishes() == 0; });
+  net.settle();
+  CHECK_EQ(failed, 2);
+  CHECK_EQ(acknowledged, 0);
+  CHECK_EQ(delivered[30], 1);
+  CHECK_EQ(delivered[31], 1);
+  brokerCAN.dropNext(CAN_PS_PUBLISH_ACK, 0);
+
+  // A full window refuses further reliable publishes until ACKs come back
+  reset();
+  brokerCAN.dropNext(CAN_PS_PUBLISH_ACK, 1000);
+  CHECK(publishAll(40, CAN_PS_QOS_WINDOW));
+  CHECK(!publishAll(40 + CAN_PS_QOS_WINDOW, 1));
+  brokerCAN.dropNext(CAN_PS_PUBLISH_ACK, 0);
+  net.waitFor([]() { return publisher.getPendingPublishes() == 0; });
+  net.settle();
+  CHECK_EQ(acknowledged + failed, CAN_PS_QOS_WINDOW);
+  for (int i = 40; i < 40 + CAN_PS_QOS_WINDOW; i++) {
+    CHECK_EQ(delivered[i], 1);
+  }
+
+  // A client built with a window of two refuses the third unacknowledged publish
+  reset();
+  CHECK(net.connect(narrow, "QOS-NARROW"));
+  brokerCAN.dropNext(CAN_PS_PUBLISH_ACK, 1000);
+  uint8_t values[3] = { 50, 51, 52 };
+  uint16_t topicHash = CANPubSubBase::hashTopic("qos/data");
+  CHECK(narrow.publishReliable(topicHash, &values[0], 1));
+  CHECK(narrow.publishReliable(topicHash, &values[1], 1));
+  CHECK(!narrow.publishReliable(topicHash, &values[2], 1));
+  CHECK_EQ(narrow.getPendingPublishes(), 2);
+  brokerCAN.dropNext(CAN_PS_PUBLISH_ACK, 0);
+  CHECK(net.waitFor([]() { return narrow.getPendingPublishes() == 0; }));
+  net.settle();
+  CHECK_EQ(delivered[50], 1);
+  CHECK_EQ(delivered[51], 1);
+  CHECK_EQ(delivered[52], 0);
+
+  // A reconnecting publisher starts a new sequence, its first publish is not taken as a duplicate
+  reset();
+  publisher.end();
+  CHECK(net.connect(publisher, "QOS-P"));
+  CHECK(publishAll(60, 1));
+  net.waitFor([]() { return publisher.getPendingPublishes() == 0; });
+  net.settle();
+  CHECK_EQ(delivered[60], 1);
+  CHECK_EQ(acknowledged, 1);
+
+  return testSummary("qos");
+}
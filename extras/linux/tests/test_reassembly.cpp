@@ -0,0 +1,130 @@
+// Multi-frame messages: every payload length travels publisher -> broker ->
+// subscriber intact, a lost frame drops only its own message, a message longer
+// than the receive buffer is dropped, and messages from two senders interleave
+// without mixing
+
+#include "TestNetwork.h"
+
+#define MAX_PAYLOAD (MAX_EXTENDED_MSG_SIZE - 3)  // clientId and topic hash travel with it
+
+TestNetwork net;
+TestCAN brokerCAN(net.bus), canS(net.bus), canP(net.bus), canQ(net.bus), canN(net.bus);
+CANPubSubBroker broker(brokerCAN);
+CANPubSubClient subscriber(canS), publisher(canP), second(canQ);
+CANPubSubClientT<MAX_CLIENT_TOPICS, MAX_SUBSCRIPTIONS, CAN_PS_BATCH_SIZE, 1, CAN_PS_TOPIC_ARENA_SIZE, 32> narrow(canN);
+
+uint16_t topicP, topicQ;
+size_t lastLength;
+int received = 0;
+int receivedQ = 0;
+int receivedNarrow = 0;
+size_t narrowLength;
+bool intact = true;
+
+uint8_t pattern(size_t length, size_t i) {
+  return (uint8_t)(length * 31 + i * 7 + 1);
+}
+
+void fill(uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) data[i] = pattern(length, i);
+}
+
+void onMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  if (topicHash == topicQ) receivedQ++; else received++;
+  lastLength = length;
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != pattern(length, i)) intact = false;
+  }
+}
+
+void onNarrowMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  receivedNarrow++;
+  narrowLength = length;
+}
+
+// Publish `length` bytes and check they arrive as sent
+void roundTrip(CANPubSubClient& client, uint16_t topicHash, size_t length) {
+  uint8_t data[MAX_EXTENDED_MSG_SIZE];
+  fill(data, length);
+  received = 0;
+  intact = true;
+  client.publish(topicHash, data, length);
+  net.settle(5);
+  CHECK_EQ(received, 1);
+  CHECK_EQ(lastLength, length);
+  CHECK(intact);
+  if (received != 1 || lastLength != length || !intact) printf("  length %u\n", (unsigned)length);
+}
+
+int main() {
+  net.add(brokerCAN, broker);
+  net.add(canS, subscriber);
+  net.add(canP, publisher);
+  net.add(canQ, second);
+  net.add(canN, narrow);
+
+  useTestStorage("reassembly");
+  broker.begin();
+  subscriber.onMessageBinary(onMessage);
+  CHECK(net.connect(subscriber, "REASM-S"));
+  CHECK(net.connect(publisher, "REASM-P"));
+  CHECK(net.connect(second, "REASM-Q"));
+  subscriber.subscribe("reasm/p");
+  subscriber.subscribe("reasm/q");
+  net.settle();
+  topicP = CANPubSubBase::hashTopic("reasm/p");
+  topicQ = CANPubSubBase::hashTopic("reasm/q");
+
+  // Every length, single frame and multi-frame, multicast and unicast
+  for (size_t length = 0; length <= MAX_PAYLOAD; length++) {
+    roundTrip(publisher, topicP, length);
+  }
+  broker.enableMulticast(false);
+  for (size_t length = 0; length <= MAX_PAYLOAD; length += 7) {
+    roundTrip(publisher, topicP, length);
+  }
+  broker.enableMulticast(true);
+
+  // A lost first frame drops the message, the next one arrives whole
+  uint8_t data[MAX_EXTENDED_MSG_SIZE];
+  fill(data, 40);
+  received = 0;
+  canP.dropNext(CAN_PS_PUBLISH, 1);
+  publisher.publish(topicP, data, 40);
+  net.settle();
+  CHECK_EQ(received, 0);
+  roundTrip(publisher, topicP, 40);
+
+  // A client with a 32-byte receive buffer takes what fits and drops the rest whole
+  narrow.onMessageBinary(onNarrowMessage);
+  CHECK(net.connect(narrow, "REASM-NARROW"));
+  narrow.subscribe("reasm/p");
+  net.settle();
+  receivedNarrow = 0;
+  roundTrip(publisher, topicP, 20);
+  CHECK_EQ(receivedNarrow, 1);
+  CHECK_EQ(narrowLength, 20);
+  receivedNarrow = 0;
+  roundTrip(publisher, topicP, 60);
+  CHECK_EQ(receivedNarrow, 0);
+  narrow.unsubscribe("reasm/p");
+  net.settle();
+
+  // Two senders, frames interleaved on the bus, reassembled in their own slots
+  received = 0;
+  receivedQ = 0;
+  intact = true;
+  uint8_t other[MAX_EXTENDED_MSG_SIZE];
+  fill(data, 60);
+  fill(other, 90);
+  for (int i = 0; i < 4; i++) {
+    publisher.publish(topicP, data, 60);
+    second.publish(topicQ, other, 90);
+  }
+  net.settle();
+  CHECK_EQ(received, 4);
+  CHECK_EQ(receivedQ, 4);
+  CHECK(intact);
+
+  return testSummary("reassembly");
+}
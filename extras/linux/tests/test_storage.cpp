@@ -0,0 +1,218 @@
+// Broker storage: a version 1 EEPROM image (fixed-size records at the legacy
+// addresses) is migrated to the packed blobs, a blob failing its CRC drops that
+// table only, and write-behind changes survive a restart.
+
+#include "TestNetwork.h"
+
+VirtualCANBus bus;
+VirtualCANClass brokerCAN(bus);
+
+#define SERIAL_ONE   "SN1"
+#define SERIAL_SEVEN "SN-SEVEN-LONGER-SERIAL"
+
+void writeLegacyImage() {
+  ClientMapping mappings[2];
+  memset(mappings, 0, sizeof(mappings));
+  mappings[0].clientId = 1;
+  mappings[0].setSerial(SERIAL_ONE);
+  mappings[0].registered = true;
+  mappings[1].clientId = 7;
+  mappings[1].setSerial(SERIAL_SEVEN);
+  mappings[1].registered = true;
+
+  ClientSubscriptions subs[2];
+  memset(subs, 0, sizeof(subs));
+  subs[0].clientId = 1;
+  subs[0].topicCount = 2;
+  subs[0].topics[0] = CANPubSubBase::hashTopic("a/b");
+  subs[0].topics[1] = CANPubSubBase::hashTopic("c");
+  subs[1].clientId = 7;
+  subs[1].topicCount = 1;
+  subs[1].topics[0] = CANPubSubBase::hashTopic("c");
+
+  StoredTopicName names[2];
+  memset(names, 0, sizeof(names));
+  names[0].hash = subs[0].topics[0];
+  names[0].setName("a/b");
+  names[0].active = true;
+  names[1].hash = subs[0].topics[1];
+  names[1].setName("c");
+  names[1].active = true;
+
+  EEPROM.begin(EEPROM_SIZE);
+  EEPROM.put(0, (uint16_t)STORAGE_MAGIC);
+  EEPROM.put(2, (uint8_t)2);  // mapping count
+  EEPROM.put(3, (uint8_t)8);  // next client ID
+  EEPROM.put(4, mappings[0]);
+  EEPROM.put(4 + sizeof(ClientMapping), mappings[1]);
+
+  int address = STORAGE_LEGACY_SUB_ADDR;
+  EEPROM.put(address, (uint16_t)STORAGE_SUB_MAGIC);
+  EEPROM.put(address + 2, (uint8_t)2);
+  EEPROM.put(address + 3, subs[0]);
+  EEPROM.put(address + 3 + sizeof(ClientSubscriptions), subs[1]);
+
+  address = STORAGE_LEGACY_PING_ADDR;
+  EEPROM.put(address, true);
+  EEPROM.put(address + sizeof(bool), (unsigned long)1234);
+  EEPROM.put(address + sizeof(bool) + sizeof(unsigned long), (uint8_t)4);
+
+  address = STORAGE_LEGACY_TOPIC_ADDR;
+  EEPROM.put(address, (uint16_t)STORAGE_TOPIC_MAGIC);
+  EEPROM.put(address + 2, (uint8_t)2);
+  EEPROM.put(address + 3, names[0]);
+  EEPROM.put(address + 3 + sizeof(StoredTopicName), names[1]);
+  EEPROM.commit();
+}
+
+void checkRestored(CANPubSubBroker& broker) {
+  CHECK_EQ(broker.getRegisteredClientCount(), 2);
+  CHECK(broker.getSerialByClientId(1) == SERIAL_ONE);
+  CHECK(broker.getSerialByClientId(7) == SERIAL_SEVEN);
+  CHECK_EQ(broker.getClientIdBySerial(SERIAL_SEVEN), 7);
+  CHECK_EQ(broker.getClientSubscriptionCount(1), 2);
+  CHECK_EQ(broker.getClientSubscriptionCount(7), 1);
+  CHECK(broker.isAutoPingEnabled());
+  CHECK_EQ(broker.getPingInterval(), 1234);
+  CHECK_EQ(broker.getMaxMissedPings(), 4);
+  CHECK(!broker.hasPendingWrites());
+}
+
+int main() {
+  brokerCAN.begin(500E3);
+  useTestStorage("storage");
+  writeLegacyImage();
+
+  // Version 1 image: read from the legacy addresses, rewritten as version 2
+  {
+    CANPubSubBroker broker(brokerCAN);
+    CHECK(broker.begin());
+    checkRestored(broker);
+  }
+  CHECK_EQ(EEPROM.read(0), STORAGE_FORMAT_MAGIC & 0xFF);
+  CHECK_EQ(EEPROM.read(1), STORAGE_FORMAT_MAGIC >> 8);
+  CHECK_EQ(EEPROM.read(2), STORAGE_VERSION);
+
+  // Clean reload of the packed format
+  {
+    CANPubSubBroker broker(brokerCAN);
+    CHECK(broker.begin());
+    checkRestored(broker);
+  }
+
+  // One byte flipped in the mapping blob: the mappings go, subscriptions and ping stay
+  EEPROM.write(STORAGE_MAP_ADDR + STORAGE_BLOB_HEADER + 3, EEPROM.read(STORAGE_MAP_ADDR + STORAGE_BLOB_HEADER + 3) ^ 0x40);
+  EEPROM.commit();
+  {
+    CANPubSubBroker broker(brokerCAN);
+    CHECK(broker.begin());
+    CHECK_EQ(broker.getRegisteredClientCount(), 0);
+    CHECK(broker.getSerialByClientId(7) == "");
+    CHECK_EQ(broker.getClientSubscriptionCount(1), 2);
+    CHECK_EQ(broker.getClientSubscriptionCount(7), 1);
+    CHECK_EQ(broker.getPingInterval(), 1234);
+
+    // New registration and a cleared table, written through the blobs
+    CHECK(broker.registerClient("NEW-1") != 0);
+    CHECK(broker.hasPendingWrites());
+    CHECK(broker.clearStoredTopicNames());
+    broker.flush();
+    CHECK(!broker.hasPendingWrites());
+  }
+  {
+    CANPubSubBroker broker(brokerCAN);
+    CHECK(broker.begin());
+    CHECK_EQ(broker.getRegisteredClientCount(), 1);
+    uint8_t clientId = broker.getClientIdBySerial("NEW-1");
+    CHECK(clientId != 0);
+    CHECK(broker.getSerialByClientId(clientId) == "NEW-1");
+    CHECK_EQ(broker.getClientSubscriptionCount(7), 1);
+  }
+
+  // Write-behind: a client's subscription is pending until the interval or flush()
+  uint8_t storedSubs = 0;
+  {
+    TestNetwork net;
+    TestCAN canB(net.bus), canC(net.bus);
+    CANPubSubBroker broker(canB);
+    CANPubSubClient client(canC);
+    net.add(canB, broker);
+    net.add(canC, client);
+    broker.setPersistInterval(60000);
+    CHECK(broker.begin());
+    CHECK(net.connect(client, "NEW-1"));
+    storedSubs = broker.getClientSubscriptionCount(client.getClientId());
+    client.subscribe("w/1");
+    net.settle();
+    CHECK_EQ(broker.getClientSubscriptionCount(client.getClientId()), storedSubs + 1);
+    CHECK(broker.hasPendingWrites());
+    CHECK(broker.flush());
+    CHECK(!broker.hasPendingWrites());
+    
+    // Reconnecting under a registered serial changes nothing to store
+    client.end();
+    net.settle();
+    CHECK(net.connect(client, "NEW-1"));
+    CHECK(!broker.hasPendingWrites());
+  }
+  {
+    CANPubSubBroker broker(brokerCAN);
+    CHECK(broker.begin());
+    CHECK_EQ(broker.getClientSubscriptionCount(broker.getClientIdBySerial("NEW-1")), storedSubs + 1);
+  }
+
+  // A broker sized for one client loads the table while it fits, then refuses new serials
+  {
+    CANPubSubBrokerT<MAX_SUBSCRIPTIONS, MAX_SUBSCRIBERS_PER_TOPIC, CAN_PS_MAX_SUBSCRIBER_CLIENTS,
+                     CAN_PS_EXT_REASSEMBLY_SLOTS, CAN_PS_TOPIC_ARENA_SIZE, CAN_PS_SUB_INDEX_SIZE, 1> small(brokerCAN);
+    CHECK(small.begin());
+    CHECK_EQ(small.getRegisteredClientCount(), 1);
+    CHECK(small.getClientIdBySerial("NEW-1") != 0);
+    CHECK_EQ(small.registerClient("NEW-2"), CAN_PS_UNASSIGNED_ID);
+  }
+
+  // A broker tracking fewer topics per client keeps the first ones of each stored list
+  CHECK(storedSubs + 1 > 2);
+  {
+    CANPubSubBrokerT<MAX_SUBSCRIPTIONS, MAX_SUBSCRIBERS_PER_TOPIC, CAN_PS_MAX_SUBSCRIBER_CLIENTS,
+                     CAN_PS_EXT_REASSEMBLY_SLOTS, CAN_PS_TOPIC_ARENA_SIZE, CAN_PS_SUB_INDEX_SIZE,
+                     MAX_CLIENT_MAPPINGS, MAX_EXTENDED_MSG_SIZE, 2, 4> narrow(brokerCAN);
+    CHECK(narrow.begin());
+    CHECK_EQ(narrow.getClientSubscriptionCount(narrow.getClientIdBySerial("NEW-1")), 2);
+    CHECK_EQ(narrow.getClientSubscriptionCount(7), 1);
+  }
+
+  // A table too large for a smaller broker: the first mappings load, the rest are
+  // counted, and the image stays whole until the table is written again
+  {
+    CANPubSubBroker broker(brokerCAN);
+    CHECK(broker.begin());
+    CHECK(broker.clearStoredMappings());
+    CHECK(broker.clearStoredSubscriptions());
+    CHECK(broker.clearStoredTopicNames());
+    for (int i = 0; i < 8; i++) {
+      CHECK(broker.registerClient(String("SHRINK-") + i) != CAN_PS_UNASSIGNED_ID);
+    }
+    CHECK(broker.flush());
+    CHECK_EQ(broker.getStorageDrops(), 0);
+  }
+  {
+    CANPubSubBrokerT<MAX_SUBSCRIPTIONS, MAX_SUBSCRIBERS_PER_TOPIC, CAN_PS_MAX_SUBSCRIBER_CLIENTS,
+                     CAN_PS_EXT_REASSEMBLY_SLOTS, CAN_PS_TOPIC_ARENA_SIZE, CAN_PS_SUB_INDEX_SIZE,
+                     2, MAX_EXTENDED_MSG_SIZE, 2, 1> tiny(brokerCAN);
+    CHECK(tiny.begin());
+    CHECK_EQ(tiny.getRegisteredClientCount(), 2);
+    CHECK(tiny.getClientIdBySerial("SHRINK-0") != CAN_PS_UNASSIGNED_ID);
+    CHECK(tiny.getClientIdBySerial("SHRINK-1") != CAN_PS_UNASSIGNED_ID);
+    CHECK_EQ(tiny.getClientIdBySerial("SHRINK-2"), CAN_PS_UNASSIGNED_ID);
+    CHECK_EQ(tiny.getStorageDrops(), 6);
+  }
+  {
+    CANPubSubBroker broker(brokerCAN);
+    CHECK(broker.begin());
+    CHECK_EQ(broker.getRegisteredClientCount(), 8);
+    CHECK_EQ(broker.getStorageDrops(), 0);
+  }
+
+  return testSummary("storage");
+}
@@ -0,0 +1,177 @@
+// Broker subscription index: open addressing with backward-shift deletion.
+// A 16-slot index for 12 topics, with topic names chosen so their home slots
+// collide and one probe chain wraps from the last slot to the first.
+
+#include "TestNetwork.h"
+
+#define INDEX_TOPICS 12
+#define INDEX_SIZE   16
+
+TestNetwork net;
+TestCAN brokerCAN(net.bus), canA(net.bus), canB(net.bus);
+CANPubSubBrokerT<INDEX_TOPICS, 4, 8, 4, INDEX_TOPICS * 16, INDEX_SIZE> broker(brokerCAN);
+CANPubSubClient clientA(canA), clientB(canB);
+
+struct IndexTopic {
+  String name;
+  uint16_t hash;
+  CANPubSubClient* owner;
+  bool active;
+};
+
+IndexTopic topics[INDEX_TOPICS];
+int received[INDEX_TOPICS];
+
+// Same scramble as CANPubSubBrokerCore::subscriptionHome()
+uint16_t homeSlot(uint16_t hash) {
+  uint16_t mixed = hash * 40503u;
+  return ((uint32_t)mixed * INDEX_SIZE) >> 16;
+}
+
+// Names whose home slot is `home`, appended to topics[]
+void pickTopics(uint16_t home, int count, int& next, CANPubSubClient* owner) {
+  for (int n = 0; count > 0; n++) {
+    String name = String("idx/") + String(n);
+    uint16_t hash = CANPubSubBase::hashTopic(name);
+    if (homeSlot(hash) != home) continue;
+
+    bool used = false;
+    for (int i = 0; i < next; i++) {
+      if (topics[i].hash == hash) used = true;
+    }
+    if (used) continue;
+
+    topics[next].name = name;
+    topics[next].hash = hash;
+    topics[next].owner = owner;
+    topics[next].active = false;
+    next++;
+    count--;
+  }
+}
+
+void onMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  for (int i = 0; i < INDEX_TOPICS; i++) {
+    if (topics[i].hash == topicHash) received[i]++;
+  }
+}
+
+void checkTable(const char* step) {
+  int failures = testFailures;
+  int active = 0;
+  for (int i = 0; i < INDEX_TOPICS; i++) {
+    uint8_t subscribers[4];
+    uint8_t count = 0xFF;
+    broker.getSubscribers(topics[i].hash, subscribers, &count);
+
+    if (topics[i].active) {
+      active++;
+      CHECK_EQ(count, 1);
+      CHECK_EQ(subscribers[0], topics[i].owner->getClientId());
+    } else {
+      CHECK_EQ(count, 0);
+    }
+  }
+  CHECK_EQ(broker.getSubscriptionCount(), active);
+  if (testFailures != failures) printf("  after %s\n", step);
+}
+
+void setActive(int i, bool active) {
+  if (active) {
+    topics[i].owner->subscribe(topics[i].name);
+  } else {
+    topics[i].owner->unsubscribe(topics[i].name);
+  }
+  topics[i].active = active;
+  net.settle();
+}
+
+int main() {
+  net.add(brokerCAN, broker);
+  net.add(canA, clientA);
+  net.add(canB, clientB);
+
+  useTestStorage("index");
+  broker.begin();
+  clientA.onMessageBinary(onMessage);
+  clientB.onMessageBinary(onMessage);
+  CHECK(net.connect(clientA, "INDEX-A"));
+  CHECK(net.connect(clientB, "INDEX-B"));
+
+  // Chain from the last slot wraps to slot 0, where the next cluster starts
+  int next = 0;
+  pickTopics(INDEX_SIZE - 1, 4, next, &clientA);
+  pickTopics(0, 3, next, &clientB);
+  pickTopics(5, 3, next, &clientA);
+  pickTopics(6, 2, next, &clientB);
+  CHECK_EQ(next, INDEX_TOPICS);
+
+  for (int i = 0; i < INDEX_TOPICS; i++) {
+    setActive(i, true);
+  }
+  checkTable("insert");
+
+  // Table full: a further topic is refused and nothing else moves
+  String extra = "idx/extra";
+  clientB.subscribe(extra);
+  net.settle();
+  uint8_t subscribers[4], count = 0xFF;
+  broker.getSubscribers(CANPubSubBase::hashTopic(extra), subscribers, &count);
+  CHECK_EQ(count, 0);
+  clientB.unsubscribe(extra);
+  net.settle();
+  checkTable("overflow");
+
+  // Chain heads first, so later entries shift back over the wrap and across clusters
+  const int order[] = { 0, 4, 8, 1, 10, 5, 2, 11, 3, 6, 9, 7 };
+  for (int k = 0; k < INDEX_TOPICS; k++) {
+    setActive(order[k], false);
+    checkTable("delete");
+
+    if (k == 5) {
+      // Re-insert into the holes while half of the table is still in use
+      setActive(0, true);
+      setActive(4, true);
+      checkTable("reinsert");
+      setActive(0, false);
+      setActive(4, false);
+      checkTable("delete again");
+    }
+  }
+  CHECK_EQ(broker.getSubscriptionCount(), 0);
+
+  for (int i = 0; i < INDEX_TOPICS; i++) {
+    setActive(i, true);
+  }
+  checkTable("refill");
+
+  // Every entry still routes
+  memset(received, 0, sizeof(received));
+  for (int i = 0; i < INDEX_TOPICS; i++) {
+    uint8_t value = i;
+    clientA.publish(topics[i].hash, &value, 1);
+    net.settle(5);
+  }
+  net.settle();
+  for (int i = 0; i < INDEX_TOPICS; i++) {
+    CHECK_EQ(received[i], 1);
+  }
+
+  // Two subscribers on one entry: removing one keeps the entry
+  setActive(7, false);
+  clientA.subscribe(topics[7].name);
+  clientB.subscribe(topics[7].name);
+  net.settle();
+  broker.getSubscribers(topics[7].hash, subscribers, &count);
+  CHECK_EQ(count, 2);
+  clientA.unsubscribe(topics[7].name);
+  net.settle();
+  broker.getSubscribers(topics[7].hash, subscribers, &count);
+  CHECK_EQ(count, 1);
+  CHECK_EQ(subscribers[0], clientB.getClientId());
+  topics[7].owner = &clientB;
+  topics[7].active = true;
+  checkTable("shared entry");
+
+  return testSummary("subscription index");
+}
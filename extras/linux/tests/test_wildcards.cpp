@@ -0,0 +1,220 @@
+// Wildcard subscriptions: "+" matches one level, "#" the remaining levels
+// (none included), subscribers of both a pattern and the exact topic get one copy
+
+#include "TestNetwork.h"
+
+TestNetwork net;
+TestCAN brokerCAN(net.bus), canW(net.bus), canE(net.bus), canP(net.bus);
+CANPubSubBrokerT<MAX_SUBSCRIPTIONS, 16> broker(brokerCAN);  // more subscribers per topic than the build-wide cap
+CANPubSubClient wild(canW), exact(canE), publisher(canP);
+
+#define FAN_OUT 12
+
+TestCAN* fanCAN[FAN_OUT];
+CANPubSubClient* fan[FAN_OUT];
+int fanSeen;
+
+#define MAX_SEEN 16
+
+struct Seen {
+  String topic[MAX_SEEN];
+  String message[MAX_SEEN];
+  int count;
+
+  void clear() { count = 0; }
+  int find(const String& name) {
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+      if (topic[i] == name) n++;
+    }
+    return n;
+  }
+};
+
+Seen wildSeen, exactSeen;
+
+void onWild(uint16_t topicHash, const String& topic, const String& message) {
+  if (wildSeen.count < MAX_SEEN) {
+    wildSeen.topic[wildSeen.count] = topic;
+    wildSeen.message[wildSeen.count++] = message;
+  }
+}
+
+void onExact(uint16_t topicHash, const String& topic, const String& message) {
+  if (exactSeen.count < MAX_SEEN) {
+    exactSeen.topic[exactSeen.count] = topic;
+    exactSeen.message[exactSeen.count++] = message;
+  }
+}
+
+void publish(const char* topic, const char* message) {
+  publisher.publish(topic, message);
+  net.settle();
+}
+
+int main() {
+  net.add(brokerCAN, broker);
+  net.add(canW, wild);
+  net.add(canE, exact);
+  net.add(canP, publisher);
+
+  useTestStorage("wildcards");
+  broker.begin();
+  wild.onMessage(onWild);
+  exact.onMessage(onExact);
+  CHECK(net.connect(wild, "WILD-W"));
+  CHECK(net.connect(exact, "WILD-E"));
+  CHECK(net.connect(publisher, "WILD-P"));
+
+  wild.subscribe("sensors/+/temp");
+  wild.subscribe("alerts/#");
+  wild.subscribe("sensors/+x/temp");  // "+" inside a level is a plain name
+  exact.subscribe("sensors/kitchen/temp");
+  net.settle();
+  CHECK_EQ(broker.getWildcardCount(), 2);
+  CHECK_EQ(broker.getSubscriptionCount(), 4);
+
+  // Name known from the exact subscription: both get the first publish, once each
+  wildSeen.clear();
+  exactSeen.clear();
+  publish("sensors/kitchen/temp", "21");
+  CHECK_EQ(wildSeen.find("sensors/kitchen/temp"), 1);
+  CHECK_EQ(exactSeen.find("sensors/kitchen/temp"), 1);
+  publish("sensors/kitchen/temp", "22");
+  CHECK_EQ(wildSeen.find("sensors/kitchen/temp"), 2);
+  CHECK_EQ(exactSeen.find("sensors/kitchen/temp"), 2);
+  CHECK(wildSeen.message[wildSeen.count - 1] == "22");
+
+  // Unicast fan-out gives the same single copies
+  broker.enableMulticast(false);
+  publish("sensors/kitchen/temp", "23");
+  CHECK_EQ(wildSeen.find("sensors/kitchen/temp"), 3);
+  CHECK_EQ(exactSeen.find("sensors/kitchen/temp"), 3);
+  broker.enableMulticast(true);
+
+  // Level rules, names learned from the publisher: the first publish is held until the answer
+  wildSeen.clear();
+  const char* matching[] = { "sensors/hall/temp", "alerts", "alerts/fire", "alerts/fire/east" };
+  const char* other[] = { "sensors/temp", "sensors/a/b/temp", "sensors/hall/temperature", "alert/fire" };
+  for (unsigned i = 0; i < sizeof(matching) / sizeof(matching[0]); i++) {
+    publish(matching[i], "first");
+    CHECK_EQ(wildSeen.find(matching[i]), 1);
+    CHECK(wildSeen.message[wildSeen.count - 1] == "first");
+    publish(matching[i], "second");
+    CHECK_EQ(wildSeen.find(matching[i]), 2);
+    CHECK(wildSeen.message[wildSeen.count - 1] == "second");
+  }
+  for (unsigned i = 0; i < sizeof(other) / sizeof(other[0]); i++) {
+    publish(other[i], "first");
+    publish(other[i], "second");
+    CHECK_EQ(wildSeen.find(other[i]), 0);
+  }
+  CHECK_EQ(exactSeen.find("sensors/hall/temp"), 0);
+
+  // A reliable first publish is acknowledged and still reaches the pattern
+  wildSeen.clear();
+  publisher.publishReliable("sensors/porch/temp", "q1");
+  net.settle();
+  CHECK_EQ(wildSeen.find("sensors/porch/temp"), 1);
+  CHECK(wildSeen.message[wildSeen.count - 1] == "q1");
+  CHECK_EQ(publisher.getPendingPublishes(), 0);
+
+  // Two publishes before the name arrives are both held, in order
+  wildSeen.clear();
+  publisher.publish("sensors/attic/temp", "h1");
+  publisher.publish("sensors/attic/temp", "h2");
+  net.settle();
+  CHECK_EQ(wildSeen.find("sensors/attic/temp"), 2);
+  CHECK(wildSeen.count == 2 && wildSeen.message[0] == "h1" && wildSeen.message[1] == "h2");
+
+  // A new pattern recomputes only the cached topics it matches: the others keep
+  // their entry and are not announced to the wildcard subscriber again
+  brokerCAN.resetSent();
+  wild.subscribe("lights/+");
+  net.settle();
+  publish("sensors/hall/temp", "cached");
+  publish("alerts/fire", "cached");
+  CHECK_EQ(brokerCAN.sent(CAN_PS_TOPIC_NAME), 0);
+  CHECK_EQ(brokerCAN.sent(CAN_PS_TOPIC_NAME_REQUEST), 0);
+  wildSeen.clear();
+  publish("lights/desk", "on");
+  CHECK_EQ(wildSeen.find("lights/desk"), 1);
+
+  // A second subscriber to a pattern is added to the topics it matches
+  exactSeen.clear();
+  exact.subscribe("alerts/#");
+  net.settle();
+  brokerCAN.resetSent();
+  publish("alerts/fire", "both");
+  publish("sensors/hall/temp", "wild only");
+  CHECK_EQ(exactSeen.find("alerts/fire"), 1);
+  CHECK_EQ(exactSeen.find("sensors/hall/temp"), 0);
+  CHECK_EQ(brokerCAN.sent(CAN_PS_TOPIC_NAME), 2);  // alerts/fire (two frames) to the new subscriber only
+  exact.unsubscribe("alerts/#");
+  wild.unsubscribe("lights/+");
+  net.settle();
+
+  // The literal "+x" subscription only takes its own name
+  wildSeen.clear();
+  publish("sensors/+x/temp", "literal");
+  CHECK_EQ(wildSeen.find("sensors/+x/temp"), 1);
+
+  // Unsubscribing a pattern stops its matches, the other pattern keeps working
+  wild.unsubscribe("alerts/#");
+  net.settle();
+  CHECK_EQ(broker.getWildcardCount(), 1);
+  wildSeen.clear();
+  publish("alerts/fire", "after");
+  publish("sensors/hall/temp", "after");
+  CHECK_EQ(wildSeen.find("alerts/fire"), 0);
+  CHECK_EQ(wildSeen.find("sensors/hall/temp"), 1);
+  CHECK_EQ(wildSeen.count, 1);
+
+  // Patterns are stored like other subscriptions and come back after a broker restart
+  broker.flush();
+  broker.end();
+  broker.begin();
+  CHECK_EQ(broker.getWildcardCount(), 1);
+  CHECK(net.connect(wild, "WILD-W"));
+  CHECK(net.connect(publisher, "WILD-P"));
+  wildSeen.clear();
+  publish("sensors/garage/temp", "1");
+  publish("sensors/garage/temp", "2");
+  CHECK_EQ(wildSeen.find("sensors/garage/temp"), 2);
+  CHECK(wildSeen.count == 2 && wildSeen.message[0] == "1" && wildSeen.message[1] == "2");
+
+  // The union of pattern subscribers follows the broker's SubscribersPerTopic,
+  // not the build-wide MAX_SUBSCRIBERS_PER_TOPIC
+  for (int i = 0; i < FAN_OUT; i++) {
+    fanCAN[i] = new TestCAN(net.bus);
+    fan[i] = new CANPubSubClient(*fanCAN[i]);
+    net.add(*fanCAN[i], *fan[i]);
+    fan[i]->onMessage([](uint16_t topicHash, const String& topic, const String& message) { fanSeen++; });
+    CHECK(net.connect(*fan[i], String("WILD-F") + i));
+    fan[i]->subscribe("fanout/+");
+  }
+  net.settle();
+  fanSeen = 0;
+  publish("fanout/all", "1");
+  CHECK_EQ(fanSeen, FAN_OUT);
+  fanSeen = 0;
+  publish("fanout/all", "2");
+  CHECK_EQ(fanSeen, FAN_OUT);
+  
+  // Filling the cache evicts the computed entries, not one whose publish is held
+  // while its name is asked: a burst of new topics behind it does not lose it
+  wild.subscribe("burst/+");
+  net.settle();
+  wildSeen.clear();
+  publisher.publish("burst/held", "first");
+  for (int i = 0; i < CAN_PS_WILDCARD_CACHE_SIZE; i++) {
+    publisher.publish(String("burst/") + i, "x");
+  }
+  net.settle();
+  CHECK_EQ(wildSeen.find("burst/held"), 1);
+  CHECK(wildSeen.count > 0 && wildSeen.message[0] == "first");
+  publish("burst/held", "second");
+  CHECK_EQ(wildSeen.find("burst/held"), 2);
+
+  return testSummary("wildcards");
+}
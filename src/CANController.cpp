@@ -12,13 +12,34 @@ CANControllerClass::CANControllerClass() :
   _txRtr(false),
   _txDlc(0),
   _txLength(0),
+  _txCapacity(8),
 
   _rxId(-1),
   _rxExtended(false),
   _rxRtr(false),
+  _rxFd(false),
   _rxDlc(0),
   _rxLength(0),
-  _rxIndex(0)
+  _rxIndex(0),
+
+  _rxQueue(NULL),
+  _rxQueueMask(0),
+  _rxQueueHead(0),
+  _rxQueueTail(0),
+  _rxQueueOverflows(0),
+
+  _arbitrationLost(0),
+  _busErrors(0),
+  _rxOverruns(0),
+  _txFailures(0),
+  _busOffCount(0),
+  _lastBusState(CAN_BUS_STATE_UNKNOWN),
+  _autoRecovery(true),
+
+  _bitRate(0),
+  _busBits(0),
+  _busLoadStart(0),
+  _busLoad(0)
 {
   // overide Stream timeout value
   setTimeout(0);
@@ -26,9 +47,12 @@ CANControllerClass::CANControllerClass() :
 
 CANControllerClass::~CANControllerClass()
 {
+  if (_rxQueue) {
+    free(_rxQueue);
+  }
 }
 
-int CANControllerClass::begin(long /*baudRate*/)
+int CANControllerClass::begin(long baudRate)
 {
   _packetBegun = false;
   _txId = -1;
@@ -38,24 +62,46 @@ int CANControllerClass::begin(long /*baudRate*/)
 
   _rxId = -1;
   _rxRtr = false;
+  _rxFd = false;
   _rxDlc = 0;
   _rxLength = 0;
   _rxIndex = 0;
 
+  _rxQueueHead = 0;
+  _rxQueueTail = 0;
+
+  _lastBusState = CAN_BUS_STATE_UNKNOWN;
+  _bitRate = baudRate;
+  _busBits = 0;
+  _busLoadStart = millis();
+  _busLoad = 0;
+
   return 1;
 }
 
+int CANControllerClass::beginFD(long /*baudRate*/, long /*dataBaudRate*/)
+{
+  return 0;
+}
+
 void CANControllerClass::end()
 {
 }
 
+int CANControllerClass::maxDataLength()
+{
+  return 8;
+}
+
 int CANControllerClass::beginPacket(int id, int dlc, bool rtr)
 {
   if (id < 0 || id > 0x7FF) {
     return 0;
   }
 
-  if (dlc > 8) {
+  int capacity = maxDataLength();
+
+  if (dlc > capacity) {
     return 0;
   }
 
@@ -65,8 +111,9 @@ int CANControllerClass::beginPacket(int id, int dlc, bool rtr)
   _txRtr = rtr;
   _txDlc = dlc;
   _txLength = 0;
+  _txCapacity = capacity;
 
-  memset(_txData, 0x00, sizeof(_txData));
+  memset(_txData, 0x00, capacity);
 
   return 1;
 }
@@ -77,7 +124,9 @@ int CANControllerClass::beginExtendedPacket(long id, int dlc, bool rtr)
     return 0;
   }
 
-  if (dlc > 8) {
+  int capacity = maxDataLength();
+
+  if (dlc > capacity) {
     return 0;
   }
 
@@ -87,8 +136,9 @@ int CANControllerClass::beginExtendedPacket(long id, int dlc, bool rtr)
   _txRtr = rtr;
   _txDlc = dlc;
   _txLength = 0;
+  _txCapacity = capacity;
 
-  memset(_txData, 0x00, sizeof(_txData));
+  memset(_txData, 0x00, capacity);
 
   return 1;
 }
@@ -104,12 +154,18 @@ int CANControllerClass::endPacket()
     _txLength = _txDlc;
   }
 
+  _busBits += frameBits(_txExtended, _txRtr ? 0 : _txLength);
+
   return 1;
 }
 
 int CANControllerClass::parsePacket()
 {
-  return 0;
+  if (!popRxFrame()) {
+    return 0;
+  }
+
+  return _rxDlc;
 }
 
 long CANControllerClass::packetId()
@@ -132,6 +188,43 @@ int CANControllerClass::packetDlc()
   return _rxDlc;
 }
 
+bool CANControllerClass::packetFd()
+{
+  return _rxFd;
+}
+
+int CANControllerClass::packetTxLength()
+{
+  return _packetBegun ? _txLength : 0;
+}
+
+uint8_t CANControllerClass::lengthToDlc(int length)
+{
+  // smallest DLC whose data field holds length bytes
+  if (length <= 8) {
+    return (length < 0) ? 0 : length;
+  }
+
+  for (uint8_t dlc = 9; dlc < 15; dlc++) {
+    if (dlcToLength(dlc) >= length) {
+      return dlc;
+    }
+  }
+
+  return 15;
+}
+
+int CANControllerClass::dlcToLength(uint8_t dlc)
+{
+  static const uint8_t FD_LENGTHS[] = { 12, 16, 20, 24, 32, 48, 64 };
+
+  if (dlc <= 8) {
+    return dlc;
+  }
+
+  return FD_LENGTHS[(dlc > 15 ? 15 : dlc) - 9];
+}
+
 size_t CANControllerClass::write(uint8_t byte)
 {
   return write(&byte, sizeof(byte));
@@ -143,8 +236,8 @@ size_t CANControllerClass::write(const uint8_t *buffer, size_t size)
     return 0;
   }
 
-  if (size > (sizeof(_txData) - _txLength)) {
-    size = sizeof(_txData) - _txLength;
+  if (size > (size_t)(_txCapacity - _txLength)) {
+    size = _txCapacity - _txLength;
   }
 
   memcpy(&_txData[_txLength], buffer, size);
@@ -185,6 +278,253 @@ void CANControllerClass::onReceive(void(*callback)(int))
   _onReceive = callback;
 }
 
+int CANControllerClass::setRxQueueSize(int size)
+{
+  if (size < 0 || size > CAN_RX_QUEUE_MAX_SIZE) {
+    return 0;
+  }
+
+  // round up to a power of two so indexes can be masked
+  int depth = 0;
+  if (size > 0) {
+    depth = 1;
+    while (depth < size) {
+      depth <<= 1;
+    }
+  }
+
+  CANFrame* queue = NULL;
+  if (depth > 0) {
+    queue = (CANFrame*)malloc(depth * sizeof(CANFrame));
+    if (queue == NULL) {
+      return 0;
+    }
+  }
+
+  noInterrupts();
+  CANFrame* oldQueue = _rxQueue;
+  _rxQueue = queue;
+  _rxQueueMask = depth ? (depth - 1) : 0;
+  _rxQueueHead = 0;
+  _rxQueueTail = 0;
+  interrupts();
+
+  if (oldQueue) {
+    free(oldQueue);
+  }
+
+  // re-evaluate interrupt wiring, the queue needs the ISR even without a callback
+  onReceive(_onReceive);
+
+  return 1;
+}
+
+int CANControllerClass::rxQueueSize()
+{
+  return _rxQueue ? (_rxQueueMask + 1) : 0;
+}
+
+int CANControllerClass::rxQueueCount()
+{
+  return (uint8_t)(_rxQueueHead - _rxQueueTail);
+}
+
+unsigned long CANControllerClass::rxQueueOverflows()
+{
+  return _rxQueueOverflows;
+}
+
+void CANControllerClass::resetRxQueueOverflows()
+{
+  _rxQueueOverflows = 0;
+}
+
+int CANControllerClass::setTxQueueSize(int /*size*/)
+{
+  return 0;
+}
+
+int CANControllerClass::txQueueSize()
+{
+  return 0;
+}
+
+int CANControllerClass::txQueueCount()
+{
+  return 0;
+}
+
+int CANControllerClass::txErrorCount()
+{
+  return -1;
+}
+
+int CANControllerClass::rxErrorCount()
+{
+  return -1;
+}
+
+int CANControllerClass::busState()
+{
+  int state = readBusState();
+
+  if (state == CAN_BUS_OFF) {
+    if (_lastBusState != CAN_BUS_OFF) {
+      _busOffCount++;
+    }
+
+    if (_autoRecovery) {
+      recover();
+    }
+  }
+
+  _lastBusState = state;
+
+  return state;
+}
+
+int CANControllerClass::readBusState()
+{
+  return CAN_BUS_STATE_UNKNOWN;
+}
+
+int CANControllerClass::recover()
+{
+  return 0;
+}
+
+void CANControllerClass::setAutoRecovery(bool enable)
+{
+  _autoRecovery = enable;
+}
+
+unsigned long CANControllerClass::busOffCount()
+{
+  return _busOffCount;
+}
+
+unsigned long CANControllerClass::arbitrationLostCount()
+{
+  return _arbitrationLost;
+}
+
+unsigned long CANControllerClass::busErrorCount()
+{
+  return _busErrors;
+}
+
+unsigned long CANControllerClass::rxOverrunCount()
+{
+  return _rxOverruns;
+}
+
+unsigned long CANControllerClass::txFailureCount()
+{
+  return _txFailures;
+}
+
+int CANControllerClass::busLoad()
+{
+  unsigned long elapsed = millis() - _busLoadStart;
+
+  if (elapsed >= CAN_BUS_LOAD_WINDOW && _bitRate > 0) {
+    // bits seen against what the bus could carry in the window, in percent
+    unsigned long onePercent = (unsigned long)(_bitRate / 1000) * elapsed / 100;
+    unsigned long load = onePercent ? _busBits / onePercent : 0;
+
+    _busLoad = load > 100 ? 100 : load;
+    _busBits = 0;
+    _busLoadStart = millis();
+  }
+
+  return _busLoad;
+}
+
+unsigned long CANControllerClass::frameBits(bool extended, int length)
+{
+  // header, CRC, ACK, EOF and interframe space, plus about 10% stuff bits;
+  // CAN FD data phases are counted at the nominal rate
+  unsigned long bits = (extended ? 67 : 47) + 8 * length;
+
+  return bits + bits / 10;
+}
+
+bool CANControllerClass::pushRxFrame(const CANFrame& frame)
+{
+  uint8_t head = _rxQueueHead;
+
+  if ((uint8_t)(head - _rxQueueTail) > _rxQueueMask) {
+    // queue full, drop the newest frame
+    _rxQueueOverflows++;
+    return false;
+  }
+
+  _rxQueue[head & _rxQueueMask] = frame;
+
+  // publish the slot only after it has been written
+  _rxQueueHead = head + 1;
+
+  return true;
+}
+
+bool CANControllerClass::popRxFrame()
+{
+  uint8_t tail = _rxQueueTail;
+
+  if (_rxQueue == NULL || tail == _rxQueueHead) {
+    _rxId = -1;
+    _rxExtended = false;
+    _rxRtr = false;
+    _rxFd = false;
+    _rxLength = 0;
+    return false;
+  }
+
+  loadRxFrame(_rxQueue[tail & _rxQueueMask]);
+
+  // release the slot back to the producer
+  _rxQueueTail = tail + 1;
+
+  return true;
+}
+
+bool CANControllerClass::receiveFrame(CANFrame& frame)
+{
+  uint8_t tail = _rxQueueTail;
+
+  if (_rxQueue == NULL || tail == _rxQueueHead) {
+    return false;
+  }
+
+  frame = _rxQueue[tail & _rxQueueMask];
+
+  _rxQueueTail = tail + 1;
+
+  return true;
+}
+
+int CANControllerClass::parseFrame(const CANFrame& frame)
+{
+  loadRxFrame(frame);
+
+  return _rxDlc;
+}
+
+void CANControllerClass::loadRxFrame(const CANFrame& frame)
+{
+  _rxId = frame.id;
+  _rxExtended = frame.extended;
+  _rxRtr = frame.rtr;
+  _rxFd = frame.fd;
+  _rxDlc = frame.dlc;
+  _rxLength = frame.length;
+  _rxIndex = 0;
+
+  memcpy(_rxData, frame.data, frame.length);
+
+  _busBits += frameBits(frame.extended, frame.length);
+}
+
 int CANControllerClass::filter(int /*id*/, int /*mask*/)
 {
   return 0;
@@ -195,6 +535,16 @@ int CANControllerClass::filterExtended(long /*id*/, long /*mask*/)
   return 0;
 }
 
+int CANControllerClass::filter(int /*id*/, int /*mask*/, long /*idExtended*/, long /*maskExtended*/)
+{
+  return 0;
+}
+
+int CANControllerClass::clearFilter()
+{
+  return 0;
+}
+
 int CANControllerClass::observe()
 {
   return 0;
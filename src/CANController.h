@@ -6,21 +6,69 @@
 
 #include <Arduino.h>
 
+// Maximum depth of the optional interrupt-fed receive queue (must be a power of two <= 128)
+#define CAN_RX_QUEUE_MAX_SIZE 128
+
+// Largest data field a frame buffer can hold. It sizes every frame buffer and receive
+// queue entry, so CAN FD frames over 8 bytes are opt-in: build the whole project (library
+// sources included) with -DCAN_MAX_DATA_LENGTH=64
+#ifndef CAN_MAX_DATA_LENGTH
+#define CAN_MAX_DATA_LENGTH 8
+#endif
+
+#if CAN_MAX_DATA_LENGTH != 8 && CAN_MAX_DATA_LENGTH != 64
+#error "CAN_MAX_DATA_LENGTH must be 8 or 64"
+#endif
+
+// Fault confinement state reported by busState()
+#define CAN_BUS_STATE_UNKNOWN  -1  // controller can't report it
+#define CAN_BUS_ERROR_ACTIVE   0
+#define CAN_BUS_ERROR_WARNING  1   // an error counter reached 96
+#define CAN_BUS_ERROR_PASSIVE  2   // an error counter reached 128
+#define CAN_BUS_OFF            3   // transmit error counter passed 255, node is off the bus
+
+// Averaging window of busLoad() (ms)
+#define CAN_BUS_LOAD_WINDOW    1000
+
+// A single received frame, as stored in the receive queue
+struct CANFrame {
+  long id;
+  bool extended;
+  bool rtr;
+  bool fd;          // CAN FD frame (FDF), dlc holds the data length in bytes
+  bool brs;         // CAN FD bit rate switch
+  uint8_t dlc;
+  uint8_t length;
+  uint8_t data[CAN_MAX_DATA_LENGTH];
+};
+
 class CANControllerClass : public Stream {
 
 public:
   virtual int begin(long baudRate);
+  // CAN FD: nominal (arbitration) and data phase bit rates, 0 if not supported
+  virtual int beginFD(long baudRate, long dataBaudRate);
   virtual void end();
 
+  // bytes a frame can carry in the current mode, 8 for classic CAN
+  virtual int maxDataLength();
+
   int beginPacket(int id, int dlc = -1, bool rtr = false);
   int beginExtendedPacket(long id, int dlc = -1, bool rtr = false);
   virtual int endPacket();
+  // bytes written to the packet being built
+  int packetTxLength();
 
   virtual int parsePacket();
   long packetId();
   bool packetExtended();
   bool packetRtr();
   int packetDlc();
+  bool packetFd();
+
+  // CAN FD lengths: 0-8, 12, 16, 20, 24, 32, 48, 64 bytes (DLC 0-15)
+  static uint8_t lengthToDlc(int length);
+  static int dlcToLength(uint8_t dlc);
 
   // from Print
   virtual size_t write(uint8_t byte);
@@ -34,10 +82,49 @@ public:
 
   virtual void onReceive(void(*callback)(int));
 
+  int setRxQueueSize(int size);
+  int rxQueueSize();
+  int rxQueueCount();
+  unsigned long rxQueueOverflows();
+  void resetRxQueueOverflows();
+  // hand frames to another task: receiveFrame() takes the oldest queued frame
+  // without touching the current packet, parseFrame() makes a frame the current
+  // packet and returns its DLC like parsePacket()
+  bool receiveFrame(CANFrame& frame);
+  int parseFrame(const CANFrame& frame);
+
+  virtual int setTxQueueSize(int size);
+  virtual int txQueueSize();
+  virtual int txQueueCount();
+
+  // error counters (TEC/REC), -1 if the controller can't report them
+  virtual int txErrorCount();
+  virtual int rxErrorCount();
+  // CAN_BUS_ERROR_ACTIVE .. CAN_BUS_OFF, leaves bus-off when auto recovery is on
+  int busState();
+  // restart after bus-off, 0 if not supported
+  virtual int recover();
+  void setAutoRecovery(bool enable);
+  unsigned long busOffCount();
+  unsigned long arbitrationLostCount();
+  unsigned long busErrorCount();
+  // frames lost inside the controller (hardware receive buffer overrun)
+  unsigned long rxOverrunCount();
+  // frames endPacket() accepted into a transmit queue or batch that were
+  // dropped later (aborted after a transmit error, or discarded by a restart)
+  unsigned long txFailureCount();
+  // estimated bus utilisation in percent, from the frames this node sent and received
+  int busLoad();
+  // bits a frame occupies on the bus, stuff bits estimated
+  static unsigned long frameBits(bool extended, int length);
+
   virtual int filter(int id) { return filter(id, 0x7ff); }
   virtual int filter(int id, int mask);
   virtual int filterExtended(long id) { return filterExtended(id, 0x1fffffff); }
   virtual int filterExtended(long id, long mask);
+  // accept standard frames matching id/mask and extended frames matching idExtended/maskExtended
+  virtual int filter(int id, int mask, long idExtended, long maskExtended);
+  virtual int clearFilter();
 
   virtual int observe();
   virtual int loopback();
@@ -48,6 +135,15 @@ protected:
   CANControllerClass();
   virtual ~CANControllerClass();
 
+protected:
+  // receive queue helpers, pushRxFrame() is called from interrupt context
+  bool pushRxFrame(const CANFrame& frame);
+  bool popRxFrame();
+  void loadRxFrame(const CANFrame& frame);
+
+  // controller specific part of busState()
+  virtual int readBusState();
+
 protected:
   void (*_onReceive)(int);
 
@@ -57,15 +153,39 @@ protected:
   bool _txRtr;
   int _txDlc;
   int _txLength;
-  uint8_t _txData[8];
+  int _txCapacity;
+  uint8_t _txData[CAN_MAX_DATA_LENGTH];
 
   long _rxId;
   bool _rxExtended;
   bool _rxRtr;
+  bool _rxFd;
   int _rxDlc;
   int _rxLength;
   int _rxIndex;
-  uint8_t _rxData[8];
+  uint8_t _rxData[CAN_MAX_DATA_LENGTH];
+
+  // single-producer (ISR) / single-consumer (parsePacket) frame ring
+  CANFrame* _rxQueue;
+  uint8_t _rxQueueMask;
+  volatile uint8_t _rxQueueHead;
+  volatile uint8_t _rxQueueTail;
+  volatile unsigned long _rxQueueOverflows;
+
+  // diagnostics, counted by the drivers where the hardware reports them
+  volatile unsigned long _arbitrationLost;
+  volatile unsigned long _busErrors;
+  volatile unsigned long _rxOverruns;
+  volatile unsigned long _txFailures;
+  unsigned long _busOffCount;
+  int _lastBusState;
+  bool _autoRecovery;
+
+  // bus load estimate
+  long _bitRate;
+  unsigned long _busBits;
+  unsigned long _busLoadStart;
+  int _busLoad;
 };
 
 #endif
@@ -5,71 +5,444 @@
 
 // ===== CANPubSubBase Implementation =====
 
-CANPubSubBase::CANPubSubBase(CANControllerClass& can) : _can(&can), _topicMappingCount(0) {
-  memset(&_extBuffer, 0, sizeof(_extBuffer));
+CANPubSubBase::CANPubSubBase(CANControllerClass& can, const CANPubSubTables& tables)
+  : _can(&can),
+    _topicMappings(tables.topicMappings),
+    _topicMappingCount(0),
+    _topicMappingCapacity(tables.topicNames),
+    _topicArena(tables.topicArena),
+    _topicArenaLength(0),
+    _topicArenaSize(tables.topicArenaSize),
+    _topicPriorityCount(0),
+    _topicCollisions(0),
+    _onTopicCollision(nullptr),
+    _downlink(false),
+    _framesSent(0),
+    _frameGapUs(CAN_PS_DEFAULT_FRAME_GAP_US),
+    _loadGapUs(0),
+    _lastFrameMicros(0),
+    _busState(CAN_BUS_STATE_UNKNOWN),
+    _busLoad(-1),
+    _lastBusCheck(0),
+    _extSlots(tables.extSlots),
+    _extSlotCount(tables.extSlotCount),
+    _extBufferSize(tables.extBufferSize),
+    _xferBuffer(nullptr),
+    _xferCapacity(0),
+    _onTransferReceived(nullptr),
+    _onTransferDone(nullptr) {
+  memset(_extSlots, 0, _extSlotCount * sizeof(ExtendedMessageBuffer));
+  for (uint8_t i = 0; i < _extSlotCount; i++) {
+    _extSlots[i].buffer = tables.extBuffers + i * _extBufferSize;
+  }
+  memset(_topicPriorities, 0, sizeof(_topicPriorities));
+  memset(&_xferTx, 0, sizeof(_xferTx));
+  memset(&_xferRx, 0, sizeof(_xferRx));
+#if CAN_PS_STATS
+  _statsTxSlot = 0;
+  _statsRxMicros = 0;
+  resetStats();
+#endif
 }
 
 uint16_t CANPubSubBase::hashTopic(const String& topic) {
+  return hashTopic(topic.c_str());
+}
+
+uint16_t CANPubSubBase::hashTopic(const char* topic) {
+  // Must match canPsTopicHash(): hash * 31 + c over the characters, 16-bit
   uint16_t hash = 0;
-  for (unsigned int i = 0; i < topic.length(); i++) {
-    hash = hash * 31 + topic.charAt(i);
+  while (*topic) {
+    hash = hash * 31 + *topic++;
   }
   return hash;
 }
 
-void CANPubSubBase::registerTopic(const String& topic) {
+bool CANPubSubBase::registerTopic(const String& topic) {
+  return registerTopic(topic.c_str());
+}
+
+bool CANPubSubBase::registerTopic(const char* topic) {
   uint16_t hash = hashTopic(topic);
   
   // Check if already registered in runtime mapping
-  for (uint8_t i = 0; i < _topicMappingCount; i++) {
-    if (_topicMappings[i].hash == hash) {
-      return; // Already registered
+  int index = findTopicMapping(hash);
+  if (index >= 0) {
+    const char* existing = _topicArena + _topicMappings[index].offset;
+    if (strcmp(existing, topic) != 0) {
+      reportTopicCollision(hash, String(existing), String(topic));
+      return false;
     }
+    return true; // Already registered
   }
   
-  // Add new mapping to runtime table
-  if (_topicMappingCount < MAX_SUBSCRIPTIONS) {
-    _topicMappings[_topicMappingCount].hash = hash;
-    _topicMappings[_topicMappingCount].name = topic;
-    _topicMappingCount++;
+  // Add new mapping: name appended to the arena, index kept sorted by hash
+  size_t size = strlen(topic) + 1;
+  if (_topicMappingCount >= _topicMappingCapacity || _topicArenaLength + size > _topicArenaSize) {
+    return true; // Table full, lookups fall back to the hex form
   }
+  
+  uint8_t pos = -(index + 1);
+  memmove(&_topicMappings[pos + 1], &_topicMappings[pos], (_topicMappingCount - pos) * sizeof(TopicMapping));
+  _topicMappings[pos].hash = hash;
+  _topicMappings[pos].offset = _topicArenaLength;
+  memcpy(_topicArena + _topicArenaLength, topic, size);
+  _topicArenaLength += size;
+  _topicMappingCount++;
+  return true;
 }
 
-String CANPubSubBase::getTopicName(uint16_t hash) {
-  for (uint8_t i = 0; i < _topicMappingCount; i++) {
-    if (_topicMappings[i].hash == hash) {
-      return _topicMappings[i].name;
+int CANPubSubBase::findTopicMapping(uint16_t hash) {
+  int low = 0;
+  int high = _topicMappingCount - 1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    uint16_t midHash = _topicMappings[mid].hash;
+    if (midHash == hash) {
+      return mid;
+    }
+    if (midHash < hash) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
     }
   }
-  return String("0x") + String(hash, HEX);
+  return -(low + 1);
+}
+
+void CANPubSubBase::clearTopicNames() {
+  _topicMappingCount = 0;
+  _topicArenaLength = 0;
+}
+
+void CANPubSubBase::onTopicCollision(TopicCollisionCallback callback) {
+  _onTopicCollision = callback;
+}
+
+uint16_t CANPubSubBase::getTopicCollisionCount() {
+  return _topicCollisions;
+}
+
+void CANPubSubBase::reportTopicCollision(uint16_t hash, const String& existingName, const String& newName) {
+  if (_topicCollisions < 0xFFFF) {
+    _topicCollisions++;
+  }
+  if (_onTopicCollision) {
+    _onTopicCollision(hash, existingName, newName);
+  }
+}
+
+const char* CANPubSubBase::findTopicName(uint16_t hash) {
+  int index = findTopicMapping(hash);
+  return index >= 0 ? _topicArena + _topicMappings[index].offset : nullptr;
+}
+
+const char* CANPubSubBase::getTopicName(uint16_t hash) {
+  const char* name = findTopicName(hash);
+  if (name) {
+    return name;
+  }
+  
+  // Same text as String(hash, HEX): lowercase, no leading zeros
+  static const char digits[] = "0123456789abcdef";
+  char* p = _topicHexName;
+  *p++ = '0';
+  *p++ = 'x';
+  bool started = false;
+  for (int shift = 12; shift >= 0; shift -= 4) {
+    uint8_t nibble = (hash >> shift) & 0x0F;
+    if (nibble || started || shift == 0) {
+      *p++ = digits[nibble];
+      started = true;
+    }
+  }
+  *p = '\0';
+  return _topicHexName;
+}
+
+bool CANPubSubBase::setTopicPriority(const String& topic, uint8_t priority) {
+  return setTopicPriority(hashTopic(topic), priority);
+}
+
+bool CANPubSubBase::setTopicPriority(uint16_t topicHash, uint8_t priority) {
+  if (priority > CAN_PS_PRIORITY_BULK) return false;
+  
+  for (uint8_t i = 0; i < _topicPriorityCount; i++) {
+    if (_topicPriorities[i].topicHash == topicHash) {
+      if (priority == CAN_PS_PRIORITY_NORMAL) {
+        // Back to the default - drop the override
+        _topicPriorities[i] = _topicPriorities[--_topicPriorityCount];
+      } else {
+        _topicPriorities[i].priority = priority;
+      }
+      return true;
+    }
+  }
+  
+  if (priority == CAN_PS_PRIORITY_NORMAL) return true;
+  if (_topicPriorityCount >= CAN_PS_MAX_TOPIC_PRIORITIES) return false;
+  
+  _topicPriorities[_topicPriorityCount].topicHash = topicHash;
+  _topicPriorities[_topicPriorityCount].priority = priority;
+  _topicPriorityCount++;
+  return true;
+}
+
+uint8_t CANPubSubBase::getTopicPriority(uint16_t topicHash) {
+  for (uint8_t i = 0; i < _topicPriorityCount; i++) {
+    if (_topicPriorities[i].topicHash == topicHash) {
+      return _topicPriorities[i].priority;
+    }
+  }
+  return CAN_PS_PRIORITY_NORMAL;
+}
+
+void CANPubSubBase::setFrameGap(unsigned long gapUs) {
+  _frameGapUs = gapUs;
+}
+
+unsigned long CANPubSubBase::getFrameGap() {
+  return _frameGapUs;
+}
+
+int CANPubSubBase::getBusState() {
+  return _busState;
+}
+
+int CANPubSubBase::getBusLoad() {
+  return _busLoad;
+}
+
+bool CANPubSubBase::serviceBus() {
+  if (millis() - _lastBusCheck < CAN_PS_BUS_CHECK_INTERVAL) return false;
+  _lastBusCheck = millis();
+  
+  // busState() also restarts a controller that went bus-off (auto recovery)
+  _busState = _can->busState();
+  _busLoad = _can->busLoad();
+  return true;
+}
+
+String CANPubSubBase::payloadToString(const uint8_t* data, size_t length) {
+  String result;
+  result.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    result += (char)data[i];
+  }
+  return result;
+}
+
+size_t CANPubSubBase::readPayload(uint8_t* buffer, size_t maxLength) {
+  // Copy the rest of the current frame, no heap involved
+  size_t length = 0;
+  while (length < maxLength && _can->available()) {
+    buffer[length++] = _can->read();
+  }
+  return length;
 }
 
-bool CANPubSubBase::sendExtendedMessage(uint8_t msgType, const uint8_t* data, size_t length) {
+bool CANPubSubBase::beginFrame(uint8_t msgType, uint8_t priority) {
+  waitForFrameSlot();
+#if CAN_PS_STATS
+  _statsTxSlot = statsSlot(msgType);
+#endif
+  int id = ((priority & CAN_PS_PRIORITY_MASK) << CAN_PS_PRIORITY_SHIFT) | msgType;
+  return _can->beginPacket(_downlink ? (id | CAN_PS_DOWNLINK_FLAG) : id) == 1;
+}
+
+bool CANPubSubBase::beginExtendedFrame(long extId, uint8_t priority) {
+  waitForFrameSlot();
+#if CAN_PS_STATS
+  _statsTxSlot = statsSlot((extId >> CAN_PS_EXT_TYPE_SHIFT) & 0xFF);
+#endif
+  extId |= (long)(priority & CAN_PS_PRIORITY_MASK) << CAN_PS_EXT_PRIORITY_SHIFT;
+  return _can->beginExtendedPacket(_downlink ? (extId | CAN_PS_EXT_DOWNLINK_FLAG) : extId) == 1;
+}
+
+uint8_t CANPubSubBase::packetPriority() {
+  long id = _can->packetId();
+  int shift = _can->packetExtended() ? CAN_PS_EXT_PRIORITY_SHIFT : CAN_PS_PRIORITY_SHIFT;
+  return (id >> shift) & CAN_PS_PRIORITY_MASK;
+}
+
+bool CANPubSubBase::packetDownlink() {
+  long flag = _can->packetExtended() ? CAN_PS_EXT_DOWNLINK_FLAG : CAN_PS_DOWNLINK_FLAG;
+  return (_can->packetId() & flag) != 0;
+}
+
+int CANPubSubBase::endFrame() {
+#if CAN_PS_STATS
+  int length = _can->packetTxLength();
+#endif
+  int result = _can->endPacket();
+  _lastFrameMicros = micros();
+  if (result == 1) {
+    _framesSent++;
+  }
+#if CAN_PS_STATS
+  if (result == 1) {
+    _stats.txFrames[_statsTxSlot]++;
+    _stats.txBytes += length;
+  } else {
+    _stats.txAborts++;
+  }
+#endif
+  return result;
+}
+
+size_t CANPubSubBase::frameCapacity() {
+  // Every node on a CAN FD bus must be FD capable, so the local controller's
+  // mode decides for the whole bus
+  int capacity = _can->maxDataLength();
+  return capacity > CAN_FRAME_DATA_SIZE ? capacity : CAN_FRAME_DATA_SIZE;
+}
+
+void CANPubSubBase::waitForFrameSlot() {
+  // Pacing is bounded by endPacket() (blocking, or TX queue back-pressure) and an
+  // optional minimum gap, so receivers without an RX queue can read a burst from
+  // two buffers. The gap is waited out here, so it is off unless configured
+  unsigned long gap = _frameGapUs > _loadGapUs ? _frameGapUs : _loadGapUs;
+  if (gap == 0) return;
+  
+  while ((micros() - _lastFrameMicros) < gap) {
+    yield();
+  }
+}
+
+#if CAN_PS_STATS
+// ===== Statistics =====
+//
+// Plain counters updated inline on the frame paths; only compiled with
+// CAN_PS_STATS=1, so a default build carries none of this code.
+
+uint8_t CANPubSubBase::statsSlot(uint8_t msgType) {
+  if (msgType <= CAN_PS_TOPIC_NAME) return msgType;
+  if (msgType == CAN_PS_ID_RESPONSE) return CAN_PS_TOPIC_NAME + 1;
+  if (msgType == CAN_PS_ID_REQUEST) return CAN_PS_TOPIC_NAME + 2;
+  return 0;
+}
+
+void CANPubSubBase::getStats(CANPubSubStats& stats) {
+  statsRollWindow();
+  stats = _stats;
+  stats.rxOverruns = _can->rxQueueOverflows() + _can->rxOverrunCount() - _statsOverrunBase;
+  stats.txAborts += _can->txFailureCount() - _statsTxFailureBase;
+  if (stats.loops == 0) {
+    stats.loopMinUs = 0;
+  }
+}
+
+void CANPubSubBase::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+  _stats.loopMinUs = 0xFFFFFFFFUL;
+  _statsOverrunBase = _can->rxQueueOverflows() + _can->rxOverrunCount();
+  _statsTxFailureBase = _can->txFailureCount();
+  _statsWindowStart = millis();
+}
+
+void CANPubSubBase::statsRxFrame() {
+  _statsRxMicros = micros();
+  long id = _can->packetId();
+  uint8_t msgType = _can->packetExtended() ? (id >> CAN_PS_EXT_TYPE_SHIFT) & 0xFF : id & 0xFF;
+  _stats.rxFrames[statsSlot(msgType)]++;
+  _stats.rxBytes += _can->available();
+}
+
+void CANPubSubBase::statsLoop(unsigned long startMicros) {
+  uint32_t elapsed = micros() - startMicros;
+  _stats.loops++;
+  if (elapsed < _stats.loopMinUs) _stats.loopMinUs = elapsed;
+  if (elapsed > _stats.loopMaxUs) _stats.loopMaxUs = elapsed;
+}
+
+void CANPubSubBase::statsPublish(uint16_t topicHash) {
+  for (uint8_t i = 0; i < _stats.topicCount; i++) {
+    if (_stats.topics[i].topicHash == topicHash) {
+      _stats.topics[i].publishes++;
+      if (_stats.topics[i].windowCount < 0xFFFF) _stats.topics[i].windowCount++;
+      return;
+    }
+  }
+  if (_stats.topicCount < CAN_PS_STATS_TOPICS) {
+    TopicStats& topic = _stats.topics[_stats.topicCount++];
+    topic.topicHash = topicHash;
+    topic.publishes = 1;
+    topic.windowCount = 1;
+    topic.rate = 0;
+  } else {
+    _stats.untrackedPublishes++;
+  }
+}
+
+void CANPubSubBase::statsFanout() {
+  // Time from reading the publish to the last subscriber frame leaving endPacket()
+  uint32_t elapsed = micros() - _statsRxMicros;
+  uint32_t scaled = elapsed >> 7;
+  uint8_t bucket = 0;
+  while (scaled && bucket < CAN_PS_STATS_LATENCY_BUCKETS - 1) {
+    scaled >>= 1;
+    bucket++;
+  }
+  _stats.fanoutLatency[bucket]++;
+  if (elapsed > _stats.fanoutMaxUs) _stats.fanoutMaxUs = elapsed;
+}
+
+void CANPubSubBase::statsRollWindow() {
+  unsigned long elapsed = millis() - _statsWindowStart;
+  if (elapsed < CAN_PS_STATS_RATE_WINDOW) return;
+  
+  // Topics quiet for more than one window drop to 0
+  for (uint8_t i = 0; i < _stats.topicCount; i++) {
+    _stats.topics[i].rate = elapsed < 2 * CAN_PS_STATS_RATE_WINDOW
+      ? (uint32_t)_stats.topics[i].windowCount * 1000 / elapsed : 0;
+    _stats.topics[i].windowCount = 0;
+  }
+  _statsWindowStart = millis();
+}
+#endif
+
+bool CANPubSubBase::sendExtendedMessage(uint8_t msgType, const uint8_t* data, size_t length, uint8_t priority) {
   if (length <= CAN_FRAME_DATA_SIZE) {
     // Single frame - use standard packet
-    _can->beginPacket(msgType);
+    beginFrame(msgType, priority);
     _can->write(data, length);
-    return _can->endPacket() == 1;
+    return endFrame() == 1;
+  }
+  
+  // Multi-frame message using extended CAN IDs, frames as large as the
+  // controller allows (8 bytes classic, up to 64 with CAN FD)
+  // Extended ID format: [2-bit priority][8-bit msgType][downlink flag][8-bit sender][5-bit frameSeq][5-bit totalFrames]
+  size_t chunkSize = frameCapacity();
+  // A CAN FD frame is padded to the next DLC step, so FD messages carry their length
+  size_t header = chunkSize > CAN_FRAME_DATA_SIZE ? CAN_PS_EXT_FD_HEADER : 0;
+  uint8_t totalFrames = (header + length + chunkSize - 1) / chunkSize;
+  if (totalFrames > CAN_PS_EXT_MAX_FRAMES) {
+    return false;
   }
   
-  // Multi-frame message using extended CAN IDs
-  // Extended ID format: [8-bit msgType][8-bit frameSeq][13-bit reserved/totalFrames]
-  uint8_t totalFrames = (length + CAN_FRAME_DATA_SIZE - 1) / CAN_FRAME_DATA_SIZE;
+  long senderField = (long)localNodeId() << CAN_PS_EXT_SENDER_SHIFT;
+  size_t offset = 0;
   
   for (uint8_t frame = 0; frame < totalFrames; frame++) {
-    uint8_t frameSize = min((size_t)CAN_FRAME_DATA_SIZE, length - (frame * CAN_FRAME_DATA_SIZE));
+    size_t room = chunkSize;
     
-    // Build extended ID: [msgType][frameSeq][totalFrames]
-    long extId = ((long)msgType << 21) | ((long)frame << 13) | totalFrames;
+    // Build extended ID: [msgType][sender][frameSeq][totalFrames]
+    long extId = ((long)msgType << CAN_PS_EXT_TYPE_SHIFT) | senderField |
+                 ((long)frame << CAN_PS_EXT_SEQ_SHIFT) | totalFrames;
     
-    _can->beginExtendedPacket(extId);
-    _can->write(data + (frame * CAN_FRAME_DATA_SIZE), frameSize);
+    beginExtendedFrame(extId, priority);
+    if (frame == 0 && header > 0) {
+      _can->write(length >> 8);
+      _can->write(length & 0xFF);
+      room -= header;
+    }
+    size_t frameSize = min(room, length - offset);
+    _can->write(data + offset, frameSize);
+    offset += frameSize;
     
-    if (_can->endPacket() != 1) {
+    if (endFrame() != 1) {
       return false;
     }
-    
-    delay(5); // Small delay between frames to prevent bus congestion
   }
   
   return true;
@@ -82,2664 +455,5457 @@ void CANPubSubBase::processExtendedFrame(int packetSize) {
   
   long extId = _can->packetId();
   
-  // Decode extended ID: [msgType][frameSeq][totalFrames]
-  uint8_t msgType = (extId >> 21) & 0xFF;
-  uint8_t frameSeq = (extId >> 13) & 0xFF;
-  uint8_t totalFrames = extId & 0x1FFF;
-  
-  // Check for timeout on existing buffer
-  if (_extBuffer.active && (millis() - _extBuffer.lastFrameTime > EXTENDED_MSG_TIMEOUT)) {
-    // Timeout - discard incomplete message
-    memset(&_extBuffer, 0, sizeof(_extBuffer));
+  // Decode extended ID: [priority][msgType][downlink flag][sender][frameSeq][totalFrames]
+  uint8_t msgType = (extId >> CAN_PS_EXT_TYPE_SHIFT) & 0xFF;
+  uint8_t sourceId = (extId >> CAN_PS_EXT_SENDER_SHIFT) & 0xFF;
+  uint8_t frameSeq = (extId >> CAN_PS_EXT_SEQ_SHIFT) & CAN_PS_EXT_FIELD_MASK;
+  uint8_t totalFrames = extId & CAN_PS_EXT_FIELD_MASK;
+  unsigned long now = millis();
+  
+  // Discard incomplete messages whose sender went quiet
+  for (uint8_t i = 0; i < _extSlotCount; i++) {
+    if (_extSlots[i].active && (now - _extSlots[i].lastFrameTime > EXTENDED_MSG_TIMEOUT)) {
+      _extSlots[i].active = false;
+#if CAN_PS_STATS
+      _stats.reassemblyTimeouts++;
+#endif
+    }
   }
   
-  // First frame - initialize buffer
+  ExtendedMessageBuffer* slot = findExtendedSlot(sourceId, msgType);
+  
   if (frameSeq == 0) {
-    memset(&_extBuffer, 0, sizeof(_extBuffer));
-    _extBuffer.msgType = msgType;
-    _extBuffer.totalSize = totalFrames * CAN_FRAME_DATA_SIZE; // Approximate
-    _extBuffer.active = true;
+    // First frame - (re)start the message from this sender
+    if (!slot) {
+      slot = allocateExtendedSlot();
+    }
+    uint8_t* buffer = slot->buffer;
+    memset(slot, 0, sizeof(ExtendedMessageBuffer));
+    slot->buffer = buffer;
+    slot->msgType = msgType;
+    slot->sourceId = sourceId;
+    slot->totalFrames = totalFrames;
+    slot->active = true;
+    
+    if (frameCapacity() > CAN_FRAME_DATA_SIZE) {
+      // CAN FD: the true length leads, bytes past it are DLC padding
+      uint16_t length = 0;
+      if (_can->available() >= CAN_PS_EXT_FD_HEADER) {
+        length = _can->read() << 8;
+        length |= _can->read();
+      }
+      if (length == 0) {
+        slot->active = false;
+#if CAN_PS_STATS
+        _stats.reassemblyDrops++;
+#endif
+        return;
+      }
+      slot->totalSize = length - 1;  // The sender ID is not kept in the buffer
+    } else {
+      // Classic frames carry exact lengths, the last one ends the message
+      slot->totalSize = totalFrames * CAN_FRAME_DATA_SIZE - 1;
+    }
     
     // Read sender ID if available (first byte)
     if (_can->available() > 0) {
-      _extBuffer.senderId = _can->read();
-      packetSize--;
+      slot->senderId = _can->read();
     }
+  } else if (!slot) {
+#if CAN_PS_STATS
+    _stats.reassemblyOrphans++;
+#endif
+    return; // Frame doesn't match any message in progress
+  } else if (frameSeq != slot->nextFrame || totalFrames != slot->totalFrames) {
+    slot->active = false; // Lost or reordered frame - the message can't be rebuilt
+#if CAN_PS_STATS
+    _stats.reassemblyDrops++;
+#endif
+    return;
   }
   
-  // Verify this frame belongs to current message
-  if (!_extBuffer.active || _extBuffer.msgType != msgType) {
-    return; // Frame doesn't match current message
-  }
-  
-  // Read frame data
-  while (_can->available() && _extBuffer.receivedSize < MAX_EXTENDED_MSG_SIZE) {
-    _extBuffer.buffer[_extBuffer.receivedSize++] = _can->read();
+  // Read frame data, a message longer than the buffer is dropped rather than cut short
+  while (_can->available() && slot->receivedSize < slot->totalSize) {
+    if (slot->receivedSize >= _extBufferSize) {
+      slot->active = false;
+#if CAN_PS_STATS
+      _stats.reassemblyDrops++;
+#endif
+      return;
+    }
+    slot->buffer[slot->receivedSize++] = _can->read();
   }
   
-  _extBuffer.lastFrameTime = millis();
+  slot->nextFrame++;
+  slot->lastFrameTime = now;
   
   // Check if message is complete
   if (frameSeq == totalFrames - 1) {
-    // Message complete - notify subclass
-    onExtendedMessageComplete(_extBuffer.msgType, _extBuffer.senderId, 
-                              _extBuffer.buffer, _extBuffer.receivedSize);
-    
-    // Reset buffer
-    memset(&_extBuffer, 0, sizeof(_extBuffer));
+    // Free the slot first; the data stays intact for the duration of the callback
+    slot->active = false;
+    onExtendedMessageComplete(slot->msgType, slot->senderId, slot->buffer, slot->receivedSize);
   }
 }
 
-// ===== CANPubSubBroker Implementation =====
-
-CANPubSubBroker::CANPubSubBroker(CANControllerClass& can) 
-  : CANPubSubBase(can),
-    _subTableSize(0),
-    _nextClientID(0x01),
-    _nextTempID(101),
-    _clientCount(0),
-    _mappingCount(0),
-    _storedSubCount(0),
-    _storedTopicCount(0),
-    _pingStateCount(0),
-    _pingInterval(5000),
-    _autoPingEnabled(false),
-    _maxMissedPings(2),
-    _lastPingTime(0),
-    _onClientConnect(nullptr),
-    _onClientDisconnect(nullptr),
-    _onPublish(nullptr),
-    _onDirectMessage(nullptr) {
-  memset(_subscriptions, 0, sizeof(_subscriptions));
-  memset(_connectedClients, 0, sizeof(_connectedClients));
-  memset(_clientMappings, 0, sizeof(_clientMappings));
-  memset(_storedSubscriptions, 0, sizeof(_storedSubscriptions));
-  memset(_storedTopicNames, 0, sizeof(_storedTopicNames));
-  memset(_pingStates, 0, sizeof(_pingStates));
+ExtendedMessageBuffer* CANPubSubBase::findExtendedSlot(uint8_t sourceId, uint8_t msgType) {
+  for (uint8_t i = 0; i < _extSlotCount; i++) {
+    if (_extSlots[i].active && _extSlots[i].sourceId == sourceId && _extSlots[i].msgType == msgType) {
+      return &_extSlots[i];
+    }
+  }
+  return nullptr;
 }
 
-bool CANPubSubBroker::begin() {
-  _subTableSize = 0;
-  _nextClientID = 0x01;
-  _nextTempID = 101;
-  _clientCount = 0;  // All clients start as offline after power cycle
-  _mappingCount = 0;
-  _storedSubCount = 0;
-  _storedTopicCount = 0;
-  _pingStateCount = 0;  // Clear ping states - will be reinitialized when clients connect
-  _topicMappingCount = 0;  // Clear runtime topic name mappings - will be repopulated from storage
-  
-  // Initialize storage and load saved mappings
-  initStorage();
-  loadMappingsFromStorage();
-  loadSubscriptionsFromStorage();
-  loadTopicNamesFromStorage();  // Load topic names from flash
-  loadPingConfigFromStorage();
-  
-  // Restore all stored subscriptions to active table
-  restoreAllSubscriptionsToActiveTable();
-  
-  // If auto-ping was enabled, initialize ping states for registered clients
-  // Note: This only sets up ping tracking, clients are NOT marked as online
-  // Clients will be marked online when they send their first message
-  if (_autoPingEnabled) {
-    for (uint8_t i = 0; i < _mappingCount; i++) {
-      if (_clientMappings[i].registered) {
-        initPingState(_clientMappings[i].clientId);
-      }
+ExtendedMessageBuffer* CANPubSubBase::allocateExtendedSlot() {
+  // Prefer a free slot, otherwise evict the least recently updated message
+  unsigned long now = millis();
+  ExtendedMessageBuffer* oldest = &_extSlots[0];
+  for (uint8_t i = 0; i < _extSlotCount; i++) {
+    if (!_extSlots[i].active) {
+      return &_extSlots[i];
+    }
+    if (now - _extSlots[i].lastFrameTime > now - oldest->lastFrameTime) {
+      oldest = &_extSlots[i];
     }
-    
-    // Immediately ping all registered clients after power-up to discover who's online
-    // Give a small delay for CAN bus to stabilize
-    delay(100);
-    pingAllClients();
-    _lastPingTime = millis();
   }
-  
-  return true;
+#if CAN_PS_STATS
+  _stats.reassemblyDrops++;
+#endif
+  return oldest;
 }
 
-void CANPubSubBroker::end() {
-  _subTableSize = 0;
-  _clientCount = 0;
+// ===== Segmented Transfer =====
+//
+// START/ACK/ABORT are standard frames whose first byte names the client end of
+// the transfer; DATA segments use extended IDs carrying the same node and the
+// low 10 bits of the segment number. The receiver rebuilds the 16-bit segment
+// number relative to its window and answers with block ACKs: the first missing
+// segment plus a bitmap of the 32 segments after it.
+
+void CANPubSubBase::setTransferBuffer(uint8_t* buffer, size_t capacity) {
+  _xferBuffer = buffer;
+  _xferCapacity = buffer ? capacity : 0;
 }
 
-void CANPubSubBroker::loop() {
-  int packetSize = _can->parsePacket();
-  if (packetSize > 0) {
-    handleMessage(packetSize);
+void CANPubSubBase::onTransferReceived(TransferReceivedCallback callback) {
+  _onTransferReceived = callback;
+}
+
+void CANPubSubBase::onTransferDone(TransferDoneCallback callback) {
+  _onTransferDone = callback;
+}
+
+bool CANPubSubBase::isTransferActive() {
+  return _xferTx.state != CAN_PS_XFER_IDLE;
+}
+
+void CANPubSubBase::abortTransfer() {
+  if (_xferTx.state != CAN_PS_XFER_IDLE) {
+    sendTransferAbort(_xferTx.peerId, CAN_PS_XFER_FROM_SENDER | CAN_PS_XFER_ERR_CANCEL);
+    finishTransmit(false);
   }
-  
-  // Auto-ping clients if enabled
-  if (_autoPingEnabled && (millis() - _lastPingTime >= _pingInterval)) {
-    pingAllClients();
-    checkClientTimeouts();
-    _lastPingTime = millis();
+  if (_xferRx.state == CAN_PS_XFER_RECEIVING) {
+    sendTransferAbort(_xferRx.peerId, CAN_PS_XFER_ERR_CANCEL);
+    _xferRx.state = CAN_PS_XFER_IDLE;
   }
 }
 
-void CANPubSubBroker::handleMessage(int packetSize) {
-  // Check for extended frames first
+bool CANPubSubBase::startTransfer(uint8_t peerId, const uint8_t* data, size_t length, uint8_t tag) {
+  if (_xferTx.state != CAN_PS_XFER_IDLE || !data || length == 0) return false;
+  if ((uint32_t)length > (uint32_t)CAN_PS_XFER_MAX_SEGMENTS * CAN_FRAME_DATA_SIZE) return false;
+  
+  memset(&_xferTx, 0, sizeof(_xferTx));
+  _xferTx.data = data;
+  _xferTx.length = length;
+  _xferTx.totalSegments = (length + CAN_FRAME_DATA_SIZE - 1) / CAN_FRAME_DATA_SIZE;
+  _xferTx.peerId = peerId;
+  _xferTx.tag = tag;
+  _xferTx.state = CAN_PS_XFER_OPENING;
+  _xferTx.lastProgress = millis();
+  
+  sendTransferStart();
+  return true;
+}
+
+bool CANPubSubBase::transferPeer(bool downlink, uint8_t node, uint8_t& peerId) {
+  if (_downlink) {
+    // Broker: every uplink transfer frame is ours, the node is the client
+    if (downlink) return false;
+    peerId = node;
+    return true;
+  }
+  
+  // Client: only the broker's frames addressed to us
+  if (!downlink || node != localNodeId()) return false;
+  peerId = CAN_PS_BROKER_ID;
+  return true;
+}
+
+bool CANPubSubBase::handleTransferFrame() {
+  long id = _can->packetId();
+  uint8_t peerId;
+  
   if (_can->packetExtended()) {
-    processExtendedFrame(packetSize);
-    return;
+    if (((id >> CAN_PS_EXT_TYPE_SHIFT) & 0xFF) != CAN_PS_XFER_DATA) return false;
+    
+    uint8_t node = (id >> CAN_PS_EXT_SENDER_SHIFT) & 0xFF;
+    if (transferPeer(id & CAN_PS_EXT_DOWNLINK_FLAG, node, peerId)) {
+      handleTransferData(peerId, id & CAN_PS_XFER_SEQ_MASK);
+    }
+    return true;
   }
   
-  uint8_t msgType = _can->packetId();
+  uint8_t msgType = id & 0xFF;
+  if (msgType != CAN_PS_XFER_START && msgType != CAN_PS_XFER_ACK && msgType != CAN_PS_XFER_ABORT) {
+    return false;
+  }
+  if (_can->available() < 1) return true;
+  
+  uint8_t node = _can->read();
+  if (!transferPeer(id & CAN_PS_DOWNLINK_FLAG, node, peerId)) return true;
   
   switch (msgType) {
-    case CAN_PS_SUBSCRIBE:
-      handleSubscribe();
-      break;
-    case CAN_PS_UNSUBSCRIBE:
-      handleUnsubscribe();
-      break;
-    case CAN_PS_PUBLISH:
-      handlePublish();
-      break;
-    case CAN_PS_DIRECT_MSG:
-      handleDirectMessage();
-      break;
-    case CAN_PS_PEER_MSG:
-      handlePeerMessage();
-      break;
-    case CAN_PS_PING:
-      handlePing();
+    case CAN_PS_XFER_START:
+      handleTransferStart(peerId);
       break;
-    case CAN_PS_PONG:
-      handlePong();
+    case CAN_PS_XFER_ACK:
+      handleTransferAck(peerId);
       break;
-    case CAN_PS_ID_REQUEST:
-      // Check if this is a request with serial number (has data)
-      if (_can->available() > 0) {
-        handleIdRequestWithSerial();
-      } else {
-        // Assign temporary ID for clients without serial numbers
-        // These IDs are not persistent and won't be saved to storage
-        assignClientID();
-      }
+    case CAN_PS_XFER_ABORT:
+      handleTransferAbort(peerId);
       break;
   }
+  return true;
 }
 
-void CANPubSubBroker::handleSubscribe() {
-  if (_can->available() < 3) return;
+void CANPubSubBase::handleTransferStart(uint8_t peerId) {
+  if (_can->available() < 5) return;
   
-  uint8_t clientId = _can->read();
-  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  uint8_t tag = _can->read();
+  uint32_t length = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    length = (length << 8) | _can->read();
+  }
   
-  // Track client activity (marks as online)
-  trackClientActivity(clientId);
+  unsigned long now = millis();
+  bool busy = _xferRx.state == CAN_PS_XFER_RECEIVING &&
+              (now - _xferRx.lastFrameTime <= CAN_PS_XFER_RX_TIMEOUT);
   
-  // Read topic name if available (for broker-side topic mapping)
-  String topicName = "";
-  if (_can->available() > 0) {
-    uint8_t topicLen = _can->read();
-    for (uint8_t i = 0; i < topicLen && _can->available(); i++) {
-      topicName += (char)_can->read();
-    }
+  if (busy && _xferRx.peerId == peerId && _xferRx.tag == tag &&
+      _xferRx.length == length && _xferRx.base == 0 && _xferRx.received == 0) {
+    sendTransferAck(); // Our first ACK was lost, the sender repeated START
+    return;
   }
-  
-  // Register topic name if provided
-  if (topicName.length() > 0) {
-    registerTopic(topicName);
-    // Also persist topic name to flash storage
-    storeTopicName(topicHash, topicName);
+  if (busy && _xferRx.peerId != peerId) {
+    sendTransferAbort(peerId, CAN_PS_XFER_ERR_BUSY);
+    return;
+  }
+  if (!_xferBuffer || length == 0 || length > _xferCapacity ||
+      length > (uint32_t)CAN_PS_XFER_MAX_SEGMENTS * CAN_FRAME_DATA_SIZE) {
+    sendTransferAbort(peerId, CAN_PS_XFER_ERR_SIZE);
+    return;
   }
   
-  addSubscription(clientId, topicHash);
+  memset(&_xferRx, 0, sizeof(_xferRx));
+  _xferRx.length = length;
+  _xferRx.totalSegments = (length + CAN_FRAME_DATA_SIZE - 1) / CAN_FRAME_DATA_SIZE;
+  _xferRx.peerId = peerId;
+  _xferRx.tag = tag;
+  _xferRx.state = CAN_PS_XFER_RECEIVING;
+  _xferRx.lastFrameTime = now;
+  
+  sendTransferAck();
 }
 
-void CANPubSubBroker::handleUnsubscribe() {
-  if (_can->available() < 3) return;
-  
-  uint8_t clientId = _can->read();
-  uint16_t topicHash = (_can->read() << 8) | _can->read();
+void CANPubSubBase::handleTransferData(uint8_t peerId, uint16_t wireSeq) {
+  if (_xferRx.state == CAN_PS_XFER_IDLE || _xferRx.peerId != peerId) return;
   
-  // Track client activity (marks as online)
-  trackClientActivity(clientId);
+  _xferRx.lastFrameTime = millis();
   
-  removeSubscription(clientId, topicHash);
-}
-
-void CANPubSubBroker::handlePublish() {
-  if (_can->available() < 3) return;
+  // Rebuild the segment number: anything outside the window is a repeat of
+  // an acknowledged segment, meaning our ACK was lost
+  uint16_t offset = (wireSeq - _xferRx.base) & CAN_PS_XFER_SEQ_MASK;
+  uint32_t seq = (uint32_t)_xferRx.base + offset;
+  uint32_t bit = 1UL << (offset & 31);
   
-  uint8_t publisherId = _can->read();
-  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  if (_xferRx.state == CAN_PS_XFER_COMPLETE || offset >= CAN_PS_XFER_WINDOW ||
+      seq >= _xferRx.totalSegments || (_xferRx.received & bit)) {
+    _xferRx.unacked++; // Answered by the delayed ACK
+    return;
+  }
   
-  // Track client activity (marks as online)
-  trackClientActivity(publisherId);
+  uint32_t pos = seq * CAN_FRAME_DATA_SIZE;
+  uint32_t length = min((uint32_t)CAN_FRAME_DATA_SIZE, _xferRx.length - pos);
+  for (uint32_t i = 0; i < length && _can->available(); i++) {
+    _xferBuffer[pos + i] = _can->read();
+  }
   
-  // Get topic name from stored mapping (learned from SUBSCRIBE)
-  String topicName = getTopicName(topicHash);
+  // Frames from one sender arrive in order, so a hole below this segment was lost
+  bool gap = offset > 0 && !(_xferRx.received & (bit >> 1));
   
-  // Read message (all remaining data)
-  String message = "";
-  while (_can->available()) {
-    message += (char)_can->read();
+  _xferRx.received |= bit;
+  while (_xferRx.received & 1) {
+    _xferRx.received >>= 1;
+    _xferRx.base++;
   }
+  _xferRx.unacked++;
   
-  // Call callback if registered
-  if (_onPublish) {
-    _onPublish(topicHash, topicName, message);
+  if (_xferRx.base >= _xferRx.totalSegments) {
+    _xferRx.state = CAN_PS_XFER_COMPLETE;
+    sendTransferAck();
+    if (_onTransferReceived) {
+      _onTransferReceived(_xferRx.peerId, _xferRx.tag, _xferBuffer, _xferRx.length);
+    }
+    return;
   }
   
-  // Forward to subscribers
-  forwardToSubscribers(topicHash, message);
+  if (gap || _xferRx.unacked >= (CAN_PS_XFER_WINDOW + 1) / 2) {
+    sendTransferAck();
+  }
 }
 
-void CANPubSubBroker::handleDirectMessage() {
-  if (_can->available() < 1) return;
+void CANPubSubBase::handleTransferAck(uint8_t peerId) {
+  if (_xferTx.state == CAN_PS_XFER_IDLE || _xferTx.peerId != peerId) return;
+  if (_can->available() < 6) return;
+  
+  uint16_t ackBase = (_can->read() << 8) | _can->read();
+  uint32_t bitmap = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    bitmap = (bitmap << 8) | _can->read();
+  }
   
-  uint8_t senderId = _can->read();
+  // Ignore ACKs from before our current base (stale or reordered)
+  uint16_t advance = ackBase - _xferTx.base;
+  if (advance > _xferTx.totalSegments - _xferTx.base) return;
   
-  // Track client activity (marks as online)
-  trackClientActivity(senderId);
+  if (_xferTx.state == CAN_PS_XFER_OPENING) {
+    _xferTx.state = CAN_PS_XFER_SENDING;
+  }
+  _xferTx.lastProgress = millis();
   
-  String message = "";
-  while (_can->available()) {
-    message += (char)_can->read();
+  if (advance > 0) {
+    _xferTx.retries = 0;
+    _xferTx.acked = advance < 32 ? _xferTx.acked >> advance : 0;
+    _xferTx.sent = advance < 32 ? _xferTx.sent >> advance : 0;
+    _xferTx.base = ackBase;
   }
   
-  // Call callback if registered
-  if (_onDirectMessage) {
-    _onDirectMessage(senderId, message);
+  if (_xferTx.base >= _xferTx.totalSegments) {
+    finishTransmit(true);
+    return;
   }
   
-  // Send acknowledgment
-  _can->beginPacket(CAN_PS_ACK);
-  _can->write(CAN_PS_BROKER_ID);
-  _can->write(senderId);
-  _can->print("ACK");
-  _can->endPacket();
+  // Selective retransmit: anything below the highest segment received is lost
+  _xferTx.acked |= bitmap << 1;
+  uint32_t below = _xferTx.acked;
+  below |= below >> 1;
+  below |= below >> 2;
+  below |= below >> 4;
+  below |= below >> 8;
+  below |= below >> 16;
+  _xferTx.sent &= ~((below >> 1) & ~_xferTx.acked);
 }
 
-void CANPubSubBroker::handlePing() {
-  if (_can->available() < 1) return;
-  
-  uint8_t clientId = _can->read();
-  
-  // Track client activity (marks as online)
-  trackClientActivity(clientId);
+void CANPubSubBase::handleTransferAbort(uint8_t peerId) {
+  uint8_t reason = _can->available() > 0 ? _can->read() : 0;
   
-  // Send pong response
-  _can->beginPacket(CAN_PS_PONG);
-  _can->write(CAN_PS_BROKER_ID);
-  _can->write(clientId);
-  _can->endPacket();
+  if (reason & CAN_PS_XFER_FROM_SENDER) {
+    if (_xferRx.state != CAN_PS_XFER_IDLE && _xferRx.peerId == peerId) {
+      _xferRx.state = CAN_PS_XFER_IDLE;
+    }
+  } else if (_xferTx.state != CAN_PS_XFER_IDLE && _xferTx.peerId == peerId) {
+    finishTransmit(false);
+  }
 }
 
-void CANPubSubBroker::handlePong() {
-  if (_can->available() < 2) return;
-  
-  uint8_t senderId = _can->read();  // Should be client ID
-  uint8_t targetId = _can->read();  // Should be broker ID (0x00)
-  
-  if (targetId != CAN_PS_BROKER_ID) return;
-  
-  // Track client activity (marks as online and updates ping state)
-  trackClientActivity(senderId);
+void CANPubSubBase::sendTransferControl(uint8_t msgType, uint8_t peerId, const uint8_t* data, uint8_t length) {
+  beginFrame(msgType);
+  _can->write(_downlink ? peerId : localNodeId());
+  _can->write(data, length);
+  endFrame();
 }
 
-void CANPubSubBroker::pingAllClients() {
-  // Ping all registered clients
-  for (uint8_t i = 0; i < _mappingCount; i++) {
-    if (_clientMappings[i].registered) {
-      uint8_t clientId = _clientMappings[i].clientId;
-      
-      _can->beginPacket(CAN_PS_PING);
-      _can->write(CAN_PS_BROKER_ID);
-      _can->write(clientId);
-      _can->endPacket();
-      
-      // Increment missed pings counter in ping state
-      int stateIdx = findPingState(clientId);
-      if (stateIdx >= 0) {
-        _pingStates[stateIdx].missedPings++;
-      }
-      
-      delay(5); // Small delay between pings
-    }
-  }
+void CANPubSubBase::sendTransferStart() {
+  uint8_t buffer[5];
+  buffer[0] = _xferTx.tag;
+  buffer[1] = _xferTx.length >> 24;
+  buffer[2] = _xferTx.length >> 16;
+  buffer[3] = _xferTx.length >> 8;
+  buffer[4] = _xferTx.length & 0xFF;
+  sendTransferControl(CAN_PS_XFER_START, _xferTx.peerId, buffer, 5);
 }
 
-void CANPubSubBroker::checkClientTimeouts() {
-  // Check for clients that haven't responded
-  for (uint8_t i = 0; i < _pingStateCount; i++) {
-    uint8_t clientId = _pingStates[i].clientId;
+void CANPubSubBase::sendTransferAck() {
+  uint32_t bitmap = _xferRx.received >> 1; // Bit i: segment base + 1 + i
+  uint8_t buffer[6];
+  buffer[0] = _xferRx.base >> 8;
+  buffer[1] = _xferRx.base & 0xFF;
+  buffer[2] = bitmap >> 24;
+  buffer[3] = bitmap >> 16;
+  buffer[4] = bitmap >> 8;
+  buffer[5] = bitmap & 0xFF;
+  sendTransferControl(CAN_PS_XFER_ACK, _xferRx.peerId, buffer, 6);
+  _xferRx.unacked = 0;
+}
+
+void CANPubSubBase::sendTransferAbort(uint8_t peerId, uint8_t reason) {
+  sendTransferControl(CAN_PS_XFER_ABORT, peerId, &reason, 1);
+}
+
+void CANPubSubBase::sendTransferWindow() {
+  uint8_t node = _downlink ? _xferTx.peerId : localNodeId();
+  
+  for (uint8_t i = 0; i < CAN_PS_XFER_WINDOW; i++) {
+    uint32_t seq = (uint32_t)_xferTx.base + i;
+    if (seq >= _xferTx.totalSegments) break;
     
-    if (_pingStates[i].missedPings >= _maxMissedPings) {
-      // Check if client is currently online
-      bool wasOnline = false;
-      for (uint8_t j = 0; j < _clientCount; j++) {
-        if (_connectedClients[j] == clientId) {
-          wasOnline = true;
-          break;
-        }
-      }
-      
-      // Only process if client was online (avoid duplicate disconnect callbacks)
-      if (wasOnline) {
-        // Remove from connected clients list (mark offline)
-        for (uint8_t j = 0; j < _clientCount; j++) {
-          if (_connectedClients[j] == clientId) {
-            // Shift remaining clients
-            for (uint8_t k = j; k < _clientCount - 1; k++) {
-              _connectedClients[k] = _connectedClients[k + 1];
-            }
-            _clientCount--;
-            break;
-          }
-        }
-        
-        // Call disconnect callback
-        if (_onClientDisconnect) {
-          _onClientDisconnect(clientId);
-        }
-      }
-      
-      // Note: Client remains registered (active=true) in mappings
-      // and will be marked online again when it reconnects
+    uint32_t bit = 1UL << i;
+    if ((_xferTx.acked | _xferTx.sent) & bit) continue;
+    
+    uint32_t pos = seq * CAN_FRAME_DATA_SIZE;
+    long extId = ((long)CAN_PS_XFER_DATA << CAN_PS_EXT_TYPE_SHIFT) |
+                 ((long)node << CAN_PS_EXT_SENDER_SHIFT) | (seq & CAN_PS_XFER_SEQ_MASK);
+    
+    // Bulk data never delays regular traffic in arbitration
+    beginExtendedFrame(extId, CAN_PS_PRIORITY_BULK);
+    _can->write(_xferTx.data + pos, min((uint32_t)CAN_FRAME_DATA_SIZE, _xferTx.length - pos));
+    if (endFrame() != 1) {
+      return; // Controller busy, the rest goes out on the next loop()
     }
+    _xferTx.sent |= bit;
   }
 }
 
-void CANPubSubBroker::handlePeerMessage() {
-  // Peer-to-peer message forwarding (only for clients with permanent IDs)
-  // Format: [senderId][targetId][message...]
-  if (_can->available() < 2) return;
-  
-  uint8_t senderId = _can->read();
-  uint8_t targetId = _can->read();
-  
-  // Track client activity (marks as online)
-  trackClientActivity(senderId);
-  
-  // Verify sender has a permanent ID (registered with serial number)
-  int senderIndex = findClientMappingById(senderId);
-  if (senderIndex < 0) {
-    // Sender doesn't have permanent ID, reject
-    return;
+void CANPubSubBase::finishTransmit(bool success) {
+  _xferTx.state = CAN_PS_XFER_IDLE;
+  if (_onTransferDone) {
+    _onTransferDone(_xferTx.peerId, _xferTx.tag, success);
   }
+}
+
+void CANPubSubBase::serviceTransfers() {
+  unsigned long now = millis();
   
-  // Verify target has a permanent ID
-  int targetIndex = findClientMappingById(targetId);
-  if (targetIndex < 0) {
-    // Target doesn't have permanent ID, reject
-    return;
+  if (_xferTx.state != CAN_PS_XFER_IDLE && (now - _xferTx.lastProgress > CAN_PS_XFER_ACK_TIMEOUT)) {
+    if (++_xferTx.retries > CAN_PS_XFER_MAX_RETRIES) {
+      sendTransferAbort(_xferTx.peerId, CAN_PS_XFER_FROM_SENDER | CAN_PS_XFER_ERR_CANCEL);
+      finishTransmit(false);
+    } else {
+      _xferTx.lastProgress = now;
+      if (_xferTx.state == CAN_PS_XFER_OPENING) {
+        sendTransferStart();
+      } else {
+        _xferTx.sent = 0; // Resend everything still unacknowledged
+      }
+    }
   }
   
-  // Read message
-  String message = "";
-  while (_can->available()) {
-    message += (char)_can->read();
+  if (_xferTx.state == CAN_PS_XFER_SENDING) {
+    sendTransferWindow();
   }
   
-  // Forward message to target client
-  // Calculate total message size: senderId + targetId + message
-  size_t totalSize = 1 + 1 + message.length();
-  
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long messages
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = senderId;
-    buffer[1] = targetId;
-    memcpy(buffer + 2, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 2)));
-    
-    sendExtendedMessage(CAN_PS_PEER_MSG, buffer, min(2 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_PEER_MSG);
-    _can->write(senderId);
-    _can->write(targetId);
-    _can->print(message);
-    _can->endPacket();
+  if (_xferRx.state != CAN_PS_XFER_IDLE) {
+    if (now - _xferRx.lastFrameTime > CAN_PS_XFER_RX_TIMEOUT) {
+      _xferRx.state = CAN_PS_XFER_IDLE;
+    } else if (_xferRx.unacked > 0 && (now - _xferRx.lastFrameTime >= CAN_PS_XFER_ACK_DELAY)) {
+      sendTransferAck(); // Tail of a burst, or repeats after a lost ACK
+    }
   }
 }
 
-void CANPubSubBroker::addSubscription(uint8_t clientId, uint16_t topicHash) {
-  // Find or create topic entry
-  for (uint8_t i = 0; i < _subTableSize; i++) {
-    if (_subscriptions[i].topicHash == topicHash) {
-      // Add client if not already subscribed
-      for (uint8_t j = 0; j < _subscriptions[i].subCount; j++) {
-        if (_subscriptions[i].subscribers[j] == clientId) return;
-      }
-      if (_subscriptions[i].subCount < MAX_SUBSCRIBERS_PER_TOPIC) {
-        _subscriptions[i].subscribers[_subscriptions[i].subCount++] = clientId;
-      }
-      // Store subscription persistently
-      storeClientSubscriptions(clientId);
-      return;
-    }
+// ===== CANPubSubBroker Implementation =====
+
+CANPubSubBrokerCore::CANPubSubBrokerCore(CANControllerClass& can, const CANPubSubTables& tables,
+                                         const CANPubSubBrokerTables& brokerTables)
+  : CANPubSubBase(can, tables),
+    _subscriptions(brokerTables.subscriptions),
+    _subTableSize(0),
+    _subTableCapacity(brokerTables.subscriptionCount),
+    _subscribersPerTopic(brokerTables.subscribersPerTopic),
+    _subIndex(brokerTables.subIndex),
+    _subIndexSize(brokerTables.subIndexSize),
+    _clientTopics(brokerTables.clientTopics),
+    _clientTopicCapacity(brokerTables.subscriberClients),
+    _topicsPerClient(brokerTables.topicsPerClient),
+    _nextClientID(0x01),
+    _nextTempID(101),
+    _multicastEnabled(true),
+    _wildcardCount(0),
+    _wildcardNodeCount(0),
+    _wildcardRoot(0),
+    _wildcardMatchCount(0),
+    _restoreCount(0),
+    _restoreCursor(0),
+    _batchedRestore(true),
+    _retainEnabled(false),
+    _pingInterval(5000),
+    _autoPingEnabled(false),
+    _maxMissedPings(2),
+    _lastPingTime(0),
+    _pingCursor(0),
+    _pingRoundActive(false),
+    _pingOutstanding(false),
+    _groupHeartbeat(false),
+    _passiveLiveness(false),
+    _heartbeatSeq(0),
+    _heartbeatSlotMs(CAN_PS_DEFAULT_HEARTBEAT_SLOT_MS),
+    _loadAdaptation(false),
+    _loadThreshold(CAN_PS_DEFAULT_LOAD_THRESHOLD),
+    _busCongested(false),
+    _clientMappings(brokerTables.clientMappings),
+    _mappingCount(0),
+    _mappingCapacity(brokerTables.clients),
+    _storedSubscriptions(brokerTables.storedSubscriptions),
+    _storedSubCount(0),
+    _pingStates(brokerTables.pingStates),
+    _pingStateCount(0),
+    _storedTopicNames(brokerTables.storedTopicNames),
+    _storedTopicCount(0),
+    _storedTopicCapacity(brokerTables.storedNames),
+    _storageDrops(0),
+    _storageBlob(brokerTables.storageBlob),
+    _storageBlobSize(brokerTables.storageBlobSize),
+    _storageDirty(0),
+    _persistPending(false),
+    _persistDirtySince(0),
+    _persistInterval(CAN_PS_DEFAULT_PERSIST_INTERVAL),
+    _onClientConnect(nullptr),
+    _onClientDisconnect(nullptr),
+    _onPublish(nullptr),
+    _onPublishBinary(nullptr),
+    _onDirectMessage(nullptr)
+#if CAN_PS_TASKS
+    , _taskMode(false),
+    _taskCore(CAN_PS_TASK_CORE),
+    _taskStop(false),
+    _rxTaskHandle(NULL),
+    _routeTaskHandle(NULL),
+    _persistTaskHandle(NULL),
+    _frameQueue(NULL),
+    _eventQueue(NULL),
+    _taskLock(NULL),
+    _taskExit(NULL),
+    _taskFrameDrops(0),
+    _taskEventDrops(0)
+#endif
+    {
+  // Each entry owns one row of the subscriber table, rows move with the entry's contents
+  for (uint8_t i = 0; i < _subTableCapacity; i++) {
+    _subscriptions[i].topicHash = 0;
+    _subscriptions[i].subscribers = brokerTables.subscribers + i * _subscribersPerTopic;
+    _subscriptions[i].subCount = 0;
   }
-  
-  // Create new topic entry
-  if (_subTableSize < MAX_SUBSCRIPTIONS) {
-    _subscriptions[_subTableSize].topicHash = topicHash;
-    _subscriptions[_subTableSize].subscribers[0] = clientId;
-    _subscriptions[_subTableSize].subCount = 1;
-    _subTableSize++;
-    // Store subscription persistently
-    storeClientSubscriptions(clientId);
+  for (uint8_t i = 0; i < _clientTopicCapacity; i++) {
+    _clientTopics[i].clientId = 0;
+    _clientTopics[i].topicCount = 0;
+    _clientTopics[i].topics = brokerTables.clientTopicRows + i * _topicsPerClient;
   }
-}
-
-void CANPubSubBroker::removeSubscription(uint8_t clientId, uint16_t topicHash) {
-  for (uint8_t i = 0; i < _subTableSize; i++) {
-    if (_subscriptions[i].topicHash == topicHash) {
-      for (uint8_t j = 0; j < _subscriptions[i].subCount; j++) {
-        if (_subscriptions[i].subscribers[j] == clientId) {
-          // Shift remaining subscribers
-          for (uint8_t k = j; k < _subscriptions[i].subCount - 1; k++) {
-            _subscriptions[i].subscribers[k] = _subscriptions[i].subscribers[k + 1];
-          }
-          _subscriptions[i].subCount--;
-          
-          // If no subscribers left, remove the topic entry
-          if (_subscriptions[i].subCount == 0) {
-            // Shift remaining topics
-            for (uint8_t k = i; k < _subTableSize - 1; k++) {
-              _subscriptions[k] = _subscriptions[k + 1];
-            }
-            _subTableSize--;
-          }
-          
-          // Update stored subscriptions
-          storeClientSubscriptions(clientId);
-          return;
-        }
-      }
-    }
+  for (uint16_t i = 0; i < CAN_PS_WILDCARD_CACHE_SIZE; i++) {
+    _wildcardMatches[i].subscribers = brokerTables.wildcardSubscribers + i * _subscribersPerTopic;
+  }
+  clearSubscriptionTable();
+  memset(_onlineClients, 0, sizeof(_onlineClients));
+  memset(_restorePending, 0, sizeof(_restorePending));
+  memset(_retained, 0, sizeof(_retained));
+  memset(_qosClients, 0, sizeof(_qosClients));
+  memset(_heardClients, 0, sizeof(_heardClients));
+  memset(_pingSkip, 0, sizeof(_pingSkip));
+  memset(_clientMappings, 0, _mappingCapacity * sizeof(ClientMapping));
+  for (uint8_t i = 0; i < _mappingCapacity; i++) {
+    _storedSubscriptions[i].clientId = 0;
+    _storedSubscriptions[i].topicCount = 0;
+    _storedSubscriptions[i].topics = brokerTables.storedTopicRows + i * _topicsPerClient;
   }
+  memset(_storedTopicNames, 0, _storedTopicCapacity * sizeof(StoredTopicName));
+  memset(_pingStates, 0, _mappingCapacity * sizeof(ClientPingState));
+  _downlink = true;
 }
 
-void CANPubSubBroker::removeAllSubscriptions(uint8_t clientId) {
-  // Iterate through all topics (backwards to handle removal safely)
-  for (int i = _subTableSize - 1; i >= 0; i--) {
-    for (uint8_t j = 0; j < _subscriptions[i].subCount; j++) {
-      if (_subscriptions[i].subscribers[j] == clientId) {
-        // Shift remaining subscribers
-        for (uint8_t k = j; k < _subscriptions[i].subCount - 1; k++) {
-          _subscriptions[i].subscribers[k] = _subscriptions[i].subscribers[k + 1];
-        }
-        _subscriptions[i].subCount--;
-        j--; // Check the same index again
+bool CANPubSubBrokerCore::begin() {
+#if CAN_PS_TASKS
+  stopTasks();
+#endif
+  clearSubscriptionTable();
+  _nextClientID = 0x01;
+  _nextTempID = 101;
+  memset(_onlineClients, 0, sizeof(_onlineClients));  // All clients start as offline after power cycle
+  memset(_restorePending, 0, sizeof(_restorePending));
+  _restoreCount = 0;
+  _mappingCount = 0;
+  _storedSubCount = 0;
+  _storedTopicCount = 0;
+  _storageDrops = 0;
+  _pingStateCount = 0;  // Clear ping states - will be reinitialized when clients connect
+  _pingOutstanding = false;
+  memset(_heardClients, 0, sizeof(_heardClients));
+  clearTopicNames();       // Clear runtime topic name mappings - will be repopulated from storage
+  clearAllRetained();      // Retained values are runtime state, publishers refill them
+  memset(_qosClients, 0, sizeof(_qosClients));  // Publishers resynchronise on their next sequence number
+  
+  // Initialize storage and load saved mappings
+  initStorage();
+  loadMappingsFromStorage();
+  loadSubscriptionsFromStorage();
+  loadTopicNamesFromStorage();  // Load topic names from flash
+  loadPingConfigFromStorage();
+  
+  // Restore all stored subscriptions to active table
+  restoreAllSubscriptionsToActiveTable();
+  
+  // If auto-ping was enabled, initialize ping states for registered clients
+  // Note: This only sets up ping tracking, clients are NOT marked as online
+  // Clients will be marked online when they send their first message
+  if (_autoPingEnabled) {
+    for (uint8_t i = 0; i < _mappingCount; i++) {
+      if (_clientMappings[i].registered) {
+        initPingState(_clientMappings[i].clientId);
       }
     }
     
-    // If no subscribers left after removing this client, remove the topic entry
-    if (_subscriptions[i].subCount == 0) {
-      // Shift remaining topics
-      for (uint8_t k = i; k < _subTableSize - 1; k++) {
-        _subscriptions[k] = _subscriptions[k + 1];
-      }
-      _subTableSize--;
-    }
+    // Immediately ping all registered clients after power-up to discover who's online
+    // The round is sent from loop(), so the bus has settled by the first ping
+    pingAllClients();
+    _lastPingTime = millis();
   }
-  // Update stored subscriptions
-  storeClientSubscriptions(clientId);
+  
+#if CAN_PS_TASKS
+  if (_taskMode && !startTasks()) {
+    return false;
+  }
+#endif
+  
+  return true;
 }
 
-void CANPubSubBroker::forwardToSubscribers(uint16_t topicHash, const String& message) {
-  for (uint8_t i = 0; i < _subTableSize; i++) {
-    if (_subscriptions[i].topicHash == topicHash) {
-      for (uint8_t j = 0; j < _subscriptions[i].subCount; j++) {
-        uint8_t subId = _subscriptions[i].subscribers[j];
-        
-        // Calculate total message size: subId + topicHash + message
-        size_t totalSize = 1 + 2 + message.length();
-        
-        if (totalSize > CAN_FRAME_DATA_SIZE) {
-          // Use extended message for long messages
-          uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-          buffer[0] = subId;
-          buffer[1] = topicHash >> 8;
-          buffer[2] = topicHash & 0xFF;
-          memcpy(buffer + 3, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 3)));
-          
-          sendExtendedMessage(CAN_PS_TOPIC_DATA, buffer, min(3 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-        } else {
-          _can->beginPacket(CAN_PS_TOPIC_DATA);
-          _can->write(subId);
-          _can->write(topicHash >> 8);
-          _can->write(topicHash & 0xFF);
-          _can->print(message);
-          _can->endPacket();
-        }
-        
-        delay(10); // Small delay between sends
-      }
-      return;
-    }
-  }
+void CANPubSubBrokerCore::end() {
+#if CAN_PS_TASKS
+  stopTasks();
+#endif
+  abortTransfer();
+  flush();
+  clearSubscriptionTable();
+  memset(_onlineClients, 0, sizeof(_onlineClients));
+  memset(_restorePending, 0, sizeof(_restorePending));
+  _restoreCount = 0;
+  _pingRoundActive = false;
+  _pingOutstanding = false;
 }
 
-void CANPubSubBroker::assignClientID() {
-  _can->beginPacket(CAN_PS_ID_RESPONSE);
-  _can->write(_nextTempID);
-  _can->endPacket();
+void CANPubSubBrokerCore::loop() {
+#if CAN_PS_TASKS
+  if (_routeTaskHandle) {
+    // The routing task handles the bus, only its callbacks run here
+    dispatchTaskEvents();
+    return;
+  }
+#endif
   
-  _nextTempID++;
-  if (_nextTempID == 0xFF) {
-    _nextTempID = 101; // Wrap around to 101 for temporary IDs
+#if CAN_PS_STATS
+  unsigned long loopStart = micros();
+#endif
+  
+  // Drain pending frames in bulk (RX queue or hardware buffers), bounded per call
+  for (uint8_t i = 0; i < CAN_PS_MAX_FRAMES_PER_LOOP; i++) {
+    int packetSize = _can->parsePacket();
+    if (packetSize <= 0) break;
+    handleMessage(packetSize);
   }
+  
+  service();
+  
+#if CAN_PS_STATS
+  statsRollWindow();
+  statsLoop(loopStart);
+#endif
 }
 
-void CANPubSubBroker::onClientConnect(ConnectionCallback callback) {
-  _onClientConnect = callback;
+void CANPubSubBrokerCore::service() {
+  serviceTransfers();
+  serviceQosAcks();
+  
+  if (serviceBus()) {
+    _busCongested = _loadAdaptation && _busLoad >= _loadThreshold;
+    _loadGapUs = _busCongested ? CAN_PS_LOADED_FRAME_GAP_US : 0;
+    
+    if (_busState == CAN_BUS_OFF) {
+      // Pongs could not reach us while off the bus, do not count them as missed
+      _pingOutstanding = false;
+    }
+  }
+  
+  // Subscription restores queued by ID requests (held while off the bus)
+  if (_restoreCount > 0 && _busState != CAN_BUS_OFF) {
+    serviceRestores();
+  }
+  
+  // Auto-ping clients if enabled (less often while the bus is congested, never while off the bus)
+  if (_autoPingEnabled && _busState != CAN_BUS_OFF) {
+    unsigned long interval = _busCongested ? _pingInterval * CAN_PS_LOADED_PING_FACTOR : _pingInterval;
+    if (!_pingRoundActive && (millis() - _lastPingTime >= interval)) {
+      pingAllClients();
+      _lastPingTime = millis();
+    }
+    
+    if (_pingRoundActive) {
+      servicePingRound();
+    }
+  }
+  
+  // Write coalesced subscription/topic name changes once the interval has passed
+  if (_persistPending && (millis() - _persistDirtySince >= _persistInterval)) {
+    flush();
+  }
 }
 
-void CANPubSubBroker::onClientDisconnect(ConnectionCallback callback) {
-  _onClientDisconnect = callback;
+void CANPubSubBrokerCore::handleMessage(int packetSize) {
+#if CAN_PS_STATS
+  statsRxFrame();
+#endif
+  
+  if (handleTransferFrame()) {
+    return;
+  }
+  
+  // Check for extended frames first
+  if (_can->packetExtended()) {
+    processExtendedFrame(packetSize);
+    return;
+  }
+  
+  uint8_t msgType = _can->packetId();
+  
+  switch (msgType) {
+    case CAN_PS_SUBSCRIBE:
+      handleSubscribe();
+      break;
+    case CAN_PS_UNSUBSCRIBE:
+      handleUnsubscribe();
+      break;
+    case CAN_PS_PUBLISH:
+      handlePublish();
+      break;
+    case CAN_PS_PUBLISH_BATCH:
+      handlePublishBatch();
+      break;
+    case CAN_PS_PUBLISH_QOS:
+      handlePublishQos();
+      break;
+    case CAN_PS_TOPIC_NAME_REQUEST:
+      handleTopicNameRequest();
+      break;
+    case CAN_PS_TOPIC_NAME:
+      handleTopicName();
+      break;
+    case CAN_PS_DIRECT_MSG:
+      handleDirectMessage();
+      break;
+    case CAN_PS_PEER_MSG:
+      handlePeerMessage();
+      break;
+    case CAN_PS_PING:
+      handlePing();
+      break;
+    case CAN_PS_PONG:
+      handlePong();
+      break;
+    case CAN_PS_ID_REQUEST:
+      // Check if this is a request with serial number (has data)
+      if (_can->available() > 0) {
+        handleIdRequestWithSerial();
+      } else {
+        // Assign temporary ID for clients without serial numbers
+        // These IDs are not persistent and won't be saved to storage
+        assignClientID();
+      }
+      break;
+  }
 }
 
-void CANPubSubBroker::onPublish(MessageCallback callback) {
-  _onPublish = callback;
+void CANPubSubBrokerCore::handleSubscribe() {
+  if (_can->available() < 3) return;
+  
+  uint8_t clientId = _can->read();
+  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  
+  // Track client activity (marks as online)
+  trackClientActivity(clientId);
+  
+  // Read topic name if available (for broker-side topic mapping)
+  String topicName = "";
+  if (_can->available() > 0) {
+    uint8_t topicLen = _can->read();
+    for (uint8_t i = 0; i < topicLen && _can->available(); i++) {
+      topicName += (char)_can->read();
+    }
+  }
+  
+  // Register topic name if provided
+  if (topicName.length() > 0 && registerTopic(topicName)) {
+    // Also persist topic name to flash storage
+    storeTopicName(topicHash, topicName);
+    completeWildcardMatch(topicHash, topicName.c_str());
+  }
+  
+  addSubscription(clientId, topicHash);
+  sendRetained(clientId, topicHash);
 }
 
-void CANPubSubBroker::onDirectMessage(DirectMessageCallback callback) {
-  _onDirectMessage = callback;
+void CANPubSubBrokerCore::handleUnsubscribe() {
+  if (_can->available() < 3) return;
+  
+  uint8_t clientId = _can->read();
+  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  
+  // Track client activity (marks as online)
+  trackClientActivity(clientId);
+  
+  removeSubscription(clientId, topicHash);
 }
 
-void CANPubSubBroker::setPingInterval(unsigned long intervalMs) {
-  _pingInterval = intervalMs;
-  savePingConfigToStorage();
+void CANPubSubBrokerCore::handlePublish() {
+  if (_can->available() < 3) return;
+  
+  uint8_t publisherId = _can->read();
+  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  
+  // Track client activity (marks as online)
+  trackClientActivity(publisherId);
+  
+  // Read message (all remaining data) straight from the frame
+  uint8_t payload[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(payload, sizeof(payload));
+  
+  dispatchPublish(publisherId, topicHash, payload, length);
 }
 
-unsigned long CANPubSubBroker::getPingInterval() {
-  return _pingInterval;
+void CANPubSubBrokerCore::handlePublishBatch() {
+  if (_can->available() < 1) return;
+  
+  uint8_t publisherId = _can->read();
+  
+  uint8_t records[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(records, sizeof(records));
+  
+  dispatchPublishBatch(publisherId, records, length);
 }
 
-void CANPubSubBroker::enableAutoPing(bool enable) {
-  _autoPingEnabled = enable;
-  if (enable) {
-    _lastPingTime = millis();
+void CANPubSubBrokerCore::dispatchPublishBatch(uint8_t publisherId, const uint8_t* records, size_t length) {
+  // Track client activity (marks as online)
+  trackClientActivity(publisherId);
+  
+  // Records: [topicHash_h][topicHash_l][length][data...], a truncated last record is dropped
+  size_t pos = 0;
+  while (pos + 3 <= length) {
+    uint16_t topicHash = (records[pos] << 8) | records[pos + 1];
+    size_t recordLength = records[pos + 2];
+    pos += 3;
+    if (pos + recordLength > length) break;
     
-    // Initialize ping state for all registered clients
-    for (uint8_t i = 0; i < _mappingCount; i++) {
-      if (_clientMappings[i].registered) {
-        initPingState(_clientMappings[i].clientId);
-      }
-    }
+    dispatchPublish(publisherId, topicHash, records + pos, recordLength);
+    pos += recordLength;
   }
-  savePingConfigToStorage();
-}
-
-bool CANPubSubBroker::isAutoPingEnabled() {
-  return _autoPingEnabled;
 }
 
-void CANPubSubBroker::setMaxMissedPings(uint8_t maxMissed) {
-  _maxMissedPings = maxMissed;
-  savePingConfigToStorage();
+void CANPubSubBrokerCore::handlePublishQos() {
+  if (_can->available() < 4) return;
+  
+  uint8_t publisherId = _can->read();
+  
+  uint8_t message[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(message, sizeof(message));
+  
+  dispatchPublishQos(publisherId, message, length);
 }
 
-uint8_t CANPubSubBroker::getMaxMissedPings() {
-  return _maxMissedPings;
+void CANPubSubBrokerCore::dispatchPublishQos(uint8_t publisherId, const uint8_t* message, size_t length) {
+  // Message: [seq][topicHash_h][topicHash_l][data...]
+  if (length < 3) return;
+  
+  // Track client activity (marks as online)
+  trackClientActivity(publisherId);
+  
+  uint8_t seq = message[0];
+  uint16_t topicHash = (message[1] << 8) | message[2];
+  QosClientState* state = findQosState(publisherId, true);
+  
+  if (acceptQosSequence(*state, seq)) {
+    dispatchPublish(publisherId, topicHash, message + 3, length - 3);
+  } else {
+#if CAN_PS_STATS
+    _stats.qosDuplicates++;
+#endif
+  }
+  
+  // Repeats are acknowledged again, the earlier ACK was probably lost
+  queueQosAck(*state, seq);
 }
 
-int CANPubSubBroker::findPingState(uint8_t clientId) {
-  for (uint8_t i = 0; i < _pingStateCount; i++) {
-    if (_pingStates[i].clientId == clientId) {
-      return i;
+QosClientState* CANPubSubBrokerCore::findQosState(uint8_t clientId, bool create) {
+  // Look up the publisher, remembering a free slot or else the one heard from least recently
+  QosClientState* victim = &_qosClients[0];
+  unsigned long now = millis();
+  
+  for (uint8_t i = 0; i < CAN_PS_QOS_CLIENTS; i++) {
+    QosClientState& state = _qosClients[i];
+    if (state.active && state.clientId == clientId) {
+      state.lastSeen = now;
+      return &state;
+    }
+    if (victim->active && (!state.active || now - state.lastSeen > now - victim->lastSeen)) {
+      victim = &state;
     }
   }
-  return -1;
+  
+  if (!create) return nullptr;
+  
+  // An ACK still pending in the replaced slot goes out first, its client is waiting for it
+  if (victim->active && victim->ackPending) {
+    sendQosAck(*victim);
+  }
+  memset(victim, 0, sizeof(QosClientState));
+  victim->clientId = clientId;
+  victim->lastSeen = now;
+  return victim;
 }
 
-void CANPubSubBroker::initPingState(uint8_t clientId) {
-  // Check if already exists
-  int index = findPingState(clientId);
-  
-  if (index >= 0) {
-    // Reset existing state
-    _pingStates[index].lastPongTime = millis();
-    _pingStates[index].missedPings = 0;
-  } else if (_pingStateCount < MAX_CLIENT_MAPPINGS) {
-    // Create new state
-    _pingStates[_pingStateCount].clientId = clientId;
-    _pingStates[_pingStateCount].lastPongTime = millis();
-    _pingStates[_pingStateCount].missedPings = 0;
-    _pingStateCount++;
+void CANPubSubBrokerCore::resetQosState(uint8_t clientId) {
+  QosClientState* state = findQosState(clientId, false);
+  if (state) {
+    state->active = false;
+    state->ackPending = false;
   }
 }
 
-void CANPubSubBroker::trackClientActivity(uint8_t clientId) {
-  // Add client to connected clients list if not already present
-  bool found = false;
-  for (uint8_t i = 0; i < _clientCount; i++) {
-    if (_connectedClients[i] == clientId) {
-      found = true;
-      break;
-    }
+bool CANPubSubBrokerCore::acceptQosSequence(QosClientState& state, uint8_t seq) {
+  if (!state.active) {
+    // First publish since the state was (re)created sets the reference point
+    state.active = true;
+    state.highest = seq;
+    state.window = 1;
+    return true;
   }
   
-  if (!found && _clientCount < 256) {
-    _connectedClients[_clientCount++] = clientId;
-    
-    // Call connect callback if this is a new connection
-    if (_onClientConnect) {
-      _onClientConnect(clientId);
-    }
+  int8_t ahead = (int8_t)(seq - state.highest);
+  if (ahead > 0) {
+    state.window = (ahead >= CAN_PS_QOS_DEDUP_WINDOW) ? 1 : (state.window << ahead) | 1;
+    state.highest = seq;
+    return true;
   }
   
-  // Update ping state if auto-ping is enabled
-  if (_autoPingEnabled) {
-    int index = findPingState(clientId);
-    if (index >= 0) {
-      _pingStates[index].lastPongTime = millis();
-      _pingStates[index].missedPings = 0;
-    }
-  }
+  // At or behind the highest: new only if inside the window and not yet seen
+  uint8_t behind = (uint8_t)(state.highest - seq);
+  if (behind >= CAN_PS_QOS_DEDUP_WINDOW) return false;
+  
+  uint32_t bit = 1UL << behind;
+  if (state.window & bit) return false;
+  state.window |= bit;
+  return true;
 }
 
-void CANPubSubBroker::sendToClient(uint8_t clientId, uint16_t topicHash, const String& message) {
-  // Calculate total message size: clientId + topicHash + message
-  size_t totalSize = 1 + 2 + message.length();
+void CANPubSubBrokerCore::queueQosAck(QosClientState& state, uint8_t seq) {
+  if (state.ackPending) {
+    uint8_t span = state.ackLast - state.ackFirst;
+    if ((uint8_t)(seq - state.ackFirst) <= span) {
+      return;  // Already covered by the pending range
+    }
+    if (seq == (uint8_t)(state.ackLast + 1)) {
+      state.ackLast = seq;
+    } else {
+      // Not contiguous - close the pending range and start a new one
+      sendQosAck(state);
+    }
+  }
   
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long messages
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = clientId;
-    buffer[1] = topicHash >> 8;
-    buffer[2] = topicHash & 0xFF;
-    memcpy(buffer + 3, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 3)));
-    
-    sendExtendedMessage(CAN_PS_TOPIC_DATA, buffer, min(3 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_TOPIC_DATA);
-    _can->write(clientId);
-    _can->write(topicHash >> 8);
-    _can->write(topicHash & 0xFF);
-    _can->print(message);
-    _can->endPacket();
+  if (!state.ackPending) {
+    state.ackFirst = seq;
+    state.ackLast = seq;
+    state.ackPending = true;
+    state.ackSince = millis();
   }
-}
-
-void CANPubSubBroker::sendDirectMessage(uint8_t clientId, const String& message) {
-  // Calculate total message size: brokerId + clientId + message
-  size_t totalSize = 1 + 1 + message.length();
   
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long messages
-    // Format: [brokerID][clientID][message...]
-    // processExtendedFrame will extract brokerID as senderId from first byte
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = CAN_PS_BROKER_ID;
-    buffer[1] = clientId;
-    memcpy(buffer + 2, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 2)));
-    
-    sendExtendedMessage(CAN_PS_DIRECT_MSG, buffer, min(2 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_DIRECT_MSG);
-    _can->write(CAN_PS_BROKER_ID);
-    _can->write(clientId);
-    _can->print(message);
-    _can->endPacket();
+  if ((uint8_t)(state.ackLast - state.ackFirst) + 1 >= CAN_PS_QOS_ACK_BATCH) {
+    sendQosAck(state);
   }
 }
 
-void CANPubSubBroker::broadcastMessage(uint16_t topicHash, const String& message) {
-  forwardToSubscribers(topicHash, message);
+void CANPubSubBrokerCore::sendQosAck(QosClientState& state) {
+  beginFrame(CAN_PS_PUBLISH_ACK);
+  _can->write(CAN_PS_BROKER_ID);
+  _can->write(state.clientId);
+  _can->write(state.ackFirst);
+  _can->write(state.ackLast);
+  endFrame();
+  state.ackPending = false;
 }
 
-uint8_t CANPubSubBroker::getClientCount() {
-  return _clientCount;
+void CANPubSubBrokerCore::serviceQosAcks() {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < CAN_PS_QOS_CLIENTS; i++) {
+    QosClientState& state = _qosClients[i];
+    if (state.ackPending && (now - state.ackSince >= CAN_PS_QOS_ACK_DELAY)) {
+      sendQosAck(state);
+    }
+  }
 }
 
-uint8_t CANPubSubBroker::getSubscriptionCount() {
-  return _subTableSize;
+uint8_t CANPubSubBrokerCore::getQosClientCount() {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < CAN_PS_QOS_CLIENTS; i++) {
+    if (_qosClients[i].active) count++;
+  }
+  return count;
 }
 
-void CANPubSubBroker::getSubscribers(uint16_t topicHash, uint8_t* subscribers, uint8_t* count) {
-  for (uint8_t i = 0; i < _subTableSize; i++) {
-    if (_subscriptions[i].topicHash == topicHash) {
-      *count = _subscriptions[i].subCount;
-      memcpy(subscribers, _subscriptions[i].subscribers, _subscriptions[i].subCount);
-      return;
-    }
+void CANPubSubBrokerCore::dispatchPublish(uint8_t publisherId, uint16_t topicHash, const uint8_t* data, size_t length) {
+  notifyPublish(topicHash, data, length);
+  
+  // Forward to subscribers in the publisher's priority class
+#if CAN_PS_STATS
+  statsPublish(topicHash);
+  uint32_t framesBefore = _framesSent;
+#endif
+  forwardToSubscribers(topicHash, data, length, packetPriority(), publisherId);
+#if CAN_PS_STATS
+  if (_framesSent != framesBefore) {
+    statsFanout();
   }
-  *count = 0;
+#endif
 }
 
-void CANPubSubBroker::listSubscribedTopics(std::function<void(uint16_t hash, const String& name, uint8_t subscriberCount)> callback) {
-  if (!callback) return;
+void CANPubSubBrokerCore::handleDirectMessage() {
+  if (_can->available() < 1) return;
   
-  // Show active subscriptions (includes restored subscriptions from storage)
-  for (uint8_t i = 0; i < _subTableSize; i++) {
-    uint16_t hash = _subscriptions[i].topicHash;
-    String name = getTopicName(hash);
-    uint8_t count = _subscriptions[i].subCount;
-    callback(hash, name, count);
-  }
+  uint8_t senderId = _can->read();
   
-  // Also show stored topics that don't have active subscribers (after power cycle)
-  // This helps show what topics are in storage even if clients haven't reconnected
-  for (uint8_t i = 0; i < _storedTopicCount; i++) {
-    if (!_storedTopicNames[i].active) continue;
-    
-    uint16_t hash = _storedTopicNames[i].hash;
-    
-    // Check if this topic is already in the active subscriptions
-    bool alreadyListed = false;
-    for (uint8_t j = 0; j < _subTableSize; j++) {
-      if (_subscriptions[j].topicHash == hash) {
-        alreadyListed = true;
-        break;
-      }
-    }
-    
-    // If not already listed, show it with 0 subscribers
-    if (!alreadyListed) {
-      String name = _storedTopicNames[i].getName();
-      callback(hash, name, 0);
-    }
-  }
-}
-
-// ===== Client ID Mapping Methods =====
-
-void CANPubSubBroker::handleIdRequestWithSerial() {
-  // Read serial number from CAN message
-  String serialNumber = "";
-  while (_can->available()) {
-    serialNumber += (char)_can->read();
-  }
+  // Track client activity (marks as online)
+  trackClientActivity(senderId);
   
-  if (serialNumber.length() == 0) {
-    // No serial number provided - assign temporary ID (not saved to storage)
-    assignClientID();
-    return;
+  String message = "";
+  while (_can->available()) {
+    message += (char)_can->read();
   }
   
-  // Find or create client ID for this serial number (will be saved to storage)
-  uint8_t assignedId = findOrCreateClientId(serialNumber);
+  notifyDirectMessage(senderId, message);
   
-  // Check if this is a returning client (has stored subscriptions)
-  int subIndex = findStoredSubscription(assignedId);
-  bool hasStoredSubs = (subIndex >= 0 && _storedSubscriptions[subIndex].topicCount > 0);
+  // Send acknowledgment
+  beginFrame(CAN_PS_ACK);
+  _can->write(CAN_PS_BROKER_ID);
+  _can->write(senderId);
+  _can->print("ACK");
+  endFrame();
+}
+
+void CANPubSubBrokerCore::handlePing() {
+  if (_can->available() < 1) return;
   
-  // Send response with serial number included so client can verify it's for them
-  // Format: [assignedId][hasStoredSubs][serialNumberLength][serialNumber...]
-  size_t totalSize = 1 + 1 + 1 + serialNumber.length();
+  uint8_t clientId = _can->read();
   
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long serial numbers
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = assignedId;
-    buffer[1] = hasStoredSubs ? 0x01 : 0x00;
-    buffer[2] = (uint8_t)serialNumber.length();
-    memcpy(buffer + 3, serialNumber.c_str(), min(serialNumber.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 3)));
-    
-    sendExtendedMessage(CAN_PS_ID_RESPONSE, buffer, min(3 + serialNumber.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_ID_RESPONSE);
-    _can->write(assignedId);
-    _can->write(hasStoredSubs ? 0x01 : 0x00); // Flag: has stored subscriptions
-    _can->write((uint8_t)serialNumber.length());
-    _can->print(serialNumber);
-    _can->endPacket();
-  }
+  // Track client activity (marks as online)
+  trackClientActivity(clientId);
   
-  // Track connected client (marks as online)
-  trackClientActivity(assignedId);
+  // Send pong response
+  beginFrame(CAN_PS_PONG);
+  _can->write(CAN_PS_BROKER_ID);
+  _can->write(clientId);
+  endFrame();
+}
+
+void CANPubSubBrokerCore::handlePong() {
+  if (_can->available() < 2) return;
   
-  // Restore stored subscriptions for this client (if any)
-  if (hasStoredSubs) {
-    delay(100); // Delay to let client process ID response and prepare to receive subscriptions
-    restoreClientSubscriptions(assignedId);
+  uint8_t senderId = _can->read();  // Should be client ID
+  uint8_t targetId = _can->read();  // Should be broker ID (0x00)
+  
+  if (targetId != CAN_PS_BROKER_ID) return;
+  
+  // Track client activity (marks as online and updates ping state)
+  trackClientActivity(senderId);
+}
+
+void CANPubSubBrokerCore::pingAllClients() {
+  // Judge the previous round before starting a new one
+  evaluateLiveness();
+  
+  if (_groupHeartbeat) {
+    sendHeartbeat();
+    return;
   }
+  
+  // Start a ping round - pings are sent a few at a time from loop()
+  _pingCursor = 0;
+  _pingRoundActive = true;
 }
 
-uint8_t CANPubSubBroker::findOrCreateClientId(const String& serialNumber) {
-  // Check if this serial number already has an ID
-  int index = findClientMapping(serialNumber);
+void CANPubSubBrokerCore::servicePingRound() {
+  uint8_t sent = 0;
   
-  if (index >= 0) {
-    // Found existing mapping, mark as registered and return the same ID
-    _clientMappings[index].registered = true;
-    saveMappingsToStorage(); // Save state change
+  while (_pingCursor < _mappingCount && sent < CAN_PS_PINGS_PER_LOOP) {
+    uint8_t i = _pingCursor++;
+    if (!_clientMappings[i].registered) continue;
     
-    // Initialize ping tracking if auto-ping is enabled
-    if (_autoPingEnabled) {
-      initPingState(_clientMappings[index].clientId);
-    }
+    uint8_t clientId = _clientMappings[i].clientId;
     
-    return _clientMappings[index].clientId;
+    // Heard from during the last interval - its own traffic was the pong
+    if ((_pingSkip[clientId >> 5] >> (clientId & 31)) & 1) continue;
+    
+    beginFrame(CAN_PS_PING);
+    _can->write(CAN_PS_BROKER_ID);
+    _can->write(clientId);
+    endFrame();
+    sent++;
   }
   
-  // No existing mapping, create a new one
-  if (_mappingCount < MAX_CLIENT_MAPPINGS) {
-    _clientMappings[_mappingCount].clientId = _nextClientID;
-    _clientMappings[_mappingCount].setSerial(serialNumber);
-    _clientMappings[_mappingCount].registered = true;
-    _mappingCount++;
-    
-    uint8_t assignedId = _nextClientID;
+  if (_pingCursor >= _mappingCount) {
+    _pingRoundActive = false;
+  }
+}
+
+void CANPubSubBrokerCore::sendHeartbeat() {
+  // One frame for every client; each answers in its own slot to spread the pongs
+  beginFrame(CAN_PS_HEARTBEAT);
+  _can->write(CAN_PS_BROKER_ID);
+  _can->write(++_heartbeatSeq);
+  _can->write(_heartbeatSlotMs);
+  _can->write(_passiveLiveness ? CAN_PS_HEARTBEAT_PASSIVE : 0x00);
+  endFrame();
+}
+
+void CANPubSubBrokerCore::evaluateLiveness() {
+  // A client answered the previous round if any frame from it arrived since
+  // then (pong, or any traffic at all); otherwise it missed one more ping
+  unsigned long now = millis();
+  
+  for (uint8_t i = 0; i < _pingStateCount; i++) {
+    uint8_t clientId = _pingStates[i].clientId;
     
-    // Increment for next client
-    _nextClientID++;
-    if (_nextClientID == 0xFF) {
-      _nextClientID = 0x01; // Wrap around, skip special IDs
+    if ((_heardClients[clientId >> 5] >> (clientId & 31)) & 1) {
+      _pingStates[i].lastPongTime = now;
+      _pingStates[i].missedPings = 0;
+    } else if (_pingOutstanding && _pingStates[i].missedPings < 255) {
+      _pingStates[i].missedPings++;
     }
+  }
+  
+  if (_pingOutstanding) {
+    checkClientTimeouts();
+  }
+  
+  if (_passiveLiveness) {
+    memcpy(_pingSkip, _heardClients, sizeof(_pingSkip));
+  } else {
+    memset(_pingSkip, 0, sizeof(_pingSkip));
+  }
+  memset(_heardClients, 0, sizeof(_heardClients));
+  _pingOutstanding = true;
+}
+
+void CANPubSubBrokerCore::checkClientTimeouts() {
+  // Check for clients that haven't responded
+  for (uint8_t i = 0; i < _pingStateCount; i++) {
+    uint8_t clientId = _pingStates[i].clientId;
     
-    // Initialize ping tracking if auto-ping is enabled
-    if (_autoPingEnabled) {
-      initPingState(assignedId);
+    if (_pingStates[i].missedPings >= _maxMissedPings) {
+      // Mark offline, only process if client was online (avoid duplicate disconnect callbacks)
+      if (clearClientOnline(clientId)) {
+        notifyClientDisconnect(clientId);
+      }
+      
+      // Note: Client remains registered (active=true) in mappings
+      // and will be marked online again when it reconnects
     }
-    
-    saveMappingsToStorage(); // Save new mapping
-    return assignedId;
   }
+}
+
+void CANPubSubBrokerCore::handlePeerMessage() {
+  // Peer-to-peer message forwarding (only for clients with permanent IDs)
+  // Format: [senderId][targetId][message...]
+  if (_can->available() < 2) return;
   
-  // Mapping table full, return error (use 0xFF)
-  return CAN_PS_UNASSIGNED_ID;
+  uint8_t senderId = _can->read();
+  uint8_t targetId = _can->read();
+  
+  // Track client activity (marks as online)
+  trackClientActivity(senderId);
+  
+  // Verify sender has a permanent ID (registered with serial number)
+  int senderIndex = findClientMappingById(senderId);
+  if (senderIndex < 0) {
+    // Sender doesn't have permanent ID, reject
+    return;
+  }
+  
+  // Verify target has a permanent ID
+  int targetIndex = findClientMappingById(targetId);
+  if (targetIndex < 0) {
+    // Target doesn't have permanent ID, reject
+    return;
+  }
+  
+  // Read message
+  uint8_t payload[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(payload, sizeof(payload));
+  
+  forwardPeerMessage(senderId, targetId, payload, length);
 }
 
-int CANPubSubBroker::findClientMapping(const String& serialNumber) {
-  for (uint8_t i = 0; i < _mappingCount; i++) {
-    if (_clientMappings[i].getSerial() == serialNumber) {
-      return i;
+void CANPubSubBrokerCore::forwardPeerMessage(uint8_t senderId, uint8_t targetId, const uint8_t* data, size_t length) {
+  // Forward message to target client
+  // Calculate total message size: senderId + targetId + message
+  size_t totalSize = 1 + 1 + length;
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long messages
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    size_t copyLength = min(length, (size_t)(MAX_EXTENDED_MSG_SIZE - 2));
+    buffer[0] = senderId;
+    buffer[1] = targetId;
+    memcpy(buffer + 2, data, copyLength);
+    
+    sendExtendedMessage(CAN_PS_PEER_MSG, buffer, 2 + copyLength);
+  } else {
+    beginFrame(CAN_PS_PEER_MSG);
+    _can->write(senderId);
+    _can->write(targetId);
+    _can->write(data, length);
+    endFrame();
+  }
+}
+
+// ===== Wildcard Subscriptions =====
+//
+// A subscription whose name is a pattern ("sensors/+/temp", "alerts/#") sits in the
+// subscription table under the hash of the pattern, like any other topic, so storage,
+// restore and the reverse index need nothing extra. The patterns are also compiled into
+// a trie of levels; a concrete topic is matched against it by name the first time it is
+// published, and the merged subscriber set is cached under the topic's hash. A change to
+// a pattern or its subscribers marks only the cached topics that pattern matches, and a
+// publish whose name has to be asked for is held until the answer.
+
+// "+" and "#" count only as a whole level, "#" only as the last one
+static bool isWildcardPattern(const char* topic) {
+  bool wildcard = false;
+  const char* level = topic;
+  for (;;) {
+    const char* end = level;
+    while (*end && *end != '/') end++;
+    size_t length = end - level;
+    if (memchr(level, '+', length) || memchr(level, '#', length)) {
+      if (length != 1 || (*level == '#' && *end)) return false;
+      wildcard = true;
     }
+    if (!*end) return wildcard;
+    level = end + 1;
   }
-  return -1;
 }
 
-int CANPubSubBroker::findClientMappingById(uint8_t clientId) {
-  for (uint8_t i = 0; i < _mappingCount; i++) {
-    if (_clientMappings[i].clientId == clientId) {
+static inline uint16_t wildcardCacheHome(uint16_t topicHash) {
+  // Same scramble as the subscription index
+  uint16_t mixed = topicHash * 40503u;
+  return ((uint32_t)mixed * CAN_PS_WILDCARD_CACHE_SIZE) >> 16;
+}
+
+int CANPubSubBrokerCore::findWildcard(uint16_t patternHash) {
+  for (uint8_t i = 0; i < _wildcardCount; i++) {
+    if (_wildcards[i].hash == patternHash) {
       return i;
     }
   }
   return -1;
 }
 
-uint8_t CANPubSubBroker::registerClient(const String& serialNumber) {
-  return findOrCreateClientId(serialNumber);
+void CANPubSubBrokerCore::addWildcard(uint16_t patternHash, const char* pattern) {
+  // Names that do not hash back to the subscription (collisions, truncated) are left as plain topics
+  if (_wildcardCount >= CAN_PS_MAX_WILDCARDS || strlen(pattern) >= MAX_TOPIC_NAME_LENGTH) return;
+  if (hashTopic(pattern) != patternHash || findWildcard(patternHash) >= 0) return;
+  
+  WildcardPattern& wildcard = _wildcards[_wildcardCount++];
+  wildcard.hash = patternHash;
+  strcpy(wildcard.name, pattern);
+  
+  compileWildcards();
+  invalidateWildcardMatches(_wildcardCount - 1);
 }
 
-bool CANPubSubBroker::unregisterClient(uint8_t clientId) {
-  int index = findClientMappingById(clientId);
-  if (index >= 0) {
-    _clientMappings[index].registered = false;
-    // Remove all subscriptions for this client
-    removeAllSubscriptions(clientId);
-    saveMappingsToStorage(); // Save state change
-    return true;
-  }
-  return false;
+void CANPubSubBrokerCore::removeWildcard(uint8_t index) {
+  invalidateWildcardMatches(index);  // While the trie still holds the pattern
+  _wildcards[index] = _wildcards[--_wildcardCount];
+  compileWildcards();
 }
 
-bool CANPubSubBroker::unregisterClientBySerial(const String& serialNumber) {
-  int index = findClientMapping(serialNumber);
-  if (index >= 0) {
-    _clientMappings[index].registered = false;
-    // Remove all subscriptions for this client
-    removeAllSubscriptions(_clientMappings[index].clientId);
-    saveMappingsToStorage(); // Save state change
-    return true;
+void CANPubSubBrokerCore::compileWildcards() {
+  // Rebuilt from the pattern list on every change, there are only a handful
+  _wildcardNodeCount = 0;
+  _wildcardRoot = 0;
+  
+  for (uint8_t p = 0; p < _wildcardCount; p++) {
+    const char* name = _wildcards[p].name;
+    uint8_t* list = &_wildcardRoot;
+    uint8_t offset = 0;
+    
+    for (;;) {
+      uint8_t length = 0;
+      while (name[offset + length] && name[offset + length] != '/') length++;
+      
+      // Share the level with an earlier pattern, else add it to this level's list
+      uint8_t node = *list;
+      while (node) {
+        const WildcardNode& n = _wildcardNodes[node - 1];
+        if (n.length == length && memcmp(_wildcards[n.pattern].name + n.offset, name + offset, length) == 0) break;
+        node = n.sibling;
+      }
+      if (!node) {
+        if (_wildcardNodeCount >= CAN_PS_WILDCARD_NODES) break;  // Out of nodes, the pattern never matches
+        WildcardNode& n = _wildcardNodes[_wildcardNodeCount++];
+        n.pattern = p;
+        n.offset = offset;
+        n.length = length;
+        n.child = 0;
+        n.sibling = *list;
+        n.terminal = 0;
+        node = _wildcardNodeCount;
+        *list = node;
+      }
+      
+      if (!name[offset + length]) {
+        _wildcardNodes[node - 1].terminal = p + 1;
+        break;
+      }
+      list = &_wildcardNodes[node - 1].child;
+      offset += length + 1;
+    }
   }
-  return false;
 }
 
-uint8_t CANPubSubBroker::getClientIdBySerial(const String& serialNumber) {
-  int index = findClientMapping(serialNumber);
-  if (index >= 0) {
-    return _clientMappings[index].clientId;
+uint32_t CANPubSubBrokerCore::matchWildcards(uint8_t node, const char* level) {
+  // Patterns matching the topic from this level on, level is nullptr past the last one
+  const char* end = level;
+  if (level) {
+    while (*end && *end != '/') end++;
   }
-  return CAN_PS_UNASSIGNED_ID;
+  
+  uint32_t matched = 0;
+  for (; node; node = _wildcardNodes[node - 1].sibling) {
+    const WildcardNode& n = _wildcardNodes[node - 1];
+    const char* text = _wildcards[n.pattern].name + n.offset;
+    uint32_t terminal = n.terminal ? 1UL << (n.terminal - 1) : 0;
+    
+    if (n.length == 1 && *text == '#') {
+      // The remaining levels, none included ("a/#" matches "a")
+      matched |= terminal;
+      continue;
+    }
+    if (!level) continue;
+    if (!(n.length == 1 && *text == '+') &&
+        (n.length != end - level || memcmp(text, level, n.length) != 0)) continue;
+    
+    if (*end) {
+      matched |= matchWildcards(n.child, end + 1);
+    } else {
+      matched |= terminal | matchWildcards(n.child, nullptr);
+    }
+  }
+  return matched;
 }
 
-String CANPubSubBroker::getSerialByClientId(uint8_t clientId) {
-  int index = findClientMappingById(clientId);
-  if (index >= 0) {
-    return _clientMappings[index].getSerial();
+WildcardMatch* CANPubSubBrokerCore::findWildcardMatch(uint16_t topicHash) {
+  uint16_t slot = wildcardCacheHome(topicHash);
+  for (uint16_t probe = 0; probe < CAN_PS_WILDCARD_CACHE_SIZE; probe++) {
+    WildcardMatch& match = _wildcardMatches[slot];
+    if (match.state == 0) return nullptr;
+    if (match.topicHash == topicHash) return &match;
+    slot = (slot + 1) & (CAN_PS_WILDCARD_CACHE_SIZE - 1);
   }
-  return "";
+  return nullptr;
 }
 
-bool CANPubSubBroker::updateClientSerial(uint8_t clientId, const String& newSerial) {
-  int index = findClientMappingById(clientId);
-  if (index >= 0) {
-    // Check if new serial already exists
-    if (findClientMapping(newSerial) >= 0) {
-      return false; // Serial already in use
+WildcardMatch* CANPubSubBrokerCore::resolveWildcardMatch(uint16_t topicHash, uint8_t publisherId) {
+  WildcardMatch* match = findWildcardMatch(topicHash);
+  
+  if (!match || match->state == CAN_PS_MATCH_STALE) {
+    const char* name = knownTopicName(topicHash);
+    // Only the publisher may know the name of a topic nobody subscribed to by name
+    if (!name && publisherId == CAN_PS_BROKER_ID) return nullptr;
+    
+    if (!match) {
+      // Evict the computed sets when three quarters full, probe chains stay short
+      if (_wildcardMatchCount >= CAN_PS_WILDCARD_CACHE_SIZE * 3 / 4) {
+        evictWildcardMatches();
+      }
+      // Every entry waits for a name: this topic goes to exact subscribers only
+      if (_wildcardMatchCount >= CAN_PS_WILDCARD_CACHE_SIZE) return nullptr;
+      uint16_t slot = wildcardCacheHome(topicHash);
+      while (_wildcardMatches[slot].state != 0) {
+        slot = (slot + 1) & (CAN_PS_WILDCARD_CACHE_SIZE - 1);
+      }
+      match = &_wildcardMatches[slot];
+      match->topicHash = topicHash;
+      match->subCount = 0;
+      _wildcardMatchCount++;
+    }
+    
+    if (name) {
+      buildWildcardMatch(*match, name);
+    } else {
+      // Ask once, the answer completes the entry and releases the held publishes
+      match->state = CAN_PS_MATCH_PENDING;
+      beginFrame(CAN_PS_TOPIC_NAME_REQUEST);
+      _can->write(publisherId);
+      _can->write(topicHash >> 8);
+      _can->write(topicHash & 0xFF);
+      endFrame();
     }
-    _clientMappings[index].setSerial(newSerial);
-    saveMappingsToStorage(); // Save change
-    return true;
   }
-  return false;
+  
+  return match->state == CAN_PS_MATCH_RESOLVED && match->subCount > 0 ? match : nullptr;
 }
 
-uint8_t CANPubSubBroker::getRegisteredClientCount() {
-  // Count only registered clients (registered=true)
-  uint8_t count = 0;
-  for (uint8_t i = 0; i < _mappingCount; i++) {
-    if (_clientMappings[i].registered) {
-      count++;
+void CANPubSubBrokerCore::buildWildcardMatch(WildcardMatch& match, const char* topicName) {
+  // Subscribers of a stale entry already know the name, one bit per client ID
+  uint32_t known[256 / 32];
+  memset(known, 0, sizeof(known));
+  if (match.state == CAN_PS_MATCH_STALE) {
+    for (uint8_t j = 0; j < match.subCount; j++) {
+      known[match.subscribers[j] >> 5] |= 1UL << (match.subscribers[j] & 31);
     }
   }
-  return count;
+  
+  uint32_t patterns = matchWildcards(_wildcardRoot, topicName);
+  match.state = CAN_PS_MATCH_RESOLVED;
+  match.subCount = 0;
+  
+  // Union of the matching patterns' subscribers, capped like any topic
+  for (uint8_t p = 0; p < _wildcardCount; p++) {
+    if (!(patterns & (1UL << p))) continue;
+    int index = findSubscription(_wildcards[p].hash);
+    if (index < 0) continue;
+    const Subscription& sub = _subscriptions[index];
+    for (uint8_t j = 0; j < sub.subCount && match.subCount < _subscribersPerTopic; j++) {
+      if (!memchr(match.subscribers, sub.subscribers[j], match.subCount)) {
+        match.subscribers[match.subCount++] = sub.subscribers[j];
+      }
+    }
+  }
+  
+  // Wildcard subscribers learn the topic's name before its first message
+  int exact = findSubscription(match.topicHash);
+  for (uint8_t j = 0; j < match.subCount; j++) {
+    if (exact >= 0 && memchr(_subscriptions[exact].subscribers, match.subscribers[j], _subscriptions[exact].subCount)) continue;
+    if ((known[match.subscribers[j] >> 5] >> (match.subscribers[j] & 31)) & 1) continue;
+    sendTopicName(match.subscribers[j], match.topicHash, topicName);
+  }
 }
 
-void CANPubSubBroker::listRegisteredClients(std::function<void(uint8_t id, const String& serial, bool registered)> callback) {
-  if (!callback) return;
+void CANPubSubBrokerCore::completeWildcardMatch(uint16_t topicHash, const char* topicName) {
+  WildcardMatch* match = findWildcardMatch(topicHash);
+  if (!match || match->state != CAN_PS_MATCH_PENDING) return;
+  
+  buildWildcardMatch(*match, topicName);
+  
+  // The publishes that raised the question went to exact subscribers only
+  int exact = findSubscription(topicHash);
+  bool released = false;
+  unsigned long now = millis();
+  for (uint8_t h = 0; h < CAN_PS_WILDCARD_HOLD; h++) {
+    WildcardHeldPublish& held = _wildcardHeld[h];
+    if (!held.active || held.topicHash != topicHash) continue;
+    held.active = false;
+    if (now - held.since > CAN_PS_WILDCARD_HOLD_TIME) continue;
+    released = true;
+    
+    for (uint8_t j = 0; j < match->subCount; j++) {
+      uint8_t clientId = match->subscribers[j];
+      if (exact >= 0 && memchr(_subscriptions[exact].subscribers, clientId, _subscriptions[exact].subCount)) continue;
+      sendTopicData(clientId, topicHash, held.data, held.length, held.priority);
+    }
+  }
   
-  for (uint8_t i = 0; i < _mappingCount; i++) {
-    callback(_clientMappings[i].clientId, 
-             _clientMappings[i].getSerial(), 
-             _clientMappings[i].registered);
+  // Nothing could be held: the retained value, if enabled, stands in for it
+  if (!released) {
+    for (uint8_t j = 0; j < match->subCount; j++) {
+      sendRetained(match->subscribers[j], topicHash);
+    }
   }
 }
 
-bool CANPubSubBroker::isClientOnline(uint8_t clientId) {
-  // Check if client is in the connected clients list
-  for (uint8_t i = 0; i < _clientCount; i++) {
-    if (_connectedClients[i] == clientId) {
-      return true;
+void CANPubSubBrokerCore::invalidateWildcardMatches(uint8_t pattern) {
+  // Entries stay in place (no probe chain to repair), the next publish rebuilds them
+  for (uint16_t i = 0; i < CAN_PS_WILDCARD_CACHE_SIZE; i++) {
+    WildcardMatch& match = _wildcardMatches[i];
+    if (match.state != CAN_PS_MATCH_RESOLVED) continue;
+    
+    const char* name = knownTopicName(match.topicHash);
+    if (!name || (matchWildcards(_wildcardRoot, name) & (1UL << pattern))) {
+      match.state = CAN_PS_MATCH_STALE;
     }
   }
-  return false;
 }
 
-uint8_t CANPubSubBroker::getClientSubscriptionCount(uint8_t clientId) {
-  uint8_t count = 0;
-  // Count how many topics this client is subscribed to
-  for (uint8_t i = 0; i < _subTableSize; i++) {
-    for (uint8_t j = 0; j < _subscriptions[i].subCount; j++) {
-      if (_subscriptions[i].subscribers[j] == clientId) {
-        count++;
-        break; // Client found in this topic, move to next topic
+void CANPubSubBrokerCore::evictWildcardMatches() {
+  // Resolved and stale entries are rebuilt on the next publish. An entry waiting
+  // for its name stays while a publish is held for it, so the answer still
+  // finds it and releases the publish
+  unsigned long now = millis();
+  for (uint16_t slot = 0; slot < CAN_PS_WILDCARD_CACHE_SIZE; ) {
+    WildcardMatch& match = _wildcardMatches[slot];
+    bool keep = match.state == 0;
+    if (match.state == CAN_PS_MATCH_PENDING) {
+      for (uint8_t h = 0; h < CAN_PS_WILDCARD_HOLD && !keep; h++) {
+        const WildcardHeldPublish& held = _wildcardHeld[h];
+        keep = held.active && held.topicHash == match.topicHash && now - held.since <= CAN_PS_WILDCARD_HOLD_TIME;
       }
     }
+    if (keep) {
+      slot++;
+    } else {
+      removeWildcardMatch(slot);  // A later entry may have moved in, look again
+    }
   }
-  return count;
 }
 
-void CANPubSubBroker::onExtendedMessageComplete(uint8_t msgType, uint8_t senderId, const uint8_t* data, size_t length) {
-  // Handle extended messages based on type
-  switch (msgType) {
-    case CAN_PS_ID_REQUEST: {
-      // Extended ID request with serial number
-      // Note: A placeholder byte (0x00) was extracted by processExtendedFrame as "senderId"
-      // The actual serial number is in the data buffer
-      String serialNumber = "";
-      for (size_t i = 0; i < length; i++) {
-        serialNumber += (char)data[i];
-      }
-      
-      if (serialNumber.length() == 0) {
-        // No serial number provided - reject by not sending a response
-        return;
-      }
-      
-      uint8_t assignedId = findOrCreateClientId(serialNumber);
-      
-      // Check if this is a returning client (has stored subscriptions)
-      int subIndex = findStoredSubscription(assignedId);
-      bool hasStoredSubs = (subIndex >= 0 && _storedSubscriptions[subIndex].topicCount > 0);
-      
-      // Send response with serial number included so client can verify it's for them
-      // Format: [assignedId][hasStoredSubs][serialNumberLength][serialNumber...]
-      size_t totalSize = 1 + 1 + 1 + serialNumber.length();
-      
-      if (totalSize > CAN_FRAME_DATA_SIZE) {
-        // Use extended message for long serial numbers
-        uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-        buffer[0] = assignedId;
-        buffer[1] = hasStoredSubs ? 0x01 : 0x00;
-        buffer[2] = (uint8_t)serialNumber.length();
-        memcpy(buffer + 3, serialNumber.c_str(), min(serialNumber.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 3)));
-        
-        sendExtendedMessage(CAN_PS_ID_RESPONSE, buffer, min(3 + serialNumber.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-      } else {
-        _can->beginPacket(CAN_PS_ID_RESPONSE);
-        _can->write(assignedId);
-        _can->write(hasStoredSubs ? 0x01 : 0x00);
-        _can->write((uint8_t)serialNumber.length());
-        _can->print(serialNumber);
-        _can->endPacket();
-      }
-      
-      // Track connected client if not already tracked
-      bool found = false;
-      for (uint8_t i = 0; i < _clientCount; i++) {
-        if (_connectedClients[i] == assignedId) {
-          found = true;
-          break;
-        }
-      }
-      if (!found && _clientCount < 256) {
-        _connectedClients[_clientCount++] = assignedId;
-        
-        if (_onClientConnect) {
-          _onClientConnect(assignedId);
-        }
-      }
-      
-      // Restore stored subscriptions for this client (if any)
-      if (hasStoredSubs) {
-        delay(100); // Delay to let client process ID response and prepare to receive subscriptions
-        restoreClientSubscriptions(assignedId);
-      }
-      break;
-    }
-    
-    case CAN_PS_SUBSCRIBE: {
-      // Extended subscribe with full topic name
-      // Format (in buffer): [topicHash_h][topicHash_l][topic_name...]
-      // Note: clientId was already extracted by processExtendedFrame from first byte
-      if (length < 2) return;
-      
-      uint8_t clientId = senderId; // Use the extracted sender ID
-      uint16_t topicHash = (data[0] << 8) | data[1];
-      String topicName = "";
-      
-      for (size_t i = 2; i < length; i++) {
-        topicName += (char)data[i];
-      }
-      
-      if (topicName.length() > 0) {
-        registerTopic(topicName);
-        // Also persist topic name to flash storage
-        storeTopicName(topicHash, topicName);
-      }
-      
-      addSubscription(clientId, topicHash);
-      
-      // Track client activity (marks as online)
-      trackClientActivity(clientId);
-      
-      break;
-    }
-    
-    case CAN_PS_PUBLISH: {
-      // Extended publish with long message
-      // Format (in buffer): [topicHash_h][topicHash_l][message...]
-      // Note: publisherId was already extracted by processExtendedFrame from first byte
-      if (length < 2) return;
-      
-      uint8_t publisherId = senderId; // Use the extracted sender ID
-      uint16_t topicHash = (data[0] << 8) | data[1];
-      String message = "";
-      
-      for (size_t i = 2; i < length; i++) {
-        message += (char)data[i];
-      }
-      
-      // Track client activity (marks as online)
-      trackClientActivity(publisherId);
-      
-      String topicName = getTopicName(topicHash);
-      
-      if (_onPublish) {
-        _onPublish(topicHash, topicName, message);
-      }
-      
-      forwardToSubscribers(topicHash, message);
-      break;
-    }
-    
-    case CAN_PS_DIRECT_MSG: {
-      // Extended direct message from client to broker
-      // Format (in buffer): [message...]
-      // Note: senderId (client ID) was already extracted by processExtendedFrame from first byte
-      
-      // Track client activity (marks as online)
-      trackClientActivity(senderId);
-      
-      String message = "";
-      for (size_t i = 0; i < length; i++) {
-        message += (char)data[i];
-      }
-      
-      if (_onDirectMessage) {
-        _onDirectMessage(senderId, message);
-      }
-      
-      // Send acknowledgment
-      _can->beginPacket(CAN_PS_ACK);
-      _can->write(CAN_PS_BROKER_ID);
-      _can->write(senderId);
-      _can->print("ACK");
-      _can->endPacket();
-      break;
-    }
+void CANPubSubBrokerCore::removeWildcardMatch(uint16_t slot) {
+  // Linear probing deletion: pull later entries of the chain back into the hole
+  // unless that would put them before their home slot. Rows travel with entries
+  const uint16_t mask = CAN_PS_WILDCARD_CACHE_SIZE - 1;
+  WildcardMatch& match = _wildcardMatches[slot];
+  match.topicHash = 0;
+  match.state = 0;
+  match.subCount = 0;
+  _wildcardMatchCount--;
+  
+  uint16_t next = slot;
+  for (;;) {
+    next = (next + 1) & mask;
+    WildcardMatch& candidate = _wildcardMatches[next];
+    if (candidate.state == 0) break;
+    uint16_t home = wildcardCacheHome(candidate.topicHash);
+    if (((next - home) & mask) < ((next - slot) & mask)) continue;
     
-    case CAN_PS_PEER_MSG: {
-      // Extended peer message from client to client (forwarded by broker)
-      // Format (in buffer): [targetId][message...]
-      // Note: senderId was already extracted by processExtendedFrame from first byte
-      if (length < 1) return;
-      
-      uint8_t targetId = data[0];
-      
-      // Track client activity (marks as online)
-      trackClientActivity(senderId);
-      
-      // Verify sender has a permanent ID (registered with serial number)
-      int senderIndex = findClientMappingById(senderId);
-      if (senderIndex < 0) {
-        // Sender doesn't have permanent ID, reject
-        return;
-      }
-      
-      // Verify target has a permanent ID
-      int targetIndex = findClientMappingById(targetId);
-      if (targetIndex < 0) {
-        // Target doesn't have permanent ID, reject
-        return;
-      }
-      
-      // Extract message
-      String message = "";
-      for (size_t i = 1; i < length; i++) {
-        message += (char)data[i];
-      }
-      
-      // Forward message to target client
-      size_t totalSize = 1 + 1 + message.length();
-      
-      if (totalSize > CAN_FRAME_DATA_SIZE) {
-        // Use extended message for long messages
-        uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-        buffer[0] = senderId;
-        buffer[1] = targetId;
-        memcpy(buffer + 2, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 2)));
-        
-        sendExtendedMessage(CAN_PS_PEER_MSG, buffer, min(2 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-      } else {
-        _can->beginPacket(CAN_PS_PEER_MSG);
-        _can->write(senderId);
-        _can->write(targetId);
-        _can->print(message);
-        _can->endPacket();
-      }
-      break;
-    }
+    WildcardMatch hole = _wildcardMatches[slot];
+    _wildcardMatches[slot] = candidate;
+    candidate = hole;
+    slot = next;
   }
 }
 
-// ===== CANPubSubClient Implementation =====
-
-CANPubSubClient::CANPubSubClient(CANControllerClass& can)
-  : CANPubSubBase(can),
-    _clientId(CAN_PS_UNASSIGNED_ID),
-    _connected(false),
-    _subscribedTopicCount(0),
-    _lastPing(0),
-    _lastPong(0),
-    _lastPeerSenderId(0),
-    _lastPeerMsgTime(0),
-    _onMessage(nullptr),
-    _onDirectMessage(nullptr),
-    _onConnect(nullptr),
-    _onDisconnect(nullptr),
-    _onPong(nullptr) {
-  memset(_subscribedTopics, 0, sizeof(_subscribedTopics));
-  memset(_lastPeerMessage, 0, sizeof(_lastPeerMessage));
+void CANPubSubBrokerCore::clearWildcardMatches() {
+  // Rows stay with their entries
+  for (uint16_t i = 0; i < CAN_PS_WILDCARD_CACHE_SIZE; i++) {
+    _wildcardMatches[i].topicHash = 0;
+    _wildcardMatches[i].state = 0;
+    _wildcardMatches[i].subCount = 0;
+  }
+  _wildcardMatchCount = 0;
+  memset(_wildcardHeld, 0, sizeof(_wildcardHeld));
 }
 
-bool CANPubSubClient::begin(unsigned long timeout) {
-  return connect(timeout);
+void CANPubSubBrokerCore::holdWildcardPublish(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority) {
+  WildcardMatch* match = findWildcardMatch(topicHash);
+  if (!match || match->state != CAN_PS_MATCH_PENDING) return;
+  
+  // A free slot, or one whose publisher never answered
+  unsigned long now = millis();
+  for (uint8_t h = 0; h < CAN_PS_WILDCARD_HOLD; h++) {
+    WildcardHeldPublish& held = _wildcardHeld[h];
+    if (held.active && now - held.since <= CAN_PS_WILDCARD_HOLD_TIME) continue;
+    
+    held.topicHash = topicHash;
+    held.priority = priority;
+    held.length = min(length, (size_t)MAX_EXTENDED_MSG_SIZE);
+    held.since = now;
+    held.active = true;
+    memcpy(held.data, data, held.length);
+    return;
+  }
+#if CAN_PS_STATS
+  _stats.wildcardHoldDrops++;
+#endif
 }
 
-bool CANPubSubClient::begin(const String& serialNumber, unsigned long timeout) {
-  return connect(serialNumber, timeout);
+const char* CANPubSubBrokerCore::knownTopicName(uint16_t hash) {
+  const char* name = findTopicName(hash);
+  if (name) return name;
+  int slot = findStoredTopicName(hash);
+  return slot >= 0 ? _storedTopicNames[slot].name : nullptr;
 }
 
-void CANPubSubClient::end() {
-  _connected = false;
-  _clientId = CAN_PS_UNASSIGNED_ID;
-  _subscribedTopicCount = 0;
-  _serialNumber = "";
+void CANPubSubBrokerCore::sendTopicName(uint8_t clientId, uint16_t topicHash, const char* name) {
+  // Format: [clientId][topicHash_h][topicHash_l][nameLength][name]
+  uint8_t buffer[4 + MAX_TOPIC_NAME_LENGTH];
+  size_t nameLength = strnlen(name, MAX_TOPIC_NAME_LENGTH - 1);
+  buffer[0] = clientId;
+  buffer[1] = topicHash >> 8;
+  buffer[2] = topicHash & 0xFF;
+  buffer[3] = (uint8_t)nameLength;
+  memcpy(buffer + 4, name, nameLength);
+  
+  sendExtendedMessage(CAN_PS_TOPIC_NAME, buffer, 4 + nameLength);
 }
 
-bool CANPubSubClient::connect(unsigned long timeout) {
-  // Clear subscriptions on (re)connect - they will be restored by broker if persistent
-  _subscribedTopicCount = 0;
-  memset(_subscribedTopics, 0, sizeof(_subscribedTopics));
-  
-  requestClientID();
+void CANPubSubBrokerCore::handleTopicName() {
+  if (_can->available() < 4) return;
   
-  unsigned long startTime = millis();
-  while (_clientId == CAN_PS_UNASSIGNED_ID && (millis() - startTime) < timeout) {
-    int packetSize = _can->parsePacket();
-    if (packetSize > 0) {
-      handleMessage(packetSize);
-    }
-    delay(10);
-  }
+  uint8_t clientId = _can->read();
   
-  if (_clientId != CAN_PS_UNASSIGNED_ID) {
-    _connected = true;
-    if (_onConnect) {
-      _onConnect();
-    }
-    return true;
-  }
+  uint8_t records[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(records, sizeof(records));
   
-  return false;
+  dispatchTopicNames(clientId, records, length);
 }
 
-bool CANPubSubClient::connect(const String& serialNumber, unsigned long timeout) {
-  // Clear subscriptions on (re)connect - they will be restored by broker if persistent
-  _subscribedTopicCount = 0;
-  memset(_subscribedTopics, 0, sizeof(_subscribedTopics));
-  
-  _serialNumber = serialNumber;
-  requestClientIDWithSerial(serialNumber);
-  
-  unsigned long startTime = millis();
-  unsigned long idReceivedTime = 0;
-  bool idReceived = false;
+void CANPubSubBrokerCore::dispatchTopicNames(uint8_t clientId, const uint8_t* records, size_t length) {
+  // Records: [topicHash_h][topicHash_l][nameLength][name...], answers to our name requests
+  trackClientActivity(clientId);
   
-  // Wait for ID assignment and subscription restoration
-  while ((millis() - startTime) < timeout) {
-    int packetSize = _can->parsePacket();
-    if (packetSize > 0) {
-      handleMessage(packetSize);
-      
-      // Check if we just received our ID
-      if (!idReceived && _clientId != CAN_PS_UNASSIGNED_ID) {
-        idReceived = true;
-        idReceivedTime = millis();
-      }
-    }
+  size_t pos = 0;
+  while (pos + 3 <= length) {
+    uint16_t topicHash = (records[pos] << 8) | records[pos + 1];
+    uint8_t nameLength = records[pos + 2];
+    pos += 3;
+    if (pos + nameLength > length) break;
     
-    // If we have an ID and enough time has passed for subscription restoration, we're done
-    if (idReceived && (millis() - idReceivedTime) >= 200) {
-      break;
+    String topicName = "";
+    for (uint8_t i = 0; i < nameLength; i++) {
+      topicName += (char)records[pos + i];
     }
+    pos += nameLength;
     
-    delay(10);
-  }
-  
-  if (_clientId != CAN_PS_UNASSIGNED_ID) {
-    _connected = true;
-    if (_onConnect) {
-      _onConnect();
-    }
-    return true;
+    // Kept in RAM only, a publisher is asked again after a broker restart
+    if (hashTopic(topicName) != topicHash || !registerTopic(topicName)) continue;
+    completeWildcardMatch(topicHash, topicName.c_str());
   }
-  
-  return false;
 }
 
-bool CANPubSubClient::isConnected() {
-  return _connected;
+uint16_t CANPubSubBrokerCore::subscriptionHome(uint16_t topicHash) {
+  // Fibonacci scramble, high bits select the home slot
+  uint16_t mixed = topicHash * 40503u;
+  return ((uint32_t)mixed * _subIndexSize) >> 16;
 }
 
-uint8_t CANPubSubClient::getClientId() {
-  return _clientId;
+int CANPubSubBrokerCore::findSubscriptionSlot(uint16_t topicHash) {
+  uint16_t slot = subscriptionHome(topicHash);
+  for (uint16_t probe = 0; probe < _subIndexSize; probe++) {
+    uint8_t entry = _subIndex[slot];
+    if (entry == 0) return -1;
+    if (_subscriptions[entry - 1].topicHash == topicHash) return slot;
+    slot = (slot + 1) & (_subIndexSize - 1);
+  }
+  return -1;
 }
 
-String CANPubSubClient::getSerialNumber() {
-  return _serialNumber;
+int CANPubSubBrokerCore::findSubscription(uint16_t topicHash) {
+  int slot = findSubscriptionSlot(topicHash);
+  return slot < 0 ? -1 : _subIndex[slot] - 1;
 }
 
-void CANPubSubClient::loop() {
-  int packetSize = _can->parsePacket();
-  if (packetSize > 0) {
-    handleMessage(packetSize);
+int CANPubSubBrokerCore::createSubscription(uint16_t topicHash) {
+  if (_subTableSize >= _subTableCapacity) return -1;
+  
+  uint16_t slot = subscriptionHome(topicHash);
+  while (_subIndex[slot] != 0) {
+    slot = (slot + 1) & (_subIndexSize - 1);
+  }
+  
+  uint8_t index = _subTableSize++;
+  _subscriptions[index].topicHash = topicHash;
+  _subscriptions[index].subCount = 0;
+  _subIndex[slot] = index + 1;
+  
+  // A topic subscribed under a pattern name becomes a wildcard
+  const char* name = knownTopicName(topicHash);
+  if (name && isWildcardPattern(name)) {
+    addWildcard(topicHash, name);
   }
+  return index;
 }
 
-void CANPubSubClient::handleMessage(int packetSize) {
-  // Check for extended frames first
-  if (_can->packetExtended()) {
-    processExtendedFrame(packetSize);
-    return;
-  }
+void CANPubSubBrokerCore::eraseSubscription(uint8_t index) {
+  int slot = findSubscriptionSlot(_subscriptions[index].topicHash);
+  if (slot < 0) return;
   
-  uint8_t msgType = _can->packetId();
+  int wildcard = _wildcardCount > 0 ? findWildcard(_subscriptions[index].topicHash) : -1;
+  if (wildcard >= 0) {
+    removeWildcard(wildcard);
+  }
   
-  switch (msgType) {
-    case CAN_PS_ID_RESPONSE:
-      handleIdAssignment();
-      break;
-    case CAN_PS_SUBSCRIBE:
-      handleSubscribeNotification();
-      break;
-    case CAN_PS_SUB_RESTORE:
-      handleSubscriptionRestore();
-      break;
-    case CAN_PS_TOPIC_DATA:
-      handleTopicData();
-      break;
-    case CAN_PS_DIRECT_MSG:
-      handleDirectMessageReceived();
-      break;
-    case CAN_PS_PEER_MSG:
-      // Handle standard peer messages (extended peer messages go through onExtendedMessageComplete)
-      if (_can->available() >= 2) {
-        uint8_t senderId = _can->read();
-        uint8_t targetId = _can->read();
-        
-        if (targetId == _clientId) {
-          // This message is for us
-          String message = "";
-          while (_can->available()) {
-            message += (char)_can->read();
-          }
-          
-          // Deduplicate: skip if same sender and message within 50ms
-          unsigned long now = millis();
-          bool isDuplicate = (senderId == _lastPeerSenderId && 
-                              message == String(_lastPeerMessage) &&
-                              (now - _lastPeerMsgTime) < 50);
-          
-          if (!isDuplicate && _onDirectMessage) {
-            _onDirectMessage(senderId, message);
-            
-            // Track this message to detect duplicates
-            _lastPeerSenderId = senderId;
-            _lastPeerMsgTime = now;
-            strncpy(_lastPeerMessage, message.c_str(), 31);
-            _lastPeerMessage[31] = '\0';
-          }
-        }
-        // Note: Messages not for us are silently discarded to avoid processing
-        // forwarded peer messages intended for other clients
-      }
+  // Backward-shift deletion keeps probe chains intact without tombstones
+  uint16_t hole = slot;
+  uint16_t next = hole;
+  for (;;) {
+    next = (next + 1) & (_subIndexSize - 1);
+    if (_subIndex[next] == 0) break;
+    uint16_t home = subscriptionHome(_subscriptions[_subIndex[next] - 1].topicHash);
+    bool stays = (hole <= next) ? (hole < home && home <= next) : (hole < home || home <= next);
+    if (stays) continue;
+    _subIndex[hole] = _subIndex[next];
+    hole = next;
+  }
+  _subIndex[hole] = 0;
+  
+  // Move the last entry into the gap so the dense table stays packed
+  uint8_t last = _subTableSize - 1;
+  if (index != last) {
+    int lastSlot = findSubscriptionSlot(_subscriptions[last].topicHash);
+    _subscriptions[index].topicHash = _subscriptions[last].topicHash;
+    _subscriptions[index].subCount = _subscriptions[last].subCount;
+    memcpy(_subscriptions[index].subscribers, _subscriptions[last].subscribers, _subscriptions[last].subCount);
+    if (lastSlot >= 0) _subIndex[lastSlot] = index + 1;
+  }
+  _subTableSize--;
+}
+
+void CANPubSubBrokerCore::clearSubscriptionTable() {
+  _subTableSize = 0;
+  _clientTopicCount = 0;
+  memset(_subIndex, 0, _subIndexSize);
+  memset(_clientTopicSlot, 0, sizeof(_clientTopicSlot));
+  _wildcardCount = 0;
+  compileWildcards();
+  clearWildcardMatches();
+}
+
+int CANPubSubBrokerCore::findClientTopics(uint8_t clientId) {
+  return _clientTopicSlot[clientId] - 1;
+}
+
+bool CANPubSubBrokerCore::linkSubscriber(uint16_t topicHash, uint8_t clientId) {
+  int index = findSubscription(topicHash);
+  if (index >= 0) {
+    Subscription& sub = _subscriptions[index];
+    for (uint8_t j = 0; j < sub.subCount; j++) {
+      if (sub.subscribers[j] == clientId) return false; // Already subscribed
+    }
+    if (sub.subCount >= _subscribersPerTopic) return false;
+  }
+  
+  // Reverse index entry for this client
+  int topics = findClientTopics(clientId);
+  if (topics < 0) {
+    if (_clientTopicCount >= _clientTopicCapacity) return false;
+    topics = _clientTopicCount++;
+    _clientTopics[topics].clientId = clientId;
+    _clientTopics[topics].topicCount = 0;
+    _clientTopicSlot[clientId] = topics + 1;
+  }
+  ClientTopicList& list = _clientTopics[topics];
+  if (list.topicCount >= _topicsPerClient) return false;
+  
+  if (index < 0) {
+    index = createSubscription(topicHash);
+    if (index < 0) {
+      if (list.topicCount == 0) releaseClientTopics(topics);  // Drop the reverse entry we just created
+      return false;
+    }
+  }
+  
+  Subscription& sub = _subscriptions[index];
+  sub.subscribers[sub.subCount++] = clientId;
+  list.topics[list.topicCount++] = topicHash;
+  
+  // Cached subscriber sets of the topics this pattern matches include it
+  int pattern = _wildcardCount > 0 ? findWildcard(topicHash) : -1;
+  if (pattern >= 0) {
+    invalidateWildcardMatches(pattern);
+  }
+  return true;
+}
+
+bool CANPubSubBrokerCore::unlinkSubscriber(uint16_t topicHash, uint8_t clientId) {
+  int index = findSubscription(topicHash);
+  if (index < 0) return false;
+  
+  Subscription& sub = _subscriptions[index];
+  bool found = false;
+  for (uint8_t j = 0; j < sub.subCount; j++) {
+    if (sub.subscribers[j] == clientId) {
+      sub.subscribers[j] = sub.subscribers[--sub.subCount];
+      found = true;
       break;
-    case CAN_PS_PING:
-      // Broker is pinging us, respond with pong
-      if (_can->available() >= 2) {
-        uint8_t senderId = _can->read();  // Broker ID
-        uint8_t targetId = _can->read();  // Our ID
-        if (targetId == _clientId) {
-          // Send pong response
-          _can->beginPacket(CAN_PS_PONG);
-          _can->write(_clientId);
-          _can->write(senderId);
-          _can->endPacket();
-        }
+    }
+  }
+  if (!found) return false;
+  
+  int pattern = _wildcardCount > 0 ? findWildcard(topicHash) : -1;
+  if (pattern >= 0) {
+    invalidateWildcardMatches(pattern);
+  }
+  
+  // If no subscribers left, remove the topic entry
+  if (sub.subCount == 0) {
+    eraseSubscription(index);
+  }
+  
+  int topics = findClientTopics(clientId);
+  if (topics >= 0) {
+    ClientTopicList& list = _clientTopics[topics];
+    for (uint8_t j = 0; j < list.topicCount; j++) {
+      if (list.topics[j] == topicHash) {
+        list.topics[j] = list.topics[--list.topicCount];
+        break;
       }
-      break;
-    case CAN_PS_PONG:
-      handlePong();
-      break;
-    case CAN_PS_ACK:
-      // Acknowledgment received
-      break;
+    }
+    
+    // Release the reverse entry once the client has no topics left
+    if (list.topicCount == 0) releaseClientTopics(topics);
   }
+  return true;
 }
 
-void CANPubSubClient::handleIdAssignment() {
-  if (_can->available() < 1) return;
+void CANPubSubBrokerCore::releaseClientTopics(uint8_t topics) {
+  // The last entry moves into the gap, its row stays put and the hashes are copied
+  _clientTopicSlot[_clientTopics[topics].clientId] = 0;
+  uint8_t last = --_clientTopicCount;
+  if (topics != last) {
+    ClientTopicList& moved = _clientTopics[topics];
+    moved.clientId = _clientTopics[last].clientId;
+    moved.topicCount = _clientTopics[last].topicCount;
+    memcpy(moved.topics, _clientTopics[last].topics, moved.topicCount * sizeof(uint16_t));
+    _clientTopicSlot[moved.clientId] = topics + 1;
+  }
+}
+
+void CANPubSubBrokerCore::addSubscription(uint8_t clientId, uint16_t topicHash) {
+  if (linkSubscriber(topicHash, clientId)) {
+    // Store subscription persistently
+    storeClientSubscriptions(clientId);
+  }
+}
+
+void CANPubSubBrokerCore::removeSubscription(uint8_t clientId, uint16_t topicHash) {
+  if (unlinkSubscriber(topicHash, clientId)) {
+    // Update stored subscriptions
+    storeClientSubscriptions(clientId);
+  }
+}
+
+void CANPubSubBrokerCore::removeAllSubscriptions(uint8_t clientId) {
+  // Walk the client's reverse index; each unlink shrinks it from the back
+  int topics = findClientTopics(clientId);
+  while (topics >= 0) {
+    ClientTopicList& list = _clientTopics[topics];
+    unlinkSubscriber(list.topics[list.topicCount - 1], clientId);
+    topics = findClientTopics(clientId);
+  }
+  // Update stored subscriptions
+  storeClientSubscriptions(clientId);
+}
+
+void CANPubSubBrokerCore::forwardToSubscribers(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority,
+                                           uint8_t publisherId) {
+  // Cache before the subscriber check - late joiners are the point
+  if (_retainEnabled) {
+    storeRetained(topicHash, data, length, priority);
+  }
   
-  uint8_t assignedId = _can->read();
+  // Wildcard subscribers, looked up once per topic and then served from the cache
+  WildcardMatch* match = nullptr;
+  if (_wildcardCount > 0) {
+    match = resolveWildcardMatch(topicHash, publisherId);
+    if (!match) {
+      holdWildcardPublish(topicHash, data, length, priority);  // Only while the name is asked
+    }
+  }
   
-  // Check if there's a flag indicating stored subscriptions will be restored
-  bool hasStoredSubs = false;
-  if (_can->available() > 0) {
-    hasStoredSubs = (_can->read() == 0x01);
+  int i = findSubscription(topicHash);
+  uint8_t exactCount = i >= 0 ? _subscriptions[i].subCount : 0;
+  
+  if (exactCount > 0) {
+    if (_multicastEnabled) {
+      // CAN is a broadcast medium - one copy reaches every subscriber
+      sendTopicMulticast(topicHash, data, length, priority);
+    } else {
+      for (uint8_t j = 0; j < exactCount; j++) {
+        sendTopicData(_subscriptions[i].subscribers[j], topicHash, data, length, priority);
+      }
+    }
   }
   
-  // If serial number is provided, verify it matches ours
-  if (_can->available() > 0 && _serialNumber.length() > 0) {
-    uint8_t serialLen = _can->read();
-    String receivedSerial = "";
+  if (!match) return;
+  
+  // Addressed copies: clients keep multicast frames only for topics in their own list
+  for (uint8_t j = 0; j < match->subCount; j++) {
+    uint8_t clientId = match->subscribers[j];
+    if (exactCount > 0 && memchr(_subscriptions[i].subscribers, clientId, exactCount)) continue;
+    sendTopicData(clientId, topicHash, data, length, priority);
+  }
+}
+
+void CANPubSubBrokerCore::sendTopicMulticast(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority) {
+  // Standard frame format: [topicHash_h][topicHash_l][message...]
+  size_t totalSize = 2 + length;
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Extended format: [brokerId][topicHash_h][topicHash_l][message...]
+    // processExtendedFrame extracts the first byte as senderId
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    size_t copyLength = min(length, (size_t)(MAX_EXTENDED_MSG_SIZE - 3));
+    buffer[0] = CAN_PS_BROKER_ID;
+    buffer[1] = topicHash >> 8;
+    buffer[2] = topicHash & 0xFF;
+    memcpy(buffer + 3, data, copyLength);
     
-    for (uint8_t i = 0; i < serialLen && _can->available(); i++) {
-      receivedSerial += (char)_can->read();
+    sendExtendedMessage(CAN_PS_TOPIC_MCAST, buffer, 3 + copyLength, priority);
+  } else {
+    beginFrame(CAN_PS_TOPIC_MCAST, priority);
+    _can->write(topicHash >> 8);
+    _can->write(topicHash & 0xFF);
+    _can->write(data, length);
+    endFrame();
+  }
+}
+
+void CANPubSubBrokerCore::enableMulticast(bool enable) {
+  _multicastEnabled = enable;
+}
+
+bool CANPubSubBrokerCore::isMulticastEnabled() {
+  return _multicastEnabled;
+}
+
+void CANPubSubBrokerCore::enableBatchedRestore(bool enable) {
+  _batchedRestore = enable;
+}
+
+bool CANPubSubBrokerCore::isBatchedRestoreEnabled() {
+  return _batchedRestore;
+}
+
+void CANPubSubBrokerCore::enableRetainedMessages(bool enable) {
+  _retainEnabled = enable;
+  if (!enable) {
+    clearAllRetained();
+  }
+}
+
+bool CANPubSubBrokerCore::isRetainedEnabled() {
+  return _retainEnabled;
+}
+
+int CANPubSubBrokerCore::findRetained(uint16_t topicHash) {
+  for (uint8_t i = 0; i < CAN_PS_MAX_RETAINED; i++) {
+    if (_retained[i].active && _retained[i].topicHash == topicHash) {
+      return i;
     }
-    
-    // Only accept this ID if the serial number matches
-    if (receivedSerial != _serialNumber) {
-      // This ID response is not for us, ignore it
-      return;
+  }
+  return -1;
+}
+
+void CANPubSubBrokerCore::storeRetained(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority) {
+  int slot = findRetained(topicHash);
+  
+  if (length > CAN_PS_RETAINED_PAYLOAD_SIZE) {
+    // Too long to cache - drop the old value rather than serve a stale one
+    if (slot >= 0) {
+      _retained[slot].active = false;
     }
+    return;
   }
   
-  _clientId = assignedId;
-  _connected = true;
+  if (slot < 0) {
+    // Free slot, else replace the least recently updated topic
+    unsigned long now = millis();
+    unsigned long oldestAge = 0;
+    for (uint8_t i = 0; i < CAN_PS_MAX_RETAINED; i++) {
+      if (!_retained[i].active) {
+        slot = i;
+        break;
+      }
+      if (slot < 0 || now - _retained[i].updated > oldestAge) {
+        slot = i;
+        oldestAge = now - _retained[i].updated;
+      }
+    }
+  }
   
-  // If subscriptions will be restored, broker will send them shortly
-  // Client just needs to wait and handle incoming SUBSCRIBE messages
+  _retained[slot].topicHash = topicHash;
+  _retained[slot].length = (uint8_t)length;
+  _retained[slot].priority = priority;
+  _retained[slot].updated = millis();
+  _retained[slot].active = true;
+  memcpy(_retainedData[slot], data, length);
 }
 
-void CANPubSubClient::handleSubscribeNotification() {
-  // Broker is notifying us about a subscription (restored from storage)
-  // Format: [clientId][topicHash_h][topicHash_l][topicNameLen][topicName]
-  if (_can->available() < 4) return;
+void CANPubSubBrokerCore::sendRetained(uint8_t clientId, uint16_t topicHash) {
+  if (!_retainEnabled) return;
+  
+  // A wildcard gets the retained value of every named topic it matches
+  int wildcard = _wildcardCount > 0 ? findWildcard(topicHash) : -1;
+  if (wildcard >= 0) {
+    for (uint8_t i = 0; i < CAN_PS_MAX_RETAINED; i++) {
+      if (!_retained[i].active) continue;
+      const char* name = knownTopicName(_retained[i].topicHash);
+      if (!name || !(matchWildcards(_wildcardRoot, name) & (1UL << wildcard))) continue;
+      sendTopicData(clientId, _retained[i].topicHash, _retainedData[i], _retained[i].length, _retained[i].priority);
+    }
+    return;
+  }
   
-  uint8_t clientId = _can->read();
-  if (clientId != _clientId) return;
+  int slot = findRetained(topicHash);
+  if (slot < 0) return;
   
-  uint16_t topicHash = (_can->read() << 8) | _can->read();
-  uint8_t topicLen = _can->read();
+  // Addressed copy: other subscribers already have this value
+  sendTopicData(clientId, topicHash, _retainedData[slot], _retained[slot].length, _retained[slot].priority);
+}
+
+bool CANPubSubBrokerCore::getRetained(uint16_t topicHash, uint8_t* data, size_t* length) {
+  int slot = findRetained(topicHash);
+  if (slot < 0) return false;
   
-  String topic = "";
-  for (uint8_t i = 0; i < topicLen && _can->available(); i++) {
-    topic += (char)_can->read();
+  if (data) {
+    memcpy(data, _retainedData[slot], _retained[slot].length);
   }
-  
-  // Register the topic mapping locally
-  if (topic.length() > 0) {
-    registerTopic(topic);
+  if (length) {
+    *length = _retained[slot].length;
+  }
+  return true;
+}
+
+void CANPubSubBrokerCore::clearRetained(uint16_t topicHash) {
+  int slot = findRetained(topicHash);
+  if (slot >= 0) {
+    _retained[slot].active = false;
+  }
+}
+
+void CANPubSubBrokerCore::clearAllRetained() {
+  for (uint8_t i = 0; i < CAN_PS_MAX_RETAINED; i++) {
+    _retained[i].active = false;
+  }
+}
+
+uint8_t CANPubSubBrokerCore::getRetainedCount() {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < CAN_PS_MAX_RETAINED; i++) {
+    if (_retained[i].active) count++;
   }
+  return count;
+}
+
+void CANPubSubBrokerCore::assignClientID() {
+  resetQosState(_nextTempID);
   
-  // Add to local subscription list
-  if (_subscribedTopicCount < MAX_CLIENT_TOPICS) {
-    // Check if already subscribed
-    bool alreadySubscribed = false;
-    for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
-      if (_subscribedTopics[i] == topicHash) {
-        alreadySubscribed = true;
-        break;
+  beginFrame(CAN_PS_ID_RESPONSE);
+  _can->write(_nextTempID);
+  endFrame();
+  
+  _nextTempID++;
+  if (_nextTempID == 0xFF) {
+    _nextTempID = 101; // Wrap around to 101 for temporary IDs
+  }
+}
+
+void CANPubSubBrokerCore::onClientConnect(ConnectionCallback callback) {
+  _onClientConnect = callback;
+}
+
+void CANPubSubBrokerCore::onClientDisconnect(ConnectionCallback callback) {
+  _onClientDisconnect = callback;
+}
+
+void CANPubSubBrokerCore::onPublish(MessageCallback callback) {
+  _onPublish = callback;
+}
+
+void CANPubSubBrokerCore::onPublishBinary(BinaryMessageCallback callback) {
+  _onPublishBinary = callback;
+}
+
+void CANPubSubBrokerCore::onDirectMessage(DirectMessageCallback callback) {
+  _onDirectMessage = callback;
+}
+
+void CANPubSubBrokerCore::setPingInterval(unsigned long intervalMs) {
+  _pingInterval = intervalMs;
+  savePingConfigToStorage();
+}
+
+unsigned long CANPubSubBrokerCore::getPingInterval() {
+  return _pingInterval;
+}
+
+void CANPubSubBrokerCore::enableAutoPing(bool enable) {
+  _autoPingEnabled = enable;
+  if (enable) {
+    _lastPingTime = millis();
+    
+    // Initialize ping state for all registered clients
+    for (uint8_t i = 0; i < _mappingCount; i++) {
+      if (_clientMappings[i].registered) {
+        initPingState(_clientMappings[i].clientId);
+      }
+    }
+  }
+  savePingConfigToStorage();
+}
+
+bool CANPubSubBrokerCore::isAutoPingEnabled() {
+  return _autoPingEnabled;
+}
+
+void CANPubSubBrokerCore::setMaxMissedPings(uint8_t maxMissed) {
+  _maxMissedPings = maxMissed;
+  savePingConfigToStorage();
+}
+
+uint8_t CANPubSubBrokerCore::getMaxMissedPings() {
+  return _maxMissedPings;
+}
+
+void CANPubSubBrokerCore::enableGroupHeartbeat(bool enable) {
+  _groupHeartbeat = enable;
+  if (enable) {
+    _pingRoundActive = false; // A per-client round in progress is superseded
+  }
+}
+
+bool CANPubSubBrokerCore::isGroupHeartbeatEnabled() {
+  return _groupHeartbeat;
+}
+
+void CANPubSubBrokerCore::setHeartbeatSlot(uint8_t slotMs) {
+  _heartbeatSlotMs = slotMs;
+}
+
+void CANPubSubBrokerCore::enablePassiveLiveness(bool enable) {
+  _passiveLiveness = enable;
+  if (!enable) {
+    memset(_pingSkip, 0, sizeof(_pingSkip));
+  }
+}
+
+bool CANPubSubBrokerCore::isPassiveLivenessEnabled() {
+  return _passiveLiveness;
+}
+
+void CANPubSubBrokerCore::enableLoadAdaptation(bool enable) {
+  _loadAdaptation = enable;
+  if (!enable) {
+    _busCongested = false;
+    _loadGapUs = 0;
+  }
+}
+
+bool CANPubSubBrokerCore::isLoadAdaptationEnabled() {
+  return _loadAdaptation;
+}
+
+void CANPubSubBrokerCore::setLoadThreshold(uint8_t percent) {
+  _loadThreshold = percent > 100 ? 100 : percent;
+}
+
+uint8_t CANPubSubBrokerCore::getLoadThreshold() {
+  return _loadThreshold;
+}
+
+bool CANPubSubBrokerCore::isBusCongested() {
+  return _busCongested;
+}
+
+int CANPubSubBrokerCore::findPingState(uint8_t clientId) {
+  for (uint8_t i = 0; i < _pingStateCount; i++) {
+    if (_pingStates[i].clientId == clientId) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void CANPubSubBrokerCore::initPingState(uint8_t clientId) {
+  // Check if already exists
+  int index = findPingState(clientId);
+  
+  if (index >= 0) {
+    // Reset existing state
+    _pingStates[index].lastPongTime = millis();
+    _pingStates[index].missedPings = 0;
+  } else if (_pingStateCount < _mappingCapacity) {
+    // Create new state
+    _pingStates[_pingStateCount].clientId = clientId;
+    _pingStates[_pingStateCount].lastPongTime = millis();
+    _pingStates[_pingStateCount].missedPings = 0;
+    _pingStateCount++;
+  }
+}
+
+bool CANPubSubBrokerCore::setClientOnline(uint8_t clientId) {
+  uint32_t bit = 1UL << (clientId & 31);
+  uint32_t& word = _onlineClients[clientId >> 5];
+  if (word & bit) return false;
+  word |= bit;
+  return true;
+}
+
+bool CANPubSubBrokerCore::clearClientOnline(uint8_t clientId) {
+  uint32_t bit = 1UL << (clientId & 31);
+  uint32_t& word = _onlineClients[clientId >> 5];
+  if (!(word & bit)) return false;
+  word &= ~bit;
+  return true;
+}
+
+void CANPubSubBrokerCore::trackClientActivity(uint8_t clientId) {
+  // Mark client online, set bit test keeps this O(1) on every received frame
+  if (setClientOnline(clientId)) {
+    // Call connect callback if this is a new connection
+    notifyClientConnect(clientId);
+  }
+  
+  // Liveness for the current ping round, judged when the next one starts
+  _heardClients[clientId >> 5] |= 1UL << (clientId & 31);
+}
+
+void CANPubSubBrokerCore::notifyClientConnect(uint8_t clientId) {
+#if CAN_PS_TASKS
+  if (_routeTaskHandle) {
+    if (_onClientConnect) postEvent(CAN_PS_EVENT_CONNECT, clientId, 0, NULL, 0);
+    return;
+  }
+#endif
+  if (_onClientConnect) {
+    _onClientConnect(clientId);
+  }
+}
+
+void CANPubSubBrokerCore::notifyClientDisconnect(uint8_t clientId) {
+#if CAN_PS_TASKS
+  if (_routeTaskHandle) {
+    if (_onClientDisconnect) postEvent(CAN_PS_EVENT_DISCONNECT, clientId, 0, NULL, 0);
+    return;
+  }
+#endif
+  if (_onClientDisconnect) {
+    _onClientDisconnect(clientId);
+  }
+}
+
+void CANPubSubBrokerCore::notifyPublish(uint16_t topicHash, const uint8_t* data, size_t length) {
+#if CAN_PS_TASKS
+  if (_routeTaskHandle) {
+    if (_onPublish || _onPublishBinary) postEvent(CAN_PS_EVENT_PUBLISH, 0, topicHash, data, length);
+    return;
+  }
+#endif
+  if (_onPublishBinary) {
+    _onPublishBinary(topicHash, data, length);
+  }
+  
+  // String callback only pays for allocation when registered
+  if (_onPublish) {
+    // Get topic name from stored mapping (learned from SUBSCRIBE)
+    _onPublish(topicHash, String(getTopicName(topicHash)), payloadToString(data, length));
+  }
+}
+
+void CANPubSubBrokerCore::notifyDirectMessage(uint8_t senderId, const String& message) {
+#if CAN_PS_TASKS
+  if (_routeTaskHandle) {
+    if (_onDirectMessage) postEvent(CAN_PS_EVENT_DIRECT, senderId, 0, (const uint8_t*)message.c_str(), message.length());
+    return;
+  }
+#endif
+  if (_onDirectMessage) {
+    _onDirectMessage(senderId, message);
+  }
+}
+
+void CANPubSubBrokerCore::sendToClient(uint8_t clientId, uint16_t topicHash, const String& message) {
+  sendToClient(clientId, topicHash, (const uint8_t*)message.c_str(), message.length());
+}
+
+void CANPubSubBrokerCore::sendToClient(uint8_t clientId, uint16_t topicHash, const uint8_t* data, size_t length) {
+  sendTopicData(clientId, topicHash, data, length, getTopicPriority(topicHash));
+}
+
+void CANPubSubBrokerCore::sendTopicData(uint8_t clientId, uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority) {
+  // Calculate total message size: clientId + topicHash + message
+  size_t totalSize = 1 + 2 + length;
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long messages
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    size_t copyLength = min(length, (size_t)(MAX_EXTENDED_MSG_SIZE - 3));
+    buffer[0] = clientId;
+    buffer[1] = topicHash >> 8;
+    buffer[2] = topicHash & 0xFF;
+    memcpy(buffer + 3, data, copyLength);
+    
+    sendExtendedMessage(CAN_PS_TOPIC_DATA, buffer, 3 + copyLength, priority);
+  } else {
+    beginFrame(CAN_PS_TOPIC_DATA, priority);
+    _can->write(clientId);
+    _can->write(topicHash >> 8);
+    _can->write(topicHash & 0xFF);
+    _can->write(data, length);
+    endFrame();
+  }
+}
+
+void CANPubSubBrokerCore::sendDirectMessage(uint8_t clientId, const String& message) {
+  // Calculate total message size: brokerId + clientId + message
+  size_t totalSize = 1 + 1 + message.length();
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long messages
+    // Format: [brokerID][clientID][message...]
+    // processExtendedFrame will extract brokerID as senderId from first byte
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    buffer[0] = CAN_PS_BROKER_ID;
+    buffer[1] = clientId;
+    memcpy(buffer + 2, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 2)));
+    
+    sendExtendedMessage(CAN_PS_DIRECT_MSG, buffer, min(2 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
+  } else {
+    beginFrame(CAN_PS_DIRECT_MSG);
+    _can->write(CAN_PS_BROKER_ID);
+    _can->write(clientId);
+    _can->print(message);
+    endFrame();
+  }
+}
+
+void CANPubSubBrokerCore::broadcastMessage(uint16_t topicHash, const String& message) {
+  broadcastMessage(topicHash, (const uint8_t*)message.c_str(), message.length());
+}
+
+void CANPubSubBrokerCore::broadcastMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  forwardToSubscribers(topicHash, data, length, getTopicPriority(topicHash));
+}
+
+bool CANPubSubBrokerCore::sendTransfer(uint8_t clientId, const uint8_t* data, size_t length, uint8_t tag) {
+  if (clientId == CAN_PS_BROKER_ID || clientId == CAN_PS_UNASSIGNED_ID) return false;
+  return startTransfer(clientId, data, length, tag);
+}
+
+uint8_t CANPubSubBrokerCore::getClientCount() {
+  uint16_t count = 0;
+  for (uint8_t i = 0; i < 256 / 32; i++) {
+    count += __builtin_popcountl((unsigned long)_onlineClients[i]);
+  }
+  return count > 255 ? 255 : count;
+}
+
+uint8_t CANPubSubBrokerCore::getSubscriptionCount() {
+  return _subTableSize;
+}
+
+uint8_t CANPubSubBrokerCore::getWildcardCount() {
+  return _wildcardCount;
+}
+
+uint8_t CANPubSubBrokerCore::getSubscriberCapacity() {
+  return _subscribersPerTopic;
+}
+
+void CANPubSubBrokerCore::getSubscribers(uint16_t topicHash, uint8_t* subscribers, uint8_t* count) {
+  int i = findSubscription(topicHash);
+  if (i < 0) {
+    *count = 0;
+    return;
+  }
+  *count = _subscriptions[i].subCount;
+  memcpy(subscribers, _subscriptions[i].subscribers, _subscriptions[i].subCount);
+}
+
+void CANPubSubBrokerCore::listSubscribedTopics(std::function<void(uint16_t hash, const String& name, uint8_t subscriberCount)> callback) {
+  if (!callback) return;
+  
+  // Show active subscriptions (includes restored subscriptions from storage)
+  for (uint8_t i = 0; i < _subTableSize; i++) {
+    uint16_t hash = _subscriptions[i].topicHash;
+    String name = getTopicName(hash);
+    uint8_t count = _subscriptions[i].subCount;
+    callback(hash, name, count);
+  }
+  
+  // Also show stored topics that don't have active subscribers (after power cycle)
+  // This helps show what topics are in storage even if clients haven't reconnected
+  for (uint8_t i = 0; i < _storedTopicCount; i++) {
+    if (!_storedTopicNames[i].active) continue;
+    
+    uint16_t hash = _storedTopicNames[i].hash;
+    
+    // If not already in the active subscriptions, show it with 0 subscribers
+    if (findSubscription(hash) < 0) {
+      String name = _storedTopicNames[i].getName();
+      callback(hash, name, 0);
+    }
+  }
+}
+
+// ===== Client ID Mapping Methods =====
+
+void CANPubSubBrokerCore::handleIdRequestWithSerial() {
+  // Read serial number from CAN message
+  String serialNumber = "";
+  while (_can->available()) {
+    serialNumber += (char)_can->read();
+  }
+  
+  if (serialNumber.length() == 0) {
+    // No serial number provided - assign temporary ID (not saved to storage)
+    assignClientID();
+    return;
+  }
+  
+  // Find or create client ID for this serial number (will be saved to storage)
+  uint8_t assignedId = assignSerialClientId(serialNumber);
+  
+  // Check if this is a returning client (has stored subscriptions)
+  int subIndex = findStoredSubscription(assignedId);
+  bool hasStoredSubs = (subIndex >= 0 && _storedSubscriptions[subIndex].topicCount > 0);
+  
+  // Send response with serial number included so client can verify it's for them
+  // Format: [assignedId][hasStoredSubs][serialNumberLength][serialNumber...]
+  size_t totalSize = 1 + 1 + 1 + serialNumber.length();
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long serial numbers
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    buffer[0] = assignedId;
+    buffer[1] = hasStoredSubs ? 0x01 : 0x00;
+    buffer[2] = (uint8_t)serialNumber.length();
+    memcpy(buffer + 3, serialNumber.c_str(), min(serialNumber.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 3)));
+    
+    sendExtendedMessage(CAN_PS_ID_RESPONSE, buffer, min(3 + serialNumber.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
+  } else {
+    beginFrame(CAN_PS_ID_RESPONSE);
+    _can->write(assignedId);
+    _can->write(hasStoredSubs ? 0x01 : 0x00); // Flag: has stored subscriptions
+    _can->write((uint8_t)serialNumber.length());
+    _can->print(serialNumber);
+    endFrame();
+  }
+  
+  // Track connected client (marks as online)
+  trackClientActivity(assignedId);
+  
+  // Restore stored subscriptions for this client (if any) from loop()
+  if (hasStoredSubs) {
+    scheduleRestore(assignedId);
+  }
+}
+
+uint8_t CANPubSubBrokerCore::findOrCreateClientId(const String& serialNumber) {
+  // Check if this serial number already has an ID
+  int index = findClientMapping(serialNumber);
+  
+  if (index >= 0) {
+    // Found existing mapping, mark as registered and return the same ID.
+    // A reconnect of a registered client, the common case, does not touch flash
+    if (!_clientMappings[index].registered) {
+      _clientMappings[index].registered = true;
+      markStorageDirty(STORAGE_TABLE_MAPPINGS);
+    }
+    
+    // Initialize ping tracking if auto-ping is enabled
+    if (_autoPingEnabled) {
+      initPingState(_clientMappings[index].clientId);
+    }
+    
+    return _clientMappings[index].clientId;
+  }
+  
+  // No existing mapping, create a new one
+  if (_mappingCount < _mappingCapacity) {
+    _clientMappings[_mappingCount].clientId = _nextClientID;
+    _clientMappings[_mappingCount].setSerial(serialNumber);
+    _clientMappings[_mappingCount].registered = true;
+    _mappingCount++;
+    
+    uint8_t assignedId = _nextClientID;
+    
+    // Increment for next client
+    _nextClientID++;
+    if (_nextClientID == 0xFF) {
+      _nextClientID = 0x01; // Wrap around, skip special IDs
+    }
+    
+    // Initialize ping tracking if auto-ping is enabled
+    if (_autoPingEnabled) {
+      initPingState(assignedId);
+    }
+    
+    markStorageDirty(STORAGE_TABLE_MAPPINGS); // New mapping, written behind with the other tables
+    return assignedId;
+  }
+  
+  // Mapping table full, return error (use 0xFF)
+  return CAN_PS_UNASSIGNED_ID;
+}
+
+uint8_t CANPubSubBrokerCore::assignSerialClientId(const String& serialNumber) {
+  uint8_t clientId = findOrCreateClientId(serialNumber);
+  resetQosState(clientId);  // A client asking for its ID may have restarted its sequence numbers
+  return clientId;
+}
+
+int CANPubSubBrokerCore::findClientMapping(const String& serialNumber) {
+  for (uint8_t i = 0; i < _mappingCount; i++) {
+    if (_clientMappings[i].getSerial() == serialNumber) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int CANPubSubBrokerCore::findClientMappingById(uint8_t clientId) {
+  for (uint8_t i = 0; i < _mappingCount; i++) {
+    if (_clientMappings[i].clientId == clientId) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+uint8_t CANPubSubBrokerCore::registerClient(const String& serialNumber) {
+  return findOrCreateClientId(serialNumber);
+}
+
+bool CANPubSubBrokerCore::unregisterClient(uint8_t clientId) {
+  int index = findClientMappingById(clientId);
+  if (index >= 0) {
+    _clientMappings[index].registered = false;
+    // Remove all subscriptions for this client
+    removeAllSubscriptions(clientId);
+    saveMappingsToStorage(); // Save state change
+    return true;
+  }
+  return false;
+}
+
+bool CANPubSubBrokerCore::unregisterClientBySerial(const String& serialNumber) {
+  int index = findClientMapping(serialNumber);
+  if (index >= 0) {
+    _clientMappings[index].registered = false;
+    // Remove all subscriptions for this client
+    removeAllSubscriptions(_clientMappings[index].clientId);
+    saveMappingsToStorage(); // Save state change
+    return true;
+  }
+  return false;
+}
+
+uint8_t CANPubSubBrokerCore::getClientIdBySerial(const String& serialNumber) {
+  int index = findClientMapping(serialNumber);
+  if (index >= 0) {
+    return _clientMappings[index].clientId;
+  }
+  return CAN_PS_UNASSIGNED_ID;
+}
+
+String CANPubSubBrokerCore::getSerialByClientId(uint8_t clientId) {
+  int index = findClientMappingById(clientId);
+  if (index >= 0) {
+    return _clientMappings[index].getSerial();
+  }
+  return "";
+}
+
+bool CANPubSubBrokerCore::updateClientSerial(uint8_t clientId, const String& newSerial) {
+  int index = findClientMappingById(clientId);
+  if (index >= 0) {
+    // Check if new serial already exists
+    if (findClientMapping(newSerial) >= 0) {
+      return false; // Serial already in use
+    }
+    _clientMappings[index].setSerial(newSerial);
+    saveMappingsToStorage(); // Save change
+    return true;
+  }
+  return false;
+}
+
+uint8_t CANPubSubBrokerCore::getRegisteredClientCount() {
+  // Count only registered clients (registered=true)
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < _mappingCount; i++) {
+    if (_clientMappings[i].registered) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void CANPubSubBrokerCore::listRegisteredClients(std::function<void(uint8_t id, const String& serial, bool registered)> callback) {
+  if (!callback) return;
+  
+  for (uint8_t i = 0; i < _mappingCount; i++) {
+    callback(_clientMappings[i].clientId, 
+             _clientMappings[i].getSerial(), 
+             _clientMappings[i].registered);
+  }
+}
+
+bool CANPubSubBrokerCore::isClientOnline(uint8_t clientId) {
+  return (_onlineClients[clientId >> 5] >> (clientId & 31)) & 1;
+}
+
+uint8_t CANPubSubBrokerCore::getClientSubscriptionCount(uint8_t clientId) {
+  // Count how many topics this client is subscribed to
+  int topics = findClientTopics(clientId);
+  return topics < 0 ? 0 : _clientTopics[topics].topicCount;
+}
+
+uint8_t CANPubSubBrokerCore::localNodeId() {
+  return CAN_PS_BROKER_ID;
+}
+
+void CANPubSubBrokerCore::onExtendedMessageComplete(uint8_t msgType, uint8_t senderId, const uint8_t* data, size_t length) {
+  // Handle extended messages based on type
+  switch (msgType) {
+    case CAN_PS_ID_REQUEST: {
+      // Extended ID request with serial number
+      // Note: A placeholder byte (0x00) was extracted by processExtendedFrame as "senderId"
+      // The actual serial number is in the data buffer
+      String serialNumber = "";
+      for (size_t i = 0; i < length; i++) {
+        serialNumber += (char)data[i];
+      }
+      
+      if (serialNumber.length() == 0) {
+        // No serial number provided - reject by not sending a response
+        return;
+      }
+      
+      uint8_t assignedId = assignSerialClientId(serialNumber);
+      
+      // Check if this is a returning client (has stored subscriptions)
+      int subIndex = findStoredSubscription(assignedId);
+      bool hasStoredSubs = (subIndex >= 0 && _storedSubscriptions[subIndex].topicCount > 0);
+      
+      // Send response with serial number included so client can verify it's for them
+      // Format: [assignedId][hasStoredSubs][serialNumberLength][serialNumber...]
+      size_t totalSize = 1 + 1 + 1 + serialNumber.length();
+      
+      if (totalSize > CAN_FRAME_DATA_SIZE) {
+        // Use extended message for long serial numbers
+        uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+        buffer[0] = assignedId;
+        buffer[1] = hasStoredSubs ? 0x01 : 0x00;
+        buffer[2] = (uint8_t)serialNumber.length();
+        memcpy(buffer + 3, serialNumber.c_str(), min(serialNumber.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 3)));
+        
+        sendExtendedMessage(CAN_PS_ID_RESPONSE, buffer, min(3 + serialNumber.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
+      } else {
+        beginFrame(CAN_PS_ID_RESPONSE);
+        _can->write(assignedId);
+        _can->write(hasStoredSubs ? 0x01 : 0x00);
+        _can->write((uint8_t)serialNumber.length());
+        _can->print(serialNumber);
+        endFrame();
+      }
+      
+      // Track connected client if not already tracked
+      if (setClientOnline(assignedId)) {
+        notifyClientConnect(assignedId);
+      }
+      
+      // Restore stored subscriptions for this client (if any) from loop()
+      if (hasStoredSubs) {
+        scheduleRestore(assignedId);
+      }
+      break;
+    }
+    
+    case CAN_PS_SUBSCRIBE: {
+      // Extended subscribe with full topic name
+      // Format (in buffer): [topicHash_h][topicHash_l][topic_name...]
+      // Note: clientId was already extracted by processExtendedFrame from first byte
+      if (length < 2) return;
+      
+      uint8_t clientId = senderId; // Use the extracted sender ID
+      uint16_t topicHash = (data[0] << 8) | data[1];
+      String topicName = "";
+      
+      for (size_t i = 2; i < length; i++) {
+        topicName += (char)data[i];
+      }
+      
+      if (topicName.length() > 0 && registerTopic(topicName)) {
+        // Also persist topic name to flash storage
+        storeTopicName(topicHash, topicName);
+        completeWildcardMatch(topicHash, topicName.c_str());
+      }
+      
+      addSubscription(clientId, topicHash);
+      sendRetained(clientId, topicHash);
+      
+      // Track client activity (marks as online)
+      trackClientActivity(clientId);
+      
+      break;
+    }
+    
+    case CAN_PS_PUBLISH: {
+      // Extended publish with long message
+      // Format (in buffer): [topicHash_h][topicHash_l][message...]
+      // Note: publisherId was already extracted by processExtendedFrame from first byte
+      if (length < 2) return;
+      
+      uint8_t publisherId = senderId; // Use the extracted sender ID
+      uint16_t topicHash = (data[0] << 8) | data[1];
+      
+      // Track client activity (marks as online)
+      trackClientActivity(publisherId);
+      
+      // Route straight out of the reassembly buffer
+      dispatchPublish(publisherId, topicHash, data + 2, length - 2);
+      break;
+    }
+    
+    case CAN_PS_PUBLISH_BATCH: {
+      // Batched publishes from one client
+      // Format (in buffer): {[topicHash_h][topicHash_l][length][data...]}
+      // Note: publisherId was already extracted by processExtendedFrame from first byte
+      dispatchPublishBatch(senderId, data, length);
+      break;
+    }
+    
+    case CAN_PS_PUBLISH_QOS: {
+      // Reliable publish with a long message
+      // Format (in buffer): [seq][topicHash_h][topicHash_l][message...]
+      // Note: publisherId was already extracted by processExtendedFrame from first byte
+      dispatchPublishQos(senderId, data, length);
+      break;
+    }
+    
+    case CAN_PS_TOPIC_NAME_REQUEST: {
+      // Topic names a client lacks after a batched restore
+      // Format (in buffer): [topicHash_h][topicHash_l]...
+      // Note: clientId was already extracted by processExtendedFrame from first byte
+      dispatchTopicNameRequest(senderId, data, length);
+      break;
+    }
+    
+    case CAN_PS_TOPIC_NAME: {
+      // Topic names a publisher sends on our request
+      // Format (in buffer): {[topicHash_h][topicHash_l][nameLength][name...]}
+      // Note: clientId was already extracted by processExtendedFrame from first byte
+      dispatchTopicNames(senderId, data, length);
+      break;
+    }
+    
+    case CAN_PS_DIRECT_MSG: {
+      // Extended direct message from client to broker
+      // Format (in buffer): [message...]
+      // Note: senderId (client ID) was already extracted by processExtendedFrame from first byte
+      
+      // Track client activity (marks as online)
+      trackClientActivity(senderId);
+      
+      String message = "";
+      for (size_t i = 0; i < length; i++) {
+        message += (char)data[i];
+      }
+      
+      notifyDirectMessage(senderId, message);
+      
+      // Send acknowledgment
+      beginFrame(CAN_PS_ACK);
+      _can->write(CAN_PS_BROKER_ID);
+      _can->write(senderId);
+      _can->print("ACK");
+      endFrame();
+      break;
+    }
+    
+    case CAN_PS_PEER_MSG: {
+      // Extended peer message from client to client (forwarded by broker)
+      // Format (in buffer): [targetId][message...]
+      // Note: senderId was already extracted by processExtendedFrame from first byte
+      if (length < 1) return;
+      
+      uint8_t targetId = data[0];
+      
+      // Track client activity (marks as online)
+      trackClientActivity(senderId);
+      
+      // Verify sender has a permanent ID (registered with serial number)
+      int senderIndex = findClientMappingById(senderId);
+      if (senderIndex < 0) {
+        // Sender doesn't have permanent ID, reject
+        return;
+      }
+      
+      // Verify target has a permanent ID
+      int targetIndex = findClientMappingById(targetId);
+      if (targetIndex < 0) {
+        // Target doesn't have permanent ID, reject
+        return;
+      }
+      
+      // Forward message to target client
+      forwardPeerMessage(senderId, targetId, data + 1, length - 1);
+      break;
+    }
+  }
+}
+
+// ===== CANPubSubClient Implementation =====
+
+CANPubSubClientCore::CANPubSubClientCore(CANControllerClass& can, const CANPubSubTables& tables,
+                                         uint16_t* subscribedTopics, uint8_t topicCapacity, uint8_t* batch, uint16_t batchSize,
+                                         QosPublish* qosOutbox, uint8_t qosWindow)
+  : CANPubSubBase(can, tables),
+    _clientId(CAN_PS_UNASSIGNED_ID),
+    _connected(false),
+    _subscribedTopics(subscribedTopics),
+    _subscribedTopicCount(0),
+    _subscribedTopicCapacity(topicCapacity),
+    _lastPing(0),
+    _lastPong(0),
+    _hardwareFilterEnabled(false),
+    _connecting(false),
+    _connectWithSerial(false),
+    _connectAttempts(0),
+    _connectStart(0),
+    _connectTimeout(0),
+    _connectLast(0),
+    _connectWait(0),
+    _connectDelay(CAN_PS_DEFAULT_CONNECT_BACKOFF_MIN),
+    _backoffMin(CAN_PS_DEFAULT_CONNECT_BACKOFF_MIN),
+    _backoffMax(CAN_PS_DEFAULT_CONNECT_BACKOFF_MAX),
+    _random(0x9E3779B9UL),
+    _restoring(false),
+    _restoreNamesAsked(false),
+    _restoreStart(0),
+    _heartbeatPending(false),
+    _heartbeatSeq(0),
+    _heartbeatReceived(0),
+    _heartbeatDelay(0),
+    _heartbeatTxMark(0),
+    _batch(batch),
+    _batchSize(batchSize),
+    _batchLength(0),
+    _batchCount(0),
+    _batchPriority(CAN_PS_PRIORITY_NORMAL),
+    _batchingEnabled(false),
+    _batchLatency(CAN_PS_DEFAULT_BATCH_LATENCY),
+    _batchStart(0),
+    _qosOutbox(qosOutbox),
+    _qosWindow(qosWindow),
+    _qosSeq(0),
+    _qosPending(0),
+    _qosTimeout(CAN_PS_DEFAULT_QOS_TIMEOUT),
+    _qosRetries(CAN_PS_DEFAULT_QOS_RETRIES),
+    _onMessage(nullptr),
+    _onMessageBinary(nullptr),
+    _onDirectMessage(nullptr),
+    _onConnect(nullptr),
+    _onDisconnect(nullptr),
+    _onPong(nullptr),
+    _onPublishDone(nullptr) {
+  memset(_subscribedTopics, 0, _subscribedTopicCapacity * sizeof(uint16_t));
+  memset(_qosOutbox, 0, _qosWindow * sizeof(QosPublish));
+}
+
+bool CANPubSubClientCore::begin(unsigned long timeout) {
+  return connect(timeout);
+}
+
+bool CANPubSubClientCore::begin(const String& serialNumber, unsigned long timeout) {
+  return connect(serialNumber, timeout);
+}
+
+void CANPubSubClientCore::end() {
+  flush();
+  abortTransfer();
+  for (uint8_t i = 0; i < _qosWindow; i++) {
+    if (_qosOutbox[i].active) {
+      finishQosPublish(_qosOutbox[i], false);
+    }
+  }
+  if (_hardwareFilterEnabled) {
+    _can->clearFilter();
+  }
+  _connected = false;
+  _connecting = false;
+  _heartbeatPending = false;
+  _clientId = CAN_PS_UNASSIGNED_ID;
+  _subscribedTopicCount = 0;
+  _serialNumber = "";
+}
+
+bool CANPubSubClientCore::connect(unsigned long timeout) {
+  startConnect(false, timeout, 0);
+  
+  unsigned long startTime = millis();
+  while (_clientId == CAN_PS_UNASSIGNED_ID && (millis() - startTime) < timeout) {
+    int packetSize = _can->parsePacket();
+    if (packetSize > 0) {
+      handleMessage(packetSize);
+    } else {
+      retryConnect();
+      yield();
+    }
+  }
+  _connecting = false;
+  
+  if (_clientId != CAN_PS_UNASSIGNED_ID) {
+    _connected = true;
+    if (_onConnect) {
+      _onConnect();
+    }
+    return true;
+  }
+  
+  return false;
+}
+
+bool CANPubSubClientCore::connect(const String& serialNumber, unsigned long timeout) {
+  _serialNumber = serialNumber;
+  startConnect(true, timeout, 0);
+  
+  unsigned long startTime = millis();
+  bool idReceived = false;
+  
+  // Wait for ID assignment and subscription restoration
+  while ((millis() - startTime) < timeout) {
+    int packetSize = _can->parsePacket();
+    if (packetSize > 0) {
+      handleMessage(packetSize);
+      
+      // Check if we just received our ID
+      if (!idReceived && _clientId != CAN_PS_UNASSIGNED_ID) {
+        idReceived = true;
+      }
+    }
+    
+    // Done once the stored subscriptions are restored
+    if (idReceived && !isRestoring()) {
+      break;
+    }
+    
+    // Keep polling without sleeping so back-to-back restore frames are not dropped
+    if (packetSize <= 0) {
+      if (!idReceived) {
+        retryConnect();
+      }
+      yield();
+    }
+  }
+  _connecting = false;
+  
+  if (_clientId != CAN_PS_UNASSIGNED_ID) {
+    _connected = true;
+    if (_onConnect) {
+      _onConnect();
+    }
+    return true;
+  }
+  
+  return false;
+}
+
+void CANPubSubClientCore::connectAsync(unsigned long timeout) {
+  startConnect(false, timeout, _backoffMin);
+}
+
+void CANPubSubClientCore::connectAsync(const String& serialNumber, unsigned long timeout) {
+  _serialNumber = serialNumber;
+  startConnect(true, timeout, _backoffMin);
+}
+
+bool CANPubSubClientCore::isConnecting() {
+  return _connecting;
+}
+
+bool CANPubSubClientCore::isRestoring() {
+  // A broker restoring one topic at a time never says it is done, nor does a lost batch
+  if (_restoring && millis() - _restoreStart >= CAN_PS_RESTORE_WAIT) {
+    _restoring = false;
+  }
+  return _restoring;
+}
+
+void CANPubSubClientCore::setConnectBackoff(unsigned long minMs, unsigned long maxMs) {
+  _backoffMin = minMs > 0 ? minMs : 1;
+  _backoffMax = maxMs > _backoffMin ? maxMs : _backoffMin;
+}
+
+uint8_t CANPubSubClientCore::getConnectAttempts() {
+  return _connectAttempts;
+}
+
+void CANPubSubClientCore::startConnect(bool withSerial, unsigned long timeout, unsigned long firstDelay) {
+  // Clear subscriptions on (re)connect - they will be restored by broker if persistent
+  _subscribedTopicCount = 0;
+  memset(_subscribedTopics, 0, _subscribedTopicCapacity * sizeof(uint16_t));
+  
+  // Forget the old ID so the new assignment is recognised
+  _clientId = CAN_PS_UNASSIGNED_ID;
+  _connected = false;
+  _restoring = false;
+  
+  _connecting = true;
+  _connectWithSerial = withSerial;
+  _connectAttempts = 0;
+  _connectStart = millis();
+  _connectTimeout = timeout;
+  _connectDelay = _backoffMin;
+  
+  // Nodes running the same firmware must not draw the same jitter: mix in the
+  // serial number and the time since boot
+  uint16_t hash = hashTopic(_serialNumber);
+  _random ^= ((uint32_t)hash << 16) ^ hash ^ micros();
+  if (_random == 0) {
+    _random = 0x9E3779B9UL;
+  }
+  
+  applyHardwareFilter();
+  
+  // The first request goes out after a random part of firstDelay, so clients
+  // reconnecting after a broker restart don't all transmit at once
+  _connectLast = _connectStart;
+  _connectWait = firstDelay > 0 ? nextRandom() % firstDelay : 0;
+  retryConnect();
+}
+
+bool CANPubSubClientCore::retryConnect() {
+  unsigned long now = millis();
+  if (_connectTimeout > 0 && (now - _connectStart) >= _connectTimeout) {
+    return false;
+  }
+  if ((now - _connectLast) < _connectWait) {
+    return true;
+  }
+  
+  if (_connectWithSerial) {
+    requestClientIDWithSerial(_serialNumber);
+  } else {
+    requestClientID();
+  }
+  if (_connectAttempts < 255) {
+    _connectAttempts++;
+  }
+  
+  // Wait a random time in [delay/2, delay], then double the delay
+  _connectLast = now;
+  _connectWait = _connectDelay / 2 + nextRandom() % (_connectDelay / 2 + 1);
+  _connectDelay = (_connectDelay >= _backoffMax / 2) ? _backoffMax : _connectDelay * 2;
+  return true;
+}
+
+uint32_t CANPubSubClientCore::nextRandom() {
+  // xorshift32, stirred with the loop timing of this node
+  uint32_t x = _random ^ micros();
+  if (x == 0) {
+    x = 0x9E3779B9UL;
+  }
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  _random = x;
+  return x;
+}
+
+bool CANPubSubClientCore::isConnected() {
+  return _connected;
+}
+
+uint8_t CANPubSubClientCore::getClientId() {
+  return _clientId;
+}
+
+String CANPubSubClientCore::getSerialNumber() {
+  return _serialNumber;
+}
+
+void CANPubSubClientCore::loop() {
+#if CAN_PS_STATS
+  unsigned long loopStart = micros();
+#endif
+  
+  // Drain pending frames in bulk (RX queue or hardware buffers), bounded per call
+  for (uint8_t i = 0; i < CAN_PS_MAX_FRAMES_PER_LOOP; i++) {
+    int packetSize = _can->parsePacket();
+    if (packetSize <= 0) break;
+    handleMessage(packetSize);
+  }
+  
+  // Asynchronous connect: done once an ID is assigned, otherwise retry when due
+  if (_connecting) {
+    if (_clientId != CAN_PS_UNASSIGNED_ID) {
+      _connecting = false;
+      _connected = true;
+      if (_onConnect) {
+        _onConnect();
+      }
+    } else if (!retryConnect()) {
+      _connecting = false;
+    }
+  }
+  
+  serviceTransfers();
+  serviceBus();
+  
+  // Answer a group heartbeat once our slot has come up
+  if (_heartbeatPending && (millis() - _heartbeatReceived >= _heartbeatDelay)) {
+    sendHeartbeatPong();
+  }
+  
+  // Send queued publishes once the oldest has used up the latency budget
+  if (_batchCount > 0 && (millis() - _batchStart >= _batchLatency)) {
+    flush();
+  }
+  
+  // Resend reliable publishes whose ACK is overdue
+  if (_qosPending > 0) {
+    serviceQosPublishes();
+  }
+  
+#if CAN_PS_STATS
+  statsLoop(loopStart);
+#endif
+}
+
+void CANPubSubClientCore::handleMessage(int packetSize) {
+#if CAN_PS_STATS
+  statsRxFrame();
+#endif
+  
+  if (handleTransferFrame()) {
+    return;
+  }
+  
+  // Check for extended frames first
+  if (_can->packetExtended()) {
+    processExtendedFrame(packetSize);
+    return;
+  }
+  
+  uint8_t msgType = _can->packetId();
+  
+  switch (msgType) {
+    case CAN_PS_ID_RESPONSE:
+      handleIdAssignment();
+      break;
+    case CAN_PS_SUBSCRIBE:
+      handleSubscribeNotification();
+      break;
+    case CAN_PS_SUB_RESTORE:
+      handleSubscriptionRestore();
+      break;
+    case CAN_PS_SUB_RESTORE_BATCH:
+      handleRestoreBatch();
+      break;
+    case CAN_PS_TOPIC_NAME_REQUEST:
+      handleTopicNameRequest();
+      break;
+    case CAN_PS_TOPIC_NAME:
+      handleTopicName();
+      break;
+    case CAN_PS_TOPIC_DATA:
+      handleTopicData();
+      break;
+    case CAN_PS_TOPIC_MCAST:
+      handleTopicMulticast();
+      break;
+    case CAN_PS_DIRECT_MSG:
+      handleDirectMessageReceived();
+      break;
+    case CAN_PS_PEER_MSG:
+      // Handle standard peer messages (extended peer messages go through onExtendedMessageComplete)
+      // Only the broker's forwarded copy counts: the sender's own frame reaches us too,
+      // but the broker may still reject it (sender or target without a permanent ID)
+      if (packetDownlink() && _can->available() >= 2) {
+        uint8_t senderId = _can->read();
+        uint8_t targetId = _can->read();
+        
+        if (targetId == _clientId) {
+          // This message is for us
+          String message = "";
+          while (_can->available()) {
+            message += (char)_can->read();
+          }
+          
+          if (_onDirectMessage) {
+            _onDirectMessage(senderId, message);
+          }
+        }
+        // Note: Messages not for us are silently discarded to avoid processing
+        // forwarded peer messages intended for other clients
+      }
+      break;
+    case CAN_PS_PING:
+      // Broker is pinging us, respond with pong
+      if (_can->available() >= 2) {
+        uint8_t senderId = _can->read();  // Broker ID
+        uint8_t targetId = _can->read();  // Our ID
+        if (targetId == _clientId) {
+          // Send pong response
+          beginFrame(CAN_PS_PONG);
+          _can->write(_clientId);
+          _can->write(senderId);
+          endFrame();
+        }
+      }
+      break;
+    case CAN_PS_PONG:
+      handlePong();
+      break;
+    case CAN_PS_HEARTBEAT:
+      handleHeartbeat();
+      break;
+    case CAN_PS_PUBLISH_ACK:
+      handlePublishAck();
+      break;
+    case CAN_PS_ACK:
+      // Acknowledgment received
+      break;
+  }
+}
+
+void CANPubSubClientCore::handleIdAssignment() {
+  if (_can->available() < 1) return;
+  
+  uint8_t assignedId = _can->read();
+  
+  // Check if there's a flag indicating stored subscriptions will be restored
+  bool hasStoredSubs = false;
+  if (_can->available() > 0) {
+    hasStoredSubs = (_can->read() == 0x01);
+  }
+  
+  // If serial number is provided, verify it matches ours
+  if (_can->available() > 0 && _serialNumber.length() > 0) {
+    uint8_t serialLen = _can->read();
+    String receivedSerial = "";
+    
+    for (uint8_t i = 0; i < serialLen && _can->available(); i++) {
+      receivedSerial += (char)_can->read();
+    }
+    
+    // Only accept this ID if the serial number matches
+    if (receivedSerial != _serialNumber) {
+      // This ID response is not for us, ignore it
+      return;
+    }
+  }
+  
+  _clientId = assignedId;
+  _connected = true;
+  
+  // If subscriptions will be restored, broker will send them shortly
+  // Client just needs to wait and handle incoming SUB_RESTORE messages
+  _restoring = hasStoredSubs;
+  _restoreNamesAsked = false;
+  _restoreStart = millis();
+}
+
+void CANPubSubClientCore::handleSubscribeNotification() {
+  // Broker is notifying us about a subscription (restored from storage)
+  // Format: [clientId][topicHash_h][topicHash_l][topicNameLen][topicName]
+  if (_can->available() < 4) return;
+  
+  uint8_t clientId = _can->read();
+  if (clientId != _clientId) return;
+  
+  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  uint8_t topicLen = _can->read();
+  
+  String topic = "";
+  for (uint8_t i = 0; i < topicLen && _can->available(); i++) {
+    topic += (char)_can->read();
+  }
+  
+  // Register the topic mapping locally
+  if (topic.length() > 0) {
+    registerTopic(topic);
+  }
+  
+  // Add to local subscription list
+  if (_subscribedTopicCount < _subscribedTopicCapacity) {
+    // Check if already subscribed
+    bool alreadySubscribed = false;
+    for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+      if (_subscribedTopics[i] == topicHash) {
+        alreadySubscribed = true;
+        break;
+      }
+    }
+    
+    if (!alreadySubscribed) {
+      _subscribedTopics[_subscribedTopicCount++] = topicHash;
+    }
+  }
+}
+
+void CANPubSubClientCore::handleTopicData() {
+  if (_can->available() < 3) return;
+  
+  uint8_t targetId = _can->read();
+  if (targetId != _clientId) return;
+  
+  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  
+  uint8_t payload[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(payload, sizeof(payload));
+  
+  deliverMessage(topicHash, payload, length);
+}
+
+void CANPubSubClientCore::deliverMessage(uint16_t topicHash, const uint8_t* data, size_t length) {
+  if (_onMessageBinary) {
+    _onMessageBinary(topicHash, data, length);
+  }
+  
+  // Call callback if registered
+  if (_onMessage) {
+    _onMessage(topicHash, String(getTopicName(topicHash)), payloadToString(data, length));
+  }
+}
+
+void CANPubSubClientCore::handleTopicMulticast() {
+  // Format: [topicHash_h][topicHash_l][message...]
+  if (_can->available() < 2) return;
+  
+  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  
+  // Multicast frames reach every node - keep only topics we subscribed to
+  if (!isSubscribed(topicHash)) return;
+  
+  uint8_t payload[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(payload, sizeof(payload));
+  
+  deliverMessage(topicHash, payload, length);
+}
+
+void CANPubSubClientCore::handleDirectMessageReceived() {
+  if (_can->available() < 2) return;
+  
+  uint8_t senderId = _can->read();
+  uint8_t targetId = _can->read();
+  
+  if (targetId != _clientId) return;
+  
+  String message = "";
+  while (_can->available()) {
+    message += (char)_can->read();
+  }
+  
+  // Call callback if registered
+  if (_onDirectMessage) {
+    _onDirectMessage(senderId, message);
+  }
+}
+
+void CANPubSubClientCore::handlePong() {
+  if (_can->available() < 2) return;
+  
+  uint8_t brokerId = _can->read();
+  uint8_t targetId = _can->read();
+  
+  if (targetId == _clientId) {
+    _lastPong = millis();
+    
+    // Call callback if registered
+    if (_onPong) {
+      _onPong();
+    }
+  }
+}
+
+void CANPubSubClientCore::handleHeartbeat() {
+  // Format: [brokerId][seq][slotMs][flags]
+  if (!_connected || _can->available() < 4) return;
+  
+  _can->read(); // Broker ID
+  uint8_t seq = _can->read();
+  uint8_t slotMs = _can->read();
+  uint8_t flags = _can->read();
+  
+  // Passive liveness: the frames we sent since the last heartbeat already
+  // told the broker we're alive
+  bool heard = (_framesSent != _heartbeatTxMark);
+  _heartbeatTxMark = _framesSent;
+  if ((flags & CAN_PS_HEARTBEAT_PASSIVE) && heard) {
+    _heartbeatPending = false;
+    return;
+  }
+  
+  _heartbeatSeq = seq;
+  _heartbeatReceived = millis();
+  _heartbeatDelay = (unsigned long)(_clientId % CAN_PS_HEARTBEAT_SLOTS) * slotMs;
+  _heartbeatPending = true;
+}
+
+void CANPubSubClientCore::sendHeartbeatPong() {
+  _heartbeatPending = false;
+  
+  // Regular pong, with the heartbeat sequence number appended
+  beginFrame(CAN_PS_PONG);
+  _can->write(_clientId);
+  _can->write(CAN_PS_BROKER_ID);
+  _can->write(_heartbeatSeq);
+  endFrame();
+  
+  _heartbeatTxMark = _framesSent;
+}
+
+void CANPubSubClientCore::handlePublishAck() {
+  // Format: [brokerId][clientId][firstSeq][lastSeq], the range is inclusive
+  if (_can->available() < 4) return;
+  
+  _can->read();  // Broker ID
+  uint8_t clientId = _can->read();
+  if (clientId != _clientId) return;
+  
+  uint8_t first = _can->read();
+  uint8_t span = (uint8_t)(_can->read() - first);
+  
+  for (uint8_t i = 0; i < _qosWindow && _qosPending > 0; i++) {
+    QosPublish& entry = _qosOutbox[i];
+    if (entry.active && (uint8_t)(entry.seq - first) <= span) {
+      finishQosPublish(entry, true);
+    }
+  }
+}
+
+void CANPubSubClientCore::handleSubscriptionRestore() {
+  // Broker is sending us a stored subscription with topic name
+  // Format: [clientId][topicHash][topicNameLength][topicName]
+  if (_can->available() < 4) return;
+  
+  uint8_t clientId = _can->read();
+  if (clientId != _clientId) return; // Not for us
+  
+  uint16_t topicHash = (_can->read() << 8) | _can->read();
+  uint8_t topicNameLen = _can->read();
+  
+  // Read topic name
+  String topicName = "";
+  for (uint8_t i = 0; i < topicNameLen && _can->available(); i++) {
+    topicName += (char)_can->read();
+  }
+  
+  // Register topic name in our local mapping
+  registerTopic(topicName);
+  
+  // Add to our subscribed topics list if not already present
+  bool alreadySubscribed = false;
+  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+    if (_subscribedTopics[i] == topicHash) {
+      alreadySubscribed = true;
+      break;
+    }
+  }
+  
+  if (!alreadySubscribed && _subscribedTopicCount < _subscribedTopicCapacity) {
+    _subscribedTopics[_subscribedTopicCount++] = topicHash;
+  }
+}
+
+void CANPubSubClientCore::handleRestoreBatch() {
+  if (_can->available() < 2) return;
+  
+  uint8_t clientId = _can->read();
+  
+  uint8_t message[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(message, sizeof(message));
+  
+  dispatchRestoreBatch(clientId, message, length);
+}
+
+void CANPubSubClientCore::dispatchRestoreBatch(uint8_t clientId, const uint8_t* message, size_t length) {
+  // Message: [flags]{[topicHash_h][topicHash_l][nameLength][name...]}
+  if (clientId != _clientId || length < 1) return; // Not for us
+  
+  uint8_t flags = message[0];
+  size_t pos = 1;
+  while (pos + 3 <= length) {
+    uint16_t topicHash = (message[pos] << 8) | message[pos + 1];
+    uint8_t nameLength = message[pos + 2];
+    pos += 3;
+    if (pos + nameLength > length) break;
+    
+    // Names only come in the answer to our request
+    if (nameLength > 0) {
+      String topicName = "";
+      for (uint8_t i = 0; i < nameLength; i++) {
+        topicName += (char)message[pos + i];
+      }
+      registerTopic(topicName);
+      pos += nameLength;
+    }
+    
+    bool alreadySubscribed = false;
+    for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+      if (_subscribedTopics[i] == topicHash) {
+        alreadySubscribed = true;
+        break;
+      }
+    }
+    
+    if (!alreadySubscribed && _subscribedTopicCount < _subscribedTopicCapacity) {
+      _subscribedTopics[_subscribedTopicCount++] = topicHash;
+    }
+  }
+  
+  if (!(flags & CAN_PS_RESTORE_LAST)) return;
+  
+  // Complete list: ask once for the names we do not know (e.g. after our own reboot)
+  if (!_restoreNamesAsked) {
+    _restoreNamesAsked = true;
+    if (requestMissingTopicNames()) return;
+  }
+  _restoring = false;
+}
+
+bool CANPubSubClientCore::requestMissingTopicNames() {
+  // Format: [clientId]{[topicHash_h][topicHash_l]}
+  uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+  size_t length = 1;
+  buffer[0] = _clientId;
+  
+  for (uint8_t i = 0; i < _subscribedTopicCount && length + 2 <= sizeof(buffer); i++) {
+    if (findTopicName(_subscribedTopics[i])) continue;
+    buffer[length++] = _subscribedTopics[i] >> 8;
+    buffer[length++] = _subscribedTopics[i] & 0xFF;
+  }
+  
+  if (length == 1) return false;
+  return sendExtendedMessage(CAN_PS_TOPIC_NAME_REQUEST, buffer, length);
+}
+
+void CANPubSubClientCore::handleTopicNameRequest() {
+  // Only the broker's requests, other clients send theirs after a restore
+  if (!packetDownlink() || _can->available() < 3) return;
+  
+  uint8_t clientId = _can->read();
+  
+  uint8_t hashes[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(hashes, sizeof(hashes));
+  
+  dispatchTopicNameRequest(clientId, hashes, length);
+}
+
+void CANPubSubClientCore::dispatchTopicNameRequest(uint8_t clientId, const uint8_t* hashes, size_t length) {
+  // The broker needs the name of a topic we published to match its wildcards
+  // Answer: [clientId]{[topicHash_h][topicHash_l][nameLength][name...]}, unknown hashes left out
+  if (clientId != _clientId) return;
+  
+  uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+  size_t pos = 1;
+  buffer[0] = _clientId;
+  
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    uint16_t topicHash = (hashes[i] << 8) | hashes[i + 1];
+    const char* name = findTopicName(topicHash);
+    if (!name) continue;
+    size_t nameLength = strlen(name);
+    if (nameLength > 255 || pos + 3 + nameLength > sizeof(buffer)) break;
+    
+    buffer[pos++] = topicHash >> 8;
+    buffer[pos++] = topicHash & 0xFF;
+    buffer[pos++] = (uint8_t)nameLength;
+    memcpy(buffer + pos, name, nameLength);
+    pos += nameLength;
+  }
+  
+  if (pos > 1) {
+    sendExtendedMessage(CAN_PS_TOPIC_NAME, buffer, pos);
+  }
+}
+
+void CANPubSubClientCore::handleTopicName() {
+  // A publisher's answer to the broker is not for us
+  if (!packetDownlink() || _can->available() < 4) return;
+  
+  uint8_t clientId = _can->read();
+  
+  uint8_t records[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(records, sizeof(records));
+  
+  dispatchTopicNames(clientId, records, length);
+}
+
+void CANPubSubClientCore::dispatchTopicNames(uint8_t clientId, const uint8_t* records, size_t length) {
+  // Records: [topicHash_h][topicHash_l][nameLength][name...]
+  if (clientId != _clientId) return; // Not for us
+  
+  size_t pos = 0;
+  while (pos + 3 <= length) {
+    uint16_t topicHash = (records[pos] << 8) | records[pos + 1];
+    uint8_t nameLength = records[pos + 2];
+    pos += 3;
+    if (pos + nameLength > length) break;
+    
+    String topicName = "";
+    for (uint8_t i = 0; i < nameLength; i++) {
+      topicName += (char)records[pos + i];
+    }
+    pos += nameLength;
+    
+    // onMessage() then shows the topic's name rather than its hash
+    if (hashTopic(topicName) == topicHash) {
+      registerTopic(topicName);
+    }
+  }
+}
+
+void CANPubSubClientCore::requestClientID() {
+  beginFrame(CAN_PS_ID_REQUEST);
+  endFrame();
+}
+
+void CANPubSubClientCore::requestClientIDWithSerial(const String& serialNumber) {
+  // Use extended message for serial numbers > 8 bytes
+  if (serialNumber.length() > CAN_FRAME_DATA_SIZE) {
+    // Prepend a dummy byte (0x00) since processExtendedFrame will extract first byte as "senderId"
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    buffer[0] = 0x00; // Placeholder for "senderId" field
+    memcpy(buffer + 1, serialNumber.c_str(), min(serialNumber.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 1)));
+    sendExtendedMessage(CAN_PS_ID_REQUEST, buffer, min(1 + serialNumber.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
+  } else {
+    beginFrame(CAN_PS_ID_REQUEST);
+    _can->print(serialNumber);
+    endFrame();
+  }
+}
+
+bool CANPubSubClientCore::subscribe(const String& topic) {
+  if (!_connected) return false;
+  
+  uint16_t topicHash = hashTopic(topic);
+  registerTopic(topic);
+  
+  // Calculate total message size: clientId + topicHash + topicLength + topic
+  size_t totalSize = 1 + 2 + 1 + topic.length();
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long topics
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    buffer[0] = _clientId;
+    buffer[1] = topicHash >> 8;
+    buffer[2] = topicHash & 0xFF;
+    memcpy(buffer + 3, topic.c_str(), topic.length());
+    
+    sendExtendedMessage(CAN_PS_SUBSCRIBE, buffer, 3 + topic.length());
+  } else {
+    beginFrame(CAN_PS_SUBSCRIBE);
+    _can->write(_clientId);
+    _can->write(topicHash >> 8);
+    _can->write(topicHash & 0xFF);
+    _can->write((uint8_t)topic.length());  // Send topic name length
+    _can->print(topic);  // Send topic name to broker for mapping
+    endFrame();
+  }
+  
+  // Store locally
+  if (_subscribedTopicCount < _subscribedTopicCapacity) {
+    _subscribedTopics[_subscribedTopicCount++] = topicHash;
+  }
+  
+  return true;
+}
+
+bool CANPubSubClientCore::unsubscribe(const String& topic) {
+  if (!_connected) return false;
+  
+  uint16_t topicHash = hashTopic(topic);
+  
+  beginFrame(CAN_PS_UNSUBSCRIBE);
+  _can->write(_clientId);
+  _can->write(topicHash >> 8);
+  _can->write(topicHash & 0xFF);
+  endFrame();
+  
+  // Remove from local list
+  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+    if (_subscribedTopics[i] == topicHash) {
+      for (uint8_t j = i; j < _subscribedTopicCount - 1; j++) {
+        _subscribedTopics[j] = _subscribedTopics[j + 1];
+      }
+      _subscribedTopicCount--;
+      break;
+    }
+  }
+  
+  return true;
+}
+
+bool CANPubSubClientCore::publish(const String& topic, const String& message) {
+  if (!_connected) return false;
+  
+  uint16_t topicHash = hashTopic(topic);
+  registerTopic(topic);
+  
+  return publish(topicHash, (const uint8_t*)message.c_str(), message.length());
+}
+
+bool CANPubSubClientCore::publish(uint16_t topicHash, const uint8_t* data, size_t length) {
+  if (!_connected) return false;
+  
+  uint8_t priority = getTopicPriority(topicHash);
+  
+  // Latency-critical topics never wait in the batch
+  if (_batchingEnabled && priority != CAN_PS_PRIORITY_HIGH) {
+    return queuePublish(topicHash, data, length);
+  }
+  
+  return sendPublish(topicHash, data, length, priority);
+}
+
+bool CANPubSubClientCore::subscribe(const CANTopic& topic) {
+  return subscribe(String(topic.name));
+}
+
+bool CANPubSubClientCore::unsubscribe(const CANTopic& topic) {
+  return unsubscribe(String(topic.name));
+}
+
+bool CANPubSubClientCore::publish(const CANTopic& topic, const String& message) {
+  return publish(topic.hash, (const uint8_t*)message.c_str(), message.length());
+}
+
+bool CANPubSubClientCore::publish(const CANTopic& topic, const uint8_t* data, size_t length) {
+  return publish(topic.hash, data, length);
+}
+
+bool CANPubSubClientCore::publishReliable(const String& topic, const String& message) {
+  if (!_connected) return false;
+  
+  uint16_t topicHash = hashTopic(topic);
+  registerTopic(topic);
+  
+  return publishReliable(topicHash, (const uint8_t*)message.c_str(), message.length());
+}
+
+bool CANPubSubClientCore::publishReliable(const CANTopic& topic, const uint8_t* data, size_t length) {
+  return publishReliable(topic.hash, data, length);
+}
+
+bool CANPubSubClientCore::publishReliable(uint16_t topicHash, const uint8_t* data, size_t length) {
+  if (!_connected || length > CAN_PS_QOS_PAYLOAD_SIZE) return false;
+  
+  // Sliding window: the oldest unacknowledged sequence number stays less than
+  // _qosWindow behind, so its retransmissions fall inside the broker's dedup window
+  QosPublish* entry = nullptr;
+  for (uint8_t i = 0; i < _qosWindow; i++) {
+    if (!_qosOutbox[i].active) {
+      entry = &_qosOutbox[i];
+    } else if ((uint8_t)(_qosSeq - _qosOutbox[i].seq) >= _qosWindow) {
+      return false;
+    }
+  }
+  if (!entry) return false;  // Window full, wait for ACKs
+  
+  // Earlier plain publishes of the batch go first, so the topic stays in order
+  flush();
+  
+  entry->topicHash = topicHash;
+  entry->seq = _qosSeq++;
+  entry->length = (uint8_t)length;
+  entry->retries = 0;
+  entry->active = true;
+  memcpy(entry->data, data, length);
+  _qosPending++;
+  
+  // A failed send is retried like a lost one
+  sendQosPublish(*entry);
+  return true;
+}
+
+void CANPubSubClientCore::sendQosPublish(QosPublish& entry) {
+  // Message: [clientId][seq][topicHash_h][topicHash_l][data...], multi-frame when long
+  uint8_t buffer[4 + CAN_PS_QOS_PAYLOAD_SIZE];
+  buffer[0] = _clientId;
+  buffer[1] = entry.seq;
+  buffer[2] = entry.topicHash >> 8;
+  buffer[3] = entry.topicHash & 0xFF;
+  memcpy(buffer + 4, entry.data, entry.length);
+  
+  sendExtendedMessage(CAN_PS_PUBLISH_QOS, buffer, 4 + entry.length, getTopicPriority(entry.topicHash));
+  entry.sentAt = millis();
+}
+
+void CANPubSubClientCore::serviceQosPublishes() {
+  if (!_connected) return;
+  
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < _qosWindow; i++) {
+    QosPublish& entry = _qosOutbox[i];
+    if (!entry.active || (now - entry.sentAt < _qosTimeout)) continue;
+    
+    if (entry.retries >= _qosRetries) {
+      finishQosPublish(entry, false);
+      continue;
+    }
+    
+    entry.retries++;
+#if CAN_PS_STATS
+    _stats.qosRetransmits++;
+#endif
+    sendQosPublish(entry);
+  }
+}
+
+void CANPubSubClientCore::finishQosPublish(QosPublish& entry, bool acknowledged) {
+  entry.active = false;
+  _qosPending--;
+  if (_onPublishDone) {
+    _onPublishDone(entry.topicHash, acknowledged);
+  }
+}
+
+void CANPubSubClientCore::setQosTimeout(unsigned long timeoutMs, uint8_t retries) {
+  _qosTimeout = timeoutMs;
+  _qosRetries = retries;
+}
+
+unsigned long CANPubSubClientCore::getQosTimeout() {
+  return _qosTimeout;
+}
+
+uint8_t CANPubSubClientCore::getPendingPublishes() {
+  return _qosPending;
+}
+
+void CANPubSubClientCore::onPublishDone(PublishDoneCallback callback) {
+  _onPublishDone = callback;
+}
+
+bool CANPubSubClientCore::sendPublish(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority) {
+  // Calculate total message size: clientId + topicHash + message
+  size_t totalSize = 1 + 2 + length;
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long messages
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    size_t copyLength = min(length, (size_t)(MAX_EXTENDED_MSG_SIZE - 3));
+    buffer[0] = _clientId;
+    buffer[1] = topicHash >> 8;
+    buffer[2] = topicHash & 0xFF;
+    memcpy(buffer + 3, data, copyLength);
+    
+    return sendExtendedMessage(CAN_PS_PUBLISH, buffer, 3 + copyLength, priority);
+  } else {
+    beginFrame(CAN_PS_PUBLISH, priority);
+    _can->write(_clientId);
+    _can->write(topicHash >> 8);
+    _can->write(topicHash & 0xFF);
+    _can->write(data, length);
+    endFrame();
+    
+    return true;
+  }
+}
+
+bool CANPubSubClientCore::queuePublish(uint16_t topicHash, const uint8_t* data, size_t length) {
+  size_t recordSize = 3 + length;
+  
+  if (recordSize + 1 > _batchSize) {
+    // Too large to batch - send what is queued first so publishes stay in order
+    flush();
+    return sendPublish(topicHash, data, length, getTopicPriority(topicHash));
+  }
+  
+  if (_batchLength + recordSize + 1 > _batchSize) {
+    flush();
+  }
+  
+  uint8_t priority = getTopicPriority(topicHash);
+  if (_batchCount == 0) {
+    _batchStart = millis();
+    _batchPriority = priority;
+  } else if (priority < _batchPriority) {
+    _batchPriority = priority;
+  }
+  
+  uint8_t* record = _batch + 1 + _batchLength;
+  record[0] = topicHash >> 8;
+  record[1] = topicHash & 0xFF;
+  record[2] = (uint8_t)length;
+  memcpy(record + 3, data, length);
+  _batchLength += recordSize;
+  _batchCount++;
+  
+  return true;
+}
+
+bool CANPubSubClientCore::flush() {
+  if (_batchCount == 0) return true;
+  
+  uint8_t count = _batchCount;
+  size_t length = 1 + _batchLength;
+  _batchCount = 0;
+  _batchLength = 0;
+  
+  if (!_connected) return false;
+  
+  if (count == 1) {
+    // A lone record goes out as a plain publish (no batch framing)
+    const uint8_t* record = _batch + 1;
+    return sendPublish((record[0] << 8) | record[1], record + 3, record[2], _batchPriority);
+  }
+  
+  // The batch travels in the class of its most urgent record
+  _batch[0] = _clientId;
+  
+  if (length > CAN_FRAME_DATA_SIZE) {
+    return sendExtendedMessage(CAN_PS_PUBLISH_BATCH, _batch, length, _batchPriority);
+  }
+  
+  beginFrame(CAN_PS_PUBLISH_BATCH, _batchPriority);
+  _can->write(_batch, length);
+  endFrame();
+  
+  return true;
+}
+
+void CANPubSubClientCore::enablePublishBatching(bool enable, unsigned long latencyMs) {
+  if (!enable) {
+    flush();
+  }
+  _batchingEnabled = enable;
+  _batchLatency = latencyMs;
+}
+
+bool CANPubSubClientCore::isPublishBatchingEnabled() {
+  return _batchingEnabled;
+}
+
+bool CANPubSubClientCore::sendDirectMessage(const String& message) {
+  if (!_connected) return false;
+  
+  // Calculate total message size: clientId + message
+  size_t totalSize = 1 + message.length();
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long messages
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    buffer[0] = _clientId;
+    memcpy(buffer + 1, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 1)));
+    
+    return sendExtendedMessage(CAN_PS_DIRECT_MSG, buffer, min(1 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
+  } else {
+    beginFrame(CAN_PS_DIRECT_MSG);
+    _can->write(_clientId);
+    _can->print(message);
+    endFrame();
+    
+    return true;
+  }
+}
+
+bool CANPubSubClientCore::sendPeerMessage(uint8_t targetClientId, const String& message) {
+  if (!_connected) return false;
+  
+  // Only clients with permanent IDs (registered with serial numbers) can send peer messages
+  if (_serialNumber.length() == 0) {
+    return false; // No serial number = temporary ID, peer messaging not allowed
+  }
+  
+  // Calculate total message size: senderId + targetId + message
+  size_t totalSize = 1 + 1 + message.length();
+  
+  if (totalSize > CAN_FRAME_DATA_SIZE) {
+    // Use extended message for long messages
+    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+    buffer[0] = _clientId;
+    buffer[1] = targetClientId;
+    memcpy(buffer + 2, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 2)));
+    
+    return sendExtendedMessage(CAN_PS_PEER_MSG, buffer, min(2 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
+  } else {
+    beginFrame(CAN_PS_PEER_MSG);
+    _can->write(_clientId);
+    _can->write(targetClientId);
+    _can->print(message);
+    endFrame();
+    
+    return true;
+  }
+}
+
+bool CANPubSubClientCore::sendTransfer(const uint8_t* data, size_t length, uint8_t tag) {
+  if (!_connected) return false;
+  return startTransfer(CAN_PS_BROKER_ID, data, length, tag);
+}
+
+bool CANPubSubClientCore::ping() {
+  if (!_connected) return false;
+  
+  beginFrame(CAN_PS_PING);
+  _can->write(_clientId);
+  endFrame();
+  
+  _lastPing = millis();
+  
+  return true;
+}
+
+void CANPubSubClientCore::onMessage(MessageCallback callback) {
+  _onMessage = callback;
+}
+
+void CANPubSubClientCore::onMessageBinary(BinaryMessageCallback callback) {
+  _onMessageBinary = callback;
+}
+
+void CANPubSubClientCore::onDirectMessage(DirectMessageCallback callback) {
+  _onDirectMessage = callback;
+}
+
+void CANPubSubClientCore::onConnect(void (*callback)()) {
+  _onConnect = callback;
+}
+
+void CANPubSubClientCore::onDisconnect(void (*callback)()) {
+  _onDisconnect = callback;
+}
+
+void CANPubSubClientCore::onPong(void (*callback)()) {
+  _onPong = callback;
+}
+
+unsigned long CANPubSubClientCore::getLastPingTime() {
+  if (_lastPong == 0 || _lastPing == 0 || _lastPong < _lastPing) {
+    return 0; // No valid pong received yet
+  }
+  return _lastPong - _lastPing;
+}
+
+void CANPubSubClientCore::enableHardwareFilter(bool enable) {
+  _hardwareFilterEnabled = enable;
+  if (enable) {
+    applyHardwareFilter();
+  } else {
+    _can->clearFilter();
+  }
+}
+
+bool CANPubSubClientCore::isHardwareFilterEnabled() {
+  return _hardwareFilterEnabled;
+}
+
+void CANPubSubClientCore::applyHardwareFilter() {
+  if (!_hardwareFilterEnabled) return;
+  
+  // Downlink only: target IDs and topic hashes travel in the payload, and the
+  // controllers' shared masks cannot drop other clients' TOPIC_DATA or other
+  // topics' TOPIC_MCAST while still passing every other downlink type, so
+  // subscribe()/unsubscribe() leave the filter as it is
+  _can->filter(CAN_PS_DOWNLINK_FLAG, CAN_PS_DOWNLINK_FLAG,
+               CAN_PS_EXT_DOWNLINK_FLAG, CAN_PS_EXT_DOWNLINK_FLAG);
+}
+
+bool CANPubSubClientCore::isSubscribed(const String& topic) {
+  return isSubscribed(hashTopic(topic));
+}
+
+bool CANPubSubClientCore::isSubscribed(const CANTopic& topic) {
+  return isSubscribed(topic.hash);
+}
+
+bool CANPubSubClientCore::isSubscribed(uint16_t topicHash) {
+  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+    if (_subscribedTopics[i] == topicHash) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t CANPubSubClientCore::getSubscriptionCount() {
+  return _subscribedTopicCount;
+}
+
+void CANPubSubClientCore::listSubscribedTopics(std::function<void(uint16_t hash, const String& name)> callback) {
+  if (!callback) return;
+  
+  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+    uint16_t hash = _subscribedTopics[i];
+    String name = getTopicName(hash);
+    callback(hash, name);
+  }
+}
+
+uint8_t CANPubSubClientCore::localNodeId() {
+  if (_clientId != CAN_PS_UNASSIGNED_ID) {
+    return _clientId;
+  }
+  // Before an ID is assigned, tag frames with the serial hash so concurrent
+  // ID requests from different clients reassemble in separate slots
+  uint16_t hash = hashTopic(_serialNumber);
+  return (hash >> 8) ^ (hash & 0xFF);
+}
+
+void CANPubSubClientCore::onExtendedMessageComplete(uint8_t msgType, uint8_t senderId, const uint8_t* data, size_t length) {
+  // Handle extended messages based on type
+  switch (msgType) {
+    case CAN_PS_ID_RESPONSE: {
+      // Extended ID response with serial number verification
+      // Format (in buffer): [hasStoredSubs][serialNumberLength][serialNumber...]
+      // Note: assignedId was already extracted by processExtendedFrame from first byte
+      if (length < 2) return;
+      
+      uint8_t assignedId = senderId; // The extracted "senderId" is actually the assignedId
+      bool hasStoredSubs = (data[0] == 0x01);
+      uint8_t serialLen = data[1];
+      
+      String receivedSerial = "";
+      for (uint8_t i = 0; i < serialLen && (2 + i) < length; i++) {
+        receivedSerial += (char)data[2 + i];
+      }
+      
+      // Only accept this ID if the serial number matches ours
+      if (_serialNumber.length() > 0 && receivedSerial != _serialNumber) {
+        // This ID response is not for us, ignore it
+        return;
+      }
+      
+      _clientId = assignedId;
+      _connected = true;
+      
+      // If subscriptions will be restored, broker will send them shortly
+      // Client just needs to wait and handle incoming SUB_RESTORE messages
+      _restoring = hasStoredSubs;
+      _restoreNamesAsked = false;
+      _restoreStart = millis();
+      break;
+    }
+    
+    case CAN_PS_SUBSCRIBE: {
+      // Extended subscribe notification from broker (restored subscription)
+      // Format (in buffer): [topicHash_h][topicHash_l][topicNameLen][topicName...]
+      // Note: clientId was already extracted by processExtendedFrame from first byte
+      if (length < 3) return;
+      
+      // The senderId parameter actually contains our clientId
+      if (senderId != _clientId) return; // Not for us
+      
+      uint16_t topicHash = (data[0] << 8) | data[1];
+      uint8_t topicLen = data[2];
+      
+      String topic = "";
+      for (uint8_t i = 0; i < topicLen && (3 + i) < length; i++) {
+        topic += (char)data[3 + i];
+      }
+      
+      // Register the topic mapping locally
+      if (topic.length() > 0) {
+        registerTopic(topic);
+      }
+      
+      // Add to local subscription list
+      if (_subscribedTopicCount < _subscribedTopicCapacity) {
+        // Check if already subscribed
+        bool alreadySubscribed = false;
+        for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+          if (_subscribedTopics[i] == topicHash) {
+            alreadySubscribed = true;
+            break;
+          }
+        }
+        
+        if (!alreadySubscribed) {
+          _subscribedTopics[_subscribedTopicCount++] = topicHash;
+        }
+      }
+      break;
+    }
+    
+    case CAN_PS_SUB_RESTORE: {
+      // Extended subscription restore from broker (with topic name)
+      // Format (in buffer): [topicHash_h][topicHash_l][topicNameLen][topicName...]
+      // Note: clientId was already extracted by processExtendedFrame from first byte
+      if (length < 3) return;
+      
+      // The senderId parameter actually contains our clientId
+      if (senderId != _clientId) return; // Not for us
+      
+      uint16_t topicHash = (data[0] << 8) | data[1];
+      uint8_t topicLen = data[2];
+      
+      String topic = "";
+      for (uint8_t i = 0; i < topicLen && (3 + i) < length; i++) {
+        topic += (char)data[3 + i];
+      }
+      
+      // Register the topic mapping locally
+      if (topic.length() > 0) {
+        registerTopic(topic);
+      }
+      
+      // Add to local subscription list
+      if (_subscribedTopicCount < _subscribedTopicCapacity) {
+        // Check if already subscribed
+        bool alreadySubscribed = false;
+        for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
+          if (_subscribedTopics[i] == topicHash) {
+            alreadySubscribed = true;
+            break;
+          }
+        }
+        
+        if (!alreadySubscribed) {
+          _subscribedTopics[_subscribedTopicCount++] = topicHash;
+        }
+      }
+      break;
+    }
+    
+    case CAN_PS_SUB_RESTORE_BATCH: {
+      // Topic list restored by the broker, too long for one frame
+      // Format (in buffer): [flags]{[topicHash_h][topicHash_l][nameLength][name...]}
+      // Note: clientId was already extracted by processExtendedFrame from first byte
+      dispatchRestoreBatch(senderId, data, length);
+      break;
+    }
+    
+    case CAN_PS_TOPIC_NAME: {
+      // Names of topics matched by our wildcard subscriptions
+      // Format (in buffer): {[topicHash_h][topicHash_l][nameLength][name...]}
+      // Note: clientId was already extracted by processExtendedFrame from first byte
+      if (!packetDownlink()) return;
+      dispatchTopicNames(senderId, data, length);
+      break;
+    }
+    
+    case CAN_PS_TOPIC_DATA: {
+      // Extended topic data
+      // Format (in buffer): [topicHash_h][topicHash_l][message...]
+      // Note: targetId (subscriber ID) was already extracted by processExtendedFrame from first byte
+      if (length < 2) return;
+      
+      // The senderId parameter actually contains the targetId for this message type
+      if (senderId != _clientId) return; // Not for us
+      
+      uint16_t topicHash = (data[0] << 8) | data[1];
+      deliverMessage(topicHash, data + 2, length - 2);
+      break;
+    }
+    
+    case CAN_PS_TOPIC_MCAST: {
+      // Extended multicast topic data
+      // Format (in buffer): [topicHash_h][topicHash_l][message...]
+      // Note: brokerId was already extracted by processExtendedFrame from first byte
+      if (length < 2) return;
+      
+      uint16_t topicHash = (data[0] << 8) | data[1];
+      
+      if (!isSubscribed(topicHash)) return; // Not subscribed
+      
+      deliverMessage(topicHash, data + 2, length - 2);
+      break;
+    }
+    
+    case CAN_PS_DIRECT_MSG: {
+      // Extended direct message
+      // Format (in buffer): [targetId][message...]
+      // Note: senderId was already extracted by processExtendedFrame from first byte
+      if (length < 1) return;
+      
+      uint8_t targetId = data[0];
+      
+      if (targetId != _clientId) return; // Not for us
+      
+      String message = "";
+      for (size_t i = 1; i < length; i++) {
+        message += (char)data[i];
+      }
+      
+      if (_onDirectMessage) {
+        _onDirectMessage(senderId, message);
       }
+      break;
     }
     
-    if (!alreadySubscribed) {
-      _subscribedTopics[_subscribedTopicCount++] = topicHash;
+    case CAN_PS_PEER_MSG: {
+      // Extended peer message (from another client)
+      // Format (in buffer): [targetId][message...]
+      // Note: senderId was already extracted by processExtendedFrame from first byte
+      if (length < 1) return;
+      
+      uint8_t targetId = data[0];
+      
+      if (targetId != _clientId) return; // Not for us
+      
+      // Only the copy forwarded by the broker, not the sender's own frames
+      if (!packetDownlink()) return;
+      
+      String message = "";
+      for (size_t i = 1; i < length; i++) {
+        message += (char)data[i];
+      }
+      
+      // Call direct message callback (reuse for peer messages)
+      if (_onDirectMessage) {
+        _onDirectMessage(senderId, message);
+      }
+      break;
     }
   }
 }
 
-void CANPubSubClient::handleTopicData() {
-  if (_can->available() < 3) return;
-  
-  uint8_t targetId = _can->read();
-  if (targetId != _clientId) return;
-  
-  uint16_t topicHash = (_can->read() << 8) | _can->read();
-  
-  String message = "";
-  while (_can->available()) {
-    message += (char)_can->read();
-  }
-  
-  // Call callback if registered
-  if (_onMessage) {
-    String topicName = getTopicName(topicHash);
-    _onMessage(topicHash, topicName, message);
-  }
+// ===== Persistent Storage Implementation =====
+
+// Where each STORAGE_TABLE_* blob lives
+struct StorageTable {
+  const char* key;    // Preferences key (ESP32)
+  int address;        // EEPROM region
+  uint16_t size;      // Largest blob, header included
+  uint16_t magic;
+};
+
+static const StorageTable STORAGE_TABLES[STORAGE_TABLE_COUNT] = {
+  { "maps",   STORAGE_MAP_ADDR,   STORAGE_MAP_BLOB_SIZE,   STORAGE_MAGIC },
+  { "subs",   STORAGE_SUB_ADDR,   STORAGE_SUB_BLOB_SIZE,   STORAGE_SUB_MAGIC },
+  { "topics", STORAGE_TOPIC_ADDR, STORAGE_TOPIC_BLOB_SIZE, STORAGE_TOPIC_MAGIC },
+  { "ping",   STORAGE_PING_ADDR,  STORAGE_PING_BLOB_SIZE,  STORAGE_PING_MAGIC }
+};
+
+static inline void storagePut16(uint8_t* p, uint16_t value) {
+  p[0] = value & 0xFF;
+  p[1] = value >> 8;
 }
 
-void CANPubSubClient::handleDirectMessageReceived() {
-  if (_can->available() < 2) return;
-  
-  uint8_t senderId = _can->read();
-  uint8_t targetId = _can->read();
-  
-  if (targetId != _clientId) return;
-  
-  String message = "";
-  while (_can->available()) {
-    message += (char)_can->read();
-  }
-  
-  // Call callback if registered
-  if (_onDirectMessage) {
-    _onDirectMessage(senderId, message);
-  }
+static inline uint16_t storageGet16(const uint8_t* p) {
+  return p[0] | ((uint16_t)p[1] << 8);
 }
 
-void CANPubSubClient::handlePong() {
-  if (_can->available() < 2) return;
-  
-  uint8_t brokerId = _can->read();
-  uint8_t targetId = _can->read();
-  
-  if (targetId == _clientId) {
-    _lastPong = millis();
-    
-    // Call callback if registered
-    if (_onPong) {
-      _onPong();
-    }
-  }
+static inline void storagePut32(uint8_t* p, uint32_t value) {
+  storagePut16(p, value & 0xFFFF);
+  storagePut16(p + 2, value >> 16);
 }
 
-void CANPubSubClient::handleSubscriptionRestore() {
-  // Broker is sending us a stored subscription with topic name
-  // Format: [clientId][topicHash][topicNameLength][topicName]
-  if (_can->available() < 4) return;
-  
-  uint8_t clientId = _can->read();
-  if (clientId != _clientId) return; // Not for us
-  
-  uint16_t topicHash = (_can->read() << 8) | _can->read();
-  uint8_t topicNameLen = _can->read();
+static inline uint32_t storageGet32(const uint8_t* p) {
+  return storageGet16(p) | ((uint32_t)storageGet16(p + 2) << 16);
+}
+
+void CANPubSubBrokerCore::initStorage() {
+  #ifdef ESP32
+    // ESP32 uses Preferences (NVS)
+    _preferences.begin(STORAGE_NAMESPACE, false);
+  #else
+    // Arduino uses EEPROM
+    EEPROM.begin(EEPROM_SIZE);
+  #endif
   
-  // Read topic name
-  String topicName = "";
-  for (uint8_t i = 0; i < topicNameLen && _can->available(); i++) {
-    topicName += (char)_can->read();
+  migrateLegacyStorage();
+}
+
+bool CANPubSubBrokerCore::loadMappingsFromStorage() {
+  uint8_t count;
+  uint16_t length;
+  bool truncated;
+  if (!readStorageBlob(STORAGE_TABLE_MAPPINGS, count, length, &truncated) || length < 1) {
+    // No valid data stored
+    return false;
   }
   
-  // Register topic name in our local mapping
-  registerTopic(topicName);
-  
-  // Add to our subscribed topics list if not already present
-  bool alreadySubscribed = false;
-  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
-    if (_subscribedTopics[i] == topicHash) {
-      alreadySubscribed = true;
-      break;
+  const uint8_t* record = _storageBlob + STORAGE_BLOB_HEADER;
+  const uint8_t* end = record + length;
+  uint8_t nextId = *record++;
+  
+  // A table written for more Clients keeps the mappings that fit, in stored order
+  memset(_clientMappings, 0, _mappingCapacity * sizeof(ClientMapping));
+  uint8_t loaded = 0;
+  while (loaded < count && loaded < _mappingCapacity) {
+    // [clientId][registered][serialLength][serial]
+    if (end - record < 3 || end - record < 3 + record[2]) {
+      if (truncated) break;
+      _mappingCount = 0;
+      return false;
+    }
+    if (record[2] >= MAX_SERIAL_LENGTH) {
+      _mappingCount = 0;
+      return false;
     }
+    _clientMappings[loaded].clientId = record[0];
+    _clientMappings[loaded].registered = record[1] != 0;
+    memcpy(_clientMappings[loaded].serialNumber, record + 3, record[2]);
+    record += 3 + record[2];
+    loaded++;
   }
   
-  if (!alreadySubscribed && _subscribedTopicCount < MAX_CLIENT_TOPICS) {
-    _subscribedTopics[_subscribedTopicCount++] = topicHash;
-  }
+  _storageDrops += count - loaded;
+  _mappingCount = loaded;
+  _nextClientID = nextId;
+  return true;
 }
 
-void CANPubSubClient::requestClientID() {
-  _can->beginPacket(CAN_PS_ID_REQUEST);
-  _can->endPacket();
+bool CANPubSubBrokerCore::saveMappingsToStorage() {
+  return saveStorageTable(STORAGE_TABLE_MAPPINGS);
 }
 
-void CANPubSubClient::requestClientIDWithSerial(const String& serialNumber) {
-  // Use extended message for serial numbers > 8 bytes
-  if (serialNumber.length() > CAN_FRAME_DATA_SIZE) {
-    // Prepend a dummy byte (0x00) since processExtendedFrame will extract first byte as "senderId"
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = 0x00; // Placeholder for "senderId" field
-    memcpy(buffer + 1, serialNumber.c_str(), min(serialNumber.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 1)));
-    sendExtendedMessage(CAN_PS_ID_REQUEST, buffer, min(1 + serialNumber.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_ID_REQUEST);
-    _can->print(serialNumber);
-    _can->endPacket();
-  }
+bool CANPubSubBrokerCore::clearStoredMappings() {
+  _mappingCount = 0;
+  _nextClientID = 0x01;
+  memset(_clientMappings, 0, _mappingCapacity * sizeof(ClientMapping));
+  
+  // An empty table, the other tables are kept
+  return saveMappingsToStorage();
 }
 
-bool CANPubSubClient::subscribe(const String& topic) {
-  if (!_connected) return false;
-  
-  uint16_t topicHash = hashTopic(topic);
-  registerTopic(topic);
-  
-  // Calculate total message size: clientId + topicHash + topicLength + topic
-  size_t totalSize = 1 + 2 + 1 + topic.length();
+// ===== Subscription Persistence Implementation =====
+
+void CANPubSubBrokerCore::storeClientSubscriptions(uint8_t clientId) {
+  // Find or create stored subscription entry for this client
+  int index = findStoredSubscription(clientId);
   
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long topics
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = _clientId;
-    buffer[1] = topicHash >> 8;
-    buffer[2] = topicHash & 0xFF;
-    memcpy(buffer + 3, topic.c_str(), topic.length());
-    
-    sendExtendedMessage(CAN_PS_SUBSCRIBE, buffer, 3 + topic.length());
-  } else {
-    _can->beginPacket(CAN_PS_SUBSCRIBE);
-    _can->write(_clientId);
-    _can->write(topicHash >> 8);
-    _can->write(topicHash & 0xFF);
-    _can->write((uint8_t)topic.length());  // Send topic name length
-    _can->print(topic);  // Send topic name to broker for mapping
-    _can->endPacket();
-  }
+  bool created = false;
   
-  // Store locally
-  if (_subscribedTopicCount < MAX_CLIENT_TOPICS) {
-    _subscribedTopics[_subscribedTopicCount++] = topicHash;
+  if (index < 0) {
+    // Create new entry if space available
+    if (_storedSubCount >= _mappingCapacity) return;
+    index = _storedSubCount++;
+    _storedSubscriptions[index].clientId = clientId;
+    _storedSubscriptions[index].topicCount = 0;
+    created = true;
   }
   
-  return true;
+  // All topics this client is subscribed to, from the reverse index
+  int topics = findClientTopics(clientId);
+  uint8_t topicCount = topics >= 0 ? _clientTopics[topics].topicCount : 0;
+  const uint16_t* current = topics >= 0 ? _clientTopics[topics].topics : nullptr;
+  
+  // Only changed records are queued for the next flush
+  ClientTopicList& stored = _storedSubscriptions[index];
+  if (!created && stored.topicCount == topicCount &&
+      (topicCount == 0 || memcmp(stored.topics, current, topicCount * sizeof(uint16_t)) == 0)) return;
+  stored.topicCount = topicCount;
+  if (topicCount > 0) memcpy(stored.topics, current, topicCount * sizeof(uint16_t));
+  markStorageDirty(STORAGE_TABLE_SUBSCRIPTIONS);
 }
 
-bool CANPubSubClient::unsubscribe(const String& topic) {
-  if (!_connected) return false;
-  
-  uint16_t topicHash = hashTopic(topic);
-  
-  _can->beginPacket(CAN_PS_UNSUBSCRIBE);
-  _can->write(_clientId);
-  _can->write(topicHash >> 8);
-  _can->write(topicHash & 0xFF);
-  _can->endPacket();
+void CANPubSubBrokerCore::restoreClientSubscriptions(uint8_t clientId) {
+  // Find stored subscriptions for this client
+  int index = findStoredSubscription(clientId);
+  if (index < 0) return;
   
-  // Remove from local list
-  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
-    if (_subscribedTopics[i] == topicHash) {
-      for (uint8_t j = i; j < _subscribedTopicCount - 1; j++) {
-        _subscribedTopics[j] = _subscribedTopics[j + 1];
-      }
-      _subscribedTopicCount--;
-      break;
+  if (_batchedRestore) {
+    // The whole topic list in one message, the client asks for the names it lacks
+    ClientTopicList& stored = _storedSubscriptions[index];
+    for (uint8_t i = 0; i < stored.topicCount; i++) {
+      linkSubscriber(stored.topics[i], clientId);
+    }
+    sendRestoreBatch(clientId, stored.topics, stored.topicCount, false);
+    
+    // Followed by the latest value of each topic, if retained
+    for (uint8_t i = 0; i < stored.topicCount; i++) {
+      sendRetained(clientId, stored.topics[i]);
     }
+    return;
   }
   
-  return true;
-}
-
-bool CANPubSubClient::publish(const String& topic, const String& message) {
-  if (!_connected) return false;
-  
-  uint16_t topicHash = hashTopic(topic);
-  registerTopic(topic);
-  
-  // Calculate total message size: clientId + topicHash + message
-  size_t totalSize = 1 + 2 + message.length();
-  
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long messages
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = _clientId;
-    buffer[1] = topicHash >> 8;
-    buffer[2] = topicHash & 0xFF;
-    memcpy(buffer + 3, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 3)));
+  // Restore each subscription to broker's internal table and notify client
+  for (uint8_t i = 0; i < _storedSubscriptions[index].topicCount; i++) {
+    uint16_t topicHash = _storedSubscriptions[index].topics[i];
     
-    return sendExtendedMessage(CAN_PS_PUBLISH, buffer, min(3 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_PUBLISH);
-    _can->write(_clientId);
-    _can->write(topicHash >> 8);
-    _can->write(topicHash & 0xFF);
-    _can->print(message);
-    _can->endPacket();
+    // Add client to the active table (no-op if already subscribed)
+    linkSubscriber(topicHash, clientId);
     
-    return true;
+    // Get topic name from persistent storage (not just runtime mapping)
+    String topicName = getStoredTopicName(topicHash);
+    
+    // Send topic name back to client using SUB_RESTORE message type
+    // Format: [clientId][topicHash][topicNameLength][topicName]
+    size_t totalSize = 1 + 2 + 1 + topicName.length();
+    
+    if (totalSize > CAN_FRAME_DATA_SIZE) {
+      // Use extended message for long topic names
+      uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+      buffer[0] = clientId;
+      buffer[1] = topicHash >> 8;
+      buffer[2] = topicHash & 0xFF;
+      buffer[3] = (uint8_t)topicName.length();
+      memcpy(buffer + 4, topicName.c_str(), min(topicName.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 4)));
+      
+      sendExtendedMessage(CAN_PS_SUB_RESTORE, buffer, min(4 + topicName.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
+    } else {
+      beginFrame(CAN_PS_SUB_RESTORE);
+      _can->write(clientId);
+      _can->write(topicHash >> 8);
+      _can->write(topicHash & 0xFF);
+      _can->write((uint8_t)topicName.length());
+      _can->print(topicName);
+      endFrame();
+    }
+    
+    // Follow the restore with the topic's latest value, if retained
+    sendRetained(clientId, topicHash);
   }
 }
 
-bool CANPubSubClient::sendDirectMessage(const String& message) {
-  if (!_connected) return false;
-  
-  // Calculate total message size: clientId + message
-  size_t totalSize = 1 + message.length();
-  
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long messages
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = _clientId;
-    memcpy(buffer + 1, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 1)));
-    
-    return sendExtendedMessage(CAN_PS_DIRECT_MSG, buffer, min(1 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_DIRECT_MSG);
-    _can->write(_clientId);
-    _can->print(message);
-    _can->endPacket();
+void CANPubSubBrokerCore::scheduleRestore(uint8_t clientId) {
+  uint32_t bit = 1UL << (clientId & 31);
+  if (_restorePending[clientId >> 5] & bit) return;
+  _restorePending[clientId >> 5] |= bit;
+  _restoreCount++;
+}
+
+void CANPubSubBrokerCore::serviceRestores() {
+  // A few clients per loop(): after a broker reboot every client asks for its ID
+  // at once, routing keeps going while their restores drain
+  for (uint8_t n = 0; n < CAN_PS_RESTORES_PER_LOOP && _restoreCount > 0; n++) {
+    uint8_t clientId = _restoreCursor;
+    while (!(_restorePending[clientId >> 5] & (1UL << (clientId & 31)))) {
+      clientId++;  // wraps at 255, _restoreCount says a bit is set
+    }
+    _restorePending[clientId >> 5] &= ~(1UL << (clientId & 31));
+    _restoreCount--;
+    _restoreCursor = clientId + 1;
     
-    return true;
+    restoreClientSubscriptions(clientId);
   }
 }
 
-bool CANPubSubClient::sendPeerMessage(uint8_t targetClientId, const String& message) {
-  if (!_connected) return false;
-  
-  // Only clients with permanent IDs (registered with serial numbers) can send peer messages
-  if (_serialNumber.length() == 0) {
-    return false; // No serial number = temporary ID, peer messaging not allowed
-  }
-  
-  // Calculate total message size: senderId + targetId + message
-  size_t totalSize = 1 + 1 + message.length();
-  
-  if (totalSize > CAN_FRAME_DATA_SIZE) {
-    // Use extended message for long messages
-    uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-    buffer[0] = _clientId;
-    buffer[1] = targetClientId;
-    memcpy(buffer + 2, message.c_str(), min(message.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 2)));
+void CANPubSubBrokerCore::sendRestoreBatch(uint8_t clientId, const uint16_t* topics, uint8_t count, bool withNames) {
+  // Format: [clientId][flags]{[topicHash:2][nameLength][name]}, nameLength 0 = name not sent.
+  // Records that do not fit go in further messages, the last one carries CAN_PS_RESTORE_LAST
+  uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+  buffer[0] = clientId;
+  size_t length = 2;
+  
+  for (uint8_t i = 0; i < count; i++) {
+    const char* name = "";
+    if (withNames) {
+      int slot = findStoredTopicName(topics[i]);
+      if (slot >= 0) name = _storedTopicNames[slot].name;
+    }
+    size_t nameLength = strlen(name);
     
-    return sendExtendedMessage(CAN_PS_PEER_MSG, buffer, min(2 + message.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-  } else {
-    _can->beginPacket(CAN_PS_PEER_MSG);
-    _can->write(_clientId);
-    _can->write(targetClientId);
-    _can->print(message);
-    _can->endPacket();
+    if (length + 3 + nameLength > MAX_EXTENDED_MSG_SIZE) {
+      buffer[1] = 0;
+      sendExtendedMessage(CAN_PS_SUB_RESTORE_BATCH, buffer, length);
+      length = 2;
+    }
     
-    return true;
+    buffer[length++] = topics[i] >> 8;
+    buffer[length++] = topics[i] & 0xFF;
+    buffer[length++] = (uint8_t)nameLength;
+    memcpy(buffer + length, name, nameLength);
+    length += nameLength;
   }
+  
+  buffer[1] = CAN_PS_RESTORE_LAST;
+  sendExtendedMessage(CAN_PS_SUB_RESTORE_BATCH, buffer, length);
 }
 
-bool CANPubSubClient::ping() {
-  if (!_connected) return false;
+void CANPubSubBrokerCore::handleTopicNameRequest() {
+  if (_can->available() < 3) return;
   
-  _can->beginPacket(CAN_PS_PING);
-  _can->write(_clientId);
-  _can->endPacket();
+  uint8_t clientId = _can->read();
   
-  _lastPing = millis();
+  uint8_t hashes[CAN_FRAME_DATA_SIZE];
+  size_t length = readPayload(hashes, sizeof(hashes));
   
-  return true;
+  dispatchTopicNameRequest(clientId, hashes, length);
 }
 
-void CANPubSubClient::onMessage(MessageCallback callback) {
-  _onMessage = callback;
+void CANPubSubBrokerCore::dispatchTopicNameRequest(uint8_t clientId, const uint8_t* hashes, size_t length) {
+  // Hashes: [topicHash_h][topicHash_l]...
+  trackClientActivity(clientId);
+  
+  uint16_t topics[MAX_EXTENDED_MSG_SIZE / 2];
+  uint8_t count = 0;
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    topics[count++] = (hashes[i] << 8) | hashes[i + 1];
+  }
+  
+  if (count > 0) {
+    sendRestoreBatch(clientId, topics, count, true);
+  }
 }
 
-void CANPubSubClient::onDirectMessage(DirectMessageCallback callback) {
-  _onDirectMessage = callback;
+int CANPubSubBrokerCore::findStoredSubscription(uint8_t clientId) {
+  for (uint8_t i = 0; i < _storedSubCount; i++) {
+    if (_storedSubscriptions[i].clientId == clientId) {
+      return i;
+    }
+  }
+  return -1;
 }
 
-void CANPubSubClient::onConnect(void (*callback)()) {
-  _onConnect = callback;
+bool CANPubSubBrokerCore::loadSubscriptionsFromStorage() {
+  uint8_t count;
+  uint16_t length;
+  bool truncated;
+  if (!readStorageBlob(STORAGE_TABLE_SUBSCRIPTIONS, count, length, &truncated)) {
+    // No valid subscription data stored
+    return false;
+  }
+  
+  const uint8_t* record = _storageBlob + STORAGE_BLOB_HEADER;
+  const uint8_t* end = record + length;
+  
+  // Lists that do not fit this broker are dropped, longer lists keep their first topics
+  _storedSubCount = 0;
+  uint8_t loaded = 0;
+  while (loaded < count && loaded < _mappingCapacity) {
+    // [clientId][topicCount][topicHash:2]...
+    if (end - record < 2 || end - record < 2 + 2 * record[1]) {
+      if (truncated) break;
+      return false;
+    }
+    ClientTopicList& subs = _storedSubscriptions[loaded];
+    subs.clientId = record[0];
+    subs.topicCount = min(record[1], _topicsPerClient);
+    for (uint8_t j = 0; j < subs.topicCount; j++) {
+      subs.topics[j] = storageGet16(record + 2 + 2 * j);
+    }
+    _storageDrops += record[1] - subs.topicCount;
+    record += 2 + 2 * record[1];
+    loaded++;
+  }
+  
+  _storageDrops += count - loaded;
+  _storedSubCount = loaded;
+  return true;
 }
 
-void CANPubSubClient::onDisconnect(void (*callback)()) {
-  _onDisconnect = callback;
+void CANPubSubBrokerCore::restoreAllSubscriptionsToActiveTable() {
+  // Restore all stored subscriptions to the active _subscriptions table
+  // This runs at boot to make subscriptions immediately available
+  
+  for (uint8_t i = 0; i < _storedSubCount; i++) {
+    ClientTopicList& clientSubs = _storedSubscriptions[i];
+    
+    // Process each topic this client is subscribed to
+    for (uint8_t j = 0; j < clientSubs.topicCount; j++) {
+      uint16_t topicHash = clientSubs.topics[j];
+      uint8_t clientId = clientSubs.clientId;
+      
+      // Add client to the active table (no-op if already subscribed)
+      linkSubscriber(topicHash, clientId);
+    }
+  }
 }
 
-void CANPubSubClient::onPong(void (*callback)()) {
-  _onPong = callback;
+bool CANPubSubBrokerCore::saveSubscriptionsToStorage() {
+  return saveStorageTable(STORAGE_TABLE_SUBSCRIPTIONS);
 }
 
-unsigned long CANPubSubClient::getLastPingTime() {
-  if (_lastPong == 0 || _lastPing == 0 || _lastPong < _lastPing) {
-    return 0; // No valid pong received yet
-  }
-  return _lastPong - _lastPing;
+bool CANPubSubBrokerCore::clearStoredSubscriptions() {
+  _storedSubCount = 0;
+  
+  return saveSubscriptionsToStorage();
 }
 
-bool CANPubSubClient::isSubscribed(const String& topic) {
-  uint16_t topicHash = hashTopic(topic);
-  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
-    if (_subscribedTopics[i] == topicHash) {
+// ===== Ping Configuration Persistence Implementation =====
+
+bool CANPubSubBrokerCore::loadPingConfigFromStorage() {
+  uint8_t count;
+  uint16_t length;
+  if (readStorageBlob(STORAGE_TABLE_PING, count, length) && length == 6) {
+    // [enabled][interval:4][maxMissed]
+    const uint8_t* record = _storageBlob + STORAGE_BLOB_HEADER;
+    unsigned long interval = storageGet32(record + 1);
+    uint8_t maxMissed = record[5];
+    
+    // Validate values before applying (simple sanity check)
+    if (interval > 0 && interval < 3600000 && maxMissed > 0 && maxMissed < 255) {
+      _autoPingEnabled = record[0] != 0;
+      _pingInterval = interval;
+      _maxMissedPings = maxMissed;
       return true;
     }
   }
+  
+  // Nothing stored or invalid data, use defaults
+  _autoPingEnabled = false;
+  _pingInterval = 5000;
+  _maxMissedPings = 2;
   return false;
 }
 
-uint8_t CANPubSubClient::getSubscriptionCount() {
-  return _subscribedTopicCount;
+bool CANPubSubBrokerCore::savePingConfigToStorage() {
+  return saveStorageTable(STORAGE_TABLE_PING);
 }
 
-void CANPubSubClient::listSubscribedTopics(std::function<void(uint16_t hash, const String& name)> callback) {
-  if (!callback) return;
+bool CANPubSubBrokerCore::clearStoredPingConfig() {
+  // Reset to defaults
+  _autoPingEnabled = false;
+  _pingInterval = 5000;
+  _maxMissedPings = 2;
   
-  for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
-    uint16_t hash = _subscribedTopics[i];
-    String name = getTopicName(hash);
-    callback(hash, name);
-  }
+  return savePingConfigToStorage();
 }
 
-void CANPubSubClient::onExtendedMessageComplete(uint8_t msgType, uint8_t senderId, const uint8_t* data, size_t length) {
-  // Handle extended messages based on type
-  switch (msgType) {
-    case CAN_PS_ID_RESPONSE: {
-      // Extended ID response with serial number verification
-      // Format (in buffer): [hasStoredSubs][serialNumberLength][serialNumber...]
-      // Note: assignedId was already extracted by processExtendedFrame from first byte
-      if (length < 2) return;
-      
-      uint8_t assignedId = senderId; // The extracted "senderId" is actually the assignedId
-      bool hasStoredSubs = (data[0] == 0x01);
-      uint8_t serialLen = data[1];
-      
-      String receivedSerial = "";
-      for (uint8_t i = 0; i < serialLen && (2 + i) < length; i++) {
-        receivedSerial += (char)data[2 + i];
-      }
-      
-      // Only accept this ID if the serial number matches ours
-      if (_serialNumber.length() > 0 && receivedSerial != _serialNumber) {
-        // This ID response is not for us, ignore it
-        return;
-      }
-      
-      _clientId = assignedId;
-      _connected = true;
-      
-      // If subscriptions will be restored, broker will send them shortly
-      // Client just needs to wait and handle incoming SUBSCRIBE messages
-      break;
-    }
+// ===== Topic Name Persistence Implementation =====
+
+void CANPubSubBrokerCore::storeTopicName(uint16_t hash, const String& name) {
+  // Check if topic name already stored
+  int index = findStoredTopicName(hash);
+  
+  if (index >= 0) {
+    // Re-subscribing to a known topic does not touch flash
+    if (strncmp(_storedTopicNames[index].name, name.c_str(), MAX_TOPIC_NAME_LENGTH - 1) == 0) return;
     
-    case CAN_PS_SUBSCRIBE: {
-      // Extended subscribe notification from broker (restored subscription)
-      // Format (in buffer): [topicHash_h][topicHash_l][topicNameLen][topicName...]
-      // Note: clientId was already extracted by processExtendedFrame from first byte
-      if (length < 3) return;
-      
-      // The senderId parameter actually contains our clientId
-      if (senderId != _clientId) return; // Not for us
-      
-      uint16_t topicHash = (data[0] << 8) | data[1];
-      uint8_t topicLen = data[2];
-      
-      String topic = "";
-      for (uint8_t i = 0; i < topicLen && (3 + i) < length; i++) {
-        topic += (char)data[3 + i];
-      }
-      
-      // Register the topic mapping locally
-      if (topic.length() > 0) {
-        registerTopic(topic);
-      }
-      
-      // Add to local subscription list
-      if (_subscribedTopicCount < MAX_CLIENT_TOPICS) {
-        // Check if already subscribed
-        bool alreadySubscribed = false;
-        for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
-          if (_subscribedTopics[i] == topicHash) {
-            alreadySubscribed = true;
-            break;
-          }
-        }
-        
-        if (!alreadySubscribed) {
-          _subscribedTopics[_subscribedTopicCount++] = topicHash;
+    // A different name with the same hash: both topics share one set of
+    // subscribers, keep the first name and let the application know
+    reportTopicCollision(hash, _storedTopicNames[index].getName(), name);
+  } else {
+    // Find empty slot or add new entry
+    for (uint8_t i = 0; i < _storedTopicCapacity; i++) {
+      if (!_storedTopicNames[i].active) {
+        _storedTopicNames[i].hash = hash;
+        _storedTopicNames[i].setName(name);
+        _storedTopicNames[i].active = true;
+        if (i >= _storedTopicCount) {
+          _storedTopicCount = i + 1;
         }
+        markStorageDirty(STORAGE_TABLE_TOPIC_NAMES);
+        return;
       }
-      break;
     }
-    
-    case CAN_PS_SUB_RESTORE: {
-      // Extended subscription restore from broker (with topic name)
-      // Format (in buffer): [topicHash_h][topicHash_l][topicNameLen][topicName...]
-      // Note: clientId was already extracted by processExtendedFrame from first byte
-      if (length < 3) return;
-      
-      // The senderId parameter actually contains our clientId
-      if (senderId != _clientId) return; // Not for us
-      
-      uint16_t topicHash = (data[0] << 8) | data[1];
-      uint8_t topicLen = data[2];
-      
-      String topic = "";
-      for (uint8_t i = 0; i < topicLen && (3 + i) < length; i++) {
-        topic += (char)data[3 + i];
-      }
-      
-      // Register the topic mapping locally
-      if (topic.length() > 0) {
-        registerTopic(topic);
-      }
-      
-      // Add to local subscription list
-      if (_subscribedTopicCount < MAX_CLIENT_TOPICS) {
-        // Check if already subscribed
-        bool alreadySubscribed = false;
-        for (uint8_t i = 0; i < _subscribedTopicCount; i++) {
-          if (_subscribedTopics[i] == topicHash) {
-            alreadySubscribed = true;
-            break;
-          }
-        }
-        
-        if (!alreadySubscribed) {
-          _subscribedTopics[_subscribedTopicCount++] = topicHash;
-        }
-      }
-      break;
+  }
+}
+
+String CANPubSubBrokerCore::getStoredTopicName(uint16_t hash) {
+  int index = findStoredTopicName(hash);
+  if (index >= 0) {
+    return _storedTopicNames[index].getName();
+  }
+  return String("0x") + String(hash, HEX);
+}
+
+int CANPubSubBrokerCore::findStoredTopicName(uint16_t hash) {
+  for (uint8_t i = 0; i < _storedTopicCount; i++) {
+    if (_storedTopicNames[i].active && _storedTopicNames[i].hash == hash) {
+      return i;
     }
-    
-    case CAN_PS_TOPIC_DATA: {
-      // Extended topic data
-      // Format (in buffer): [topicHash_h][topicHash_l][message...]
-      // Note: targetId (subscriber ID) was already extracted by processExtendedFrame from first byte
-      if (length < 2) return;
-      
-      // The senderId parameter actually contains the targetId for this message type
-      if (senderId != _clientId) return; // Not for us
-      
-      uint16_t topicHash = (data[0] << 8) | data[1];
-      String message = "";
-      
-      for (size_t i = 2; i < length; i++) {
-        message += (char)data[i];
-      }
-      
-      if (_onMessage) {
-        String topicName = getTopicName(topicHash);
-        _onMessage(topicHash, topicName, message);
-      }
-      break;
+  }
+  return -1;
+}
+
+bool CANPubSubBrokerCore::loadTopicNamesFromStorage() {
+  uint8_t count;
+  uint16_t length;
+  bool truncated;
+  if (!readStorageBlob(STORAGE_TABLE_TOPIC_NAMES, count, length, &truncated)) {
+    // No valid topic name data stored
+    return false;
+  }
+  
+  const uint8_t* record = _storageBlob + STORAGE_BLOB_HEADER;
+  const uint8_t* end = record + length;
+  
+  // Names beyond StoredNames are dropped, the first ones kept
+  memset(_storedTopicNames, 0, _storedTopicCapacity * sizeof(StoredTopicName));
+  _storedTopicCount = 0;
+  uint8_t loaded = 0;
+  while (loaded < count && loaded < _storedTopicCapacity) {
+    // [hash:2][nameLength][name]
+    if (end - record < 3 || end - record < 3 + record[2]) {
+      if (truncated) break;
+      memset(_storedTopicNames, 0, _storedTopicCapacity * sizeof(StoredTopicName));
+      return false;
+    }
+    if (record[2] >= MAX_TOPIC_NAME_LENGTH) {
+      memset(_storedTopicNames, 0, _storedTopicCapacity * sizeof(StoredTopicName));
+      return false;
     }
+    StoredTopicName& topic = _storedTopicNames[loaded];
+    topic.hash = storageGet16(record);
+    memcpy(topic.name, record + 3, record[2]);
+    topic.active = true;
+    record += 3 + record[2];
+    loaded++;
     
-    case CAN_PS_DIRECT_MSG: {
-      // Extended direct message
-      // Format (in buffer): [targetId][message...]
-      // Note: senderId was already extracted by processExtendedFrame from first byte
-      if (length < 1) return;
-      
-      uint8_t targetId = data[0];
-      
-      if (targetId != _clientId) return; // Not for us
-      
-      String message = "";
-      for (size_t i = 1; i < length; i++) {
-        message += (char)data[i];
+    // Re-register topic in runtime mapping
+    registerTopic(topic.name);
+  }
+  
+  _storageDrops += count - loaded;
+  _storedTopicCount = loaded;
+  return true;
+}
+
+bool CANPubSubBrokerCore::saveTopicNamesToStorage() {
+  return saveStorageTable(STORAGE_TABLE_TOPIC_NAMES);
+}
+
+bool CANPubSubBrokerCore::clearStoredTopicNames() {
+  _storedTopicCount = 0;
+  memset(_storedTopicNames, 0, _storedTopicCapacity * sizeof(StoredTopicName));
+  
+  return saveTopicNamesToStorage();
+}
+
+// ===== Write-behind Persistence Implementation =====
+
+void CANPubSubBrokerCore::setPersistInterval(unsigned long intervalMs) {
+  _persistInterval = intervalMs;
+}
+
+unsigned long CANPubSubBrokerCore::getPersistInterval() {
+  return _persistInterval;
+}
+
+bool CANPubSubBrokerCore::hasPendingWrites() {
+  return _storageDirty != 0;
+}
+
+uint16_t CANPubSubBrokerCore::getStorageDrops() {
+  return _storageDrops;
+}
+
+void CANPubSubBrokerCore::markStorageDirty(uint8_t table) {
+  _storageDirty |= (1 << table);
+  if (!_persistPending) {
+    _persistPending = true;
+    _persistDirtySince = millis();
+  }
+}
+
+bool CANPubSubBrokerCore::flush() {
+  _persistPending = false;
+  if (!_storageDirty) return true;
+  
+  // The persistence task owns the blob buffer while it runs
+  if (deferToPersistTask()) return true;
+  
+  bool ok = true;
+  for (uint8_t table = 0; table < STORAGE_TABLE_COUNT; table++) {
+    if (_storageDirty & (1 << table)) {
+      ok = saveStorageTable(table) && ok;
+    }
+  }
+  return ok;
+}
+
+bool CANPubSubBrokerCore::deferToPersistTask() {
+#if CAN_PS_TASKS
+  if (_persistTaskHandle) {
+    xTaskNotifyGive(_persistTaskHandle);
+    return true;
+  }
+#endif
+  return false;
+}
+
+// ===== Packed Storage Tables =====
+
+bool CANPubSubBrokerCore::saveStorageTable(uint8_t table) {
+  // In task mode this runs from the routing path, the persistence task writes instead
+  _storageDirty |= (1 << table);
+  if (deferToPersistTask()) return true;
+  
+  _storageDirty &= ~(1 << table);
+  uint8_t count;
+  uint16_t length = packStorageTable(table, count);
+  return writeStorageBlob(table, count, length);
+}
+
+uint16_t CANPubSubBrokerCore::packStorageTable(uint8_t table, uint8_t& count) {
+  uint8_t* record = _storageBlob + STORAGE_BLOB_HEADER;
+  count = 0;
+  
+  switch (table) {
+    case STORAGE_TABLE_MAPPINGS:
+      *record++ = _nextClientID;
+      for (uint8_t i = 0; i < _mappingCount; i++) {
+        const ClientMapping& mapping = _clientMappings[i];
+        uint8_t serialLength = strnlen(mapping.serialNumber, MAX_SERIAL_LENGTH - 1);
+        *record++ = mapping.clientId;
+        *record++ = mapping.registered ? 1 : 0;
+        *record++ = serialLength;
+        memcpy(record, mapping.serialNumber, serialLength);
+        record += serialLength;
       }
+      count = _mappingCount;
+      break;
       
-      if (_onDirectMessage) {
-        _onDirectMessage(senderId, message);
+    case STORAGE_TABLE_SUBSCRIPTIONS:
+      for (uint8_t i = 0; i < _storedSubCount; i++) {
+        const ClientTopicList& subs = _storedSubscriptions[i];
+        *record++ = subs.clientId;
+        *record++ = subs.topicCount;
+        for (uint8_t j = 0; j < subs.topicCount; j++) {
+          storagePut16(record, subs.topics[j]);
+          record += 2;
+        }
       }
+      count = _storedSubCount;
       break;
-    }
-    
-    case CAN_PS_PEER_MSG: {
-      // Extended peer message (from another client)
-      // Format (in buffer): [targetId][message...]
-      // Note: senderId was already extracted by processExtendedFrame from first byte
-      if (length < 1) return;
-      
-      uint8_t targetId = data[0];
       
-      if (targetId != _clientId) return; // Not for us
-      
-      String message = "";
-      for (size_t i = 1; i < length; i++) {
-        message += (char)data[i];
+    case STORAGE_TABLE_TOPIC_NAMES:
+      // Freed slots are dropped, load() packs the names to the front
+      for (uint8_t i = 0; i < _storedTopicCount; i++) {
+        const StoredTopicName& topic = _storedTopicNames[i];
+        if (!topic.active) continue;
+        uint8_t nameLength = strnlen(topic.name, MAX_TOPIC_NAME_LENGTH - 1);
+        storagePut16(record, topic.hash);
+        record[2] = nameLength;
+        memcpy(record + 3, topic.name, nameLength);
+        record += 3 + nameLength;
+        count++;
       }
+      break;
       
-      // Deduplicate: skip if same sender and message within 50ms
-      unsigned long now = millis();
-      bool isDuplicate = (senderId == _lastPeerSenderId && 
-                          message == String(_lastPeerMessage) &&
-                          (now - _lastPeerMsgTime) < 50);
-      
-      // Call direct message callback (reuse for peer messages)
-      if (!isDuplicate && _onDirectMessage) {
-        _onDirectMessage(senderId, message);
-        
-        // Track this message to detect duplicates
-        _lastPeerSenderId = senderId;
-        _lastPeerMsgTime = now;
-        strncpy(_lastPeerMessage, message.c_str(), 31);
-        _lastPeerMessage[31] = '\0';
-      }
+    case STORAGE_TABLE_PING:
+      *record++ = _autoPingEnabled ? 1 : 0;
+      storagePut32(record, _pingInterval);
+      record += 4;
+      *record++ = _maxMissedPings;
+      count = 1;
       break;
-    }
   }
+  
+  return record - (_storageBlob + STORAGE_BLOB_HEADER);
 }
 
-// ===== Persistent Storage Implementation =====
-
-void CANPubSubBroker::initStorage() {
+bool CANPubSubBrokerCore::writeStorageBlob(uint8_t table, uint8_t count, uint16_t length) {
+  const StorageTable& where = STORAGE_TABLES[table];
+  uint16_t size = STORAGE_BLOB_HEADER + length;
+  
+  storagePut16(_storageBlob, where.magic);
+  _storageBlob[2] = STORAGE_VERSION;
+  _storageBlob[3] = count;
+  storagePut16(_storageBlob + 4, length);
+  uint32_t crc = storageCrc32(_storageBlob, 6, 0);
+  crc = storageCrc32(_storageBlob + STORAGE_BLOB_HEADER, length, crc);
+  storagePut32(_storageBlob + 6, crc);
+  
   #ifdef ESP32
-    // ESP32 uses Preferences (NVS)
-    _preferences.begin(STORAGE_NAMESPACE, false);
+    return _preferences.putBytes(where.key, _storageBlob, size) == size;
   #else
-    // Arduino uses EEPROM
-    EEPROM.begin(EEPROM_SIZE);
+    // Unchanged bytes are not rewritten (EEPROM wear)
+    for (uint16_t i = 0; i < size; i++) {
+      if (EEPROM.read(where.address + i) != _storageBlob[i]) {
+        EEPROM.write(where.address + i, _storageBlob[i]);
+      }
+    }
+    #if defined(ESP8266)
+      return EEPROM.commit();
+    #else
+      return true;
+    #endif
   #endif
 }
 
-bool CANPubSubBroker::loadMappingsFromStorage() {
+bool CANPubSubBrokerCore::readStorageBlob(uint8_t table, uint8_t& count, uint16_t& length, bool* truncated) {
+  // A table larger than this broker's buffer (written for more Clients, TopicsPerClient or
+  // StoredNames) is checked whole and its front loaded, if the caller takes a truncated table
+  const StorageTable& where = STORAGE_TABLES[table];
+  uint32_t crc;
+  
   #ifdef ESP32
-    // ESP32 implementation using Preferences
-    uint16_t magic = _preferences.getUShort("magic", 0);
-    if (magic != STORAGE_MAGIC) {
-      // No valid data stored
-      return false;
-    }
-    
-    _mappingCount = _preferences.getUChar("count", 0);
-    _nextClientID = _preferences.getUChar("nextID", 0x01);
+    size_t size = _preferences.isKey(where.key) ? _preferences.getBytesLength(where.key) : 0;
+    if (size < STORAGE_BLOB_HEADER || size > where.size) return false;
+    if (size > _storageBlobSize && !truncated) return false;
     
-    if (_mappingCount > MAX_CLIENT_MAPPINGS) {
-      _mappingCount = 0;
-      return false;
+    // Preferences reads a blob whole only, a larger one goes through the heap once at begin()
+    uint8_t* data = _storageBlob;
+    if (size > _storageBlobSize) {
+      data = (uint8_t*)malloc(size);
+      if (!data) return false;
     }
-    
-    // Load each mapping
-    for (uint8_t i = 0; i < _mappingCount; i++) {
-      String key = "map" + String(i);
-      size_t len = _preferences.getBytesLength(key.c_str());
-      if (len == sizeof(ClientMapping)) {
-        _preferences.getBytes(key.c_str(), &_clientMappings[i], sizeof(ClientMapping));
-      }
+    bool read = _preferences.getBytes(where.key, data, size) == size;
+    crc = storageCrc32(data, 6, 0);
+    crc = storageCrc32(data + STORAGE_BLOB_HEADER, size - STORAGE_BLOB_HEADER, crc);
+    if (data != _storageBlob) {
+      memcpy(_storageBlob, data, _storageBlobSize);
+      free(data);
     }
-    
-    return true;
-    
+    if (!read) return false;
   #else
-    // Arduino EEPROM implementation
-    uint16_t magic;
-    EEPROM.get(0, magic);
-    
-    if (magic != STORAGE_MAGIC) {
-      // No valid data stored
-      return false;
-    }
-    
-    int addr = sizeof(uint16_t);
-    EEPROM.get(addr, _mappingCount);
-    addr += sizeof(uint8_t);
-    
-    EEPROM.get(addr, _nextClientID);
-    addr += sizeof(uint8_t);
-    
-    if (_mappingCount > MAX_CLIENT_MAPPINGS) {
-      _mappingCount = 0;
-      return false;
+    for (uint8_t i = 0; i < STORAGE_BLOB_HEADER; i++) {
+      _storageBlob[i] = EEPROM.read(where.address + i);
     }
+    size_t size = STORAGE_BLOB_HEADER + storageGet16(_storageBlob + 4);
+    if (storageGet16(_storageBlob) != where.magic || size > where.size) return false;
+    if (size > _storageBlobSize && !truncated) return false;
     
-    // Load each mapping
-    for (uint8_t i = 0; i < _mappingCount; i++) {
-      EEPROM.get(addr, _clientMappings[i]);
-      addr += sizeof(ClientMapping);
+    crc = storageCrc32(_storageBlob, 6, 0);
+    for (size_t i = STORAGE_BLOB_HEADER; i < size; i++) {
+      uint8_t value = EEPROM.read(where.address + i);
+      crc = storageCrc32(&value, 1, crc);
+      if (i < _storageBlobSize) _storageBlob[i] = value;
     }
-    
-    return true;
   #endif
+  
+  length = storageGet16(_storageBlob + 4);
+  count = _storageBlob[3];
+  if (storageGet16(_storageBlob) != where.magic || _storageBlob[2] != STORAGE_VERSION ||
+      size != (size_t)STORAGE_BLOB_HEADER + length) {
+    return false;
+  }
+  
+  // A torn or corrupted write fails here and the table loads as empty
+  if (crc != storageGet32(_storageBlob + 6)) return false;
+  
+  // The records that were loaded, the last one may be cut off
+  if (truncated) *truncated = size > _storageBlobSize;
+  if (size > _storageBlobSize) length = _storageBlobSize - STORAGE_BLOB_HEADER;
+  return true;
 }
 
-bool CANPubSubBroker::saveMappingsToStorage() {
-  #ifdef ESP32
-    // ESP32 implementation using Preferences
-    _preferences.putUShort("magic", STORAGE_MAGIC);
-    _preferences.putUChar("count", _mappingCount);
-    _preferences.putUChar("nextID", _nextClientID);
-    
-    // Save each mapping
-    for (uint8_t i = 0; i < _mappingCount; i++) {
-      String key = "map" + String(i);
-      _preferences.putBytes(key.c_str(), &_clientMappings[i], sizeof(ClientMapping));
+uint32_t CANPubSubBrokerCore::storageCrc32(const uint8_t* data, size_t length, uint32_t crc) {
+  // CRC-32 (IEEE 802.3), bitwise: a few kilobytes at boot do not need a lookup table
+  crc = ~crc;
+  while (length--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
     }
-    
-    return true;
-    
-  #else
-    // Arduino EEPROM implementation
-    int addr = 0;
-    
-    // Write magic number
-    EEPROM.put(addr, STORAGE_MAGIC);
-    addr += sizeof(uint16_t);
-    
-    // Write count and next ID
-    EEPROM.put(addr, _mappingCount);
-    addr += sizeof(uint8_t);
-    
-    EEPROM.put(addr, _nextClientID);
-    addr += sizeof(uint8_t);
-    
-    // Write each mapping
-    for (uint8_t i = 0; i < _mappingCount; i++) {
-      EEPROM.put(addr, _clientMappings[i]);
-      addr += sizeof(ClientMapping);
-    }
-    
-    #if defined(ESP8266)
-      EEPROM.commit();
-    #endif
-    
-    return true;
-  #endif
+  }
+  return ~crc;
 }
 
-bool CANPubSubBroker::clearStoredMappings() {
-  _mappingCount = 0;
-  _nextClientID = 0x01;
-  memset(_clientMappings, 0, sizeof(_clientMappings));
-  
+// ===== Version 1 Storage Migration =====
+
+void CANPubSubBrokerCore::migrateLegacyStorage() {
   #ifdef ESP32
-    _preferences.clear();
-    return true;
+    // Version 1 kept one key per record next to its magic/count keys
+    if (!_preferences.isKey("magic") && !_preferences.isKey("subMagic") &&
+        !_preferences.isKey("topicMagic") && !_preferences.isKey("pingInterval")) return;
   #else
-    // Clear EEPROM by writing 0 to magic number
-    uint16_t zero = 0;
-    EEPROM.put(0, zero);
-    #if defined(ESP8266)
-      EEPROM.commit();
-    #endif
-    return true;
+    if ((EEPROM.read(0) | (EEPROM.read(1) << 8)) == STORAGE_FORMAT_MAGIC) return;
   #endif
-}
-
-// ===== Subscription Persistence Implementation =====
-
-void CANPubSubBroker::storeClientSubscriptions(uint8_t clientId) {
-  // Find or create stored subscription entry for this client
-  int index = findStoredSubscription(clientId);
   
-  if (index < 0) {
-    // Create new entry if space available
-    if (_storedSubCount >= MAX_CLIENT_MAPPINGS) return;
-    index = _storedSubCount++;
-    _storedSubscriptions[index].clientId = clientId;
-  }
+  loadLegacyMappings();
+  loadLegacySubscriptions();
+  loadLegacyTopicNames();
+  loadLegacyPingConfig();
+  
+  #ifndef ESP32
+    // The packed regions overlap the old layout: mark the format first, an
+    // interrupted migration then comes back as empty tables rather than mixed data
+    EEPROM.write(0, STORAGE_FORMAT_MAGIC & 0xFF);
+    EEPROM.write(1, STORAGE_FORMAT_MAGIC >> 8);
+    EEPROM.write(2, STORAGE_VERSION);
+  #endif
   
-  // Collect all topics this client is subscribed to
-  _storedSubscriptions[index].topicCount = 0;
-  for (uint8_t i = 0; i < _subTableSize && _storedSubscriptions[index].topicCount < MAX_STORED_SUBS_PER_CLIENT; i++) {
-    for (uint8_t j = 0; j < _subscriptions[i].subCount; j++) {
-      if (_subscriptions[i].subscribers[j] == clientId) {
-        _storedSubscriptions[index].topics[_storedSubscriptions[index].topicCount++] = _subscriptions[i].topicHash;
-        break;
-      }
-    }
+  for (uint8_t table = 0; table < STORAGE_TABLE_COUNT; table++) {
+    saveStorageTable(table);
   }
   
-  // Save to persistent storage
-  saveSubscriptionsToStorage();
+  #ifdef ESP32
+    // Old keys go once the new blobs are written, an interrupted migration is redone
+    static const char* const legacyKeys[] = {
+      "magic", "count", "nextID", "subMagic", "subCount", "topicMagic", "topicCount",
+      "pingEnabled", "pingInterval", "pingMaxMissed"
+    };
+    for (uint8_t i = 0; i < sizeof(legacyKeys) / sizeof(legacyKeys[0]); i++) {
+      if (_preferences.isKey(legacyKeys[i])) _preferences.remove(legacyKeys[i]);
+    }
+    for (uint8_t i = 0; i < MAX_CLIENT_MAPPINGS; i++) {
+      String key = "map" + String(i);
+      if (_preferences.isKey(key.c_str())) _preferences.remove(key.c_str());
+      key = "sub" + String(i);
+      if (_preferences.isKey(key.c_str())) _preferences.remove(key.c_str());
+    }
+    for (uint8_t i = 0; i < MAX_STORED_TOPIC_NAMES; i++) {
+      String key = "topic" + String(i);
+      if (_preferences.isKey(key.c_str())) _preferences.remove(key.c_str());
+    }
+  #endif
 }
 
-void CANPubSubBroker::restoreClientSubscriptions(uint8_t clientId) {
-  // Find stored subscriptions for this client
-  int index = findStoredSubscription(clientId);
-  if (index < 0) return;
-  
-  // Restore each subscription to broker's internal table and notify client
-  for (uint8_t i = 0; i < _storedSubscriptions[index].topicCount; i++) {
-    uint16_t topicHash = _storedSubscriptions[index].topics[i];
+bool CANPubSubBrokerCore::loadLegacyMappings() {
+  #ifdef ESP32
+    if (_preferences.getUShort("magic", 0) != STORAGE_MAGIC) return false;
     
-    // Find if topic already exists in active subscriptions table
-    int topicIndex = -1;
-    for (uint8_t j = 0; j < _subTableSize; j++) {
-      if (_subscriptions[j].topicHash == topicHash) {
-        topicIndex = j;
-        break;
-      }
-    }
+    _mappingCount = _preferences.getUChar("count", 0);
+    _nextClientID = _preferences.getUChar("nextID", 0x01);
+    clampLegacyCount(_mappingCount, _mappingCapacity);
     
-    if (topicIndex >= 0) {
-      // Topic exists - check if client is already subscribed
-      bool alreadySubscribed = false;
-      for (uint8_t k = 0; k < _subscriptions[topicIndex].subCount; k++) {
-        if (_subscriptions[topicIndex].subscribers[k] == clientId) {
-          alreadySubscribed = true;
-          break;
-        }
-      }
-      
-      // Add client to this topic's subscribers if not already there
-      if (!alreadySubscribed && _subscriptions[topicIndex].subCount < MAX_SUBSCRIBERS_PER_TOPIC) {
-        _subscriptions[topicIndex].subscribers[_subscriptions[topicIndex].subCount++] = clientId;
-      }
-    } else {
-      // Topic doesn't exist - create new topic entry
-      if (_subTableSize < MAX_SUBSCRIPTIONS) {
-        _subscriptions[_subTableSize].topicHash = topicHash;
-        _subscriptions[_subTableSize].subscribers[0] = clientId;
-        _subscriptions[_subTableSize].subCount = 1;
-        _subTableSize++;
+    for (uint8_t i = 0; i < _mappingCount; i++) {
+      String key = "map" + String(i);
+      if (_preferences.getBytesLength(key.c_str()) == sizeof(ClientMapping)) {
+        _preferences.getBytes(key.c_str(), &_clientMappings[i], sizeof(ClientMapping));
       }
     }
+  #else
+    uint16_t magic;
+    EEPROM.get(0, magic);
+    if (magic != STORAGE_MAGIC) return false;
     
-    // Get topic name from persistent storage (not just runtime mapping)
-    String topicName = getStoredTopicName(topicHash);
-    
-    // Send topic name back to client using SUB_RESTORE message type
-    // Format: [clientId][topicHash][topicNameLength][topicName]
-    size_t totalSize = 1 + 2 + 1 + topicName.length();
-    
-    if (totalSize > CAN_FRAME_DATA_SIZE) {
-      // Use extended message for long topic names
-      uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
-      buffer[0] = clientId;
-      buffer[1] = topicHash >> 8;
-      buffer[2] = topicHash & 0xFF;
-      buffer[3] = (uint8_t)topicName.length();
-      memcpy(buffer + 4, topicName.c_str(), min(topicName.length(), (size_t)(MAX_EXTENDED_MSG_SIZE - 4)));
-      
-      sendExtendedMessage(CAN_PS_SUB_RESTORE, buffer, min(4 + topicName.length(), (size_t)MAX_EXTENDED_MSG_SIZE));
-    } else {
-      _can->beginPacket(CAN_PS_SUB_RESTORE);
-      _can->write(clientId);
-      _can->write(topicHash >> 8);
-      _can->write(topicHash & 0xFF);
-      _can->write((uint8_t)topicName.length());
-      _can->print(topicName);
-      _can->endPacket();
-    }
-    
-    delay(15); // Small delay between messages
-  }
-}
-
-int CANPubSubBroker::findStoredSubscription(uint8_t clientId) {
-  for (uint8_t i = 0; i < _storedSubCount; i++) {
-    if (_storedSubscriptions[i].clientId == clientId) {
-      return i;
+    int addr = sizeof(uint16_t);
+    EEPROM.get(addr, _mappingCount);
+    addr += sizeof(uint8_t);
+    EEPROM.get(addr, _nextClientID);
+    addr += sizeof(uint8_t);
+    clampLegacyCount(_mappingCount, _mappingCapacity);
+    
+    for (uint8_t i = 0; i < _mappingCount; i++) {
+      EEPROM.get(addr, _clientMappings[i]);
+      addr += sizeof(ClientMapping);
     }
+  #endif
+  
+  for (uint8_t i = 0; i < _mappingCount; i++) {
+    _clientMappings[i].serialNumber[MAX_SERIAL_LENGTH - 1] = '\0';
   }
-  return -1;
+  return true;
 }
 
-bool CANPubSubBroker::loadSubscriptionsFromStorage() {
+bool CANPubSubBrokerCore::loadLegacySubscriptions() {
   #ifdef ESP32
-    // ESP32 implementation using Preferences
-    uint16_t magic = _preferences.getUShort("subMagic", 0);
-    if (magic != STORAGE_SUB_MAGIC) {
-      // No valid subscription data stored
-      return false;
-    }
+    if (_preferences.getUShort("subMagic", 0) != STORAGE_SUB_MAGIC) return false;
     
     _storedSubCount = _preferences.getUChar("subCount", 0);
+    clampLegacyCount(_storedSubCount, _mappingCapacity);
     
-    if (_storedSubCount > MAX_CLIENT_MAPPINGS) {
-      _storedSubCount = 0;
-      return false;
-    }
-    
-    // Load each subscription set
     for (uint8_t i = 0; i < _storedSubCount; i++) {
       String key = "sub" + String(i);
-      size_t len = _preferences.getBytesLength(key.c_str());
-      if (len == sizeof(ClientSubscriptions)) {
-        _preferences.getBytes(key.c_str(), &_storedSubscriptions[i], sizeof(ClientSubscriptions));
+      ClientSubscriptions legacy = {};
+      if (_preferences.getBytesLength(key.c_str()) == sizeof(ClientSubscriptions)) {
+        _preferences.getBytes(key.c_str(), &legacy, sizeof(ClientSubscriptions));
       }
+      copyLegacySubscriptions(_storedSubscriptions[i], legacy);
     }
-    
-    return true;
-    
   #else
-    // Arduino EEPROM implementation
-    // Calculate offset (after client mappings)
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping));
-    
+    int addr = STORAGE_LEGACY_SUB_ADDR;
     uint16_t magic;
     EEPROM.get(addr, magic);
-    
-    if (magic != STORAGE_SUB_MAGIC) {
-      // No valid subscription data stored
-      return false;
-    }
+    if (magic != STORAGE_SUB_MAGIC) return false;
     
     addr += sizeof(uint16_t);
     EEPROM.get(addr, _storedSubCount);
     addr += sizeof(uint8_t);
+    clampLegacyCount(_storedSubCount, _mappingCapacity);
     
-    if (_storedSubCount > MAX_CLIENT_MAPPINGS) {
-      _storedSubCount = 0;
-      return false;
-    }
-    
-    // Load each subscription set
     for (uint8_t i = 0; i < _storedSubCount; i++) {
-      EEPROM.get(addr, _storedSubscriptions[i]);
+      ClientSubscriptions legacy;
+      EEPROM.get(addr, legacy);
+      copyLegacySubscriptions(_storedSubscriptions[i], legacy);
       addr += sizeof(ClientSubscriptions);
     }
-    
-    return true;
   #endif
+  
+  return true;
 }
 
-void CANPubSubBroker::restoreAllSubscriptionsToActiveTable() {
-  // Restore all stored subscriptions to the active _subscriptions table
-  // This runs at boot to make subscriptions immediately available
-  
-  for (uint8_t i = 0; i < _storedSubCount; i++) {
-    ClientSubscriptions& clientSubs = _storedSubscriptions[i];
-    
-    // Process each topic this client is subscribed to
-    for (uint8_t j = 0; j < clientSubs.topicCount && j < MAX_STORED_SUBS_PER_CLIENT; j++) {
-      uint16_t topicHash = clientSubs.topics[j];
-      uint8_t clientId = clientSubs.clientId;
-      
-      // Find if this topic already exists in active table
-      int topicIndex = -1;
-      for (uint8_t k = 0; k < _subTableSize; k++) {
-        if (_subscriptions[k].topicHash == topicHash) {
-          topicIndex = k;
-          break;
-        }
-      }
-      
-      if (topicIndex >= 0) {
-        // Topic exists, add client to subscribers if not already there
-        bool alreadySubscribed = false;
-        for (uint8_t s = 0; s < _subscriptions[topicIndex].subCount; s++) {
-          if (_subscriptions[topicIndex].subscribers[s] == clientId) {
-            alreadySubscribed = true;
-            break;
-          }
-        }
-        
-        if (!alreadySubscribed && _subscriptions[topicIndex].subCount < MAX_SUBSCRIBERS_PER_TOPIC) {
-          _subscriptions[topicIndex].subscribers[_subscriptions[topicIndex].subCount++] = clientId;
-        }
-      } else {
-        // Topic doesn't exist, create new entry
-        if (_subTableSize < MAX_SUBSCRIPTIONS) {
-          _subscriptions[_subTableSize].topicHash = topicHash;
-          _subscriptions[_subTableSize].subCount = 1;
-          _subscriptions[_subTableSize].subscribers[0] = clientId;
-          _subTableSize++;
-        }
-      }
-    }
-  }
+void CANPubSubBrokerCore::copyLegacySubscriptions(ClientTopicList& list, const ClientSubscriptions& legacy) {
+  list.clientId = legacy.clientId;
+  list.topicCount = min(legacy.topicCount, _topicsPerClient);
+  if (legacy.topicCount <= MAX_STORED_SUBS_PER_CLIENT) _storageDrops += legacy.topicCount - list.topicCount;
+  memcpy(list.topics, legacy.topics, list.topicCount * sizeof(uint16_t));
 }
 
-bool CANPubSubBroker::saveSubscriptionsToStorage() {
+void CANPubSubBrokerCore::clampLegacyCount(uint8_t& count, uint8_t capacity) {
+  // The first records are migrated, the rest counted as dropped
+  if (count <= capacity) return;
+  _storageDrops += count - capacity;
+  count = capacity;
+}
+
+bool CANPubSubBrokerCore::loadLegacyTopicNames() {
   #ifdef ESP32
-    // ESP32 implementation using Preferences
-    _preferences.putUShort("subMagic", STORAGE_SUB_MAGIC);
-    _preferences.putUChar("subCount", _storedSubCount);
-    
-    // Save each subscription set
-    for (uint8_t i = 0; i < _storedSubCount; i++) {
-      String key = "sub" + String(i);
-      _preferences.putBytes(key.c_str(), &_storedSubscriptions[i], sizeof(ClientSubscriptions));
-    }
+    if (_preferences.getUShort("topicMagic", 0) != STORAGE_TOPIC_MAGIC) return false;
     
-    return true;
+    _storedTopicCount = _preferences.getUChar("topicCount", 0);
+    clampLegacyCount(_storedTopicCount, _storedTopicCapacity);
     
+    for (uint8_t i = 0; i < _storedTopicCount; i++) {
+      String key = "topic" + String(i);
+      if (_preferences.getBytesLength(key.c_str()) == sizeof(StoredTopicName)) {
+        _preferences.getBytes(key.c_str(), &_storedTopicNames[i], sizeof(StoredTopicName));
+      }
+    }
   #else
-    // Arduino EEPROM implementation
-    // Calculate offset (after client mappings)
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping));
+    int addr = STORAGE_LEGACY_TOPIC_ADDR;
+    uint16_t magic;
+    EEPROM.get(addr, magic);
+    if (magic != STORAGE_TOPIC_MAGIC) return false;
     
-    // Write magic number
-    EEPROM.put(addr, STORAGE_SUB_MAGIC);
     addr += sizeof(uint16_t);
-    
-    // Write count
-    EEPROM.put(addr, _storedSubCount);
+    EEPROM.get(addr, _storedTopicCount);
     addr += sizeof(uint8_t);
+    clampLegacyCount(_storedTopicCount, _storedTopicCapacity);
     
-    // Write each subscription set
-    for (uint8_t i = 0; i < _storedSubCount; i++) {
-      EEPROM.put(addr, _storedSubscriptions[i]);
-      addr += sizeof(ClientSubscriptions);
+    for (uint8_t i = 0; i < _storedTopicCount; i++) {
+      EEPROM.get(addr, _storedTopicNames[i]);
+      addr += sizeof(StoredTopicName);
     }
-    
-    #if defined(ESP8266)
-      EEPROM.commit();
-    #endif
-    
-    return true;
   #endif
-}
-
-bool CANPubSubBroker::clearStoredSubscriptions() {
-  _storedSubCount = 0;
-  memset(_storedSubscriptions, 0, sizeof(_storedSubscriptions));
   
-  #ifdef ESP32
-    _preferences.putUShort("subMagic", 0);
-    _preferences.putUChar("subCount", 0);
-    return true;
-  #else
-    // Clear subscription section by writing 0 to magic number
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping));
-    uint16_t zero = 0;
-    EEPROM.put(addr, zero);
-    #if defined(ESP8266)
-      EEPROM.commit();
-    #endif
-    return true;
-  #endif
+  for (uint8_t i = 0; i < _storedTopicCount; i++) {
+    _storedTopicNames[i].name[MAX_TOPIC_NAME_LENGTH - 1] = '\0';
+  }
+  return true;
 }
 
-// ===== Ping Configuration Persistence Implementation =====
-
-bool CANPubSubBroker::loadPingConfigFromStorage() {
+bool CANPubSubBrokerCore::loadLegacyPingConfig() {
   #ifdef ESP32
-    // ESP32 implementation using Preferences
-    // Load ping configuration values (use defaults if not set)
+    if (!_preferences.isKey("pingInterval")) return false;
+    
     _autoPingEnabled = _preferences.getBool("pingEnabled", false);
     _pingInterval = _preferences.getULong("pingInterval", 5000);
     _maxMissedPings = _preferences.getUChar("pingMaxMissed", 2);
-    
     return true;
-    
   #else
-    // Arduino EEPROM implementation
-    // Calculate offset (after client mappings and subscriptions)
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping)) +
-               sizeof(uint16_t) + sizeof(uint8_t) +
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientSubscriptions));
-    
-    // Read ping configuration
+    int addr = STORAGE_LEGACY_PING_ADDR;
     bool enabled;
     unsigned long interval;
     uint8_t maxMissed;
     
     EEPROM.get(addr, enabled);
     addr += sizeof(bool);
-    
     EEPROM.get(addr, interval);
     addr += sizeof(unsigned long);
-    
     EEPROM.get(addr, maxMissed);
     
-    // Validate values before applying (simple sanity check)
     if (interval > 0 && interval < 3600000 && maxMissed > 0 && maxMissed < 255) {
       _autoPingEnabled = enabled;
       _pingInterval = interval;
       _maxMissedPings = maxMissed;
       return true;
     }
-    
-    // Invalid data, use defaults
-    _autoPingEnabled = false;
-    _pingInterval = 5000;
-    _maxMissedPings = 2;
     return false;
   #endif
 }
 
-bool CANPubSubBroker::savePingConfigToStorage() {
-  #ifdef ESP32
-    // ESP32 implementation using Preferences
-    _preferences.putBool("pingEnabled", _autoPingEnabled);
-    _preferences.putULong("pingInterval", _pingInterval);
-    _preferences.putUChar("pingMaxMissed", _maxMissedPings);
-    
-    return true;
-    
-  #else
-    // Arduino EEPROM implementation
-    // Calculate offset (after client mappings and subscriptions)
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping)) +
-               sizeof(uint16_t) + sizeof(uint8_t) +
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientSubscriptions));
-    
-    // Write ping configuration
-    EEPROM.put(addr, _autoPingEnabled);
-    addr += sizeof(bool);
-    
-    EEPROM.put(addr, _pingInterval);
-    addr += sizeof(unsigned long);
-    
-    EEPROM.put(addr, _maxMissedPings);
-    
-    #if defined(ESP8266)
-      EEPROM.commit();
-    #endif
-    
-    return true;
-  #endif
+// ===== Task Mode Implementation =====
+
+void CANPubSubBrokerCore::lock() {
+#if CAN_PS_TASKS
+  if (_taskLock) xSemaphoreTakeRecursive(_taskLock, portMAX_DELAY);
+#endif
 }
 
-bool CANPubSubBroker::clearStoredPingConfig() {
-  // Reset to defaults
-  _autoPingEnabled = false;
-  _pingInterval = 5000;
-  _maxMissedPings = 2;
-  
-  return savePingConfigToStorage();
+void CANPubSubBrokerCore::unlock() {
+#if CAN_PS_TASKS
+  if (_taskLock) xSemaphoreGiveRecursive(_taskLock);
+#endif
 }
 
-// ===== Topic Name Persistence Implementation =====
+#if CAN_PS_TASKS
+CANPubSubBrokerCore* CANPubSubBrokerCore::_taskInstance = nullptr;
 
-void CANPubSubBroker::storeTopicName(uint16_t hash, const String& name) {
-  // Check if topic name already stored
-  int index = findStoredTopicName(hash);
+void CANPubSubBrokerCore::enableTaskMode(bool enable, uint8_t core) {
+  _taskMode = enable;
+  _taskCore = core;
+}
+
+bool CANPubSubBrokerCore::isTaskModeEnabled() {
+  return _taskMode;
+}
+
+unsigned long CANPubSubBrokerCore::getTaskFrameDrops() {
+  return _taskFrameDrops;
+}
+
+unsigned long CANPubSubBrokerCore::getTaskEventDrops() {
+  return _taskEventDrops;
+}
+
+bool CANPubSubBrokerCore::startTasks() {
+  // The receive interrupt wakes a single broker
+  if (_taskInstance) return false;
   
-  if (index >= 0) {
-    // Update existing entry
-    _storedTopicNames[index].setName(name);
-    _storedTopicNames[index].active = true;
-  } else {
-    // Find empty slot or add new entry
-    for (uint8_t i = 0; i < MAX_STORED_TOPIC_NAMES; i++) {
-      if (!_storedTopicNames[i].active) {
-        _storedTopicNames[i].hash = hash;
-        _storedTopicNames[i].setName(name);
-        _storedTopicNames[i].active = true;
-        if (i >= _storedTopicCount) {
-          _storedTopicCount = i + 1;
-        }
-        saveTopicNamesToStorage();
-        return;
-      }
-    }
+  // Frames reach the RX task through the controller's interrupt-fed RX queue
+  if (_can->rxQueueSize() == 0 && !_can->setRxQueueSize(CAN_PS_TASK_RX_QUEUE)) {
+    return false;
+  }
+  
+  _taskLock = xSemaphoreCreateRecursiveMutex();
+  _taskExit = xSemaphoreCreateCounting(3, 0);
+  _frameQueue = xQueueCreate(CAN_PS_TASK_FRAME_QUEUE, sizeof(CANFrame));
+  _eventQueue = xQueueCreate(CAN_PS_TASK_EVENT_QUEUE, sizeof(BrokerTaskEvent));
+  _taskStop = false;
+  _taskInstance = this;
+  
+  if (_taskLock && _taskExit && _frameQueue && _eventQueue) {
+    // Consumers first, so every handle is set before the first frame arrives
+    xTaskCreatePinnedToCore(persistTaskEntry, "canps_persist", CAN_PS_TASK_STACK, this,
+                            CAN_PS_TASK_PERSIST_PRIORITY, &_persistTaskHandle, _taskCore);
+    xTaskCreatePinnedToCore(routeTaskEntry, "canps_route", CAN_PS_TASK_STACK, this,
+                            CAN_PS_TASK_ROUTE_PRIORITY, &_routeTaskHandle, _taskCore);
+    xTaskCreatePinnedToCore(rxTaskEntry, "canps_rx", CAN_PS_TASK_STACK, this,
+                            CAN_PS_TASK_RX_PRIORITY, &_rxTaskHandle, _taskCore);
+  }
+  
+  if (!_rxTaskHandle || !_routeTaskHandle || !_persistTaskHandle) {
+    stopTasks();
+    return false;
   }
   
-  saveTopicNamesToStorage();
+  _can->onReceive(onTaskFrameReceived);
+  return true;
 }
 
-String CANPubSubBroker::getStoredTopicName(uint16_t hash) {
-  int index = findStoredTopicName(hash);
-  if (index >= 0) {
-    return _storedTopicNames[index].getName();
+void CANPubSubBrokerCore::stopTasks() {
+  if (_taskInstance != this) return;
+  
+  _can->onReceive(NULL);
+  
+  // Each task leaves its loop at the next wake-up and is deleted once it has said so
+  _taskStop = true;
+  TaskHandle_t* handles[] = { &_rxTaskHandle, &_routeTaskHandle, &_persistTaskHandle };
+  for (uint8_t i = 0; i < 3; i++) {
+    if (!*handles[i]) continue;
+    xTaskNotifyGive(*handles[i]);
+    xSemaphoreTake(_taskExit, portMAX_DELAY);
+  }
+  for (uint8_t i = 0; i < 3; i++) {
+    if (*handles[i]) vTaskDelete(*handles[i]);
+    *handles[i] = NULL;
+  }
+  
+  if (_frameQueue) vQueueDelete(_frameQueue);
+  if (_eventQueue) vQueueDelete(_eventQueue);
+  if (_taskExit) vSemaphoreDelete(_taskExit);
+  if (_taskLock) vSemaphoreDelete(_taskLock);
+  _frameQueue = NULL;
+  _eventQueue = NULL;
+  _taskExit = NULL;
+  _taskLock = NULL;
+  _taskInstance = nullptr;
+  
+  // Tables the persistence task had not written yet
+  if (_storageDirty) {
+    flush();
   }
-  return String("0x") + String(hash, HEX);
 }
 
-int CANPubSubBroker::findStoredTopicName(uint16_t hash) {
-  for (uint8_t i = 0; i < _storedTopicCount; i++) {
-    if (_storedTopicNames[i].active && _storedTopicNames[i].hash == hash) {
-      return i;
-    }
-  }
-  return -1;
+void IRAM_ATTR CANPubSubBrokerCore::onTaskFrameReceived(int /*packetSize*/) {
+  // Called from the controller interrupt for every frame put in its RX queue
+  CANPubSubBrokerCore* broker = _taskInstance;
+  if (!broker || !broker->_rxTaskHandle) return;
+  
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(broker->_rxTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
 }
 
-bool CANPubSubBroker::loadTopicNamesFromStorage() {
-  #ifdef ESP32
-    // ESP32 implementation using Preferences
-    uint16_t magic = _preferences.getUShort("topicMagic", 0);
-    if (magic != STORAGE_TOPIC_MAGIC) {
-      // No valid topic name data stored
-      return false;
-    }
-    
-    _storedTopicCount = _preferences.getUChar("topicCount", 0);
-    
-    if (_storedTopicCount > MAX_STORED_TOPIC_NAMES) {
-      _storedTopicCount = 0;
-      return false;
-    }
+void CANPubSubBrokerCore::rxTaskEntry(void* arg) {
+  CANPubSubBrokerCore* broker = (CANPubSubBrokerCore*)arg;
+  broker->rxTask();
+  xSemaphoreGive(broker->_taskExit);
+  vTaskSuspend(NULL);
+}
+
+void CANPubSubBrokerCore::routeTaskEntry(void* arg) {
+  CANPubSubBrokerCore* broker = (CANPubSubBrokerCore*)arg;
+  broker->routeTask();
+  xSemaphoreGive(broker->_taskExit);
+  vTaskSuspend(NULL);
+}
+
+void CANPubSubBrokerCore::persistTaskEntry(void* arg) {
+  CANPubSubBrokerCore* broker = (CANPubSubBrokerCore*)arg;
+  broker->persistTask();
+  xSemaphoreGive(broker->_taskExit);
+  vTaskSuspend(NULL);
+}
+
+void CANPubSubBrokerCore::rxTask() {
+  CANFrame frame;
+  
+  while (!_taskStop) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     
-    // Load each stored topic name
-    for (uint8_t i = 0; i < _storedTopicCount; i++) {
-      String key = "topic" + String(i);
-      size_t len = _preferences.getBytesLength(key.c_str());
-      if (len == sizeof(StoredTopicName)) {
-        _preferences.getBytes(key.c_str(), &_storedTopicNames[i], sizeof(StoredTopicName));
-        
-        // Re-register topic in runtime mapping
-        if (_storedTopicNames[i].active) {
-          registerTopic(_storedTopicNames[i].getName());
-        }
+    // Empty the controller queue quickly, so it does not overflow while routing is busy sending
+    while (_can->receiveFrame(frame)) {
+      if (xQueueSend(_frameQueue, &frame, 0) != pdTRUE) {
+        _taskFrameDrops++;
       }
     }
+  }
+}
+
+void CANPubSubBrokerCore::routeTask() {
+  CANFrame frame;
+  
+  while (!_taskStop) {
+    // Wake on a frame, or after CAN_PS_TASK_SERVICE_MS for pings and timeouts
+    bool received = xQueueReceive(_frameQueue, &frame, pdMS_TO_TICKS(CAN_PS_TASK_SERVICE_MS)) == pdTRUE;
     
-    return true;
-    
-  #else
-    // Arduino EEPROM implementation
-    // Calculate offset (after client mappings, subscriptions, and ping config)
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping)) +
-               sizeof(uint16_t) + sizeof(uint8_t) +
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientSubscriptions)) +
-               sizeof(bool) + sizeof(unsigned long) + sizeof(uint8_t);
-    
-    uint16_t magic;
-    EEPROM.get(addr, magic);
+    lock();
+#if CAN_PS_STATS
+    unsigned long loopStart = micros();
+#endif
     
-    if (magic != STORAGE_TOPIC_MAGIC) {
-      // No valid topic name data stored
-      return false;
+    // Same bound per pass as loop(), the periodic work still runs under load
+    uint8_t handled = 0;
+    while (received) {
+      int packetSize = _can->parseFrame(frame);
+      if (packetSize > 0) handleMessage(packetSize);
+      
+      received = ++handled < CAN_PS_MAX_FRAMES_PER_LOOP &&
+                 xQueueReceive(_frameQueue, &frame, 0) == pdTRUE;
     }
     
-    addr += sizeof(uint16_t);
-    EEPROM.get(addr, _storedTopicCount);
-    addr += sizeof(uint8_t);
+    service();
     
-    if (_storedTopicCount > MAX_STORED_TOPIC_NAMES) {
-      _storedTopicCount = 0;
-      return false;
-    }
+#if CAN_PS_STATS
+    statsRollWindow();
+    statsLoop(loopStart);
+#endif
+    unlock();
     
-    // Load each stored topic name
-    for (uint8_t i = 0; i < _storedTopicCount; i++) {
-      EEPROM.get(addr, _storedTopicNames[i]);
-      addr += sizeof(StoredTopicName);
-      
-      // Re-register topic in runtime mapping
-      if (_storedTopicNames[i].active) {
-        registerTopic(_storedTopicNames[i].getName());
-      }
+    if (handled == CAN_PS_MAX_FRAMES_PER_LOOP) {
+      // Sustained traffic: let lower priority tasks on this core run (task watchdog)
+      vTaskDelay(1);
     }
-    
-    return true;
-  #endif
+  }
 }
 
-bool CANPubSubBroker::saveTopicNamesToStorage() {
-  #ifdef ESP32
-    // ESP32 implementation using Preferences
-    _preferences.putUShort("topicMagic", STORAGE_TOPIC_MAGIC);
-    _preferences.putUChar("topicCount", _storedTopicCount);
-    
-    // Save each topic name
-    for (uint8_t i = 0; i < _storedTopicCount; i++) {
-      String key = "topic" + String(i);
-      _preferences.putBytes(key.c_str(), &_storedTopicNames[i], sizeof(StoredTopicName));
-    }
-    
-    return true;
-    
-  #else
-    // Arduino EEPROM implementation
-    // Calculate offset (after client mappings, subscriptions, and ping config)
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping)) +
-               sizeof(uint16_t) + sizeof(uint8_t) +
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientSubscriptions)) +
-               sizeof(bool) + sizeof(unsigned long) + sizeof(uint8_t);
-    
-    // Write magic number
-    EEPROM.put(addr, STORAGE_TOPIC_MAGIC);
-    addr += sizeof(uint16_t);
+void CANPubSubBrokerCore::persistTask() {
+  while (!_taskStop) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (_taskStop) break;
     
-    // Write count
-    EEPROM.put(addr, _storedTopicCount);
-    addr += sizeof(uint8_t);
-    
-    // Write each topic name
-    for (uint8_t i = 0; i < _storedTopicCount; i++) {
-      EEPROM.put(addr, _storedTopicNames[i]);
-      addr += sizeof(StoredTopicName);
+    writeBehind();
+  }
+}
+
+void CANPubSubBrokerCore::writeBehind() {
+  // Each table is packed under the lock (a memory copy) and written with it released,
+  // so the routing task never waits for flash
+  lock();
+  _persistPending = false;  // Tables dirtied from here on start a new interval
+  unlock();
+  
+  for (uint8_t table = 0; table < STORAGE_TABLE_COUNT; table++) {
+    uint8_t count = 0;
+    uint16_t length = 0;
+    lock();
+    bool dirty = _storageDirty & (1 << table);
+    if (dirty) {
+      _storageDirty &= ~(1 << table);
+      length = packStorageTable(table, count);
     }
-    
-    #if defined(ESP8266)
-      EEPROM.commit();
-    #endif
-    
-    return true;
-  #endif
+    unlock();
+    if (dirty) writeStorageBlob(table, count, length);
+  }
 }
 
-bool CANPubSubBroker::clearStoredTopicNames() {
-  _storedTopicCount = 0;
-  memset(_storedTopicNames, 0, sizeof(_storedTopicNames));
-  
-  #ifdef ESP32
-    _preferences.putUShort("topicMagic", 0);
-    _preferences.putUChar("topicCount", 0);
-    return true;
-  #else
-    // Clear topic names section by writing 0 to magic number
-    int addr = sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + 
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping)) +
-               sizeof(uint16_t) + sizeof(uint8_t) +
-               (MAX_CLIENT_MAPPINGS * sizeof(ClientSubscriptions)) +
-               sizeof(bool) + sizeof(unsigned long) + sizeof(uint8_t);
-    uint16_t zero = 0;
-    EEPROM.put(addr, zero);
-    #if defined(ESP8266)
-      EEPROM.commit();
-    #endif
-    return true;
-  #endif
+void CANPubSubBrokerCore::postEvent(uint8_t type, uint8_t clientId, uint16_t topicHash, const uint8_t* data, size_t length) {
+  BrokerTaskEvent event;
+  event.type = type;
+  event.clientId = clientId;
+  event.topicHash = topicHash;
+  event.length = min(length, (size_t)MAX_EXTENDED_MSG_SIZE);
+  if (event.length) memcpy(event.data, data, event.length);
+  
+  // Never block routing on a slow loop(), drop instead
+  if (xQueueSend(_eventQueue, &event, 0) != pdTRUE) {
+    _taskEventDrops++;
+  }
 }
 
+void CANPubSubBrokerCore::dispatchTaskEvents() {
+  BrokerTaskEvent event;
+  
+  // Callbacks run without the lock, they may call lock() themselves
+  while (_eventQueue && xQueueReceive(_eventQueue, &event, 0) == pdTRUE) {
+    switch (event.type) {
+      case CAN_PS_EVENT_CONNECT:
+        if (_onClientConnect) _onClientConnect(event.clientId);
+        break;
+      case CAN_PS_EVENT_DISCONNECT:
+        if (_onClientDisconnect) _onClientDisconnect(event.clientId);
+        break;
+      case CAN_PS_EVENT_PUBLISH:
+        if (_onPublishBinary) _onPublishBinary(event.topicHash, event.data, event.length);
+        if (_onPublish) {
+          lock();
+          String topic(getTopicName(event.topicHash));
+          unlock();
+          _onPublish(event.topicHash, topic, payloadToString(event.data, event.length));
+        }
+        break;
+      case CAN_PS_EVENT_DIRECT:
+        if (_onDirectMessage) _onDirectMessage(event.clientId, payloadToString(event.data, event.length));
+        break;
+    }
+  }
+}
+#endif
@@ -11,6 +11,10 @@
 // Platform-specific storage includes
 #ifdef ESP32
   #include <Preferences.h>
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/task.h>
+  #include <freertos/queue.h>
+  #include <freertos/semphr.h>
 #else
   #include <EEPROM.h>
 #endif
@@ -23,58 +27,452 @@
 #define CAN_PS_DIRECT_MSG     0x05
 #define CAN_PS_PEER_MSG       0x09  // Peer-to-peer message (client to client)
 #define CAN_PS_SUB_RESTORE    0x0A  // Broker restores subscription with topic name to client
+#define CAN_PS_TOPIC_MCAST    0x0B  // Broker sends topic data once to all subscribers
+#define CAN_PS_XFER_START     0x0C  // Segmented transfer: open [node][tag][length:4]
+#define CAN_PS_XFER_DATA      0x0D  // Segmented transfer: one 8-byte segment (extended ID only)
+#define CAN_PS_XFER_ACK       0x0E  // Segmented transfer: block ACK [node][base:2][bitmap:4]
+#define CAN_PS_XFER_ABORT     0x0F  // Segmented transfer: cancel [node][reason]
+#define CAN_PS_PUBLISH_BATCH  0x10  // Several publishes from one client: [clientId]{[topicHash:2][length][data]}
+#define CAN_PS_HEARTBEAT      0x11  // Group ping to all clients: [brokerId][seq][slotMs][flags]
+#define CAN_PS_PUBLISH_QOS    0x12  // At-least-once publish: [clientId][seq][topicHash:2][data...]
+#define CAN_PS_PUBLISH_ACK    0x13  // Broker ACK of QoS publishes: [brokerId][clientId][firstSeq][lastSeq]
+#define CAN_PS_SUB_RESTORE_BATCH 0x14  // Broker restores a client's topic list: [clientId][flags]{[topicHash:2][nameLength][name]}
+#define CAN_PS_TOPIC_NAME_REQUEST 0x15 // Ask for topic names: [clientId]{[topicHash:2]}, client after a restore, broker to a publisher
+#define CAN_PS_TOPIC_NAME     0x16  // Topic names: [clientId]{[topicHash:2][nameLength][name]}, publisher's answer or broker to a wildcard subscriber
 #define CAN_PS_ID_REQUEST     0xFF
 #define CAN_PS_ID_RESPONSE    0xFE
 #define CAN_PS_PING           0x06
 #define CAN_PS_PONG           0x07
 #define CAN_PS_ACK            0x08
 
+// Direction flags carried in the CAN ID, receivers decode msgType from the low 8 bits
+#define CAN_PS_DOWNLINK_FLAG      0x100       // Standard ID: frame sent by the broker
+#define CAN_PS_EXT_DOWNLINK_FLAG  0x40000L    // Extended ID (bit 18): frame sent by the broker
+
+// Priority classes, carried in the top two ID bits so they decide arbitration (lower wins)
+#define CAN_PS_PRIORITY_HIGH      0  // Latency-critical topics
+#define CAN_PS_PRIORITY_NORMAL    1  // Default for publishes and protocol traffic
+#define CAN_PS_PRIORITY_LOW       2
+#define CAN_PS_PRIORITY_BULK      3  // Segmented transfer data
+#define CAN_PS_PRIORITY_SHIFT     9   // Standard ID: [priority:2][downlink:1][msgType:8]
+#define CAN_PS_EXT_PRIORITY_SHIFT 27  // Extended ID bits 28-27
+#define CAN_PS_PRIORITY_MASK      0x03
+#ifndef CAN_PS_MAX_TOPIC_PRIORITIES
+#define CAN_PS_MAX_TOPIC_PRIORITIES 8 // Topics with a priority other than CAN_PS_PRIORITY_NORMAL
+#endif
+
 #define CAN_PS_BROKER_ID      0x00
 #define CAN_PS_UNASSIGNED_ID  0xFF
 
+#ifndef MAX_SUBSCRIPTIONS
 #define MAX_SUBSCRIPTIONS       20
+#endif
+#ifndef MAX_SUBSCRIBERS_PER_TOPIC
 #define MAX_SUBSCRIBERS_PER_TOPIC 10
+#endif
+#ifndef CAN_PS_TOPIC_ARENA_SIZE
+#define CAN_PS_TOPIC_ARENA_SIZE (MAX_SUBSCRIPTIONS * 16) // Bytes for registered topic names, terminators included
+#endif
 #define MAX_CLIENT_TOPICS       10
 #define MAX_MESSAGE_CALLBACKS   5
+#ifndef MAX_CLIENT_MAPPINGS
 #define MAX_CLIENT_MAPPINGS     50  // Maximum number of registered clients
+#endif
 #define MAX_SERIAL_LENGTH       32  // Maximum length for serial numbers
 
 // Extended message support (for messages > 8 bytes)
 #define CAN_FRAME_DATA_SIZE     8   // Standard CAN frame data size
+#ifndef MAX_EXTENDED_MSG_SIZE
 #define MAX_EXTENDED_MSG_SIZE   128 // Maximum size for extended messages
+#endif
 #define EXTENDED_MSG_TIMEOUT    1000 // Timeout for multi-frame messages (ms)
+#ifndef CAN_PS_EXT_REASSEMBLY_SLOTS
+#define CAN_PS_EXT_REASSEMBLY_SLOTS 4 // Concurrent multi-frame messages, keyed by (sender, msgType)
+#endif
+
+// Extended ID layout: [priority:2][msgType:8][downlink:1][sender:8][frameSeq:5][totalFrames:5]
+#define CAN_PS_EXT_TYPE_SHIFT   19
+#define CAN_PS_EXT_SENDER_SHIFT 10
+#define CAN_PS_EXT_SEQ_SHIFT    5
+#define CAN_PS_EXT_FIELD_MASK   0x1F
+#define CAN_PS_EXT_MAX_FRAMES   31
+#define CAN_PS_EXT_FD_HEADER    2     // CAN FD: [length:16] before the data of frame 0 (FD frames are padded)
+
+#if MAX_EXTENDED_MSG_SIZE < CAN_FRAME_DATA_SIZE || \
+    (MAX_EXTENDED_MSG_SIZE + CAN_FRAME_DATA_SIZE - 1) / CAN_FRAME_DATA_SIZE > CAN_PS_EXT_MAX_FRAMES
+#error "MAX_EXTENDED_MSG_SIZE does not fit the 5-bit frame count of the extended ID"
+#endif
+
+// Segmented transfer (acknowledged, streams into a caller-supplied buffer)
+// XFER_DATA extended ID: [priority:2][msgType:8][downlink:1][node:8][segment:10], node is the client end
+#ifndef CAN_PS_XFER_WINDOW
+#define CAN_PS_XFER_WINDOW      16    // Segments in flight before an ACK is required
+#endif
+#define CAN_PS_XFER_ACK_TIMEOUT 250   // Resend unacknowledged segments after (ms)
+#define CAN_PS_XFER_ACK_DELAY   20    // Receiver flushes a partial block ACK after (ms)
+#define CAN_PS_XFER_MAX_RETRIES 5     // Timeouts without progress before the sender gives up
+#define CAN_PS_XFER_RX_TIMEOUT  2000  // Receiver drops an idle transfer after (ms)
+#define CAN_PS_XFER_SEQ_MASK    0x3FF // Low 10 bits of the 16-bit segment number travel in the ID
+#define CAN_PS_XFER_MAX_SEGMENTS 0xFFFF
+
+// Abort reasons (CAN_PS_XFER_FROM_SENDER set when the transmitting side aborts)
+#define CAN_PS_XFER_ERR_BUSY    0x01  // Receiver already has a transfer in progress
+#define CAN_PS_XFER_ERR_SIZE    0x02  // No receive buffer or transfer too large for it
+#define CAN_PS_XFER_ERR_CANCEL  0x03  // abortTransfer() or retries exhausted
+#define CAN_PS_XFER_FROM_SENDER 0x80
+
+#if CAN_PS_XFER_WINDOW < 1 || CAN_PS_XFER_WINDOW > 32
+#error "CAN_PS_XFER_WINDOW must be between 1 and 32 (one ACK bitmap)"
+#endif
+
+// Client publish batching (records packed into one message, standard or multi-frame)
+#ifndef CAN_PS_BATCH_SIZE
+#define CAN_PS_BATCH_SIZE       MAX_EXTENDED_MSG_SIZE // Batch message bytes, client ID included
+#endif
+#define CAN_PS_DEFAULT_BATCH_LATENCY 10 // Longest a queued publish waits before it is sent (ms)
+
+#if CAN_PS_BATCH_SIZE < CAN_FRAME_DATA_SIZE || CAN_PS_BATCH_SIZE > MAX_EXTENDED_MSG_SIZE
+#error "CAN_PS_BATCH_SIZE must be between CAN_FRAME_DATA_SIZE and MAX_EXTENDED_MSG_SIZE"
+#endif
+
+// At-least-once publish (publishReliable(), sequence numbered and acknowledged in ranges)
+#ifndef CAN_PS_QOS_WINDOW
+#define CAN_PS_QOS_WINDOW       8     // Unacknowledged publishes per client
+#endif
+#ifndef CAN_PS_QOS_PAYLOAD_SIZE
+#define CAN_PS_QOS_PAYLOAD_SIZE 16    // Largest reliable payload, kept by the client until acknowledged
+#endif
+#ifndef CAN_PS_QOS_CLIENTS
+#define CAN_PS_QOS_CLIENTS      16    // Publishers with a dedup window on the broker, least recently heard is replaced
+#endif
+#define CAN_PS_DEFAULT_QOS_TIMEOUT 100 // Client retransmits an unacknowledged publish after (ms)
+#define CAN_PS_DEFAULT_QOS_RETRIES 5  // Retransmissions before the publish is reported as failed
+#define CAN_PS_QOS_ACK_DELAY    10    // Broker sends a pending ACK range after (ms)
+#define CAN_PS_QOS_ACK_BATCH    8     // ... or as soon as it covers this many publishes
+#define CAN_PS_QOS_DEDUP_WINDOW 32    // Sequence numbers behind the highest remembered by the broker
+
+#if CAN_PS_QOS_WINDOW < 1 || CAN_PS_QOS_WINDOW > CAN_PS_QOS_DEDUP_WINDOW
+#error "CAN_PS_QOS_WINDOW must be between 1 and 32 (the broker's dedup window)"
+#endif
+#if CAN_PS_QOS_PAYLOAD_SIZE > MAX_EXTENDED_MSG_SIZE - 4 || CAN_PS_QOS_PAYLOAD_SIZE > 255
+#error "CAN_PS_QOS_PAYLOAD_SIZE must fit an extended message after [clientId][seq][topicHash]"
+#endif
+
+// Receive processing
+#define CAN_PS_MAX_FRAMES_PER_LOOP 16 // Frames drained from the controller per loop() call
+
+// Subscription restore after an ID request, sent from loop() rather than the ID handler
+#define CAN_PS_RESTORES_PER_LOOP 2     // Clients restored per loop() call
+#define CAN_PS_RESTORE_LAST      0x01  // SUB_RESTORE_BATCH flag: last message of the restore
+#define CAN_PS_RESTORE_WAIT      200   // Client: longest wait for the restore after the ID (ms)
+
+// Broker subscription index (open addressing, power of two, larger than MAX_SUBSCRIPTIONS)
+#ifndef CAN_PS_SUB_INDEX_SIZE
+#define CAN_PS_SUB_INDEX_SIZE   64
+#endif
+#ifndef CAN_PS_MAX_SUBSCRIBER_CLIENTS
+#define CAN_PS_MAX_SUBSCRIBER_CLIENTS MAX_CLIENT_MAPPINGS // Clients tracked in the reverse index
+#endif
+
+#if MAX_SUBSCRIPTIONS > 254
+#error "MAX_SUBSCRIPTIONS must not exceed 254"
+#endif
+#if CAN_PS_TOPIC_ARENA_SIZE > 65535
+#error "CAN_PS_TOPIC_ARENA_SIZE must not exceed 65535"
+#endif
+#if (CAN_PS_SUB_INDEX_SIZE & (CAN_PS_SUB_INDEX_SIZE - 1)) != 0 || CAN_PS_SUB_INDEX_SIZE <= MAX_SUBSCRIPTIONS
+#error "CAN_PS_SUB_INDEX_SIZE must be a power of two larger than MAX_SUBSCRIPTIONS"
+#endif
+
+// Broker retained messages (last value per topic, sent to new subscribers)
+#ifndef CAN_PS_MAX_RETAINED
+#define CAN_PS_MAX_RETAINED     16  // Topics cached, the least recently updated is replaced
+#endif
+#ifndef CAN_PS_RETAINED_PAYLOAD_SIZE
+#define CAN_PS_RETAINED_PAYLOAD_SIZE 16 // Largest cached payload (bytes), longer publishes are not retained
+#endif
+
+#if CAN_PS_RETAINED_PAYLOAD_SIZE > 255
+#error "CAN_PS_RETAINED_PAYLOAD_SIZE must not exceed 255"
+#endif
+
+// Broker wildcard subscriptions ("+" matches one level, "#" the remaining levels), compiled into a trie
+#ifndef CAN_PS_MAX_WILDCARDS
+#define CAN_PS_MAX_WILDCARDS    8   // Distinct wildcard patterns
+#endif
+#ifndef CAN_PS_WILDCARD_NODES
+#define CAN_PS_WILDCARD_NODES   32  // Trie nodes, one per pattern level not shared with another pattern
+#endif
+#ifndef CAN_PS_WILDCARD_CACHE_SIZE
+#define CAN_PS_WILDCARD_CACHE_SIZE 32 // Topics with a cached wildcard subscriber set (power of two)
+#endif
+#ifndef CAN_PS_WILDCARD_HOLD
+#define CAN_PS_WILDCARD_HOLD    2   // Publishes held for wildcard subscribers while their topic name is asked
+#endif
+#ifndef CAN_PS_WILDCARD_HOLD_TIME
+#define CAN_PS_WILDCARD_HOLD_TIME 100 // ms a held publish waits for the publisher's answer
+#endif
+#define CAN_PS_MATCH_RESOLVED   1   // Cache entry: subscriber set computed from the topic name
+#define CAN_PS_MATCH_PENDING    2   // Cache entry: name asked from the publisher
+#define CAN_PS_MATCH_STALE      3   // Cache entry: a pattern it matched changed, rebuilt on the next publish
+
+#if CAN_PS_MAX_WILDCARDS < 1 || CAN_PS_MAX_WILDCARDS > 32
+#error "CAN_PS_MAX_WILDCARDS must be between 1 and 32 (one match bitmap)"
+#endif
+#if CAN_PS_WILDCARD_NODES > 255
+#error "CAN_PS_WILDCARD_NODES must not exceed 255"
+#endif
+#if (CAN_PS_WILDCARD_CACHE_SIZE & (CAN_PS_WILDCARD_CACHE_SIZE - 1)) != 0
+#error "CAN_PS_WILDCARD_CACHE_SIZE must be a power of two"
+#endif
+#if CAN_PS_WILDCARD_HOLD < 1
+#error "CAN_PS_WILDCARD_HOLD must be at least 1"
+#endif
+
+// Transmit pacing
+#ifndef CAN_PS_DEFAULT_FRAME_GAP_US
+#define CAN_PS_DEFAULT_FRAME_GAP_US 0 // Minimum time from one outgoing frame to the next (us), 0 = bus rate
+#endif
+#define CAN_PS_PINGS_PER_LOOP   4   // Pings sent per loop() call during a ping round
+
+// Bus health (controller error state and load, polled from loop())
+#define CAN_PS_BUS_CHECK_INTERVAL   250 // Bus state / load poll interval (ms), bus-off recovery runs from here
+#define CAN_PS_DEFAULT_LOAD_THRESHOLD 70 // Bus load (%) above which the broker backs off
+#define CAN_PS_LOADED_PING_FACTOR   4   // Ping interval multiplier while the bus is congested
+#define CAN_PS_LOADED_FRAME_GAP_US  1000 // Minimum frame gap (us) while the bus is congested
+
+// Group heartbeat (one broadcast per interval, clients answer with staggered pongs)
+#define CAN_PS_HEARTBEAT_SLOTS  16  // A client pongs in slot (clientId % slots)
+#define CAN_PS_DEFAULT_HEARTBEAT_SLOT_MS 2 // Width of one pong slot (ms)
+#define CAN_PS_HEARTBEAT_PASSIVE 0x01 // Flag: clients that transmitted since the last heartbeat skip their pong
+
+// Connect retries (ID requests back off exponentially, each delay randomised to [d/2, d])
+#define CAN_PS_DEFAULT_CONNECT_BACKOFF_MIN 250  // First retry delay (ms), also the start jitter of connectAsync()
+#define CAN_PS_DEFAULT_CONNECT_BACKOFF_MAX 8000 // Retry delay cap (ms)
+
+// Statistics (build with -DCAN_PS_STATS=1, otherwise the counting code is left out)
+#ifndef CAN_PS_STATS
+#define CAN_PS_STATS 0
+#endif
+#define CAN_PS_STATS_TYPE_SLOTS 25  // Message types 0x01-0x16, ID_RESPONSE, ID_REQUEST, slot 0 = other
+#ifndef CAN_PS_STATS_TOPICS
+#define CAN_PS_STATS_TOPICS     8   // Topics with their own publish counter on the broker
+#endif
+#define CAN_PS_STATS_LATENCY_BUCKETS 8 // Fan-out histogram: <128us, <256us, ... <8ms, >=8ms
+#define CAN_PS_STATS_RATE_WINDOW 1000 // Topic publish rate window (ms)
+
+// FreeRTOS task mode for the broker, see CANPubSubBroker::enableTaskMode() (ESP32 only,
+// build with -DCAN_PS_TASKS=0 to leave it out)
+#ifndef CAN_PS_TASKS
+#if defined(ESP32)
+#define CAN_PS_TASKS 1
+#else
+#define CAN_PS_TASKS 0
+#endif
+#endif
+#if CAN_PS_TASKS && !defined(ESP32)
+#error "CAN_PS_TASKS needs FreeRTOS (ESP32)"
+#endif
+#define CAN_PS_TASK_CORE        0     // Default core for the broker tasks (Arduino loop() runs on core 1)
+#define CAN_PS_TASK_STACK       4096  // Stack per task (bytes)
+#define CAN_PS_TASK_RX_PRIORITY 6     // Drains the controller RX queue
+#define CAN_PS_TASK_ROUTE_PRIORITY 5  // Message handling, fan-out, pings
+#define CAN_PS_TASK_PERSIST_PRIORITY 1 // Flash writes
+#ifndef CAN_PS_TASK_FRAME_QUEUE
+#define CAN_PS_TASK_FRAME_QUEUE 32    // Frames between the RX and routing task
+#endif
+#ifndef CAN_PS_TASK_EVENT_QUEUE
+#define CAN_PS_TASK_EVENT_QUEUE 16    // Callbacks waiting for loop()
+#endif
+#define CAN_PS_TASK_RX_QUEUE    32    // Controller RX queue set up by begin() if none is configured
+#define CAN_PS_TASK_SERVICE_MS  5     // Longest wait of the routing task between timer checks (ms)
+
+// Callback events from the routing task (CAN_PS_TASKS)
+#define CAN_PS_EVENT_CONNECT    1
+#define CAN_PS_EVENT_DISCONNECT 2
+#define CAN_PS_EVENT_PUBLISH    3
+#define CAN_PS_EVENT_DIRECT     4
 
 // Forward declarations
-class CANPubSubBroker;
-class CANPubSubClient;
+class CANPubSubBrokerCore;
+class CANPubSubClientCore;
 
-// Extended message buffer structure
+// Extended message buffer structure (one reassembly slot)
 struct ExtendedMessageBuffer {
   uint8_t msgType;
-  uint8_t senderId;
-  uint8_t buffer[MAX_EXTENDED_MSG_SIZE];
+  uint8_t sourceId;     // Sender field of the extended ID (slot key with msgType)
+  uint8_t nextFrame;    // Next expected frameSeq
+  uint8_t totalFrames;
+  uint8_t senderId;     // First payload byte, passed to onExtendedMessageComplete()
+  uint8_t* buffer;      // extBufferSize bytes of the owner's table storage
   uint16_t receivedSize;
   uint16_t totalSize;
   unsigned long lastFrameTime;
   bool active;
 };
 
+// Outgoing segmented transfer (data stays in the caller's buffer until done)
+struct TransferTxState {
+  const uint8_t* data;
+  uint32_t length;
+  uint16_t totalSegments;
+  uint16_t base;          // First unacknowledged segment
+  uint32_t acked;         // Bit i: segment base + i acknowledged
+  uint32_t sent;          // Bit i: segment base + i sent since the last timeout
+  unsigned long lastProgress;
+  uint8_t peerId;
+  uint8_t tag;
+  uint8_t retries;
+  uint8_t state;
+};
+
+// Incoming segmented transfer (streams into the buffer set with setTransferBuffer())
+struct TransferRxState {
+  uint32_t length;
+  uint16_t totalSegments;
+  uint16_t base;          // First missing segment
+  uint32_t received;      // Bit i: segment base + i received
+  unsigned long lastFrameTime;
+  uint8_t peerId;
+  uint8_t tag;
+  uint8_t unacked;        // Segments seen since the last ACK
+  uint8_t state;
+};
+
+#define CAN_PS_XFER_IDLE      0
+#define CAN_PS_XFER_OPENING   1  // START sent, waiting for the first ACK
+#define CAN_PS_XFER_SENDING   2
+#define CAN_PS_XFER_RECEIVING 3
+#define CAN_PS_XFER_COMPLETE  4  // All segments received, final ACK repeated on duplicates
+
+// Reliable publish kept by the client until the broker acknowledges its sequence number
+struct QosPublish {
+  uint16_t topicHash;
+  uint8_t seq;
+  uint8_t length;
+  uint8_t retries;
+  bool active;
+  unsigned long sentAt;
+  uint8_t data[CAN_PS_QOS_PAYLOAD_SIZE];
+};
+
+// Broker-side state of one reliable publisher: dedup window and the ACK range not yet sent
+struct QosClientState {
+  uint8_t clientId;
+  uint8_t highest;        // Highest sequence number received
+  uint32_t window;        // Bit i: sequence number highest - i received
+  uint8_t ackFirst;       // Pending ACK range, inclusive
+  uint8_t ackLast;
+  bool ackPending;
+  bool active;
+  unsigned long ackSince; // First publish of the pending range received
+  unsigned long lastSeen;
+};
+
+// Topic priority override (topics not listed use CAN_PS_PRIORITY_NORMAL)
+struct TopicPriority {
+  uint16_t topicHash;
+  uint8_t priority;
+};
+
 // Callback types
 typedef void (*MessageCallback)(uint16_t topicHash, const String& topic, const String& message);
+// Binary variant: data points into the frame or reassembly buffer, valid only during the call
+typedef void (*BinaryMessageCallback)(uint16_t topicHash, const uint8_t* data, size_t length);
 typedef void (*DirectMessageCallback)(uint8_t senderId, const String& message);
 typedef void (*ConnectionCallback)(uint8_t clientId);
+// Segmented transfer: data is the buffer passed to setTransferBuffer()
+typedef void (*TransferReceivedCallback)(uint8_t peerId, uint8_t tag, const uint8_t* data, size_t length);
+typedef void (*TransferDoneCallback)(uint8_t peerId, uint8_t tag, bool success);
+// Reliable publish finished: acknowledged by the broker, or given up after the retries
+typedef void (*PublishDoneCallback)(uint16_t topicHash, bool acknowledged);
+// Two topic names with the same 16-bit hash (existingName keeps the hash)
+typedef void (*TopicCollisionCallback)(uint16_t topicHash, const String& existingName, const String& newName);
+
+// Retained message slot (payload lives in the broker's retained arena)
+struct RetainedMessage {
+  uint16_t topicHash;
+  uint8_t length;
+  uint8_t priority;
+  unsigned long updated;
+  bool active;
+};
+
+#if CAN_PS_STATS
+// Per-topic publish counter (broker)
+struct TopicStats {
+  uint16_t topicHash;
+  uint32_t publishes;
+  uint16_t windowCount;  // Publishes in the current rate window
+  uint16_t rate;         // Publishes per second over the last window
+};
+
+// Statistics snapshot, see CANPubSubBase::getStats()
+struct CANPubSubStats {
+  uint32_t rxFrames[CAN_PS_STATS_TYPE_SLOTS];  // Indexed by CANPubSubBase::statsSlot(msgType)
+  uint32_t txFrames[CAN_PS_STATS_TYPE_SLOTS];
+  uint32_t rxBytes;
+  uint32_t txBytes;
+  uint32_t txAborts;            // endPacket() failures, and queued frames the controller dropped
+  uint32_t rxOverruns;          // Frames lost to a full RX queue or controller buffer
+  uint32_t reassemblyTimeouts;  // Multi-frame messages dropped after EXTENDED_MSG_TIMEOUT
+  uint32_t reassemblyDrops;     // Multi-frame messages dropped on a lost frame, slot eviction or a full buffer
+  uint32_t reassemblyOrphans;   // Continuation frames without a message in progress
+  uint32_t loops;
+  uint32_t loopMinUs;
+  uint32_t loopMaxUs;
+  uint32_t qosRetransmits;      // Client: reliable publishes sent again after a timeout
+  uint32_t qosDuplicates;       // Broker: reliable publishes dropped as repeats (still acknowledged)
+  
+  // Broker only
+  TopicStats topics[CAN_PS_STATS_TOPICS];
+  uint8_t topicCount;
+  uint32_t untrackedPublishes;  // Publishes to topics beyond CAN_PS_STATS_TOPICS
+  uint32_t fanoutLatency[CAN_PS_STATS_LATENCY_BUCKETS];  // Publish received -> last subscriber frame sent
+  uint32_t fanoutMaxUs;
+  uint32_t wildcardHoldDrops;   // Publishes that missed wildcard subscribers while their name was asked
+};
+#endif
+
+#if CAN_PS_TASKS
+// Callback queued by the routing task, delivered from CANPubSubBroker::loop()
+struct BrokerTaskEvent {
+  uint8_t type;        // CAN_PS_EVENT_*
+  uint8_t clientId;    // Client, or the sender of a direct message
+  uint16_t topicHash;
+  uint16_t length;
+  uint8_t data[MAX_EXTENDED_MSG_SIZE];
+};
+#endif
 
 // Subscription structure for broker
 struct Subscription {
   uint16_t topicHash;
-  uint8_t subscribers[MAX_SUBSCRIBERS_PER_TOPIC];
+  uint8_t* subscribers;  // This entry's row of the broker's subscriber table
   uint8_t subCount;
 };
 
-// Topic mapping structure
+// Topic mapping structure (index sorted by hash, the name lives in the topic arena)
 struct TopicMapping {
   uint16_t hash;
-  String name;
+  uint16_t offset;  // Start of the NUL-terminated name in _topicArena
+};
+
+// Topic hash as a constant expression (same value as CANPubSubBase::hashTopic()),
+// usable for case labels and compile-time topic handles
+constexpr uint16_t canPsTopicHash(const char* topic, uint16_t hash = 0) {
+  return *topic ? canPsTopicHash(topic + 1, (uint16_t)(hash * 31 + *topic)) : hash;
+}
+
+// Precomputed topic handle for a string literal, e.g.
+//   constexpr CANTopic TEMPERATURE("sensors/temp");
+// The hash is computed at build time and publish() skips the topic table.
+struct CANTopic {
+  const char* name;
+  uint16_t hash;
+  
+  constexpr explicit CANTopic(const char* topicName)
+    : name(topicName), hash(canPsTopicHash(topicName)) {}
 };
 
 // Client ID mapping structure (ID <-> Serial Number)
@@ -104,7 +502,17 @@ struct ClientPingState {
 
 // Client subscription storage structure
 // Stores which topics each client is subscribed to (persists across power cycles)
+#ifndef MAX_STORED_SUBS_PER_CLIENT
 #define MAX_STORED_SUBS_PER_CLIENT 10
+#endif
+// Topics of one client, a row of topicsPerClient hashes the entry keeps for good
+struct ClientTopicList {
+  uint8_t clientId;
+  uint8_t topicCount;
+  uint16_t* topics;
+};
+
+// Record of the version 1 format, only read to migrate
 struct ClientSubscriptions {
   uint8_t clientId;
   uint16_t topics[MAX_STORED_SUBS_PER_CLIENT];
@@ -114,7 +522,9 @@ struct ClientSubscriptions {
 // Topic name storage structure for persistence
 // Stores topic hash -> name mappings in flash memory
 #define MAX_TOPIC_NAME_LENGTH 32
+#ifndef MAX_STORED_TOPIC_NAMES
 #define MAX_STORED_TOPIC_NAMES 20
+#endif
 struct StoredTopicName {
   uint16_t hash;
   char name[MAX_TOPIC_NAME_LENGTH];
@@ -130,43 +540,296 @@ struct StoredTopicName {
   }
 };
 
+// Wildcard pattern on the broker, its subscribers are those of the Subscription with its hash
+struct WildcardPattern {
+  uint16_t hash;
+  char name[MAX_TOPIC_NAME_LENGTH];
+};
+
+// Wildcard trie node: one pattern level, its text a slice of a pattern name
+struct WildcardNode {
+  uint8_t pattern;   // _wildcards index holding the text
+  uint8_t offset;
+  uint8_t length;
+  uint8_t child;     // First node of the next level + 1, 0 = none
+  uint8_t sibling;   // Next node on this level + 1, 0 = none
+  uint8_t terminal;  // Pattern ending at this node + 1, 0 = none
+};
+
+// Wildcard subscribers of one concrete topic, computed on its first publish
+struct WildcardMatch {
+  uint16_t topicHash;
+  uint8_t state;     // 0 = free, CAN_PS_MATCH_*
+  uint8_t subCount;
+  uint8_t* subscribers;  // One row of subscribersPerTopic client IDs
+};
+
+// Publish of a topic whose name the broker is asking for, delivered to the
+// wildcard subscribers once the answer arrives
+struct WildcardHeldPublish {
+  uint16_t topicHash;
+  uint8_t priority;
+  bool active;
+  uint16_t length;
+  unsigned long since;
+  uint8_t data[MAX_EXTENDED_MSG_SIZE];
+};
+
 // Storage configuration
 #define STORAGE_NAMESPACE "CANPubSub"
-#define STORAGE_MAGIC 0xCABE        // Magic number to verify valid data
+#define STORAGE_MAGIC 0xCABE        // Magic number to verify valid data (client mappings)
 #define STORAGE_SUB_MAGIC 0xCAFF    // Magic number for subscription data
 #define STORAGE_TOPIC_MAGIC 0xFEED  // Magic number for topic name data
+#define STORAGE_PING_MAGIC 0xC0DE   // Magic number for ping configuration
+#define STORAGE_FORMAT_MAGIC 0xCA57 // EEPROM address 0 once the packed format is in use
+#define STORAGE_VERSION 2           // 1 = fixed-size records, one key/slot each
+
+// Packed format: each table is a single blob, one Preferences key on ESP32 or a
+// fixed EEPROM region elsewhere, read and checked in one go at begin()
+//   [magic:2][version][count][length:2][crc32:4][records, length bytes]
+// CRC-32 covers the first six header bytes and the records, integers are little-endian
+#define STORAGE_TABLE_MAPPINGS      0  // [nextId] then [clientId][registered][serialLength][serial]
+#define STORAGE_TABLE_SUBSCRIPTIONS 1  // [clientId][topicCount][topicHash:2]...
+#define STORAGE_TABLE_TOPIC_NAMES   2  // [hash:2][nameLength][name]
+#define STORAGE_TABLE_PING          3  // [enabled][interval:4][maxMissed]
+#define STORAGE_TABLE_COUNT         4
+#define STORAGE_BLOB_HEADER 10
+#define STORAGE_MAP_BLOB_SIZE_FOR(clients) (STORAGE_BLOB_HEADER + 1 + (clients) * (3 + MAX_SERIAL_LENGTH - 1))
+#define STORAGE_SUB_BLOB_SIZE_FOR(clients, topics) (STORAGE_BLOB_HEADER + (clients) * (2 + 2 * (topics)))
+#define STORAGE_TOPIC_BLOB_SIZE_FOR(names) (STORAGE_BLOB_HEADER + (names) * (3 + MAX_TOPIC_NAME_LENGTH - 1))
+#define STORAGE_MAP_BLOB_SIZE   STORAGE_MAP_BLOB_SIZE_FOR(MAX_CLIENT_MAPPINGS)
+#define STORAGE_SUB_BLOB_SIZE   STORAGE_SUB_BLOB_SIZE_FOR(MAX_CLIENT_MAPPINGS, MAX_STORED_SUBS_PER_CLIENT)
+#define STORAGE_TOPIC_BLOB_SIZE STORAGE_TOPIC_BLOB_SIZE_FOR(MAX_STORED_TOPIC_NAMES)
+#define STORAGE_PING_BLOB_SIZE  (STORAGE_BLOB_HEADER + 6)
+#define STORAGE_BLOB_BUFFER_SIZE (STORAGE_MAP_BLOB_SIZE > STORAGE_SUB_BLOB_SIZE ? \
+                                  (STORAGE_MAP_BLOB_SIZE > STORAGE_TOPIC_BLOB_SIZE ? STORAGE_MAP_BLOB_SIZE : STORAGE_TOPIC_BLOB_SIZE) : \
+                                  (STORAGE_SUB_BLOB_SIZE > STORAGE_TOPIC_BLOB_SIZE ? STORAGE_SUB_BLOB_SIZE : STORAGE_TOPIC_BLOB_SIZE))
+
 #define EEPROM_SIZE 8192            // EEPROM size for non-ESP32 platforms (increased for topic names)
+// EEPROM layout: [STORAGE_FORMAT_MAGIC:2][STORAGE_VERSION], then one region per table
+#define STORAGE_MAP_ADDR   3
+#define STORAGE_SUB_ADDR   (STORAGE_MAP_ADDR + STORAGE_MAP_BLOB_SIZE)
+#define STORAGE_TOPIC_ADDR (STORAGE_SUB_ADDR + STORAGE_SUB_BLOB_SIZE)
+#define STORAGE_PING_ADDR  (STORAGE_TOPIC_ADDR + STORAGE_TOPIC_BLOB_SIZE)
+#define STORAGE_END_ADDR   (STORAGE_PING_ADDR + STORAGE_PING_BLOB_SIZE)
+#if MAX_CLIENT_MAPPINGS > 255 || MAX_STORED_SUBS_PER_CLIENT > 255 || MAX_STORED_TOPIC_NAMES > 255 || \
+    STORAGE_BLOB_BUFFER_SIZE > 65535
+#error "Storage tables hold at most 255 records and 64 KB"
+#endif
+#if STORAGE_END_ADDR > EEPROM_SIZE
+#error "Storage tables do not fit in EEPROM_SIZE"
+#endif
+
+// Version 1 EEPROM layout (fixed-size records), only read to migrate
+#define STORAGE_LEGACY_SUB_ADDR (sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint8_t) + \
+                                 (MAX_CLIENT_MAPPINGS * sizeof(ClientMapping)))
+#define STORAGE_LEGACY_PING_ADDR (STORAGE_LEGACY_SUB_ADDR + sizeof(uint16_t) + sizeof(uint8_t) + \
+                                  (MAX_CLIENT_MAPPINGS * sizeof(ClientSubscriptions)))
+#define STORAGE_LEGACY_TOPIC_ADDR (STORAGE_LEGACY_PING_ADDR + sizeof(bool) + sizeof(unsigned long) + sizeof(uint8_t))
+#define CAN_PS_DEFAULT_PERSIST_INTERVAL 2000 // Write-behind delay for subscriptions and topic names (ms)
+
+// Tables sized by the CANPubSubBrokerT / CANPubSubClientT template arguments. The
+// templates own the arrays and lend them to the shared implementation, so every
+// size runs the same code.
+struct CANPubSubTables {
+  TopicMapping* topicMappings;
+  uint8_t topicNames;      // Registered topic names
+  char* topicArena;
+  uint16_t topicArenaSize;
+  ExtendedMessageBuffer* extSlots;
+  uint8_t extSlotCount;
+  uint8_t* extBuffers;     // extSlotCount buffers of extBufferSize bytes
+  uint16_t extBufferSize;  // Longest multi-frame message received
+};
+
+struct CANPubSubBrokerTables {
+  Subscription* subscriptions;
+  uint8_t* subscribers;          // subscriptionCount rows of subscribersPerTopic client IDs
+  uint8_t subscriptionCount;
+  uint8_t subscribersPerTopic;
+  uint8_t* subIndex;
+  uint16_t subIndexSize;
+  ClientTopicList* clientTopics;
+  uint16_t* clientTopicRows;           // subscriberClients rows of topicsPerClient hashes
+  uint8_t subscriberClients;
+  uint8_t topicsPerClient;
+  uint8_t* wildcardSubscribers;        // CAN_PS_WILDCARD_CACHE_SIZE rows of subscribersPerTopic client IDs
+  ClientMapping* clientMappings;       // clients entries each, registered and persisted
+  ClientTopicList* storedSubscriptions;
+  uint16_t* storedTopicRows;           // clients rows of topicsPerClient hashes
+  ClientPingState* pingStates;
+  uint8_t clients;
+  StoredTopicName* storedTopicNames;
+  uint8_t storedNames;
+  uint8_t* storageBlob;                // One packed storage table
+  uint16_t storageBlobSize;
+};
+
+// Smallest power of two at least three times the table, e.g. 64 for 20 topics
+constexpr uint16_t canPsSubIndexSize(uint8_t topics, uint16_t size = 1) {
+  return size >= 3 * topics ? size : canPsSubIndexSize(topics, size * 2);
+}
+
+constexpr uint16_t canPsMax(uint16_t a, uint16_t b) {
+  return a > b ? a : b;
+}
+
+constexpr uint16_t canPsMin(uint16_t a, uint16_t b) {
+  return a < b ? a : b;
+}
+
+// Largest packed storage table of a broker with `clients` mappings of up to
+// `topicsPerClient` stored topics, and `names` stored topic names
+constexpr uint16_t canPsStorageBlobSize(uint8_t clients, uint8_t topicsPerClient, uint8_t names) {
+  return canPsMax(canPsMax(STORAGE_MAP_BLOB_SIZE_FOR(clients), STORAGE_SUB_BLOB_SIZE_FOR(clients, topicsPerClient)),
+                  canPsMax(STORAGE_TOPIC_BLOB_SIZE_FOR(names), STORAGE_PING_BLOB_SIZE));
+}
 
 // Base pub/sub class
 class CANPubSubBase {
 public:
-  CANPubSubBase(CANControllerClass& can);
+  CANPubSubBase(CANControllerClass& can, const CANPubSubTables& tables);
   
   // Topic hashing
   static uint16_t hashTopic(const String& topic);
+  static uint16_t hashTopic(const char* topic);
+  
+  // Topic name management (false if the name collides with a registered topic)
+  bool registerTopic(const String& topic);
+  bool registerTopic(const char* topic);
+  // Registered name, or "0x<hash>" (valid until the next miss) if unknown
+  const char* getTopicName(uint16_t hash);
+  const char* findTopicName(uint16_t hash);  // nullptr if unknown
+  
+  // Hash collisions between topic names (reported each time the second name is seen)
+  void onTopicCollision(TopicCollisionCallback callback);
+  uint16_t getTopicCollisionCount();
+  
+  // Arbitration priority of a topic's frames (CAN_PS_PRIORITY_HIGH .. CAN_PS_PRIORITY_BULK)
+  bool setTopicPriority(const String& topic, uint8_t priority);
+  bool setTopicPriority(uint16_t topicHash, uint8_t priority);
+  uint8_t getTopicPriority(uint16_t topicHash);
+  
+  // Transmit pacing (minimum gap between outgoing frames, 0 = send at bus rate)
+  void setFrameGap(unsigned long gapUs);
+  unsigned long getFrameGap();
   
-  // Topic name management
-  void registerTopic(const String& topic);
-  String getTopicName(uint16_t hash);
+  // Bus health as of the last poll (CAN_BUS_ERROR_ACTIVE .. CAN_BUS_OFF, load in %)
+  int getBusState();
+  int getBusLoad();
+  
+#if CAN_PS_STATS
+  // Statistics snapshot and reset
+  void getStats(CANPubSubStats& stats);
+  void resetStats();
+  static uint8_t statsSlot(uint8_t msgType);
+#endif
+  
+  // Segmented transfer (beyond MAX_EXTENDED_MSG_SIZE, windowed ACKs, selective retransmit)
+  void setTransferBuffer(uint8_t* buffer, size_t capacity);
+  void onTransferReceived(TransferReceivedCallback callback);
+  void onTransferDone(TransferDoneCallback callback);
+  bool isTransferActive();
+  void abortTransfer();
   
 protected:
   CANControllerClass* _can;
-  TopicMapping _topicMappings[MAX_SUBSCRIPTIONS];
+  TopicMapping* _topicMappings;
   uint8_t _topicMappingCount;
+  uint8_t _topicMappingCapacity;
+  char* _topicArena;
+  uint16_t _topicArenaLength;
+  uint16_t _topicArenaSize;
+  char _topicHexName[7];  // "0x" + up to 4 hex digits for unknown topics
+  int findTopicMapping(uint16_t hash);  // Binary search, -(insert position + 1) if absent
+  void clearTopicNames();
+  TopicPriority _topicPriorities[CAN_PS_MAX_TOPIC_PRIORITIES];
+  uint8_t _topicPriorityCount;
+  uint16_t _topicCollisions;
+  TopicCollisionCallback _onTopicCollision;
+  void reportTopicCollision(uint16_t hash, const String& existingName, const String& newName);
+  
+  // Frame transmission (all outgoing frames go through these)
+  bool beginFrame(uint8_t msgType, uint8_t priority = CAN_PS_PRIORITY_NORMAL);
+  bool beginExtendedFrame(long extId, uint8_t priority = CAN_PS_PRIORITY_NORMAL);
+  uint8_t packetPriority();  // Priority class of the frame being handled
+  bool packetDownlink();     // Frame being handled was sent by the broker
+  int endFrame();
+  void waitForFrameSlot();
+  size_t frameCapacity();  // Data bytes per frame: 8, or up to 64 in CAN FD mode
+  bool _downlink;  // Set by the broker, tags outgoing IDs with the downlink flag
+  uint32_t _framesSent;
+  unsigned long _frameGapUs;
+  unsigned long _loadGapUs;  // Gap floor applied by the broker while the bus is congested
+  unsigned long _lastFrameMicros;
+  
+  // Bus health polling (controller state, bus-off recovery, load)
+  bool serviceBus();  // True when a new sample was taken
+  int _busState;
+  int _busLoad;
+  unsigned long _lastBusCheck;
+  
+#if CAN_PS_STATS
+  CANPubSubStats _stats;
+  uint8_t _statsTxSlot;          // Message type of the frame being built
+  unsigned long _statsRxMicros;  // When the frame being handled was read
+  unsigned long _statsOverrunBase;
+  unsigned long _statsTxFailureBase;
+  unsigned long _statsWindowStart;
+  void statsRxFrame();
+  void statsLoop(unsigned long startMicros);
+  void statsPublish(uint16_t topicHash);
+  void statsFanout();
+  void statsRollWindow();
+#endif
+  
+  // Payload helpers
+  static String payloadToString(const uint8_t* data, size_t length);
+  size_t readPayload(uint8_t* buffer, size_t maxLength);
   
   // Extended message support
-  bool sendExtendedMessage(uint8_t msgType, const uint8_t* data, size_t length);
+  bool sendExtendedMessage(uint8_t msgType, const uint8_t* data, size_t length, uint8_t priority = CAN_PS_PRIORITY_NORMAL);
   void processExtendedFrame(int packetSize);
   virtual void onExtendedMessageComplete(uint8_t msgType, uint8_t senderId, const uint8_t* data, size_t length) = 0;
+  virtual uint8_t localNodeId() = 0;  // Sender field for outgoing extended IDs
+  ExtendedMessageBuffer* findExtendedSlot(uint8_t sourceId, uint8_t msgType);
+  ExtendedMessageBuffer* allocateExtendedSlot();
+  
+  ExtendedMessageBuffer* _extSlots;
+  uint8_t _extSlotCount;
+  uint16_t _extBufferSize;
   
-  ExtendedMessageBuffer _extBuffer;
+  // Segmented transfer
+  bool startTransfer(uint8_t peerId, const uint8_t* data, size_t length, uint8_t tag);
+  bool handleTransferFrame();  // true when the current frame belonged to a transfer
+  void serviceTransfers();     // Retransmit, window refill and delayed ACKs, called from loop()
+  bool transferPeer(bool downlink, uint8_t node, uint8_t& peerId);
+  void handleTransferStart(uint8_t peerId);
+  void handleTransferData(uint8_t peerId, uint16_t wireSeq);
+  void handleTransferAck(uint8_t peerId);
+  void handleTransferAbort(uint8_t peerId);
+  void sendTransferControl(uint8_t msgType, uint8_t peerId, const uint8_t* data, uint8_t length);
+  void sendTransferStart();
+  void sendTransferAck();
+  void sendTransferAbort(uint8_t peerId, uint8_t reason);
+  void sendTransferWindow();
+  void finishTransmit(bool success);
+  
+  TransferTxState _xferTx;
+  TransferRxState _xferRx;
+  uint8_t* _xferBuffer;
+  size_t _xferCapacity;
+  TransferReceivedCallback _onTransferReceived;
+  TransferDoneCallback _onTransferDone;
 };
 
-// Pub/Sub Broker class
-class CANPubSubBroker : public CANPubSubBase {
-public:
-  CANPubSubBroker(CANControllerClass& can);
+// Pub/Sub Broker implementation, instantiated through CANPubSubBrokerT (CANPubSubBroker
+// for the default sizes). Refer to brokers of any size as CANPubSubBrokerCore&.
+class CANPubSubBrokerCore : public CANPubSubBase {
+protected:
+  CANPubSubBrokerCore(CANControllerClass& can, const CANPubSubTables& tables, const CANPubSubBrokerTables& brokerTables);
   
+public:
   // Initialization
   bool begin();
   void end();
@@ -181,6 +844,7 @@ public:
   void onClientConnect(ConnectionCallback callback);
   void onClientDisconnect(ConnectionCallback callback);
   void onPublish(MessageCallback callback);
+  void onPublishBinary(BinaryMessageCallback callback);
   void onDirectMessage(DirectMessageCallback callback);
   
   // Connection monitoring
@@ -191,14 +855,57 @@ public:
   void setMaxMissedPings(uint8_t maxMissed);
   uint8_t getMaxMissedPings();
   
+  // Group heartbeat: one HEARTBEAT frame per interval instead of a PING per client
+  void enableGroupHeartbeat(bool enable);
+  bool isGroupHeartbeatEnabled();
+  void setHeartbeatSlot(uint8_t slotMs);
+  // Passive liveness: any frame from a client counts as its pong and suppresses its ping
+  void enablePassiveLiveness(bool enable);
+  bool isPassiveLivenessEnabled();
+  
+  // Load adaptation: above the threshold, ping less often and pace fan-out
+  void enableLoadAdaptation(bool enable);
+  bool isLoadAdaptationEnabled();
+  void setLoadThreshold(uint8_t percent);
+  uint8_t getLoadThreshold();
+  bool isBusCongested();
+  
   // Broker operations
   void sendToClient(uint8_t clientId, uint16_t topicHash, const String& message);
+  void sendToClient(uint8_t clientId, uint16_t topicHash, const uint8_t* data, size_t length);
   void sendDirectMessage(uint8_t clientId, const String& message);
   void broadcastMessage(uint16_t topicHash, const String& message);
+  void broadcastMessage(uint16_t topicHash, const uint8_t* data, size_t length);
+  
+  // Segmented transfer to one client (data must stay valid until onTransferDone)
+  bool sendTransfer(uint8_t clientId, const uint8_t* data, size_t length, uint8_t tag = 0);
+  
+  // Reliable publishers tracked for deduplication
+  uint8_t getQosClientCount();
+  
+  // Fan-out mode: one multicast frame per publish (default) or one unicast copy per subscriber
+  void enableMulticast(bool enable);
+  bool isMulticastEnabled();
+  
+  // Restore mode: a client's topic list in one SUB_RESTORE_BATCH (default), names on
+  // request, or one SUB_RESTORE per topic with its name (older clients)
+  void enableBatchedRestore(bool enable);
+  bool isBatchedRestoreEnabled();
+  
+  // Retained messages: the last value of each topic goes to every new subscriber,
+  // on subscribe and on subscription restore
+  void enableRetainedMessages(bool enable);
+  bool isRetainedEnabled();
+  bool getRetained(uint16_t topicHash, uint8_t* data, size_t* length);
+  void clearRetained(uint16_t topicHash);
+  void clearAllRetained();
+  uint8_t getRetainedCount();
   
   // Statistics
   uint8_t getClientCount();
   uint8_t getSubscriptionCount();
+  uint8_t getWildcardCount();
+  uint8_t getSubscriberCapacity();  // Subscribers per topic, the most getSubscribers() writes
   void getSubscribers(uint16_t topicHash, uint8_t* subscribers, uint8_t* count);
   void listSubscribedTopics(std::function<void(uint16_t hash, const String& name, uint8_t subscriberCount)> callback);
   
@@ -238,12 +945,95 @@ public:
   bool saveTopicNamesToStorage();
   bool clearStoredTopicNames();
   
+  // Write-behind persistence: subscription, topic name and new mapping changes
+  // are coalesced and written (one blob per changed table) after the interval, or on flush()
+  void setPersistInterval(unsigned long intervalMs);
+  unsigned long getPersistInterval();
+  bool flush();
+  bool hasPendingWrites();
+  // Stored entries the last begin() could not load because this broker is smaller than the
+  // one that wrote them (mappings, subscription lists and their topics, topic names). The
+  // first entries of each table are kept; the next write of a table drops the rest for good
+  uint16_t getStorageDrops();
+  
+  // Task mode (set before begin()): begin() starts an RX, a routing and a persistence
+  // task pinned to core, loop() then only delivers the queued callbacks in the caller's task.
+  // Broker calls from other tasks go between lock() and unlock() (no-ops otherwise)
+#if CAN_PS_TASKS
+  void enableTaskMode(bool enable, uint8_t core = CAN_PS_TASK_CORE);
+  bool isTaskModeEnabled();
+  unsigned long getTaskFrameDrops();  // RX task found the frame queue full
+  unsigned long getTaskEventDrops();  // Callbacks lost to a full event queue
+#endif
+  void lock();
+  void unlock();
+  
 private:
+  // Sender field for outgoing extended IDs
+  uint8_t localNodeId() override;
+  
+  // Subscription table (dense array, hash index on topicHash, per-client reverse index)
+  int findSubscription(uint16_t topicHash);
+  int findSubscriptionSlot(uint16_t topicHash);
+  uint16_t subscriptionHome(uint16_t topicHash);
+  int createSubscription(uint16_t topicHash);
+  void eraseSubscription(uint8_t index);
+  void clearSubscriptionTable();
+  bool linkSubscriber(uint16_t topicHash, uint8_t clientId);
+  bool unlinkSubscriber(uint16_t topicHash, uint8_t clientId);
+  int findClientTopics(uint8_t clientId);
+  void releaseClientTopics(uint8_t topics);
+  
   // Subscription management
   void addSubscription(uint8_t clientId, uint16_t topicHash);
   void removeSubscription(uint8_t clientId, uint16_t topicHash);
   void removeAllSubscriptions(uint8_t clientId);
-  void forwardToSubscribers(uint16_t topicHash, const String& message);
+  void forwardToSubscribers(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority,
+                            uint8_t publisherId = CAN_PS_BROKER_ID);
+  void sendTopicMulticast(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority);
+  void sendTopicData(uint8_t clientId, uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority);
+  void dispatchPublish(uint8_t publisherId, uint16_t topicHash, const uint8_t* data, size_t length);
+  void dispatchPublishBatch(uint8_t publisherId, const uint8_t* records, size_t length);
+  
+  // Reliable publish: dedup window per publisher, ACKs coalesced into ranges
+  void dispatchPublishQos(uint8_t publisherId, const uint8_t* message, size_t length);
+  QosClientState* findQosState(uint8_t clientId, bool create);
+  void resetQosState(uint8_t clientId);
+  bool acceptQosSequence(QosClientState& state, uint8_t seq);
+  void queueQosAck(QosClientState& state, uint8_t seq);
+  void sendQosAck(QosClientState& state);
+  void serviceQosAcks();
+  
+  // Subscription restores queued by ID requests
+  void scheduleRestore(uint8_t clientId);
+  void serviceRestores();
+  void sendRestoreBatch(uint8_t clientId, const uint16_t* topics, uint8_t count, bool withNames);
+  void dispatchTopicNameRequest(uint8_t clientId, const uint8_t* hashes, size_t length);
+  
+  // Wildcard subscriptions: patterns compiled into a trie, subscriber sets cached per topic
+  int findWildcard(uint16_t patternHash);
+  void addWildcard(uint16_t patternHash, const char* pattern);
+  void removeWildcard(uint8_t index);
+  void compileWildcards();
+  uint32_t matchWildcards(uint8_t node, const char* level);  // Bit per _wildcards index
+  WildcardMatch* findWildcardMatch(uint16_t topicHash);
+  WildcardMatch* resolveWildcardMatch(uint16_t topicHash, uint8_t publisherId);
+  void buildWildcardMatch(WildcardMatch& match, const char* topicName);
+  void completeWildcardMatch(uint16_t topicHash, const char* topicName);
+  void invalidateWildcardMatches(uint8_t pattern);  // Entries whose topic matches the pattern
+  void evictWildcardMatches();  // All but the entries a held publish waits on
+  void removeWildcardMatch(uint16_t slot);
+  void clearWildcardMatches();
+  void holdWildcardPublish(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority);
+  const char* knownTopicName(uint16_t hash);  // Runtime or stored name, nullptr if unknown
+  void sendTopicName(uint8_t clientId, uint16_t topicHash, const char* name);
+  void dispatchTopicNames(uint8_t clientId, const uint8_t* records, size_t length);
+  
+  // Retained message cache
+  int findRetained(uint16_t topicHash);
+  void storeRetained(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority);
+  void sendRetained(uint8_t clientId, uint16_t topicHash);
+  void forwardPeerMessage(uint8_t senderId, uint8_t targetId, const uint8_t* data, size_t length);
   
   // Client ID management (old method for backward compatibility)
   void assignClientID();
@@ -251,6 +1041,7 @@ private:
   // Client ID management with serial number
   void handleIdRequestWithSerial();
   uint8_t findOrCreateClientId(const String& serialNumber);
+  uint8_t assignSerialClientId(const String& serialNumber);  // ID request: find or create, then reset QoS state
   int findClientMapping(const String& serialNumber);
   int findClientMappingById(uint8_t clientId);
   
@@ -258,6 +1049,10 @@ private:
   void handleSubscribe();
   void handleUnsubscribe();
   void handlePublish();
+  void handlePublishBatch();
+  void handlePublishQos();
+  void handleTopicNameRequest();
+  void handleTopicName();
   void handleDirectMessage();
   void handlePeerMessage();
   void handlePing();
@@ -265,40 +1060,104 @@ private:
   
   // Connection monitoring
   void pingAllClients();
+  void servicePingRound();
+  void sendHeartbeat();
+  void evaluateLiveness();
   void checkClientTimeouts();
   int findPingState(uint8_t clientId);
   void initPingState(uint8_t clientId);
   void trackClientActivity(uint8_t clientId);
+  bool setClientOnline(uint8_t clientId);
+  bool clearClientOnline(uint8_t clientId);
+  
+  // Periodic work of loop() after the frames: transfers, bus health, pings, write-behind
+  void service();
+  
+  // Callbacks, called directly or queued for loop() in task mode
+  void notifyClientConnect(uint8_t clientId);
+  void notifyClientDisconnect(uint8_t clientId);
+  void notifyPublish(uint16_t topicHash, const uint8_t* data, size_t length);
+  void notifyDirectMessage(uint8_t senderId, const String& message);
   
   // Data members
-  Subscription _subscriptions[MAX_SUBSCRIPTIONS];
+  Subscription* _subscriptions;
   uint8_t _subTableSize;
+  uint8_t _subTableCapacity;
+  uint8_t _subscribersPerTopic;
+  uint8_t* _subIndex;                         // _subscriptions index + 1, 0 = empty
+  uint16_t _subIndexSize;
+  ClientTopicList* _clientTopics;
+  uint8_t _clientTopicCount;
+  uint8_t _clientTopicCapacity;
+  uint8_t _topicsPerClient;                   // Row length of the reverse index and the stored lists
+  uint8_t _clientTopicSlot[256];              // _clientTopics index + 1 by client ID, 0 = none
   uint8_t _nextClientID;
   uint8_t _nextTempID;
-  uint8_t _connectedClients[256]; // Track connected clients
-  uint8_t _clientCount;
+  uint32_t _onlineClients[256 / 32]; // Presence bitmap, one bit per client ID
+  bool _multicastEnabled;
+  
+  // Wildcard patterns, their trie and the per-topic subscriber sets
+  WildcardPattern _wildcards[CAN_PS_MAX_WILDCARDS];
+  uint8_t _wildcardCount;
+  WildcardNode _wildcardNodes[CAN_PS_WILDCARD_NODES];
+  uint8_t _wildcardNodeCount;
+  uint8_t _wildcardRoot;  // First node of the top level + 1
+  WildcardMatch _wildcardMatches[CAN_PS_WILDCARD_CACHE_SIZE];
+  uint16_t _wildcardMatchCount;
+  WildcardHeldPublish _wildcardHeld[CAN_PS_WILDCARD_HOLD];
+  
+  // Pending subscription restores, one bit per client ID
+  uint32_t _restorePending[256 / 32];
+  uint16_t _restoreCount;
+  uint8_t _restoreCursor;  // Next client ID to look at, restores go round-robin
+  bool _batchedRestore;
+  
+  // Reliable publishers
+  QosClientState _qosClients[CAN_PS_QOS_CLIENTS];
+  
+  // Retained messages (slot i owns _retainedData[i])
+  RetainedMessage _retained[CAN_PS_MAX_RETAINED];
+  uint8_t _retainedData[CAN_PS_MAX_RETAINED][CAN_PS_RETAINED_PAYLOAD_SIZE];
+  bool _retainEnabled;
   
   // Ping monitoring
   unsigned long _pingInterval;
   bool _autoPingEnabled;
   uint8_t _maxMissedPings;
   unsigned long _lastPingTime;
+  uint8_t _pingCursor;
+  bool _pingRoundActive;
+  bool _pingOutstanding;             // A round was sent and is judged at the next one
+  bool _groupHeartbeat;
+  bool _passiveLiveness;
+  uint8_t _heartbeatSeq;
+  uint8_t _heartbeatSlotMs;
+  uint32_t _heardClients[256 / 32];  // Clients heard from since the current round started
+  uint32_t _pingSkip[256 / 32];      // Passive liveness: heard last round, not pinged this round
+  
+  // Load adaptation
+  bool _loadAdaptation;
+  uint8_t _loadThreshold;
+  bool _busCongested;
   
-  // Client ID to Serial Number mapping
-  ClientMapping _clientMappings[MAX_CLIENT_MAPPINGS];
+  // Client ID to Serial Number mapping, _mappingCapacity entries
+  ClientMapping* _clientMappings;
   uint8_t _mappingCount;
+  uint8_t _mappingCapacity;
   
-  // Client subscription persistence
-  ClientSubscriptions _storedSubscriptions[MAX_CLIENT_MAPPINGS];
+  // Client subscription persistence, one entry per mapping
+  ClientTopicList* _storedSubscriptions;
   uint8_t _storedSubCount;
   
-  // Runtime ping state (separate from persistent storage)
-  ClientPingState _pingStates[MAX_CLIENT_MAPPINGS];
+  // Runtime ping state (separate from persistent storage), one entry per mapping
+  ClientPingState* _pingStates;
   uint8_t _pingStateCount;
   
-  // Topic name persistence
-  StoredTopicName _storedTopicNames[MAX_STORED_TOPIC_NAMES];
+  // Topic name persistence, _storedTopicCapacity entries
+  StoredTopicName* _storedTopicNames;
   uint8_t _storedTopicCount;
+  uint8_t _storedTopicCapacity;
+  uint16_t _storageDrops;  // Stored entries that did not fit at begin()
   
   // Subscription storage helpers
   void storeClientSubscriptions(uint8_t clientId);
@@ -306,7 +1165,7 @@ private:
   int findStoredSubscription(uint8_t clientId);
   
   // Topic name storage helpers
-  void storeTopicName(uint16_t hash, const String& name);
+  void storeTopicName(uint16_t hash, const String& name);  // Reports a collision, keeps the stored name
   String getStoredTopicName(uint16_t hash);
   int findStoredTopicName(uint16_t hash);
   
@@ -315,19 +1174,77 @@ private:
   Preferences _preferences;
   #endif
   void initStorage();
+  void migrateLegacyStorage();
+  bool loadLegacyMappings();
+  bool loadLegacySubscriptions();
+  bool loadLegacyTopicNames();
+  bool loadLegacyPingConfig();
+  void copyLegacySubscriptions(ClientTopicList& list, const ClientSubscriptions& legacy);
+  void clampLegacyCount(uint8_t& count, uint8_t capacity);
+  
+  // Packed tables: packed into / checked in _storageBlob, one read or write per table
+  uint16_t packStorageTable(uint8_t table, uint8_t& count);
+  bool readStorageBlob(uint8_t table, uint8_t& count, uint16_t& length, bool* truncated = nullptr);
+  bool writeStorageBlob(uint8_t table, uint8_t count, uint16_t length);
+  bool saveStorageTable(uint8_t table);
+  static uint32_t storageCrc32(const uint8_t* data, size_t length, uint32_t crc);
+  uint8_t* _storageBlob;
+  uint16_t _storageBlobSize;
+  
+  // Write-behind state (bit per STORAGE_TABLE_*)
+  void markStorageDirty(uint8_t table);
+  bool deferToPersistTask();
+  uint8_t _storageDirty;
+  bool _persistPending;
+  unsigned long _persistDirtySince;
+  unsigned long _persistInterval;
   
   // Callbacks
   ConnectionCallback _onClientConnect;
   ConnectionCallback _onClientDisconnect;
   MessageCallback _onPublish;
+  BinaryMessageCallback _onPublishBinary;
   DirectMessageCallback _onDirectMessage;
+  
+#if CAN_PS_TASKS
+  // Task mode
+  bool startTasks();
+  void stopTasks();
+  void rxTask();
+  void routeTask();
+  void persistTask();
+  void writeBehind();
+  void postEvent(uint8_t type, uint8_t clientId, uint16_t topicHash, const uint8_t* data, size_t length);
+  void dispatchTaskEvents();
+  static void rxTaskEntry(void* arg);
+  static void routeTaskEntry(void* arg);
+  static void persistTaskEntry(void* arg);
+  static void onTaskFrameReceived(int packetSize);
+  static CANPubSubBrokerCore* _taskInstance;  // Broker woken by the controller interrupt
+  bool _taskMode;
+  uint8_t _taskCore;
+  volatile bool _taskStop;
+  TaskHandle_t _rxTaskHandle;
+  TaskHandle_t _routeTaskHandle;
+  TaskHandle_t _persistTaskHandle;
+  QueueHandle_t _frameQueue;
+  QueueHandle_t _eventQueue;
+  SemaphoreHandle_t _taskLock;    // Recursive, held by the routing task while it works
+  SemaphoreHandle_t _taskExit;    // Given by each task as it leaves its loop
+  unsigned long _taskFrameDrops;
+  unsigned long _taskEventDrops;
+#endif
 };
 
-// Pub/Sub Client class
-class CANPubSubClient : public CANPubSubBase {
-public:
-  CANPubSubClient(CANControllerClass& can);
+// Pub/Sub Client implementation, instantiated through CANPubSubClientT (CANPubSubClient
+// for the default sizes). Refer to clients of any size as CANPubSubClientCore&.
+class CANPubSubClientCore : public CANPubSubBase {
+protected:
+  CANPubSubClientCore(CANControllerClass& can, const CANPubSubTables& tables,
+                      uint16_t* subscribedTopics, uint8_t topicCapacity, uint8_t* batch, uint16_t batchSize,
+                      QosPublish* qosOutbox, uint8_t qosWindow);
   
+public:
   // Initialization
   bool begin(unsigned long timeout = 5000);
   bool begin(const String& serialNumber, unsigned long timeout = 5000);
@@ -337,6 +1254,17 @@ public:
   bool connect(unsigned long timeout = 5000);
   bool connect(const String& serialNumber, unsigned long timeout = 5000);
   bool isConnected();
+  
+  // Asynchronous connect: returns at once, loop() sends ID requests with exponential
+  // backoff and jitter until an ID is assigned or timeout expires (0 = keep retrying)
+  void connectAsync(unsigned long timeout = 0);
+  void connectAsync(const String& serialNumber, unsigned long timeout = 0);
+  bool isConnecting();
+  void setConnectBackoff(unsigned long minMs, unsigned long maxMs);
+  uint8_t getConnectAttempts();
+  // The broker is still restoring our stored subscriptions (batched restore)
+  bool isRestoring();
+  
   uint8_t getClientId();
   String getSerialNumber();
   
@@ -350,18 +1278,48 @@ public:
   bool subscribe(const String& topic);
   bool unsubscribe(const String& topic);
   bool publish(const String& topic, const String& message);
+  bool publish(uint16_t topicHash, const uint8_t* data, size_t length);
+  
+  // Precomputed topic handles (no hashing, publish() skips the topic table)
+  bool subscribe(const CANTopic& topic);
+  bool unsubscribe(const CANTopic& topic);
+  bool publish(const CANTopic& topic, const String& message);
+  bool publish(const CANTopic& topic, const uint8_t* data, size_t length);
+  
+  // At-least-once publish: kept and sent again until the broker acknowledges it. False above
+  // CAN_PS_QOS_PAYLOAD_SIZE, or while the oldest unacknowledged publish is the QoS window behind
+  bool publishReliable(const String& topic, const String& message);
+  bool publishReliable(uint16_t topicHash, const uint8_t* data, size_t length);
+  bool publishReliable(const CANTopic& topic, const uint8_t* data, size_t length);
+  void setQosTimeout(unsigned long timeoutMs, uint8_t retries = CAN_PS_DEFAULT_QOS_RETRIES);
+  unsigned long getQosTimeout();
+  uint8_t getPendingPublishes();
+  void onPublishDone(PublishDoneCallback callback);
+  
   bool sendDirectMessage(const String& message);
   bool sendPeerMessage(uint8_t targetClientId, const String& message);
+  
+  // Segmented transfer to the broker (data must stay valid until onTransferDone)
+  bool sendTransfer(const uint8_t* data, size_t length, uint8_t tag = 0);
   bool ping();
   
+  // Publish batching: publish() queues records that are packed into one message and
+  // sent once the oldest has waited latencyMs (0 = next loop()), the batch is full, or on flush()
+  void enablePublishBatching(bool enable, unsigned long latencyMs = CAN_PS_DEFAULT_BATCH_LATENCY);
+  bool isPublishBatchingEnabled();
+  bool flush();
+  
   // Callbacks
   void onMessage(MessageCallback callback);
+  void onMessageBinary(BinaryMessageCallback callback);
   void onDirectMessage(DirectMessageCallback callback);
   void onConnect(void (*callback)());
   void onDisconnect(void (*callback)());
   
   // Topic management
   bool isSubscribed(const String& topic);
+  bool isSubscribed(uint16_t topicHash);
+  bool isSubscribed(const CANTopic& topic);
   uint8_t getSubscriptionCount();
   void listSubscribedTopics(std::function<void(uint16_t hash, const String& name)> callback);
   
@@ -371,42 +1329,259 @@ public:
   // Get last ping round-trip time in milliseconds (0 if no pong received yet)
   unsigned long getLastPingTime();
   
+  // Downlink-only acceptance filter: broker frames reach the client, other
+  // clients' uplink traffic is dropped; independent of the subscriptions
+  void enableHardwareFilter(bool enable);
+  bool isHardwareFilterEnabled();
+  
   // Extended message handling override
   void onExtendedMessageComplete(uint8_t msgType, uint8_t senderId, const uint8_t* data, size_t length) override;
   
 private:
+  // Sender field for outgoing extended IDs (serial-hash tag until an ID is assigned)
+  uint8_t localNodeId() override;
+  
+  // Hardware filter programming
+  void applyHardwareFilter();
+  
+  // Publish path (batched or sent at once)
+  bool sendPublish(uint16_t topicHash, const uint8_t* data, size_t length, uint8_t priority);
+  bool queuePublish(uint16_t topicHash, const uint8_t* data, size_t length);
+  
+  // Reliable publish outbox
+  void sendQosPublish(QosPublish& entry);
+  void serviceQosPublishes();
+  void finishQosPublish(QosPublish& entry, bool acknowledged);
+  
   // ID management
   void requestClientID();
   void requestClientIDWithSerial(const String& serialNumber);
   
+  // Connect state machine (shared by connect() and connectAsync())
+  void startConnect(bool withSerial, unsigned long timeout, unsigned long firstDelay);
+  bool retryConnect();
+  uint32_t nextRandom();
+  
   // Message handlers
   void handleIdAssignment();
   void handleSubscribeNotification();
   void handleTopicData();
+  void handleTopicMulticast();
+  void deliverMessage(uint16_t topicHash, const uint8_t* data, size_t length);
   void handleDirectMessageReceived();
   void handlePong();
   void handleSubscriptionRestore();
+  void handleRestoreBatch();
+  void dispatchRestoreBatch(uint8_t clientId, const uint8_t* message, size_t length);
+  bool requestMissingTopicNames();
+  void handleTopicNameRequest();
+  void dispatchTopicNameRequest(uint8_t clientId, const uint8_t* hashes, size_t length);
+  void handleTopicName();
+  void dispatchTopicNames(uint8_t clientId, const uint8_t* records, size_t length);
+  void handleHeartbeat();
+  void sendHeartbeatPong();
+  void handlePublishAck();
   
   // Data members
   uint8_t _clientId;
   bool _connected;
   String _serialNumber;
-  uint16_t _subscribedTopics[MAX_CLIENT_TOPICS];
+  uint16_t* _subscribedTopics;
   uint8_t _subscribedTopicCount;
+  uint8_t _subscribedTopicCapacity;
   unsigned long _lastPing;
   unsigned long _lastPong;
+  bool _hardwareFilterEnabled;
+  
+  // Connect retries
+  bool _connecting;
+  bool _connectWithSerial;
+  uint8_t _connectAttempts;
+  unsigned long _connectStart;
+  unsigned long _connectTimeout;  // 0 = no limit
+  unsigned long _connectLast;     // When the wait for the next ID request started
+  unsigned long _connectWait;     // Randomised delay until the next ID request
+  unsigned long _connectDelay;    // Backoff step, doubles per attempt up to _backoffMax
+  unsigned long _backoffMin;
+  unsigned long _backoffMax;
+  uint32_t _random;               // xorshift32 state for the jitter
+  
+  // Batched restore: set by an ID response with stored subscriptions
+  bool _restoring;
+  bool _restoreNamesAsked;
+  unsigned long _restoreStart;
+  
+  // Group heartbeat answer (sent from loop() in our slot)
+  bool _heartbeatPending;
+  uint8_t _heartbeatSeq;
+  unsigned long _heartbeatReceived;
+  unsigned long _heartbeatDelay;
+  uint32_t _heartbeatTxMark;  // _framesSent when the last heartbeat arrived
+  
+  // Publish batch (_batch[0] is filled with the client ID when sent)
+  uint8_t* _batch;
+  uint16_t _batchSize;
+  uint16_t _batchLength;  // Record bytes after _batch[0]
+  uint8_t _batchCount;
+  uint8_t _batchPriority;  // Most urgent priority among the queued records
+  bool _batchingEnabled;
+  unsigned long _batchLatency;
+  unsigned long _batchStart;
   
-  // Peer message deduplication
-  uint8_t _lastPeerSenderId;
-  unsigned long _lastPeerMsgTime;
-  char _lastPeerMessage[32];
+  // Reliable publishes awaiting an ACK
+  QosPublish* _qosOutbox;
+  uint8_t _qosWindow;
+  uint8_t _qosSeq;         // Sequence number of the next reliable publish
+  uint8_t _qosPending;
+  unsigned long _qosTimeout;
+  uint8_t _qosRetries;
   
   // Callbacks
   MessageCallback _onMessage;
+  BinaryMessageCallback _onMessageBinary;
   DirectMessageCallback _onDirectMessage;
   void (*_onConnect)();
   void (*_onDisconnect)();
   void (*_onPong)();
+  PublishDoneCallback _onPublishDone;
 };
 
+// Table storage of a CANPubSubBrokerT, a base class so it exists before the core is built
+template <uint8_t Topics, uint8_t SubscribersPerTopic, uint8_t SubscriberClients, uint8_t ExtSlots,
+          uint16_t TopicArena, uint16_t SubIndexSize, uint8_t Clients, uint16_t ExtSize, uint8_t TopicsPerClient,
+          uint8_t StoredNames>
+struct CANPubSubBrokerStorage {
+  TopicMapping topicMappings[Topics];
+  char topicArena[TopicArena];
+  ExtendedMessageBuffer extSlots[ExtSlots];
+  uint8_t extBuffers[ExtSlots][ExtSize];
+  Subscription subscriptions[Topics];
+  uint8_t subscribers[Topics][SubscribersPerTopic];
+  uint8_t subIndex[SubIndexSize];
+  ClientTopicList clientTopics[SubscriberClients];
+  uint16_t clientTopicRows[SubscriberClients][TopicsPerClient];
+  uint8_t wildcardSubscribers[CAN_PS_WILDCARD_CACHE_SIZE][SubscribersPerTopic];
+  ClientMapping clientMappings[Clients];
+  ClientTopicList storedSubscriptions[Clients];
+  uint16_t storedTopicRows[Clients][TopicsPerClient];
+  ClientPingState pingStates[Clients];
+  StoredTopicName storedTopicNames[StoredNames];
+  uint8_t storageBlob[canPsStorageBlobSize(Clients, TopicsPerClient, StoredNames)];
+};
+
+// Broker with its table sizes fixed at compile time, e.g. CANPubSubBrokerT<64, 16> for
+// 64 topics of up to 16 subscribers each
+//   Topics              - subscribed topics, also the registered topic names
+//   SubscribersPerTopic - clients per topic
+//   SubscriberClients   - clients holding at least one subscription
+//   ExtSlots            - multi-frame messages reassembled at once
+//   TopicArena          - bytes for the topic names, terminators included
+//   SubIndexSize        - hash index slots, a power of two larger than Topics
+//   Clients             - registered clients (serial mappings, stored subscriptions, ping states)
+//   ExtSize             - longest multi-frame message received, longer ones are dropped
+//   TopicsPerClient     - topics one client subscribes to, also the stored list of each client
+//   StoredNames         - topic names persisted for restoring subscriptions
+template <uint8_t Topics = MAX_SUBSCRIPTIONS,
+          uint8_t SubscribersPerTopic = MAX_SUBSCRIBERS_PER_TOPIC,
+          uint8_t SubscriberClients = CAN_PS_MAX_SUBSCRIBER_CLIENTS,
+          uint8_t ExtSlots = CAN_PS_EXT_REASSEMBLY_SLOTS,
+          uint16_t TopicArena = Topics * 16,
+          uint16_t SubIndexSize = canPsSubIndexSize(Topics),
+          uint8_t Clients = MAX_CLIENT_MAPPINGS,
+          uint16_t ExtSize = MAX_EXTENDED_MSG_SIZE,
+          uint8_t TopicsPerClient = canPsMin(Topics, MAX_STORED_SUBS_PER_CLIENT),
+          uint8_t StoredNames = canPsMin(Topics, MAX_STORED_TOPIC_NAMES)>
+class CANPubSubBrokerT
+  : private CANPubSubBrokerStorage<Topics, SubscribersPerTopic, SubscriberClients, ExtSlots, TopicArena, SubIndexSize,
+                                   Clients, ExtSize, TopicsPerClient, StoredNames>,
+    public CANPubSubBrokerCore {
+  static_assert(Topics >= 1 && Topics <= 254, "Topics must be between 1 and 254");
+  static_assert(SubscribersPerTopic >= 1, "SubscribersPerTopic must be at least 1");
+  static_assert(SubscriberClients >= 1, "SubscriberClients must be at least 1");
+  static_assert(ExtSlots >= 1, "ExtSlots must be at least 1");
+  static_assert(TopicArena >= 2, "TopicArena must hold at least one name");
+  static_assert((SubIndexSize & (SubIndexSize - 1)) == 0 && SubIndexSize > Topics,
+                "SubIndexSize must be a power of two larger than Topics");
+  static_assert(Clients >= 1 && Clients <= MAX_CLIENT_MAPPINGS,
+                "Clients must be between 1 and MAX_CLIENT_MAPPINGS (the stored table regions)");
+  static_assert(ExtSize >= CAN_FRAME_DATA_SIZE && ExtSize <= MAX_EXTENDED_MSG_SIZE,
+                "ExtSize must be between CAN_FRAME_DATA_SIZE and MAX_EXTENDED_MSG_SIZE");
+  static_assert(TopicsPerClient >= 1 && TopicsPerClient <= MAX_STORED_SUBS_PER_CLIENT,
+                "TopicsPerClient must be between 1 and MAX_STORED_SUBS_PER_CLIENT (the stored table regions)");
+  static_assert(StoredNames >= 1 && StoredNames <= MAX_STORED_TOPIC_NAMES,
+                "StoredNames must be between 1 and MAX_STORED_TOPIC_NAMES (the stored table regions)");
+  
+public:
+  CANPubSubBrokerT(CANControllerClass& can)
+    : CANPubSubBrokerCore(can,
+        CANPubSubTables{this->topicMappings, Topics, this->topicArena, TopicArena, this->extSlots, ExtSlots,
+                        &this->extBuffers[0][0], ExtSize},
+        CANPubSubBrokerTables{this->subscriptions, &this->subscribers[0][0], Topics, SubscribersPerTopic,
+                              this->subIndex, SubIndexSize, this->clientTopics, &this->clientTopicRows[0][0],
+                              SubscriberClients, TopicsPerClient, &this->wildcardSubscribers[0][0],
+                              this->clientMappings, this->storedSubscriptions, &this->storedTopicRows[0][0],
+                              this->pingStates, Clients, this->storedTopicNames, StoredNames,
+                              this->storageBlob, canPsStorageBlobSize(Clients, TopicsPerClient, StoredNames)}) {}
+};
+
+// Table storage of a CANPubSubClientT
+template <uint8_t Topics, uint8_t TopicNames, uint16_t BatchSize, uint8_t ExtSlots, uint16_t TopicArena,
+          uint16_t ExtSize, uint8_t QosWindow>
+struct CANPubSubClientStorage {
+  TopicMapping topicMappings[TopicNames];
+  char topicArena[TopicArena];
+  ExtendedMessageBuffer extSlots[ExtSlots];
+  uint8_t extBuffers[ExtSlots][ExtSize];
+  uint16_t subscribedTopics[Topics];
+  uint8_t batch[BatchSize];
+  QosPublish qosOutbox[QosWindow];
+};
+
+// Client with its table sizes fixed at compile time, e.g. CANPubSubClientT<2, 4, 8, 1>
+// for a sensor node with two subscriptions and no batching
+//   Topics     - subscribed topics
+//   TopicNames - registered topic names (published, subscribed or learned)
+//   BatchSize  - publish batch bytes, CAN_FRAME_DATA_SIZE makes each batch one frame
+//   ExtSlots   - multi-frame messages reassembled at once
+//   TopicArena - bytes for the topic names, terminators included
+//   ExtSize    - longest multi-frame message received, longer ones are dropped
+//   QosWindow  - reliable publishes awaiting an ACK
+template <uint8_t Topics = MAX_CLIENT_TOPICS,
+          uint8_t TopicNames = MAX_SUBSCRIPTIONS,
+          uint16_t BatchSize = CAN_PS_BATCH_SIZE,
+          uint8_t ExtSlots = CAN_PS_EXT_REASSEMBLY_SLOTS,
+          uint16_t TopicArena = TopicNames * 16,
+          uint16_t ExtSize = MAX_EXTENDED_MSG_SIZE,
+          uint8_t QosWindow = CAN_PS_QOS_WINDOW>
+class CANPubSubClientT
+  : private CANPubSubClientStorage<Topics, TopicNames, BatchSize, ExtSlots, TopicArena, ExtSize, QosWindow>,
+    public CANPubSubClientCore {
+  static_assert(Topics >= 1, "Topics must be at least 1");
+  static_assert(TopicNames >= 1, "TopicNames must be at least 1");
+  static_assert(BatchSize >= CAN_FRAME_DATA_SIZE && BatchSize <= MAX_EXTENDED_MSG_SIZE,
+                "BatchSize must be between CAN_FRAME_DATA_SIZE and MAX_EXTENDED_MSG_SIZE");
+  static_assert(ExtSlots >= 1, "ExtSlots must be at least 1");
+  static_assert(TopicArena >= 2, "TopicArena must hold at least one name");
+  static_assert(ExtSize >= CAN_FRAME_DATA_SIZE && ExtSize <= MAX_EXTENDED_MSG_SIZE,
+                "ExtSize must be between CAN_FRAME_DATA_SIZE and MAX_EXTENDED_MSG_SIZE");
+  static_assert(QosWindow >= 1 && QosWindow <= CAN_PS_QOS_DEDUP_WINDOW,
+                "QosWindow must be between 1 and 32 (the broker's dedup window)");
+  
+public:
+  CANPubSubClientT(CANControllerClass& can)
+    : CANPubSubClientCore(can,
+        CANPubSubTables{this->topicMappings, TopicNames, this->topicArena, TopicArena, this->extSlots, ExtSlots,
+                        &this->extBuffers[0][0], ExtSize},
+        this->subscribedTopics, Topics, this->batch, BatchSize, this->qosOutbox, QosWindow) {}
+};
+
+// Default sizes, from the MAX_* / CAN_PS_* limits above
+typedef CANPubSubBrokerT<MAX_SUBSCRIPTIONS, MAX_SUBSCRIBERS_PER_TOPIC, CAN_PS_MAX_SUBSCRIBER_CLIENTS,
+                         CAN_PS_EXT_REASSEMBLY_SLOTS, CAN_PS_TOPIC_ARENA_SIZE, CAN_PS_SUB_INDEX_SIZE,
+                         MAX_CLIENT_MAPPINGS, MAX_EXTENDED_MSG_SIZE, MAX_STORED_SUBS_PER_CLIENT,
+                         MAX_STORED_TOPIC_NAMES> CANPubSubBroker;
+typedef CANPubSubClientT<MAX_CLIENT_TOPICS, MAX_SUBSCRIPTIONS, CAN_PS_BATCH_SIZE,
+                         CAN_PS_EXT_REASSEMBLY_SLOTS, CAN_PS_TOPIC_ARENA_SIZE,
+                         MAX_EXTENDED_MSG_SIZE, CAN_PS_QOS_WINDOW> CANPubSubClient;
+
 #endif // CAN_PS_H
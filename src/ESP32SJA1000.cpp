@@ -233,43 +233,19 @@ int ESP32SJA1000Class::endPacket()
 
 int ESP32SJA1000Class::parsePacket()
 {
-  if ((readRegister(REG_SR) & 0x01) != 0x01) {
-    // no packet
-    return 0;
+  if (_rxQueue) {
+    // frames are collected by the ISR
+    return CANControllerClass::parsePacket();
   }
 
-  _rxExtended = (readRegister(REG_SFF) & 0x80) ? true : false;
-  _rxRtr = (readRegister(REG_SFF) & 0x40) ? true : false;
-  _rxDlc = (readRegister(REG_SFF) & 0x0f);
-  _rxIndex = 0;
-
-  int dataReg;
-
-  if (_rxExtended) {
-    _rxId = (readRegister(REG_EFF + 1) << 21) |
-            (readRegister(REG_EFF + 2) << 13) |
-            (readRegister(REG_EFF + 3) << 5) |
-            (readRegister(REG_EFF + 4) >> 3);
+  CANFrame frame;
 
-    dataReg = REG_EFF + 5;
-  } else {
-    _rxId = (readRegister(REG_SFF + 1) << 3) | ((readRegister(REG_SFF + 2) >> 5) & 0x07);
-
-    dataReg = REG_SFF + 3;
-  }
-
-  if (_rxRtr) {
-    _rxLength = 0;
-  } else {
-    _rxLength = _rxDlc;
-
-    for (int i = 0; i < _rxLength; i++) {
-      _rxData[i] = readRegister(dataReg + i);
-    }
+  if (!readFrame(frame)) {
+    // no packet
+    return 0;
   }
 
-  // release RX buffer
-  modifyRegister(REG_CMR, 0x04, 0x04);
+  loadRxFrame(frame);
 
   return _rxDlc;
 }
@@ -283,7 +259,7 @@ void ESP32SJA1000Class::onReceive(void(*callback)(int))
     _intrHandle = NULL;
   }
 
-  if (callback) {
+  if (callback || _rxQueue) {
     esp_intr_alloc(ETS_TWAI_INTR_SOURCE, 0, ESP32SJA1000Class::onInterrupt, this, &_intrHandle);
   }
 }
@@ -294,6 +270,7 @@ int ESP32SJA1000Class::filter(int id, int mask)
   mask = ~(mask & 0x7ff);
 
   modifyRegister(REG_MOD, 0x17, 0x01); // reset
+  modifyRegister(REG_MOD, 0x08, 0x08); // single filter mode
 
   writeRegister(REG_ACRn(0), id >> 3);
   writeRegister(REG_ACRn(1), id << 5);
@@ -316,6 +293,7 @@ int ESP32SJA1000Class::filterExtended(long id, long mask)
   mask &= ~(mask & 0x1FFFFFFF);
 
   modifyRegister(REG_MOD, 0x17, 0x01); // reset
+  modifyRegister(REG_MOD, 0x08, 0x08); // single filter mode
 
   writeRegister(REG_ACRn(0), id >> 21);
   writeRegister(REG_ACRn(1), id >> 13);
@@ -332,6 +310,98 @@ int ESP32SJA1000Class::filterExtended(long id, long mask)
   return 1;
 }
 
+int ESP32SJA1000Class::filter(int id, int mask, long idExtended, long maskExtended)
+{
+  id &= 0x7ff;
+  mask = ~(mask & 0x7ff);
+  idExtended &= 0x1FFFFFFF;
+  maskExtended = ~(maskExtended & 0x1FFFFFFF);
+
+  modifyRegister(REG_MOD, 0x17, 0x01); // reset
+  modifyRegister(REG_MOD, 0x08, 0x00); // dual filter mode
+
+  // both filters see every frame: filter 1 holds the standard rule, filter 2
+  // the extended rule, which can only match ID28..ID17 in dual filter mode
+  writeRegister(REG_ACRn(0), id >> 3);
+  writeRegister(REG_ACRn(1), (id << 5) & 0xe0);
+  writeRegister(REG_ACRn(2), idExtended >> 21);
+  writeRegister(REG_ACRn(3), (idExtended >> 13) & 0xf0);
+
+  writeRegister(REG_AMRn(0), mask >> 3);
+  writeRegister(REG_AMRn(1), (mask << 5) | 0x1f);
+  writeRegister(REG_AMRn(2), maskExtended >> 21);
+  writeRegister(REG_AMRn(3), ((maskExtended >> 13) & 0xf0) | 0x0f);
+
+  modifyRegister(REG_MOD, 0x17, 0x00); // normal
+
+  return 1;
+}
+
+int ESP32SJA1000Class::clearFilter()
+{
+  modifyRegister(REG_MOD, 0x17, 0x01); // reset
+  modifyRegister(REG_MOD, 0x08, 0x08); // single filter mode
+
+  writeRegister(REG_ACRn(0), 0x00);
+  writeRegister(REG_ACRn(1), 0x00);
+  writeRegister(REG_ACRn(2), 0x00);
+  writeRegister(REG_ACRn(3), 0x00);
+
+  writeRegister(REG_AMRn(0), 0xff);
+  writeRegister(REG_AMRn(1), 0xff);
+  writeRegister(REG_AMRn(2), 0xff);
+  writeRegister(REG_AMRn(3), 0xff);
+
+  modifyRegister(REG_MOD, 0x17, 0x00); // normal
+
+  return 1;
+}
+
+int ESP32SJA1000Class::txErrorCount()
+{
+  return readRegister(REG_TXERR);
+}
+
+int ESP32SJA1000Class::rxErrorCount()
+{
+  return readRegister(REG_RXERR);
+}
+
+int ESP32SJA1000Class::readBusState()
+{
+  if (!_intrHandle) {
+    // without the ISR the error interrupt flags are collected here
+    handleErrorInterrupts(readRegister(REG_IR));
+  }
+
+  uint8_t sr = readRegister(REG_SR);
+
+  if (sr & 0x80) {
+    return CAN_BUS_OFF;
+  }
+
+  if (readRegister(REG_TXERR) >= 128 || readRegister(REG_RXERR) >= 128) {
+    return CAN_BUS_ERROR_PASSIVE;
+  }
+
+  if (sr & 0x40) {
+    return CAN_BUS_ERROR_WARNING;
+  }
+
+  return CAN_BUS_ERROR_ACTIVE;
+}
+
+int ESP32SJA1000Class::recover()
+{
+  // bus-off puts the controller in reset mode, leaving it starts the
+  // 128 x 11 recessive bit recovery sequence
+  if (readRegister(REG_MOD) & 0x01) {
+    modifyRegister(REG_MOD, 0x01, 0x00);
+  }
+
+  return 1;
+}
+
 int ESP32SJA1000Class::observe()
 {
   modifyRegister(REG_MOD, 0x17, 0x01); // reset
@@ -392,7 +462,22 @@ void ESP32SJA1000Class::handleInterrupt()
 {
   uint8_t ir = readRegister(REG_IR);
 
+  handleErrorInterrupts(ir);
+
   if (ir & 0x01) {
+    if (_rxQueue) {
+      CANFrame frame;
+
+      // move every frame out of the RX FIFO into the queue
+      while (readFrame(frame)) {
+        if (pushRxFrame(frame) && _onReceive) {
+          _onReceive(frame.length);
+        }
+      }
+
+      return;
+    }
+
     // received packet, parse and call callback
     parsePacket();
 
@@ -400,6 +485,70 @@ void ESP32SJA1000Class::handleInterrupt()
   }
 }
 
+void ESP32SJA1000Class::handleErrorInterrupts(uint8_t ir)
+{
+  if (ir & 0x08) {
+    // data overrun, the RX FIFO was full
+    _rxOverruns++;
+    modifyRegister(REG_CMR, 0x1f, 0x08); // clear data overrun
+  }
+
+  if (ir & 0x40) {
+    // arbitration lost, reading ALC re-arms the capture
+    _arbitrationLost++;
+    readRegister(REG_ALC);
+  }
+
+  if (ir & 0x80) {
+    // bus error, reading ECC re-arms the capture
+    _busErrors++;
+    readRegister(REG_ECC);
+  }
+}
+
+bool ESP32SJA1000Class::readFrame(CANFrame& frame)
+{
+  if ((readRegister(REG_SR) & 0x01) != 0x01) {
+    return false;
+  }
+
+  frame.extended = (readRegister(REG_SFF) & 0x80) ? true : false;
+  frame.rtr = (readRegister(REG_SFF) & 0x40) ? true : false;
+  frame.fd = false;
+  frame.brs = false;
+  frame.dlc = (readRegister(REG_SFF) & 0x0f);
+
+  int dataReg;
+
+  if (frame.extended) {
+    frame.id = (readRegister(REG_EFF + 1) << 21) |
+               (readRegister(REG_EFF + 2) << 13) |
+               (readRegister(REG_EFF + 3) << 5) |
+               (readRegister(REG_EFF + 4) >> 3);
+
+    dataReg = REG_EFF + 5;
+  } else {
+    frame.id = (readRegister(REG_SFF + 1) << 3) | ((readRegister(REG_SFF + 2) >> 5) & 0x07);
+
+    dataReg = REG_SFF + 3;
+  }
+
+  if (frame.rtr) {
+    frame.length = 0;
+  } else {
+    frame.length = (frame.dlc > 8) ? 8 : frame.dlc;
+
+    for (int i = 0; i < frame.length; i++) {
+      frame.data[i] = readRegister(dataReg + i);
+    }
+  }
+
+  // release RX buffer
+  modifyRegister(REG_CMR, 0x04, 0x04);
+
+  return true;
+}
+
 uint8_t ESP32SJA1000Class::readRegister(uint8_t address)
 {
   volatile uint32_t* reg = (volatile uint32_t*)(REG_BASE + address * 4);
@@ -32,6 +32,12 @@ public:
   virtual int filter(int id, int mask);
   using CANControllerClass::filterExtended;
   virtual int filterExtended(long id, long mask);
+  virtual int filter(int id, int mask, long idExtended, long maskExtended);
+  virtual int clearFilter();
+
+  virtual int txErrorCount();
+  virtual int rxErrorCount();
+  virtual int recover();
 
   virtual int observe();
   virtual int loopback();
@@ -42,10 +48,15 @@ public:
 
   void dumpRegisters(Stream& out);
 
+protected:
+  virtual int readBusState();
+
 private:
   void reset();
 
   void handleInterrupt();
+  void handleErrorInterrupts(uint8_t ir);
+  bool readFrame(CANFrame& frame);
 
   uint8_t readRegister(uint8_t address);
   void modifyRegister(uint8_t address, uint8_t mask, uint8_t value);
@@ -20,14 +20,29 @@
 #define REG_CANINTE                0x2b
 #define REG_CANINTF                0x2c
 
+#define REG_TEC                    0x1c
+#define REG_REC                    0x1d
+#define REG_EFLG                   0x2d
+
+#define FLAG_EWARN                 0x01
+#define FLAG_RXEP                  0x08
+#define FLAG_TXEP                  0x10
+#define FLAG_TXBO                  0x20
+#define FLAG_RX0OVR                0x40
+#define FLAG_RX1OVR                0x80
+
 #define FLAG_RXnIE(n)              (0x01 << n)
 #define FLAG_RXnIF(n)              (0x01 << n)
+#define FLAG_TXnIE(n)              (0x04 << n)
 #define FLAG_TXnIF(n)              (0x04 << n)
+#define FLAG_MERRE                 0x80
+#define FLAG_MERRF                 0x80
 
-#define REG_RXFnSIDH(n)            (0x00 + (n * 4))
-#define REG_RXFnSIDL(n)            (0x01 + (n * 4))
-#define REG_RXFnEID8(n)            (0x02 + (n * 4))
-#define REG_RXFnEID0(n)            (0x03 + (n * 4))
+// RXF3..RXF5 start at 0x10, after BFPCTRL/TXRTSCTRL/CANSTAT/CANCTRL
+#define REG_RXFnSIDH(n)            (0x00 + ((n + (n >= 3)) * 4))
+#define REG_RXFnSIDL(n)            (0x01 + ((n + (n >= 3)) * 4))
+#define REG_RXFnEID8(n)            (0x02 + ((n + (n >= 3)) * 4))
+#define REG_RXFnEID0(n)            (0x03 + ((n + (n >= 3)) * 4))
 
 #define REG_RXMnSIDH(n)            (0x20 + (n * 0x04))
 #define REG_RXMnSIDL(n)            (0x21 + (n * 0x04))
@@ -57,6 +72,22 @@
 
 #define FLAG_RXM0                  0x20
 #define FLAG_RXM1                  0x40
+#define FLAG_BUKT                  0x04
+
+#define FLAG_TXREQ                 0x08
+#define FLAG_TXERR                 0x10
+#define FLAG_MLOA                  0x20
+#define FLAG_TXP_MASK              0x03
+
+#define TX_BUFFER_COUNT            3
+
+#define INSTRUCTION_READ_RX_BUFFER(n)  (0x90 | (n << 2))
+#define INSTRUCTION_LOAD_TX_BUFFER(n)  (0x40 | (n << 1))
+#define INSTRUCTION_RTS(n)             (0x80 | (0x01 << n))
+#define INSTRUCTION_READ_STATUS        0xa0
+
+#define FLAG_STATUS_RXnIF(n)       (0x01 << n)
+#define FLAG_STATUS_TXnREQ(n)      (0x04 << (n * 2))
 
 
 MCP2515Class::MCP2515Class() :
@@ -64,18 +95,38 @@ MCP2515Class::MCP2515Class() :
   _spiSettings(10E6, MSBFIRST, SPI_MODE0),
   _csPin(MCP2515_DEFAULT_CS_PIN),
   _intPin(MCP2515_DEFAULT_INT_PIN),
-  _clockFrequency(MCP2515_DEFAULT_CLOCK_FREQUENCY)
+  _clockFrequency(MCP2515_DEFAULT_CLOCK_FREQUENCY),
+  _txQueue(NULL),
+  _txQueueMask(0),
+  _txQueueHead(0),
+  _txQueueTail(0),
+  _txPending(0),
+  _txServicing(false),
+  _txServiceRequested(false),
+  _txErrorSeen(false)
 {
+  memset(_txPriority, 0, sizeof(_txPriority));
 }
 
 MCP2515Class::~MCP2515Class()
 {
+  if (_txQueue) {
+    free(_txQueue);
+  }
 }
 
 int MCP2515Class::begin(long baudRate)
 {
   CANControllerClass::begin(baudRate);
 
+  // frames still queued from before end() never reached the bus
+  _txFailures += txQueueCount();
+
+  _txQueueHead = 0;
+  _txQueueTail = 0;
+  _txPending = 0;
+  _txErrorSeen = false;
+
   pinMode(_csPin, OUTPUT);
 
   // start SPI
@@ -164,35 +215,35 @@ int MCP2515Class::endPacket()
     return 0;
   }
 
-  int n = 0;
-
-  if (_txExtended) {
-    writeRegister(REG_TXBnSIDH(n), _txId >> 21);
-    writeRegister(REG_TXBnSIDL(n), (((_txId >> 18) & 0x07) << 5) | FLAG_EXIDE | ((_txId >> 16) & 0x03));
-    writeRegister(REG_TXBnEID8(n), (_txId >> 8) & 0xff);
-    writeRegister(REG_TXBnEID0(n), _txId & 0xff);
-  } else {
-    writeRegister(REG_TXBnSIDH(n), _txId >> 3);
-    writeRegister(REG_TXBnSIDL(n), _txId << 5);
-    writeRegister(REG_TXBnEID8(n), 0x00);
-    writeRegister(REG_TXBnEID0(n), 0x00);
+  CANFrame frame;
+  frame.id = _txId;
+  frame.extended = _txExtended;
+  frame.rtr = _txRtr;
+  frame.fd = false;
+  frame.brs = false;
+  frame.dlc = _txLength;
+  frame.length = _txLength;
+  memcpy(frame.data, _txData, _txLength);
+
+  if (_txQueue) {
+    return queueFrame(frame);
   }
 
-  if (_txRtr) {
-    writeRegister(REG_TXBnDLC(n), 0x40 | _txLength);
-  } else {
-    writeRegister(REG_TXBnDLC(n), _txLength);
-
-    for (int i = 0; i < _txLength; i++) {
-      writeRegister(REG_TXBnD0(n) + i, _txData[i]);
-    }
-  }
+  int n = 0;
 
-  writeRegister(REG_TXBnCTRL(n), 0x08);
+  loadTxBuffer(n, frame);
+  requestToSend(n);
 
   bool aborted = false;
+  bool lostArbitration = false;
 
   while (readRegister(REG_TXBnCTRL(n)) & 0x08) {
+    if (!lostArbitration && (readRegister(REG_TXBnCTRL(n)) & FLAG_MLOA)) {
+      // the controller retries on its own, count the frame once
+      lostArbitration = true;
+      _arbitrationLost++;
+    }
+
     if (readRegister(REG_TXBnCTRL(n)) & 0x10) {
       // abort
       aborted = true;
@@ -213,50 +264,105 @@ int MCP2515Class::endPacket()
   return (readRegister(REG_TXBnCTRL(n)) & 0x70) ? 0 : 1;
 }
 
-int MCP2515Class::parsePacket()
+int MCP2515Class::setTxQueueSize(int size)
 {
-  int n;
+  if (size < 0 || size > CAN_TX_QUEUE_MAX_SIZE) {
+    return 0;
+  }
 
-  uint8_t intf = readRegister(REG_CANINTF);
+  // let frames already handed to the controller go out first
+  flush();
 
-  if (intf & FLAG_RXnIF(0)) {
-    n = 0;
-  } else if (intf & FLAG_RXnIF(1)) {
-    n = 1;
-  } else {
-    _rxId = -1;
-    _rxExtended = false;
-    _rxRtr = false;
-    _rxLength = 0;
-    return 0;
+  // round up to a power of two so indexes can be masked
+  int depth = 0;
+  if (size > 0) {
+    depth = 1;
+    while (depth < size) {
+      depth <<= 1;
+    }
   }
 
-  _rxExtended = (readRegister(REG_RXBnSIDL(n)) & FLAG_IDE) ? true : false;
+  CANFrame* queue = NULL;
+  if (depth > 0) {
+    queue = (CANFrame*)malloc(depth * sizeof(CANFrame));
+    if (queue == NULL) {
+      return 0;
+    }
+  }
 
-  uint32_t idA = ((readRegister(REG_RXBnSIDH(n)) << 3) & 0x07f8) | ((readRegister(REG_RXBnSIDL(n)) >> 5) & 0x07);
-  if (_rxExtended) {
-    uint32_t idB = (((uint32_t)(readRegister(REG_RXBnSIDL(n)) & 0x03) << 16) & 0x30000) | ((readRegister(REG_RXBnEID8(n)) << 8) & 0xff00) | readRegister(REG_RXBnEID0(n));
+  noInterrupts();
+  CANFrame* oldQueue = _txQueue;
+  _txQueue = queue;
+  _txQueueMask = depth ? (depth - 1) : 0;
+  _txQueueHead = 0;
+  _txQueueTail = 0;
+  _txPending = 0;
+  interrupts();
+
+  if (oldQueue) {
+    free(oldQueue);
+  }
 
-    _rxId = (idA << 18) | idB;
-    _rxRtr = (readRegister(REG_RXBnDLC(n)) & FLAG_RTR) ? true : false;
-  } else {
-    _rxId = idA;
-    _rxRtr = (readRegister(REG_RXBnSIDL(n)) & FLAG_SRR) ? true : false;
+  // clear TXP levels left behind so the blocking path can use RTS
+  for (int n = 0; n < TX_BUFFER_COUNT; n++) {
+    writeRegister(REG_TXBnCTRL(n), 0x00);
   }
-  _rxDlc = readRegister(REG_RXBnDLC(n)) & 0x0f;
-  _rxIndex = 0;
 
-  if (_rxRtr) {
-    _rxLength = 0;
-  } else {
-    _rxLength = _rxDlc;
+  // TX completion interrupts drive the queue
+  onReceive(_onReceive);
 
-    for (int i = 0; i < _rxLength; i++) {
-      _rxData[i] = readRegister(REG_RXBnD0(n) + i);
+  return 1;
+}
+
+int MCP2515Class::txQueueSize()
+{
+  return _txQueue ? (_txQueueMask + 1) : 0;
+}
+
+int MCP2515Class::txQueueCount()
+{
+  int count = (uint8_t)(_txQueueHead - _txQueueTail);
+
+  for (int n = 0; n < TX_BUFFER_COUNT; n++) {
+    if (_txPending & (1 << n)) {
+      count++;
     }
   }
 
-  modifyRegister(REG_CANINTF, FLAG_RXnIF(n), 0x00);
+  return count;
+}
+
+void MCP2515Class::flush()
+{
+  if (!_txQueue) {
+    return;
+  }
+
+  // wait for the software queue and all TX buffers to drain
+  while (txQueueCount() > 0) {
+    serviceTx();
+    yield();
+  }
+}
+
+int MCP2515Class::parsePacket()
+{
+  if (_rxQueue) {
+    // frames are collected by the ISR
+    return CANControllerClass::parsePacket();
+  }
+
+  CANFrame frame;
+
+  if (!readFrame(frame)) {
+    _rxId = -1;
+    _rxExtended = false;
+    _rxRtr = false;
+    _rxLength = 0;
+    return 0;
+  }
+
+  loadRxFrame(frame);
 
   return _rxDlc;
 }
@@ -267,7 +373,21 @@ void MCP2515Class::onReceive(void(*callback)(int))
 
   pinMode(_intPin, INPUT);
 
-  if (callback) {
+  // only enable interrupt sources that the ISR will service, INT is level triggered
+  uint8_t inte = 0;
+
+  if (callback || _rxQueue) {
+    inte |= FLAG_RXnIE(1) | FLAG_RXnIE(0);
+  }
+
+  if (_txQueue) {
+    // message errors let the ISR abort a queued frame that keeps failing
+    inte |= FLAG_MERRE | FLAG_TXnIE(2) | FLAG_TXnIE(1) | FLAG_TXnIE(0);
+  }
+
+  if (inte) {
+    writeRegister(REG_CANINTE, inte);
+
     SPI.usingInterrupt(digitalPinToInterrupt(_intPin));
     attachInterrupt(digitalPinToInterrupt(_intPin), MCP2515Class::onInterrupt, LOW);
   } else {
@@ -275,6 +395,8 @@ void MCP2515Class::onReceive(void(*callback)(int))
 #ifdef SPI_HAS_NOTUSINGINTERRUPT
     SPI.notUsingInterrupt(digitalPinToInterrupt(_intPin));
 #endif
+
+    writeRegister(REG_CANINTE, FLAG_RXnIE(1) | FLAG_RXnIE(0));
   }
 }
 
@@ -354,6 +476,120 @@ int MCP2515Class::filterExtended(long id, long mask)
   return 1;
 }
 
+int MCP2515Class::filter(int id, int mask, long idExtended, long maskExtended)
+{
+  id &= 0x7ff;
+  mask &= 0x7ff;
+  idExtended &= 0x1FFFFFFF;
+  maskExtended &= 0x1FFFFFFF;
+
+  // config mode
+  writeRegister(REG_CANCTRL, 0x80);
+  if (readRegister(REG_CANCTRL) != 0x80) {
+    return 0;
+  }
+
+  // RXB0 (mask 0, filters 0-1) takes standard frames and rolls over into RXB1,
+  // RXB1 (mask 1, filters 2-5) takes extended frames
+  writeRegister(REG_RXBnCTRL(0), FLAG_BUKT);
+  writeRegister(REG_RXBnCTRL(1), 0x00);
+
+  // standard mask leaves EID bits clear so data bytes are not compared
+  writeRegister(REG_RXMnSIDH(0), mask >> 3);
+  writeRegister(REG_RXMnSIDL(0), mask << 5);
+  writeRegister(REG_RXMnEID8(0), 0);
+  writeRegister(REG_RXMnEID0(0), 0);
+
+  writeRegister(REG_RXMnSIDH(1), maskExtended >> 21);
+  writeRegister(REG_RXMnSIDL(1), (((maskExtended >> 18) & 0x07) << 5) | ((maskExtended >> 16) & 0x03));
+  writeRegister(REG_RXMnEID8(1), (maskExtended >> 8) & 0xff);
+  writeRegister(REG_RXMnEID0(1), maskExtended & 0xff);
+
+  for (int n = 0; n < 2; n++) {
+    writeRegister(REG_RXFnSIDH(n), id >> 3);
+    writeRegister(REG_RXFnSIDL(n), id << 5);
+    writeRegister(REG_RXFnEID8(n), 0);
+    writeRegister(REG_RXFnEID0(n), 0);
+  }
+
+  for (int n = 2; n < 6; n++) {
+    writeRegister(REG_RXFnSIDH(n), idExtended >> 21);
+    writeRegister(REG_RXFnSIDL(n), (((idExtended >> 18) & 0x07) << 5) | FLAG_EXIDE | ((idExtended >> 16) & 0x03));
+    writeRegister(REG_RXFnEID8(n), (idExtended >> 8) & 0xff);
+    writeRegister(REG_RXFnEID0(n), idExtended & 0xff);
+  }
+
+  // normal mode
+  writeRegister(REG_CANCTRL, 0x00);
+  if (readRegister(REG_CANCTRL) != 0x00) {
+    return 0;
+  }
+
+  return 1;
+}
+
+int MCP2515Class::clearFilter()
+{
+  // config mode
+  writeRegister(REG_CANCTRL, 0x80);
+  if (readRegister(REG_CANCTRL) != 0x80) {
+    return 0;
+  }
+
+  // filters off, receive any message
+  writeRegister(REG_RXBnCTRL(0), FLAG_RXM1 | FLAG_RXM0);
+  writeRegister(REG_RXBnCTRL(1), FLAG_RXM1 | FLAG_RXM0);
+
+  // normal mode
+  writeRegister(REG_CANCTRL, 0x00);
+  if (readRegister(REG_CANCTRL) != 0x00) {
+    return 0;
+  }
+
+  return 1;
+}
+
+int MCP2515Class::txErrorCount()
+{
+  return readRegister(REG_TEC);
+}
+
+int MCP2515Class::rxErrorCount()
+{
+  return readRegister(REG_REC);
+}
+
+int MCP2515Class::readBusState()
+{
+  uint8_t eflg = readRegister(REG_EFLG);
+
+  if (eflg & (FLAG_RX1OVR | FLAG_RX0OVR)) {
+    // a frame arrived while both RX buffers were full
+    _rxOverruns++;
+    modifyRegister(REG_EFLG, FLAG_RX1OVR | FLAG_RX0OVR, 0x00);
+  }
+
+  if (eflg & FLAG_TXBO) {
+    return CAN_BUS_OFF;
+  }
+
+  if (eflg & (FLAG_TXEP | FLAG_RXEP)) {
+    return CAN_BUS_ERROR_PASSIVE;
+  }
+
+  if (eflg & FLAG_EWARN) {
+    return CAN_BUS_ERROR_WARNING;
+  }
+
+  return CAN_BUS_ERROR_ACTIVE;
+}
+
+int MCP2515Class::recover()
+{
+  // the MCP2515 rejoins the bus by itself after 128 x 11 recessive bits
+  return 1;
+}
+
 int MCP2515Class::observe()
 {
   writeRegister(REG_CANCTRL, 0x80);
@@ -441,7 +677,41 @@ void MCP2515Class::reset()
 
 void MCP2515Class::handleInterrupt()
 {
-  if (readRegister(REG_CANINTF) == 0) {
+  uint8_t intf = readRegister(REG_CANINTF);
+
+  if (intf == 0) {
+    return;
+  }
+
+  uint8_t txFlags = intf & (FLAG_MERRF | FLAG_TXnIF(2) | FLAG_TXnIF(1) | FLAG_TXnIF(0));
+
+  if (txFlags) {
+    // acknowledge completions and errors, then refill the free buffers
+    modifyRegister(REG_CANINTF, txFlags, 0x00);
+
+    if (txFlags & FLAG_MERRF) {
+      _txErrorSeen = true;
+    }
+
+    if (_txQueue) {
+      serviceTx();
+    }
+  }
+
+  if (_rxQueue) {
+    CANFrame frame;
+
+    // drain both RX buffers into the queue before they can overflow
+    while (readFrame(frame)) {
+      if (pushRxFrame(frame) && _onReceive) {
+        _onReceive(frame.length);
+      }
+    }
+
+    return;
+  }
+
+  if (!_onReceive) {
     return;
   }
 
@@ -450,6 +720,265 @@ void MCP2515Class::handleInterrupt()
   }
 }
 
+int MCP2515Class::queueFrame(const CANFrame& frame)
+{
+  // back-pressure: only wait when the software queue is full
+  while ((uint8_t)(_txQueueHead - _txQueueTail) > _txQueueMask) {
+    serviceTx();
+    yield();
+  }
+
+  uint8_t head = _txQueueHead;
+
+  _txQueue[head & _txQueueMask] = frame;
+  _txQueueHead = head + 1;
+
+  serviceTx();
+
+  return 1;
+}
+
+void MCP2515Class::serviceTx()
+{
+  // serialize loop and ISR callers, a nested call is replayed by the owner
+  if (_txServicing) {
+    _txServiceRequested = true;
+    return;
+  }
+  _txServicing = true;
+
+  do {
+    _txServiceRequested = false;
+
+    if (_txErrorSeen) {
+      _txErrorSeen = false;
+      abortFailedTx();
+    }
+
+    // retire buffers whose transmission finished
+    if (_txPending) {
+      uint8_t status = readStatus();
+
+      for (int n = 0; n < TX_BUFFER_COUNT; n++) {
+        if ((_txPending & (1 << n)) && !(status & FLAG_STATUS_TXnREQ(n))) {
+          _txPending &= ~(1 << n);
+        }
+      }
+    }
+
+    while (_txQueueTail != _txQueueHead) {
+      // the controller sends the highest TXP first, so each newly loaded
+      // buffer gets a lower TXP than everything in flight to keep frames in
+      // submission order (multi-frame messages depend on it)
+      int lowest = FLAG_TXP_MASK + 1;
+      int n = -1;
+
+      for (int i = 0; i < TX_BUFFER_COUNT; i++) {
+        if (_txPending & (1 << i)) {
+          if (_txPriority[i] < lowest) {
+            lowest = _txPriority[i];
+          }
+        } else if (n < 0) {
+          n = i;
+        }
+      }
+
+      if (n < 0) {
+        // all buffers in flight, the TX interrupt calls back
+        break;
+      }
+
+      if (lowest == 0) {
+        // no lower TXP left: lift the buffers in flight to the top levels
+        lowest = raiseTxPriorities();
+      }
+
+      uint8_t priority = lowest - 1;
+      uint8_t tail = _txQueueTail;
+
+      loadTxBuffer(n, _txQueue[tail & _txQueueMask]);
+      writeRegister(REG_TXBnCTRL(n), FLAG_TXREQ | (priority & FLAG_TXP_MASK));
+
+      _txPriority[n] = priority;
+      _txPending |= (1 << n);
+      _txQueueTail = tail + 1;
+    }
+  } while (_txServiceRequested);
+
+  _txServicing = false;
+}
+
+void MCP2515Class::abortFailedTx()
+{
+  // the controller retries a failed frame until it goes out, which would hold
+  // the queue up for good when no node ACKs; drop it like blocking endPacket()
+  // does, the frames behind it still go out in order
+  for (int n = 0; n < TX_BUFFER_COUNT; n++) {
+    if (!(_txPending & (1 << n))) {
+      continue;
+    }
+
+    uint8_t ctrl = readRegister(REG_TXBnCTRL(n));
+
+    if ((ctrl & (FLAG_TXREQ | FLAG_TXERR)) == (FLAG_TXREQ | FLAG_TXERR)) {
+      modifyRegister(REG_TXBnCTRL(n), FLAG_TXREQ, 0x00);
+      _txFailures++;
+    }
+  }
+}
+
+int MCP2515Class::raiseTxPriorities()
+{
+  // highest TXP first, so the pending buffers keep their relative order at
+  // every step even if the controller picks the next frame in between
+  uint8_t raised = 0;
+  int level = FLAG_TXP_MASK;
+
+  for (;;) {
+    int top = -1;
+
+    for (int i = 0; i < TX_BUFFER_COUNT; i++) {
+      if ((_txPending & (1 << i)) && !(raised & (1 << i)) &&
+          (top < 0 || _txPriority[i] > _txPriority[top])) {
+        top = i;
+      }
+    }
+
+    if (top < 0) {
+      break;
+    }
+
+    if (_txPriority[top] != level) {
+      // TXP only, TXREQ stays set
+      modifyRegister(REG_TXBnCTRL(top), FLAG_TXP_MASK, level);
+      _txPriority[top] = level;
+    }
+    raised |= (1 << top);
+    level--;
+  }
+
+  // lowest level in use, at least 1 with a buffer free
+  return level + 1;
+}
+
+void MCP2515Class::loadTxBuffer(int n, const CANFrame& frame)
+{
+  uint8_t header[5];
+
+  if (frame.extended) {
+    header[0] = frame.id >> 21;
+    header[1] = (((frame.id >> 18) & 0x07) << 5) | FLAG_EXIDE | ((frame.id >> 16) & 0x03);
+    header[2] = (frame.id >> 8) & 0xff;
+    header[3] = frame.id & 0xff;
+  } else {
+    header[0] = frame.id >> 3;
+    header[1] = frame.id << 5;
+    header[2] = 0x00;
+    header[3] = 0x00;
+  }
+
+  int length = frame.rtr ? 0 : frame.length;
+
+  header[4] = (frame.rtr ? 0x40 : 0x00) | frame.length;
+
+  // LOAD TX BUFFER: ID, DLC and data in a single transaction
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer(INSTRUCTION_LOAD_TX_BUFFER(n));
+  for (int i = 0; i < 5; i++) {
+    SPI.transfer(header[i]);
+  }
+  for (int i = 0; i < length; i++) {
+    SPI.transfer(frame.data[i]);
+  }
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+}
+
+void MCP2515Class::requestToSend(int n)
+{
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer(INSTRUCTION_RTS(n));
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+}
+
+uint8_t MCP2515Class::readStatus()
+{
+  uint8_t value;
+
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer(INSTRUCTION_READ_STATUS);
+  value = SPI.transfer(0x00);
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+
+  return value;
+}
+
+bool MCP2515Class::readFrame(CANFrame& frame)
+{
+  int n;
+
+  uint8_t status = readStatus();
+
+  if (status & FLAG_STATUS_RXnIF(0)) {
+    n = 0;
+  } else if (status & FLAG_STATUS_RXnIF(1)) {
+    n = 1;
+  } else {
+    return false;
+  }
+
+  uint8_t header[5];
+
+  // READ RX BUFFER: ID, DLC and data in a single transaction,
+  // RXnIF is cleared by the controller when CS is released
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer(INSTRUCTION_READ_RX_BUFFER(n));
+  for (int i = 0; i < 5; i++) {
+    header[i] = SPI.transfer(0x00);
+  }
+
+  uint8_t sidh = header[0];
+  uint8_t sidl = header[1];
+  uint8_t dlc = header[4];
+
+  frame.extended = (sidl & FLAG_IDE) ? true : false;
+
+  uint32_t idA = ((sidh << 3) & 0x07f8) | ((sidl >> 5) & 0x07);
+  if (frame.extended) {
+    uint32_t idB = (((uint32_t)(sidl & 0x03) << 16) & 0x30000) | ((header[2] << 8) & 0xff00) | header[3];
+
+    frame.id = (idA << 18) | idB;
+    frame.rtr = (dlc & FLAG_RTR) ? true : false;
+  } else {
+    frame.id = idA;
+    frame.rtr = (sidl & FLAG_SRR) ? true : false;
+  }
+  frame.fd = false;
+  frame.brs = false;
+  frame.dlc = dlc & 0x0f;
+
+  if (frame.rtr) {
+    frame.length = 0;
+  } else {
+    frame.length = (frame.dlc > 8) ? 8 : frame.dlc;
+
+    for (int i = 0; i < frame.length; i++) {
+      frame.data[i] = SPI.transfer(0x00);
+    }
+  }
+
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+
+  return true;
+}
+
 uint8_t MCP2515Class::readRegister(uint8_t address)
 {
   uint8_t value;
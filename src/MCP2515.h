@@ -15,6 +15,9 @@
 
 #define MCP2515_DEFAULT_CLOCK_FREQUENCY 16e6
 
+// Maximum depth of the optional asynchronous transmit queue (must be a power of two <= 128)
+#define CAN_TX_QUEUE_MAX_SIZE 128
+
 #if defined(ARDUINO_ARCH_SAMD) && defined(PIN_SPI_MISO) && defined(PIN_SPI_MOSI) && defined(PIN_SPI_SCK) && (PIN_SPI_MISO == 10) && (PIN_SPI_MOSI == 8) && (PIN_SPI_SCK == 9)
   // Arduino MKR board: MKR CAN shield CS is pin 3, INT is pin 7
   #define MCP2515_DEFAULT_CS_PIN          3
@@ -41,16 +44,31 @@ public:
   virtual int begin(long baudRate);
   virtual void end();
 
+  // Without a TX queue: 1 once the frame is on the bus, 0 if it failed or was
+  // aborted. With setTxQueueSize(): 1 once the frame is queued, not sent; frames
+  // aborted later count in txFailureCount()
   virtual int endPacket();
 
   virtual int parsePacket();
 
+  virtual void flush();
+
+  virtual int setTxQueueSize(int size);
+  virtual int txQueueSize();
+  virtual int txQueueCount();
+
   virtual void onReceive(void(*callback)(int));
 
   using CANControllerClass::filter;
   virtual int filter(int id, int mask);
   using CANControllerClass::filterExtended;
   virtual int filterExtended(long id, long mask);
+  virtual int filter(int id, int mask, long idExtended, long maskExtended);
+  virtual int clearFilter();
+
+  virtual int txErrorCount();
+  virtual int rxErrorCount();
+  virtual int recover();
 
   virtual int observe();
   virtual int loopback();
@@ -63,10 +81,23 @@ public:
 
   void dumpRegisters(Stream& out);
 
+protected:
+  virtual int readBusState();
+
 private:
   void reset();
 
   void handleInterrupt();
+  bool readFrame(CANFrame& frame);
+
+  int queueFrame(const CANFrame& frame);
+  void serviceTx();
+  void abortFailedTx();
+  void loadTxBuffer(int n, const CANFrame& frame);
+  int raiseTxPriorities();
+  void requestToSend(int n);
+
+  uint8_t readStatus();
 
   uint8_t readRegister(uint8_t address);
   void modifyRegister(uint8_t address, uint8_t mask, uint8_t value);
@@ -79,6 +110,17 @@ private:
   int _csPin;
   int _intPin;
   long _clockFrequency;
+
+  // asynchronous TX: software FIFO in front of TXB0-TXB2
+  CANFrame* _txQueue;
+  uint8_t _txQueueMask;
+  volatile uint8_t _txQueueHead;
+  volatile uint8_t _txQueueTail;
+  volatile uint8_t _txPending;
+  uint8_t _txPriority[3];
+  volatile bool _txServicing;
+  volatile bool _txServiceRequested;
+  volatile bool _txErrorSeen;
 };
 
 extern MCP2515Class CAN;
@@ -0,0 +1,758 @@
+// Copyright (c) Sandeep Mistry. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "MCP2518FD.h"
+
+#define INSTRUCTION_RESET          0x0
+#define INSTRUCTION_WRITE          0x2
+#define INSTRUCTION_READ           0x3
+
+#define REG_CiCON                  0x000
+#define REG_CiNBTCFG               0x004
+#define REG_CiDBTCFG               0x008
+#define REG_CiTDC                  0x00c
+#define REG_CiINT                  0x01c
+#define REG_CiTREC                 0x034
+
+// FIFO 0 is the TXQ, FIFOs 1-31 follow every 12 bytes
+#define REG_CiFIFOCON(m)           (0x050 + (m * 12))
+#define REG_CiFIFOSTA(m)           (0x054 + (m * 12))
+#define REG_CiFIFOUA(m)            (0x058 + (m * 12))
+
+// four 8-bit filter controls per 32-bit register
+#define REG_CiFLTCON(n)            (0x1d0 + n)
+#define REG_CiFLTOBJ(n)            (0x1f0 + (n * 8))
+#define REG_CiMASK(n)              (0x1f4 + (n * 8))
+
+#define REG_OSC                    0xe00
+
+#define RAM_START                  0x400
+
+#define MODE_NORMAL_FD             0x00
+#define MODE_SLEEP                 0x01
+#define MODE_INTERNAL_LOOPBACK     0x02
+#define MODE_LISTEN_ONLY           0x03
+#define MODE_CONFIG                0x04
+#define MODE_NORMAL_CAN20          0x06
+
+#define FLAG_ISOCRCEN              0x00000020
+#define FLAG_BRSDIS                0x00001000
+#define TDCMOD_AUTO                0x00020000
+
+#define FLAG_OSCRDY                0x04  // OSC byte 1
+
+#define FLAG_RXIE                  0x02  // CiINT byte 2
+
+#define FIFO_TX                    1
+#define FIFO_RX                    2
+
+#define FLAG_TFNRFNIE              0x00000001
+#define FLAG_TXEN                  0x00000080
+#define FIFO_FSIZE(depth)          ((uint32_t)((depth) - 1) << 24)
+#define FIFO_PLSIZE_8              0x00000000
+#define FIFO_PLSIZE_64             0xe0000000
+
+#define FLAG_UINC                  0x01  // CiFIFOCON byte 1
+#define FLAG_TXREQ                 0x02  // CiFIFOCON byte 1
+#define FLAG_FRESET                0x04  // CiFIFOCON byte 1
+
+#define FLAG_TFNRFNIF              0x01  // CiFIFOSTA: TX not full / RX not empty
+#define FLAG_TFERFFIF              0x04  // CiFIFOSTA: TX empty / RX full
+#define FLAG_RXOVIF                0x08  // CiFIFOSTA: RX overflow
+
+// CiTREC: REC in bits 7-0, TEC in bits 15-8, state flags in byte 2
+#define FLAG_TREC_EWARN            0x01
+#define FLAG_TREC_RXBP             0x08
+#define FLAG_TREC_TXBP             0x10
+#define FLAG_TREC_TXBO             0x20
+
+#define FLAG_FLTEN                 0x80
+#define FLAG_EXIDE                 0x40000000
+#define FLAG_MIDE                  0x40000000
+
+// message object flags (second word)
+#define FLAG_IDE                   0x00000010
+#define FLAG_RTR                   0x00000020
+#define FLAG_BRS                   0x00000040
+#define FLAG_FDF                   0x00000080
+
+// message objects hold SID in bits 10-0 and the 18 extended bits in 28-11
+#define OBJECT_ID(id, extended)    ((extended) ? ((((uint32_t)(id) >> 18) & 0x7ff) | (((uint32_t)(id) & 0x3ffff) << 11)) : ((uint32_t)(id) & 0x7ff))
+
+MCP2518FDClass* MCP2518FDClass::_instance = NULL;
+
+MCP2518FDClass::MCP2518FDClass() :
+  CANControllerClass(),
+  _spiSettings(10E6, MSBFIRST, SPI_MODE0),
+  _csPin(MCP2518FD_DEFAULT_CS_PIN),
+  _intPin(MCP2518FD_DEFAULT_INT_PIN),
+  _clockFrequency(MCP2518FD_DEFAULT_CLOCK_FREQUENCY),
+  _fdMode(false),
+  _brs(false),
+  _normalMode(MODE_NORMAL_CAN20)
+{
+}
+
+MCP2518FDClass::~MCP2518FDClass()
+{
+  if (_instance == this) {
+    _instance = NULL;
+  }
+}
+
+int MCP2518FDClass::begin(long baudRate)
+{
+  return start(baudRate, 0);
+}
+
+int MCP2518FDClass::beginFD(long baudRate, long dataBaudRate)
+{
+  if (dataBaudRate < baudRate) {
+    return 0;
+  }
+
+  return start(baudRate, dataBaudRate);
+}
+
+int MCP2518FDClass::start(long baudRate, long dataBaudRate)
+{
+  CANControllerClass::begin(baudRate);
+
+  _fdMode = false;
+
+  pinMode(_csPin, OUTPUT);
+  digitalWrite(_csPin, HIGH);
+
+  // start SPI
+  SPI.begin();
+
+  reset();
+
+  // the controller leaves reset in configuration mode
+  if (operationMode() != MODE_CONFIG) {
+    return 0;
+  }
+
+  // crystal or oscillator straight to SYSCLK, no PLL or divider
+  writeRegister(REG_OSC, 0x00000000);
+
+  unsigned long startMillis = millis();
+  while (!(readRegister8(REG_OSC + 1) & FLAG_OSCRDY)) {
+    if (millis() - startMillis > 10) {
+      return 0;
+    }
+  }
+
+  bool fd = dataBaudRate > 0;
+  bool brs = fd && dataBaudRate != baudRate;
+
+  uint32_t nbtcfg;
+  if (!bitTiming(baudRate, 256, 128, nbtcfg)) {
+    return 0;
+  }
+  writeRegister(REG_CiNBTCFG, nbtcfg);
+
+  if (brs) {
+    uint32_t dbtcfg;
+    if (!bitTiming(dataBaudRate, 32, 16, dbtcfg)) {
+      return 0;
+    }
+    writeRegister(REG_CiDBTCFG, dbtcfg);
+
+    // transmitter delay compensation offset = data phase sample point
+    uint32_t brp = (dbtcfg >> 24) + 1;
+    uint32_t tseg1 = ((dbtcfg >> 16) & 0x1f) + 1;
+    uint32_t tdco = (brp * tseg1) > 63 ? 63 : (brp * tseg1);
+    writeRegister(REG_CiTDC, TDCMOD_AUTO | (tdco << 8));
+  }
+
+  // no TXQ or TX event FIFO, ISO CRC
+  writeRegister(REG_CiCON, ((uint32_t)MODE_CONFIG << 24) | FLAG_ISOCRCEN | (brs ? 0 : FLAG_BRSDIS));
+
+  // FIFO 1 transmits, FIFO 2 receives, payload slots sized for the mode
+  uint32_t plsize = (fd && CAN_MAX_DATA_LENGTH > 8) ? FIFO_PLSIZE_64 : FIFO_PLSIZE_8;
+
+  writeRegister(REG_CiFIFOCON(FIFO_TX), plsize | FIFO_FSIZE(MCP2518FD_TX_FIFO_DEPTH) | FLAG_TXEN);
+  writeRegister(REG_CiFIFOCON(FIFO_RX), plsize | FIFO_FSIZE(MCP2518FD_RX_FIFO_DEPTH) | FLAG_TFNRFNIE);
+
+  // filter 0 accepts everything into the receive FIFO
+  for (int n = 0; n < 32; n++) {
+    disableFilter(n);
+  }
+  writeFilter(0, 0, 0);
+
+  // interrupt sources are enabled by onReceive()
+  writeRegister(REG_CiINT, 0x00000000);
+
+  _normalMode = fd ? MODE_NORMAL_FD : MODE_NORMAL_CAN20;
+  _fdMode = fd;
+  _brs = brs;
+
+  if (!setMode(_normalMode)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+void MCP2518FDClass::end()
+{
+  setMode(MODE_CONFIG);
+
+  SPI.end();
+
+  _fdMode = false;
+
+  CANControllerClass::end();
+}
+
+int MCP2518FDClass::maxDataLength()
+{
+  return _fdMode ? CAN_MAX_DATA_LENGTH : 8;
+}
+
+int MCP2518FDClass::endPacket()
+{
+  if (!CANControllerClass::endPacket()) {
+    return 0;
+  }
+
+  // frames over 8 bytes go out as FD frames, shorter ones stay classic
+  bool fd = _fdMode && !_txRtr && _txLength > 8;
+  uint8_t dlc = lengthToDlc(_txLength);
+  int length = _txRtr ? 0 : dlcToLength(dlc);
+
+  // back-pressure: wait for a free slot in the transmit FIFO, a bus that takes
+  // nothing (no ACK, bus off) gets the queued frames aborted instead
+  unsigned long startMillis = millis();
+  while (!(readRegister8(REG_CiFIFOSTA(FIFO_TX)) & FLAG_TFNRFNIF)) {
+    if (millis() - startMillis > MCP2518FD_TX_TIMEOUT) {
+      abortTx();
+      return 0;
+    }
+    yield();
+  }
+
+  uint32_t id = OBJECT_ID(_txId, _txExtended);
+  uint32_t flags = dlc |
+                   (_txExtended ? FLAG_IDE : 0) |
+                   (_txRtr ? FLAG_RTR : 0) |
+                   (fd ? FLAG_FDF : 0) |
+                   ((fd && _brs) ? FLAG_BRS : 0);
+
+  uint8_t object[8 + CAN_MAX_DATA_LENGTH];
+
+  for (int i = 0; i < 4; i++) {
+    object[i] = id >> (i * 8);
+    object[4 + i] = flags >> (i * 8);
+  }
+
+  // RAM is written in whole words, _txData is zero filled up to the
+  // capacity so the padding of FD lengths is already in place
+  int padded = (length + 3) & ~3;
+  memcpy(&object[8], _txData, padded);
+  int size = 8 + padded;
+
+  uint16_t address = RAM_START + (readRegister(REG_CiFIFOUA(FIFO_TX)) & 0xfff);
+  writeBytes(address, object, size);
+
+  // advance the FIFO head and request transmission
+  writeRegister8(REG_CiFIFOCON(FIFO_TX) + 1, FLAG_UINC | FLAG_TXREQ);
+
+  return 1;
+}
+
+int MCP2518FDClass::parsePacket()
+{
+  if (_rxQueue) {
+    // frames are collected by the ISR
+    return CANControllerClass::parsePacket();
+  }
+
+  CANFrame frame;
+
+  if (!readFrame(frame)) {
+    _rxId = -1;
+    _rxExtended = false;
+    _rxRtr = false;
+    _rxFd = false;
+    _rxLength = 0;
+    return 0;
+  }
+
+  loadRxFrame(frame);
+
+  return _rxDlc;
+}
+
+void MCP2518FDClass::flush()
+{
+  // wait for the transmit FIFO to drain
+  unsigned long startMillis = millis();
+  while (!(readRegister8(REG_CiFIFOSTA(FIFO_TX)) & FLAG_TFERFFIF)) {
+    if (millis() - startMillis > MCP2518FD_TX_TIMEOUT) {
+      abortTx();
+      return;
+    }
+    yield();
+  }
+}
+
+void MCP2518FDClass::onReceive(void(*callback)(int))
+{
+  CANControllerClass::onReceive(callback);
+
+  _instance = this;
+
+  pinMode(_intPin, INPUT);
+
+  if (callback || _rxQueue) {
+    // RXIF follows the receive FIFO not-empty flag, INT is level triggered
+    writeRegister8(REG_CiINT + 2, FLAG_RXIE);
+
+    SPI.usingInterrupt(digitalPinToInterrupt(_intPin));
+    attachInterrupt(digitalPinToInterrupt(_intPin), MCP2518FDClass::onInterrupt, LOW);
+  } else {
+    detachInterrupt(digitalPinToInterrupt(_intPin));
+#ifdef SPI_HAS_NOTUSINGINTERRUPT
+    SPI.notUsingInterrupt(digitalPinToInterrupt(_intPin));
+#endif
+
+    writeRegister8(REG_CiINT + 2, 0x00);
+  }
+}
+
+int MCP2518FDClass::filter(int id, int mask)
+{
+  // standard frames only
+  writeFilter(0, OBJECT_ID(id, false), OBJECT_ID(mask, false) | FLAG_MIDE);
+  disableFilter(1);
+
+  return 1;
+}
+
+int MCP2518FDClass::filterExtended(long id, long mask)
+{
+  // extended frames only
+  writeFilter(0, OBJECT_ID(id, true) | FLAG_EXIDE, OBJECT_ID(mask, true) | FLAG_MIDE);
+  disableFilter(1);
+
+  return 1;
+}
+
+int MCP2518FDClass::filter(int id, int mask, long idExtended, long maskExtended)
+{
+  // filter 0: standard rule, filter 1: extended rule, both into the receive FIFO
+  writeFilter(0, OBJECT_ID(id, false), OBJECT_ID(mask, false) | FLAG_MIDE);
+  writeFilter(1, OBJECT_ID(idExtended, true) | FLAG_EXIDE, OBJECT_ID(maskExtended, true) | FLAG_MIDE);
+
+  return 1;
+}
+
+int MCP2518FDClass::clearFilter()
+{
+  // filter 0 with an empty mask matches any frame
+  writeFilter(0, 0, 0);
+  disableFilter(1);
+
+  return 1;
+}
+
+int MCP2518FDClass::txErrorCount()
+{
+  return readRegister8(REG_CiTREC + 1);
+}
+
+int MCP2518FDClass::rxErrorCount()
+{
+  return readRegister8(REG_CiTREC);
+}
+
+int MCP2518FDClass::readBusState()
+{
+  if (readRegister8(REG_CiFIFOSTA(FIFO_RX)) & FLAG_RXOVIF) {
+    // a frame arrived while the RX FIFO was full
+    _rxOverruns++;
+    writeRegister8(REG_CiFIFOSTA(FIFO_RX), 0x00);
+  }
+
+  uint8_t flags = readRegister8(REG_CiTREC + 2);
+
+  if (flags & FLAG_TREC_TXBO) {
+    return CAN_BUS_OFF;
+  }
+
+  if (flags & (FLAG_TREC_TXBP | FLAG_TREC_RXBP)) {
+    return CAN_BUS_ERROR_PASSIVE;
+  }
+
+  if (flags & FLAG_TREC_EWARN) {
+    return CAN_BUS_ERROR_WARNING;
+  }
+
+  return CAN_BUS_ERROR_ACTIVE;
+}
+
+int MCP2518FDClass::recover()
+{
+  // bus-off recovery is automatic after 128 x 11 recessive bits
+  return 1;
+}
+
+int MCP2518FDClass::observe()
+{
+  return setMode(MODE_LISTEN_ONLY) ? 1 : 0;
+}
+
+int MCP2518FDClass::loopback()
+{
+  return setMode(MODE_INTERNAL_LOOPBACK) ? 1 : 0;
+}
+
+int MCP2518FDClass::sleep()
+{
+  // the controller stops its oscillator, OPMOD can't be confirmed
+  writeRegister8(REG_CiCON + 3, MODE_SLEEP);
+
+  return 1;
+}
+
+int MCP2518FDClass::wakeup()
+{
+  // any SPI access wakes the controller, it resumes in configuration mode
+  readRegister8(REG_OSC + 1);
+  delayMicroseconds(3000);
+
+  return setMode(_normalMode) ? 1 : 0;
+}
+
+void MCP2518FDClass::setPins(int cs, int irq)
+{
+  _csPin = cs;
+  _intPin = irq;
+}
+
+void MCP2518FDClass::setSPIFrequency(uint32_t frequency)
+{
+  _spiSettings = SPISettings(frequency, MSBFIRST, SPI_MODE0);
+}
+
+void MCP2518FDClass::setClockFrequency(long clockFrequency)
+{
+  _clockFrequency = clockFrequency;
+}
+
+void MCP2518FDClass::dumpRegisters(Stream& out)
+{
+  // CAN FD controller module SFRs up to the filter masks
+  for (uint16_t address = 0; address < 0x2f0; address += 4) {
+    uint32_t value = readRegister(address);
+
+    out.print("0x");
+    if (address < 0x100) {
+      out.print('0');
+    }
+    if (address < 0x10) {
+      out.print('0');
+    }
+    out.print(address, HEX);
+    out.print(": 0x");
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      out.print((value >> shift) & 0x0f, HEX);
+    }
+    out.println();
+  }
+}
+
+void MCP2518FDClass::reset()
+{
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer(INSTRUCTION_RESET << 4);
+  SPI.transfer(0x00);
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+
+  delayMicroseconds(100);
+}
+
+void MCP2518FDClass::abortTx()
+{
+  // clearing TXREQ aborts the frames still queued, the FIFO is then reset to empty
+  writeRegister8(REG_CiFIFOCON(FIFO_TX) + 1, 0x00);
+
+  unsigned long startMillis = millis();
+  while (readRegister8(REG_CiFIFOCON(FIFO_TX) + 1) & FLAG_TXREQ) {
+    if (millis() - startMillis > 10) {
+      break;
+    }
+    yield();
+  }
+
+  writeRegister8(REG_CiFIFOCON(FIFO_TX) + 1, FLAG_FRESET);
+
+  startMillis = millis();
+  while (readRegister8(REG_CiFIFOCON(FIFO_TX) + 1) & FLAG_FRESET) {
+    if (millis() - startMillis > 10) {
+      break;
+    }
+    yield();
+  }
+}
+
+bool MCP2518FDClass::setMode(uint8_t mode)
+{
+  uint8_t current = operationMode();
+
+  if (current == mode) {
+    return true;
+  }
+
+  // loopback, listen only and the normal modes are entered from configuration mode
+  if (current != MODE_CONFIG && mode != MODE_CONFIG && mode != MODE_SLEEP) {
+    if (!setMode(MODE_CONFIG)) {
+      return false;
+    }
+  }
+
+  writeRegister8(REG_CiCON + 3, mode);
+
+  // a mode change completes after the current frame and 11 recessive bits
+  unsigned long startMillis = millis();
+  while (operationMode() != mode) {
+    if (millis() - startMillis > 10) {
+      return false;
+    }
+    yield();
+  }
+
+  return true;
+}
+
+uint8_t MCP2518FDClass::operationMode()
+{
+  return (readRegister8(REG_CiCON + 2) >> 5) & 0x07;
+}
+
+bool MCP2518FDClass::bitTiming(long baudRate, int maxTseg1, int maxTseg2, uint32_t& config)
+{
+  if (baudRate <= 0) {
+    return false;
+  }
+
+  // smallest prescaler giving a whole number of time quanta per bit that
+  // fits the segment limits, sample point near 80%
+  for (uint32_t brp = 1; brp <= 256; brp++) {
+    uint32_t divider = (uint32_t)baudRate * brp;
+
+    if ((uint32_t)_clockFrequency % divider) {
+      continue;
+    }
+
+    uint32_t tq = (uint32_t)_clockFrequency / divider;
+
+    if (tq > (uint32_t)(1 + maxTseg1 + maxTseg2)) {
+      continue;
+    }
+    if (tq < 4) {
+      return false;
+    }
+
+    uint32_t tseg2 = tq / 5;
+    if (tseg2 < 1) {
+      tseg2 = 1;
+    }
+    uint32_t tseg1 = tq - 1 - tseg2;
+
+    if (tseg1 > (uint32_t)maxTseg1) {
+      tseg1 = maxTseg1;
+      tseg2 = tq - 1 - tseg1;
+    }
+    if (tseg2 > (uint32_t)maxTseg2) {
+      continue;
+    }
+
+    // registers hold each value minus one, SJW as wide as phase segment 2
+    config = ((brp - 1) << 24) | ((tseg1 - 1) << 16) | ((tseg2 - 1) << 8) | (tseg2 - 1);
+
+    return true;
+  }
+
+  return false;
+}
+
+void MCP2518FDClass::handleInterrupt()
+{
+  CANFrame frame;
+
+  if (_rxQueue) {
+    // drain the receive FIFO into the queue
+    while (readFrame(frame)) {
+      if (pushRxFrame(frame) && _onReceive) {
+        _onReceive(frame.length);
+      }
+    }
+
+    return;
+  }
+
+  if (!_onReceive) {
+    return;
+  }
+
+  while (parsePacket()) {
+    _onReceive(available());
+  }
+}
+
+bool MCP2518FDClass::readFrame(CANFrame& frame)
+{
+  if (!(readRegister8(REG_CiFIFOSTA(FIFO_RX)) & FLAG_TFNRFNIF)) {
+    return false;
+  }
+
+  uint16_t address = RAM_START + (readRegister(REG_CiFIFOUA(FIFO_RX)) & 0xfff);
+
+  uint8_t header[8];
+
+  // header and data in a single sequential read
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer((INSTRUCTION_READ << 4) | ((address >> 8) & 0x0f));
+  SPI.transfer(address & 0xff);
+  for (int i = 0; i < 8; i++) {
+    header[i] = SPI.transfer(0x00);
+  }
+
+  uint32_t id = 0;
+  uint32_t flags = 0;
+  for (int i = 3; i >= 0; i--) {
+    id = (id << 8) | header[i];
+    flags = (flags << 8) | header[4 + i];
+  }
+
+  frame.extended = (flags & FLAG_IDE) ? true : false;
+  frame.rtr = (flags & FLAG_RTR) ? true : false;
+  frame.fd = (flags & FLAG_FDF) ? true : false;
+  frame.brs = (flags & FLAG_BRS) ? true : false;
+
+  if (frame.extended) {
+    frame.id = ((id & 0x7ff) << 18) | ((id >> 11) & 0x3ffff);
+  } else {
+    frame.id = id & 0x7ff;
+  }
+
+  uint8_t dlc = flags & 0x0f;
+  int length = frame.fd ? dlcToLength(dlc) : ((dlc > 8) ? 8 : dlc);
+  if (length > CAN_MAX_DATA_LENGTH) {
+    length = CAN_MAX_DATA_LENGTH;
+  }
+
+  // FD frames report their length in bytes
+  frame.dlc = frame.fd ? length : dlc;
+  frame.length = frame.rtr ? 0 : length;
+
+  for (int i = 0; i < frame.length; i++) {
+    frame.data[i] = SPI.transfer(0x00);
+  }
+
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+
+  // release the slot
+  writeRegister8(REG_CiFIFOCON(FIFO_RX) + 1, FLAG_UINC);
+
+  return true;
+}
+
+void MCP2518FDClass::writeFilter(int n, uint32_t object, uint32_t mask)
+{
+  // a filter must be disabled while its object and mask change
+  disableFilter(n);
+
+  writeRegister(REG_CiFLTOBJ(n), object);
+  writeRegister(REG_CiMASK(n), mask);
+
+  writeRegister8(REG_CiFLTCON(n), FLAG_FLTEN | FIFO_RX);
+}
+
+void MCP2518FDClass::disableFilter(int n)
+{
+  writeRegister8(REG_CiFLTCON(n), 0x00);
+}
+
+uint32_t MCP2518FDClass::readRegister(uint16_t address)
+{
+  uint32_t value = 0;
+
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer((INSTRUCTION_READ << 4) | ((address >> 8) & 0x0f));
+  SPI.transfer(address & 0xff);
+  for (int i = 0; i < 4; i++) {
+    value |= (uint32_t)SPI.transfer(0x00) << (i * 8);
+  }
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+
+  return value;
+}
+
+void MCP2518FDClass::writeRegister(uint16_t address, uint32_t value)
+{
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer((INSTRUCTION_WRITE << 4) | ((address >> 8) & 0x0f));
+  SPI.transfer(address & 0xff);
+  for (int i = 0; i < 4; i++) {
+    SPI.transfer((value >> (i * 8)) & 0xff);
+  }
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+}
+
+uint8_t MCP2518FDClass::readRegister8(uint16_t address)
+{
+  uint8_t value;
+
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer((INSTRUCTION_READ << 4) | ((address >> 8) & 0x0f));
+  SPI.transfer(address & 0xff);
+  value = SPI.transfer(0x00);
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+
+  return value;
+}
+
+void MCP2518FDClass::writeRegister8(uint16_t address, uint8_t value)
+{
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer((INSTRUCTION_WRITE << 4) | ((address >> 8) & 0x0f));
+  SPI.transfer(address & 0xff);
+  SPI.transfer(value);
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+}
+
+void MCP2518FDClass::writeBytes(uint16_t address, const uint8_t* data, int length)
+{
+  SPI.beginTransaction(_spiSettings);
+  digitalWrite(_csPin, LOW);
+  SPI.transfer((INSTRUCTION_WRITE << 4) | ((address >> 8) & 0x0f));
+  SPI.transfer(address & 0xff);
+  for (int i = 0; i < length; i++) {
+    SPI.transfer(data[i]);
+  }
+  digitalWrite(_csPin, HIGH);
+  SPI.endTransaction();
+}
+
+void MCP2518FDClass::onInterrupt()
+{
+  if (_instance) {
+    _instance->handleInterrupt();
+  }
+}
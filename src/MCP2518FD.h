@@ -0,0 +1,116 @@
+// Copyright (c) Sandeep Mistry. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Microchip MCP2518FD (and MCP2517FD) external CAN FD controller over SPI
+
+#ifndef MCP2518FD_H
+#define MCP2518FD_H
+
+#include <SPI.h>
+
+#include "CANController.h"
+
+#define MCP2518FD_DEFAULT_CLOCK_FREQUENCY 40e6
+
+// beginFD() sends data fields of up to CAN_MAX_DATA_LENGTH bytes: build with
+// -DCAN_MAX_DATA_LENGTH=64 for 64-byte frames, the default of 8 keeps FD to bit rate switching
+
+// Frames held by the controller's transmit and receive FIFOs (RAM: 2 KB)
+#define MCP2518FD_TX_FIFO_DEPTH 8
+#define MCP2518FD_RX_FIFO_DEPTH 16
+
+// How long endPacket() waits for room in the transmit FIFO and flush() for it to
+// drain (ms), the queued frames are aborted after that
+#define MCP2518FD_TX_TIMEOUT 100
+
+#if defined(CONFIG_IDF_TARGET_ESP32C3) || defined(CONFIG_IDF_TARGET_ESP32C6)
+  #define MCP2518FD_DEFAULT_CS_PIN        7
+  #define MCP2518FD_DEFAULT_INT_PIN       8
+#else
+  #define MCP2518FD_DEFAULT_CS_PIN        10
+  #define MCP2518FD_DEFAULT_INT_PIN       2
+#endif
+
+class MCP2518FDClass : public CANControllerClass {
+
+public:
+  MCP2518FDClass();
+  virtual ~MCP2518FDClass();
+
+  // classic CAN 2.0 operation
+  virtual int begin(long baudRate);
+  // CAN FD operation, bit rate switching when dataBaudRate differs from baudRate
+  virtual int beginFD(long baudRate, long dataBaudRate);
+  virtual void end();
+
+  virtual int maxDataLength();
+
+  virtual int endPacket();
+
+  virtual int parsePacket();
+
+  virtual void flush();
+
+  virtual void onReceive(void(*callback)(int));
+
+  using CANControllerClass::filter;
+  virtual int filter(int id, int mask);
+  using CANControllerClass::filterExtended;
+  virtual int filterExtended(long id, long mask);
+  virtual int filter(int id, int mask, long idExtended, long maskExtended);
+  virtual int clearFilter();
+
+  virtual int txErrorCount();
+  virtual int rxErrorCount();
+  virtual int recover();
+
+  virtual int observe();
+  virtual int loopback();
+  virtual int sleep();
+  virtual int wakeup();
+
+  void setPins(int cs = MCP2518FD_DEFAULT_CS_PIN, int irq = MCP2518FD_DEFAULT_INT_PIN);
+  void setSPIFrequency(uint32_t frequency);
+  void setClockFrequency(long clockFrequency);
+
+  void dumpRegisters(Stream& out);
+
+protected:
+  virtual int readBusState();
+
+private:
+  int start(long baudRate, long dataBaudRate);
+  void reset();
+  bool setMode(uint8_t mode);
+  uint8_t operationMode();
+  bool bitTiming(long baudRate, int maxTseg1, int maxTseg2, uint32_t& config);
+  void abortTx();
+
+  void handleInterrupt();
+  bool readFrame(CANFrame& frame);
+
+  void writeFilter(int n, uint32_t object, uint32_t mask);
+  void disableFilter(int n);
+
+  uint32_t readRegister(uint16_t address);
+  void writeRegister(uint16_t address, uint32_t value);
+  uint8_t readRegister8(uint16_t address);
+  void writeRegister8(uint16_t address, uint8_t value);
+  void writeBytes(uint16_t address, const uint8_t* data, int length);
+
+  static void onInterrupt();
+
+private:
+  SPISettings _spiSettings;
+  int _csPin;
+  int _intPin;
+  long _clockFrequency;
+
+  bool _fdMode;
+  bool _brs;
+  uint8_t _normalMode;
+
+  static MCP2518FDClass* _instance;
+};
+
+#endif
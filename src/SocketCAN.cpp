@@ -0,0 +1,499 @@
+// Copyright (c) Sandeep Mistry. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/can/error.h>
+#include <linux/can/raw.h>
+
+#include "SocketCAN.h"
+
+SocketCANClass::SocketCANClass(const char* interfaceName) :
+  CANControllerClass(),
+  _socket(-1),
+  _fdMode(false),
+  _rxBatchCount(0),
+  _rxBatchIndex(0),
+  _txCount(0),
+  _txBatchSize(SOCKETCAN_TX_BATCH),
+  _txBatchStart(0),
+  _state(CAN_BUS_STATE_UNKNOWN),
+  _txErrors(-1),
+  _rxErrors(-1)
+{
+  setInterface(interfaceName);
+}
+
+SocketCANClass::~SocketCANClass()
+{
+  end();
+}
+
+int SocketCANClass::begin(long baudRate)
+{
+  if (!open(false)) {
+    return 0;
+  }
+
+  return CANControllerClass::begin(baudRate);
+}
+
+int SocketCANClass::beginFD(long baudRate, long /*dataBaudRate*/)
+{
+  // the data phase bit rate is part of the interface configuration too
+  if (!open(true)) {
+    return 0;
+  }
+
+  return CANControllerClass::begin(baudRate);
+}
+
+void SocketCANClass::end()
+{
+  if (_socket < 0) {
+    return;
+  }
+
+  flush();
+
+  close(_socket);
+  _socket = -1;
+  _rxBatchCount = 0;
+  _rxBatchIndex = 0;
+  _txCount = 0;
+  _state = CAN_BUS_STATE_UNKNOWN;
+
+  CANControllerClass::end();
+}
+
+int SocketCANClass::maxDataLength()
+{
+  return _fdMode ? CAN_MAX_DATA_LENGTH : 8;
+}
+
+int SocketCANClass::endPacket()
+{
+  if (!CANControllerClass::endPacket()) {
+    return 0;
+  }
+
+  if (_socket < 0) {
+    return 0;
+  }
+
+  // back-pressure: a full batch has to leave before the next frame joins it
+  if (_txCount == _txBatchSize && !sendBatch(true)) {
+    return 0;
+  }
+
+  struct canfd_frame& frame = _txFrames[_txCount];
+  memset(&frame, 0, sizeof(frame));
+
+  frame.can_id = _txExtended ? ((_txId & CAN_EFF_MASK) | CAN_EFF_FLAG) : (_txId & CAN_SFF_MASK);
+
+  if (_txRtr) {
+    frame.can_id |= CAN_RTR_FLAG;
+    frame.len = _txLength;
+  } else if (_fdMode && _txLength > 8) {
+    // FD lengths above 8 are padded, _txData is zero filled up to the capacity
+    frame.len = dlcToLength(lengthToDlc(_txLength));
+    frame.flags = CANFD_BRS;
+    memcpy(frame.data, _txData, frame.len);
+  } else {
+    frame.len = _txLength;
+    memcpy(frame.data, _txData, frame.len);
+  }
+
+  if (_txCount++ == 0) {
+    _txBatchStart = micros();
+  }
+
+  // a full batch, or one that has waited long enough for more frames
+  if (_txCount == _txBatchSize || (micros() - _txBatchStart) >= SOCKETCAN_TX_DELAY) {
+    sendBatch(false);
+  }
+
+  return 1;
+}
+
+int SocketCANClass::parsePacket()
+{
+  if (_socket < 0) {
+    return 0;
+  }
+
+  // frames queued while handling the previous one go out now
+  if (_txCount) {
+    sendBatch(false);
+  }
+
+  for (;;) {
+    if (_rxBatchIndex == _rxBatchCount && !receiveBatch()) {
+      _rxId = -1;
+      _rxExtended = false;
+      _rxRtr = false;
+      _rxFd = false;
+      _rxLength = 0;
+      return 0;
+    }
+
+    const struct canfd_frame& raw = _rxBatch[_rxBatchIndex];
+    bool fd = _rxBatchFd[_rxBatchIndex];
+    _rxBatchIndex++;
+
+    if (raw.can_id & CAN_ERR_FLAG) {
+      handleErrorFrame(raw);
+      continue;
+    }
+
+    CANFrame frame;
+    frame.extended = (raw.can_id & CAN_EFF_FLAG) ? true : false;
+    frame.id = raw.can_id & (frame.extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+    frame.rtr = (raw.can_id & CAN_RTR_FLAG) ? true : false;
+    frame.fd = fd;
+    frame.brs = fd && (raw.flags & CANFD_BRS);
+
+    int length = raw.len > CAN_MAX_DATA_LENGTH ? CAN_MAX_DATA_LENGTH : raw.len;
+    if (!fd && length > 8) {
+      length = 8;
+    }
+
+    frame.dlc = length;
+    frame.length = frame.rtr ? 0 : length;
+    memcpy(frame.data, raw.data, frame.length);
+
+    loadRxFrame(frame);
+
+    return _rxDlc;
+  }
+}
+
+void SocketCANClass::flush()
+{
+  if (_txCount) {
+    sendBatch(true);
+  }
+}
+
+int SocketCANClass::setTxQueueSize(int size)
+{
+  if (size < 1 || size > SOCKETCAN_TX_BATCH) {
+    return 0;
+  }
+
+  flush();
+  _txBatchSize = size;
+
+  return 1;
+}
+
+int SocketCANClass::txQueueSize()
+{
+  return _txBatchSize;
+}
+
+int SocketCANClass::txQueueCount()
+{
+  return _txCount;
+}
+
+int SocketCANClass::filter(int id, int mask)
+{
+  // standard only: the EFF flag takes part in the match and must be clear
+  struct can_filter rule;
+  rule.can_id = id & CAN_SFF_MASK;
+  rule.can_mask = (mask & CAN_SFF_MASK) | CAN_EFF_FLAG;
+
+  return setFilters(&rule, 1);
+}
+
+int SocketCANClass::filterExtended(long id, long mask)
+{
+  // extended only
+  struct can_filter rule;
+  rule.can_id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  rule.can_mask = (mask & CAN_EFF_MASK) | CAN_EFF_FLAG;
+
+  return setFilters(&rule, 1);
+}
+
+int SocketCANClass::filter(int id, int mask, long idExtended, long maskExtended)
+{
+  struct can_filter rules[2];
+  rules[0].can_id = id & CAN_SFF_MASK;
+  rules[0].can_mask = (mask & CAN_SFF_MASK) | CAN_EFF_FLAG;
+  rules[1].can_id = (idExtended & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  rules[1].can_mask = (maskExtended & CAN_EFF_MASK) | CAN_EFF_FLAG;
+
+  return setFilters(rules, 2);
+}
+
+int SocketCANClass::clearFilter()
+{
+  struct can_filter rule;
+  rule.can_id = 0;
+  rule.can_mask = 0;
+
+  return setFilters(&rule, 1);
+}
+
+int SocketCANClass::txErrorCount()
+{
+  return _txErrors;
+}
+
+int SocketCANClass::rxErrorCount()
+{
+  return _rxErrors;
+}
+
+int SocketCANClass::readBusState()
+{
+  return _state;
+}
+
+int SocketCANClass::recover()
+{
+  // restarting needs netlink and CAP_NET_ADMIN, configure the interface
+  // with "ip link set can0 type can restart-ms 100" instead
+  return 0;
+}
+
+int SocketCANClass::observe()
+{
+  // listen-only is an interface setting ("ip link set can0 type can listen-only on")
+  return 0;
+}
+
+int SocketCANClass::loopback()
+{
+  // receive our own frames as well, they still go out on the bus
+  if (_socket < 0) {
+    return 0;
+  }
+
+  int on = 1;
+
+  return setsockopt(_socket, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &on, sizeof(on)) == 0;
+}
+
+int SocketCANClass::sleep()
+{
+  return 0;
+}
+
+int SocketCANClass::wakeup()
+{
+  return 0;
+}
+
+void SocketCANClass::setInterface(const char* interfaceName)
+{
+  strncpy(_interface, interfaceName, sizeof(_interface) - 1);
+  _interface[sizeof(_interface) - 1] = '\0';
+}
+
+int SocketCANClass::socketDescriptor()
+{
+  return _socket;
+}
+
+int SocketCANClass::open(bool fdMode)
+{
+  end();
+
+  int s = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if (s < 0) {
+    return 0;
+  }
+
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  // _interface is always terminated and no longer than IFNAMSIZ
+  memcpy(ifr.ifr_name, _interface, sizeof(_interface));
+
+  if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+    close(s);
+    return 0;
+  }
+  int ifindex = ifr.ifr_ifindex;
+
+  if (fdMode) {
+    // the interface has to be configured for CAN FD (MTU 72)
+    int on = 1;
+
+    if (ioctl(s, SIOCGIFMTU, &ifr) < 0 || ifr.ifr_mtu != CANFD_MTU ||
+        setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on)) < 0) {
+      close(s);
+      return 0;
+    }
+  }
+
+  // controller problems, bus-off and lost arbitration arrive as error frames
+  can_err_mask_t errorMask = CAN_ERR_LOSTARB | CAN_ERR_CRTL | CAN_ERR_PROT |
+                             CAN_ERR_BUSOFF | CAN_ERR_BUSERROR | CAN_ERR_RESTARTED;
+  setsockopt(s, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errorMask, sizeof(errorMask));
+
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+  struct sockaddr_can addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifindex;
+
+  if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(s);
+    return 0;
+  }
+
+  _socket = s;
+  _fdMode = fdMode;
+  _rxBatchCount = 0;
+  _rxBatchIndex = 0;
+  _txCount = 0;
+  _state = CAN_BUS_ERROR_ACTIVE;
+  _txErrors = -1;
+  _rxErrors = -1;
+
+  return 1;
+}
+
+bool SocketCANClass::sendBatch(bool wait)
+{
+  unsigned long start = millis();
+
+  while (_txCount) {
+    struct mmsghdr msgs[SOCKETCAN_TX_BATCH];
+    struct iovec iov[SOCKETCAN_TX_BATCH];
+
+    memset(msgs, 0, _txCount * sizeof(msgs[0]));
+
+    for (int i = 0; i < _txCount; i++) {
+      // classic frames go out as struct can_frame, which shares the head of canfd_frame
+      iov[i].iov_base = &_txFrames[i];
+      iov[i].iov_len = (_txFrames[i].len > 8) ? CANFD_MTU : CAN_MTU;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = sendmmsg(_socket, msgs, _txCount, MSG_DONTWAIT);
+
+    if (sent > 0) {
+      _txCount -= sent;
+      memmove(_txFrames, &_txFrames[sent], _txCount * sizeof(_txFrames[0]));
+      continue;
+    }
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != EINTR) {
+      // interface down or frame rejected, drop the batch
+      _txFailures += _txCount;
+      _txCount = 0;
+      return false;
+    }
+
+    if (!wait || (millis() - start) >= SOCKETCAN_TX_TIMEOUT) {
+      return false;
+    }
+
+    // the queue is full (ENOBUFS does not wake poll(), so wait at most 1 ms)
+    struct pollfd p = { _socket, POLLOUT, 0 };
+    poll(&p, 1, 1);
+  }
+
+  return true;
+}
+
+bool SocketCANClass::receiveBatch()
+{
+  struct mmsghdr msgs[SOCKETCAN_RX_BATCH];
+  struct iovec iov[SOCKETCAN_RX_BATCH];
+
+  memset(msgs, 0, sizeof(msgs));
+
+  for (int i = 0; i < SOCKETCAN_RX_BATCH; i++) {
+    iov[i].iov_base = &_rxBatch[i];
+    iov[i].iov_len = sizeof(_rxBatch[i]);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int count = recvmmsg(_socket, msgs, SOCKETCAN_RX_BATCH, MSG_DONTWAIT, NULL);
+
+  _rxBatchIndex = 0;
+  _rxBatchCount = count > 0 ? count : 0;
+
+  for (int i = 0; i < _rxBatchCount; i++) {
+    // the read size tells classic (CAN_MTU) and FD (CANFD_MTU) frames apart
+    _rxBatchFd[i] = (msgs[i].msg_len == CANFD_MTU);
+  }
+
+  return _rxBatchCount > 0;
+}
+
+void SocketCANClass::handleErrorFrame(const struct canfd_frame& frame)
+{
+  canid_t flags = frame.can_id;
+
+  if (flags & CAN_ERR_LOSTARB) {
+    _arbitrationLost++;
+  }
+
+  if (flags & (CAN_ERR_PROT | CAN_ERR_BUSERROR)) {
+    _busErrors++;
+  }
+
+  if (flags & CAN_ERR_CRTL) {
+    uint8_t ctrl = frame.data[1];
+
+    if (ctrl & CAN_ERR_CRTL_RX_OVERFLOW) {
+      _rxOverruns++;
+    }
+
+    if (ctrl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+      _state = CAN_BUS_ERROR_PASSIVE;
+    } else if (ctrl & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) {
+      _state = CAN_BUS_ERROR_WARNING;
+#ifdef CAN_ERR_CRTL_ACTIVE
+    } else if (ctrl & CAN_ERR_CRTL_ACTIVE) {
+      _state = CAN_BUS_ERROR_ACTIVE;
+#endif
+    }
+  }
+
+  if (flags & CAN_ERR_BUSOFF) {
+    _state = CAN_BUS_OFF;
+  }
+
+  if (flags & CAN_ERR_RESTARTED) {
+    _state = CAN_BUS_ERROR_ACTIVE;
+  }
+
+#ifdef CAN_ERR_CNT
+  // newer kernels carry the error counters in every error frame
+  if (flags & CAN_ERR_CNT) {
+    _txErrors = frame.data[6];
+    _rxErrors = frame.data[7];
+  }
+#endif
+}
+
+int SocketCANClass::setFilters(const struct can_filter* filters, int count)
+{
+  if (_socket < 0) {
+    return 0;
+  }
+
+  // filtering happens in the kernel, rejected frames never reach the socket
+  return setsockopt(_socket, SOL_CAN_RAW, CAN_RAW_FILTER, filters, count * sizeof(filters[0])) == 0;
+}
+
+#endif
@@ -0,0 +1,117 @@
+// Copyright (c) Sandeep Mistry. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Linux SocketCAN interface (can0, vcan0, ...) for running the library on a
+// gateway. Build with the Arduino shim in extras/linux, see the README there.
+
+#ifndef SOCKETCAN_H
+#define SOCKETCAN_H
+
+#if defined(__linux__)
+
+#include <linux/can.h>
+
+#include "CANController.h"
+
+#define SOCKETCAN_DEFAULT_INTERFACE "can0"
+
+// Frames moved per recvmmsg() / sendmmsg() call
+#ifndef SOCKETCAN_RX_BATCH
+#define SOCKETCAN_RX_BATCH 32
+#endif
+#ifndef SOCKETCAN_TX_BATCH
+#define SOCKETCAN_TX_BATCH 32
+#endif
+
+// Longest a frame waits in a partial batch (us), the next endPacket() sends
+// the batch once its first frame is older
+#ifndef SOCKETCAN_TX_DELAY
+#define SOCKETCAN_TX_DELAY 1000
+#endif
+
+// How long endPacket() waits for room in the kernel transmit queue (ms)
+#define SOCKETCAN_TX_TIMEOUT 100
+
+class SocketCANClass : public CANControllerClass {
+
+public:
+  SocketCANClass(const char* interfaceName = SOCKETCAN_DEFAULT_INTERFACE);
+  virtual ~SocketCANClass();
+
+  // the bit rate is set on the interface (ip link), baudRate is only used for busLoad()
+  virtual int begin(long baudRate);
+  virtual int beginFD(long baudRate, long dataBaudRate);
+  virtual void end();
+
+  virtual int maxDataLength();
+
+  // 1 once the frame is in the batch. A batch goes out when it is full, has
+  // aged past SOCKETCAN_TX_DELAY, on the next parsePacket() or on flush(): a
+  // node that stops sending and does not poll parsePacket() must call flush()
+  // or its last frames stay in the batch
+  virtual int endPacket();
+
+  virtual int parsePacket();
+
+  // send all batched frames
+  virtual void flush();
+
+  // frames collected before a sendmmsg(), 1 sends every frame at once
+  virtual int setTxQueueSize(int size);
+  virtual int txQueueSize();
+  virtual int txQueueCount();
+
+  using CANControllerClass::filter;
+  virtual int filter(int id, int mask);
+  using CANControllerClass::filterExtended;
+  virtual int filterExtended(long id, long mask);
+  virtual int filter(int id, int mask, long idExtended, long maskExtended);
+  virtual int clearFilter();
+
+  virtual int txErrorCount();
+  virtual int rxErrorCount();
+  virtual int recover();
+
+  virtual int observe();
+  virtual int loopback();
+  virtual int sleep();
+  virtual int wakeup();
+
+  void setInterface(const char* interfaceName);
+  // socket descriptor for poll()/epoll(), -1 before begin()
+  int socketDescriptor();
+
+protected:
+  virtual int readBusState();
+
+private:
+  int open(bool fdMode);
+  bool sendBatch(bool wait);
+  bool receiveBatch();
+  void handleErrorFrame(const struct canfd_frame& frame);
+  int setFilters(const struct can_filter* filters, int count);
+
+private:
+  char _interface[16];   // IFNAMSIZ
+  int _socket;
+  bool _fdMode;
+
+  struct canfd_frame _rxBatch[SOCKETCAN_RX_BATCH];
+  bool _rxBatchFd[SOCKETCAN_RX_BATCH];
+  int _rxBatchCount;
+  int _rxBatchIndex;
+
+  struct canfd_frame _txFrames[SOCKETCAN_TX_BATCH];
+  int _txCount;
+  int _txBatchSize;
+  unsigned long _txBatchStart;  // micros() when the oldest batched frame joined
+
+  // fault confinement as reported by the driver's error frames
+  int _state;
+  int _txErrors;
+  int _rxErrors;
+};
+
+#endif
+
+#endif
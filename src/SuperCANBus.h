@@ -18,6 +18,12 @@
   // Example: MCP2515Class CAN;
 #endif
 
+// External CAN FD controller, create an MCP2518FDClass object in your sketch
+#include "MCP2518FD.h"
+
+// In-memory bus for running nodes without hardware (VirtualCANBus + VirtualCANClass)
+#include "VirtualCAN.h"
+
 // Include publish/subscribe protocol support
 #include "CANPubSub.h"
 
@@ -0,0 +1,443 @@
+// Copyright (c) Sandeep Mistry. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "VirtualCAN.h"
+
+VirtualCANBus::VirtualCANBus(long bitRate) :
+  _bitRate(bitRate),
+  _nodeCount(0),
+  _running(false),
+  _frames(0),
+  _bits(0)
+{
+}
+
+int VirtualCANBus::run()
+{
+  // a node handling a frame may transmit or poll again, the outer call delivers
+  if (_running) {
+    return 0;
+  }
+  _running = true;
+
+  int delivered = 0;
+
+  while (step()) {
+    delivered++;
+  }
+
+  _running = false;
+
+  return delivered;
+}
+
+int VirtualCANBus::step()
+{
+  // lowest arbitration key among the frames at the head of each node wins
+  VirtualCANClass* sender = NULL;
+  unsigned long bestKey = 0;
+
+  for (int i = 0; i < _nodeCount; i++) {
+    VirtualCANClass* node = _nodes[i];
+
+    if (node->_txCount == 0) {
+      continue;
+    }
+
+    unsigned long key = arbitrationKey(node->_tx[node->_txHead]);
+
+    if (sender == NULL || key < bestKey) {
+      sender = node;
+      bestKey = key;
+    }
+  }
+
+  if (sender == NULL) {
+    return 0;
+  }
+
+  // take the frame off the sender first, receivers may transmit in turn
+  CANFrame frame = sender->_tx[sender->_txHead];
+  sender->_txHead = (sender->_txHead + 1) % VIRTUAL_CAN_TX_DEPTH;
+  sender->_txCount--;
+  sender->_framesSent++;
+
+  _frames++;
+  _bits += CANControllerClass::frameBits(frame.extended, frame.length);
+
+  for (int i = 0; i < _nodeCount; i++) {
+    // nodes in loopback mode are cut off from the bus
+    if (_nodes[i] != sender && !_nodes[i]->_loopback) {
+      _nodes[i]->receive(frame);
+    }
+  }
+
+  return 1;
+}
+
+int VirtualCANBus::pending()
+{
+  int count = 0;
+
+  for (int i = 0; i < _nodeCount; i++) {
+    count += _nodes[i]->_txCount;
+  }
+
+  return count;
+}
+
+long VirtualCANBus::bitRate()
+{
+  return _bitRate;
+}
+
+int VirtualCANBus::nodeCount()
+{
+  return _nodeCount;
+}
+
+unsigned long VirtualCANBus::frameCount()
+{
+  return _frames;
+}
+
+unsigned long VirtualCANBus::bitCount()
+{
+  return _bits;
+}
+
+unsigned long VirtualCANBus::busTimeMicros()
+{
+  return (unsigned long)(_bits * (1000000.0 / _bitRate));
+}
+
+void VirtualCANBus::resetCounters()
+{
+  _frames = 0;
+  _bits = 0;
+}
+
+bool VirtualCANBus::attach(VirtualCANClass* node)
+{
+  for (int i = 0; i < _nodeCount; i++) {
+    if (_nodes[i] == node) {
+      return true;
+    }
+  }
+
+  if (_nodeCount >= VIRTUAL_CAN_MAX_NODES) {
+    return false;
+  }
+
+  _nodes[_nodeCount++] = node;
+
+  return true;
+}
+
+void VirtualCANBus::detach(VirtualCANClass* node)
+{
+  for (int i = 0; i < _nodeCount; i++) {
+    if (_nodes[i] == node) {
+      _nodes[i] = _nodes[--_nodeCount];
+      return;
+    }
+  }
+}
+
+unsigned long VirtualCANBus::arbitrationKey(const CANFrame& frame)
+{
+  // base ID first; on a tie the standard frame wins (SRR and IDE are recessive)
+  if (frame.extended) {
+    return ((unsigned long)(frame.id >> 18) << 19) | (1UL << 18) | (frame.id & 0x3ffff);
+  }
+
+  return (unsigned long)frame.id << 19;
+}
+
+VirtualCANClass::VirtualCANClass(VirtualCANBus& bus) :
+  CANControllerClass(),
+  _bus(&bus),
+  _attached(false),
+  _fdMode(false),
+  _listenOnly(false),
+  _loopback(false),
+  _asleep(false),
+  _filterId(0),
+  _filterMask(0),
+  _filterIdExtended(0),
+  _filterMaskExtended(0),
+  _txHead(0),
+  _txCount(0),
+  _framesSent(0),
+  _rxHead(0),
+  _rxCount(0)
+{
+}
+
+VirtualCANClass::~VirtualCANClass()
+{
+  end();
+}
+
+int VirtualCANClass::begin(long baudRate)
+{
+  // nodes at another bit rate would only see error frames
+  if (baudRate != _bus->bitRate()) {
+    return 0;
+  }
+
+  if (!_bus->attach(this)) {
+    return 0;
+  }
+
+  CANControllerClass::begin(baudRate);
+
+  _attached = true;
+  _fdMode = false;
+  _listenOnly = false;
+  _loopback = false;
+  _asleep = false;
+
+  _txHead = 0;
+  _txCount = 0;
+  _rxHead = 0;
+  _rxCount = 0;
+
+  return 1;
+}
+
+int VirtualCANClass::beginFD(long baudRate, long /*dataBaudRate*/)
+{
+  if (!begin(baudRate)) {
+    return 0;
+  }
+
+  _fdMode = true;
+
+  return 1;
+}
+
+void VirtualCANClass::end()
+{
+  if (_attached) {
+    _bus->detach(this);
+    _attached = false;
+  }
+
+  _txCount = 0;
+  _rxCount = 0;
+}
+
+int VirtualCANClass::maxDataLength()
+{
+  return _fdMode ? CAN_MAX_DATA_LENGTH : 8;
+}
+
+int VirtualCANClass::endPacket()
+{
+  if (!CANControllerClass::endPacket()) {
+    return 0;
+  }
+
+  if (!_attached || _listenOnly || _asleep) {
+    return 0;
+  }
+
+  CANFrame frame;
+  frame.id = _txId;
+  frame.extended = _txExtended;
+  frame.rtr = _txRtr;
+  frame.fd = _fdMode && !_txRtr && _txLength > 8;
+  frame.brs = frame.fd;
+
+  if (frame.fd) {
+    // padded up to the next FD length, _txData is zero filled
+    frame.length = dlcToLength(lengthToDlc(_txLength));
+    frame.dlc = frame.length;
+  } else {
+    frame.dlc = _txLength;
+    frame.length = _txRtr ? 0 : _txLength;
+  }
+
+  memcpy(frame.data, _txData, frame.length);
+
+  if (_loopback) {
+    // internal loopback, nothing reaches the bus
+    _framesSent++;
+    receive(frame);
+    return 1;
+  }
+
+  // back-pressure: let the bus carry frames until one of ours has left
+  while (_txCount == VIRTUAL_CAN_TX_DEPTH) {
+    _bus->step();
+  }
+
+  _tx[(_txHead + _txCount) % VIRTUAL_CAN_TX_DEPTH] = frame;
+  _txCount++;
+
+  return 1;
+}
+
+int VirtualCANClass::parsePacket()
+{
+  _bus->run();
+
+  if (_rxQueue) {
+    return CANControllerClass::parsePacket();
+  }
+
+  if (_rxCount == 0) {
+    _rxId = -1;
+    _rxExtended = false;
+    _rxRtr = false;
+    _rxFd = false;
+    _rxLength = 0;
+    return 0;
+  }
+
+  loadRxFrame(_rx[_rxHead]);
+
+  _rxHead = (_rxHead + 1) % VIRTUAL_CAN_RX_BUFFERS;
+  _rxCount--;
+
+  return _rxDlc;
+}
+
+void VirtualCANClass::flush()
+{
+  while (_txCount) {
+    _bus->step();
+  }
+}
+
+int VirtualCANClass::filter(int id, int mask)
+{
+  // standard only
+  _filterId = id & 0x7ff;
+  _filterMask = mask & 0x7ff;
+  _filterIdExtended = -1;
+  _filterMaskExtended = 0;
+
+  return 1;
+}
+
+int VirtualCANClass::filterExtended(long id, long mask)
+{
+  // extended only
+  _filterId = -1;
+  _filterMask = 0;
+  _filterIdExtended = id & 0x1fffffff;
+  _filterMaskExtended = mask & 0x1fffffff;
+
+  return 1;
+}
+
+int VirtualCANClass::filter(int id, int mask, long idExtended, long maskExtended)
+{
+  _filterId = id & 0x7ff;
+  _filterMask = mask & 0x7ff;
+  _filterIdExtended = idExtended & 0x1fffffff;
+  _filterMaskExtended = maskExtended & 0x1fffffff;
+
+  return 1;
+}
+
+int VirtualCANClass::clearFilter()
+{
+  _filterId = 0;
+  _filterMask = 0;
+  _filterIdExtended = 0;
+  _filterMaskExtended = 0;
+
+  return 1;
+}
+
+int VirtualCANClass::txErrorCount()
+{
+  return 0;
+}
+
+int VirtualCANClass::rxErrorCount()
+{
+  return 0;
+}
+
+int VirtualCANClass::readBusState()
+{
+  return _attached ? CAN_BUS_ERROR_ACTIVE : CAN_BUS_STATE_UNKNOWN;
+}
+
+int VirtualCANClass::observe()
+{
+  _listenOnly = true;
+  _loopback = false;
+
+  return 1;
+}
+
+int VirtualCANClass::loopback()
+{
+  _loopback = true;
+  _listenOnly = false;
+
+  return 1;
+}
+
+int VirtualCANClass::sleep()
+{
+  _asleep = true;
+
+  return 1;
+}
+
+int VirtualCANClass::wakeup()
+{
+  _asleep = false;
+
+  return 1;
+}
+
+unsigned long VirtualCANClass::framesSent()
+{
+  return _framesSent;
+}
+
+bool VirtualCANClass::accepts(const CANFrame& frame)
+{
+  // a filter ID of -1 rejects the frame type
+  if (frame.extended) {
+    return (frame.id & _filterMaskExtended) == _filterIdExtended;
+  }
+
+  return (frame.id & _filterMask) == _filterId;
+}
+
+void VirtualCANClass::receive(const CANFrame& frame)
+{
+  if (!_attached || _asleep || !accepts(frame)) {
+    return;
+  }
+
+  if (_rxQueue) {
+    if (pushRxFrame(frame) && _onReceive) {
+      _onReceive(frame.length);
+    }
+    return;
+  }
+
+  if (_rxCount == VIRTUAL_CAN_RX_BUFFERS) {
+    // both receive buffers full, the frame is lost
+    _rxOverruns++;
+    return;
+  }
+
+  _rx[(_rxHead + _rxCount) % VIRTUAL_CAN_RX_BUFFERS] = frame;
+  _rxCount++;
+
+  if (_onReceive) {
+    while (parsePacket()) {
+      _onReceive(available());
+    }
+  }
+}
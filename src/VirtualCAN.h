@@ -0,0 +1,139 @@
+// Copyright (c) Sandeep Mistry. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// In-memory CAN bus, lets a broker and many clients run in one process
+// (host builds, benchmarks, single-board experiments) without CAN hardware
+
+#ifndef VIRTUAL_CAN_H
+#define VIRTUAL_CAN_H
+
+#include "CANController.h"
+
+#ifndef VIRTUAL_CAN_MAX_NODES
+#define VIRTUAL_CAN_MAX_NODES 64
+#endif
+
+// Frames a node can have waiting for arbitration, endPacket() runs the bus when full
+#ifndef VIRTUAL_CAN_TX_DEPTH
+#define VIRTUAL_CAN_TX_DEPTH 3
+#endif
+
+// Receive buffers of a node without an RX queue (the MCP2515 has two)
+#ifndef VIRTUAL_CAN_RX_BUFFERS
+#define VIRTUAL_CAN_RX_BUFFERS 2
+#endif
+
+#define VIRTUAL_CAN_DEFAULT_BIT_RATE 500E3
+
+class VirtualCANClass;
+
+class VirtualCANBus {
+
+public:
+  VirtualCANBus(long bitRate = VIRTUAL_CAN_DEFAULT_BIT_RATE);
+
+  // deliver pending frames in arbitration order, returns the number delivered
+  int run();
+  // deliver the single frame that wins arbitration, 0 if nothing is pending
+  int step();
+  int pending();
+
+  long bitRate();
+  int nodeCount();
+
+  // traffic since the last resetCounters()
+  unsigned long frameCount();
+  unsigned long bitCount();
+  // time the delivered frames would have occupied the bus at bitRate()
+  unsigned long busTimeMicros();
+  void resetCounters();
+
+private:
+  friend class VirtualCANClass;
+
+  bool attach(VirtualCANClass* node);
+  void detach(VirtualCANClass* node);
+
+  static unsigned long arbitrationKey(const CANFrame& frame);
+
+private:
+  long _bitRate;
+  VirtualCANClass* _nodes[VIRTUAL_CAN_MAX_NODES];
+  uint8_t _nodeCount;
+  bool _running;
+
+  unsigned long _frames;
+  unsigned long _bits;
+};
+
+class VirtualCANClass : public CANControllerClass {
+
+public:
+  VirtualCANClass(VirtualCANBus& bus);
+  virtual ~VirtualCANClass();
+
+  virtual int begin(long baudRate);
+  virtual int beginFD(long baudRate, long dataBaudRate);
+  virtual void end();
+
+  virtual int maxDataLength();
+
+  virtual int endPacket();
+
+  virtual int parsePacket();
+
+  virtual void flush();
+
+  using CANControllerClass::filter;
+  virtual int filter(int id, int mask);
+  using CANControllerClass::filterExtended;
+  virtual int filterExtended(long id, long mask);
+  virtual int filter(int id, int mask, long idExtended, long maskExtended);
+  virtual int clearFilter();
+
+  virtual int txErrorCount();
+  virtual int rxErrorCount();
+
+  virtual int observe();
+  virtual int loopback();
+  virtual int sleep();
+  virtual int wakeup();
+
+  // frames this node put on the bus
+  unsigned long framesSent();
+
+protected:
+  virtual int readBusState();
+
+private:
+  friend class VirtualCANBus;
+
+  bool accepts(const CANFrame& frame);
+  void receive(const CANFrame& frame);
+
+private:
+  VirtualCANBus* _bus;
+  bool _attached;
+  bool _fdMode;
+  bool _listenOnly;
+  bool _loopback;
+  bool _asleep;
+
+  long _filterId;
+  long _filterMask;
+  long _filterIdExtended;
+  long _filterMaskExtended;
+
+  // frames waiting for arbitration
+  CANFrame _tx[VIRTUAL_CAN_TX_DEPTH];
+  uint8_t _txHead;
+  uint8_t _txCount;
+  unsigned long _framesSent;
+
+  // receive buffers used when no RX queue is configured
+  CANFrame _rx[VIRTUAL_CAN_RX_BUFFERS];
+  uint8_t _rxHead;
+  uint8_t _rxCount;
+};
+
+#endif